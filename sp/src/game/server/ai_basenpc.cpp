@@ -252,6 +252,10 @@ CAI_Manager g_AI_Manager;
 CAI_Manager::CAI_Manager()
 {
 	m_AIs.EnsureCapacity( MAX_AIS );
+#ifdef MAPBASE
+	m_iChangeSerial = 0;
+	m_iTeleportSerial = 0;
+#endif
 }
 
 //-------------------------------------
@@ -275,6 +279,9 @@ int CAI_Manager::NumAIs()
 void CAI_Manager::AddAI( CAI_BaseNPC *pAI )
 {
 	m_AIs.AddToTail( pAI );
+#ifdef MAPBASE
+	m_iChangeSerial++;
+#endif
 }
 
 //-------------------------------------
@@ -284,7 +291,12 @@ void CAI_Manager::RemoveAI( CAI_BaseNPC *pAI )
 	int i = m_AIs.Find( pAI );
 
 	if ( i != -1 )
+	{
 		m_AIs.FastRemove( i );
+#ifdef MAPBASE
+		m_iChangeSerial++;
+#endif
+	}
 }
 
 
@@ -13685,6 +13697,10 @@ void CAI_BaseNPC::Teleport( const Vector *newPosition, const QAngle *newAngles,
 #ifdef MAPBASE // From Alien Swarm SDK
 	CheckPVSCondition();
 #endif
+
+#ifdef MAPBASE
+	g_AI_Manager.OnAITeleported();
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -508,6 +508,17 @@ public:
 	void RemoveAI( CAI_BaseNPC *pAI );
 
 	bool FindAI( CAI_BaseNPC *pAI )	{ return ( m_AIs.Find( pAI ) != m_AIs.InvalidIndex() ); }
+
+#ifdef MAPBASE
+	// Changes whenever an AI is added or removed. RemoveAI() reorders the list, so anything
+	// holding on to indices into AccessAIs() has to check this before using them again.
+	int GetChangeSerial() const		{ return m_iChangeSerial; }
+
+	// Changes whenever an AI teleports, so anything holding on to AI positions knows
+	// they may have jumped further than an AI can move on its own.
+	void OnAITeleported()			{ m_iTeleportSerial++; }
+	int GetTeleportSerial() const	{ return m_iTeleportSerial; }
+#endif
 	
 private:
 	enum
@@ -519,6 +530,10 @@ private:
 	
 	CAIArray m_AIs;
 
+#ifdef MAPBASE
+	int m_iChangeSerial;
+	int m_iTeleportSerial;
+#endif
 };
 
 //-------------------------------------
@@ -160,6 +160,11 @@ void CAI_DynamicLinkController::InputSetAllowed( inputdata_t &inputdata )
 		}
 		m_ControlledLinks[i]->m_strAllowUse = m_strAllowUse;
 	}
+
+#ifdef MAPBASE
+	// Cached routes might have been found by NPCs who can't use these links anymore
+	g_pBigAINet->GetRouteCache().Flush();
+#endif
 }
 
 void CAI_DynamicLinkController::InputSetInvert( inputdata_t &inputdata )
@@ -175,6 +180,11 @@ void CAI_DynamicLinkController::InputSetInvert( inputdata_t &inputdata )
 		}
 		m_ControlledLinks[i]->m_bInvertAllow = m_bInvertAllow;
 	}
+
+#ifdef MAPBASE
+	// Cached routes might have been found by NPCs who can't use these links anymore
+	g_pBigAINet->GetRouteCache().Flush();
+#endif
 }
 
 #ifdef MAPBASE
@@ -477,7 +487,14 @@ void CAI_DynamicLink::InitDynamicLinks(void)
 	if ( bUpdateZones )
 	{
 		g_AINetworkBuilder.InitZones( g_pBigAINet );
+#ifdef MAPBASE
+		g_pBigAINet->GetClusters().Build( g_pBigAINet );
+#endif
 	}
+
+#ifdef MAPBASE
+	g_pBigAINet->GetRouteCache().Flush();
+#endif
 }
 
 
@@ -632,6 +649,11 @@ void CAI_DynamicLink::SetLinkState(void)
 		return;
 	}
 
+#ifdef MAPBASE
+	// Routes through (or around) this link may not be the best ones anymore
+	g_pBigAINet->GetRouteCache().Flush();
+#endif
+
 	// ------------------------------------------------------------------
 	// Now update the node links...
 	//  Nodes share links so we only have to find the node from the src 
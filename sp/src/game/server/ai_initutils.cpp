@@ -141,6 +141,10 @@ bool CAI_TestHull::IsJumpLegal(const Vector &startPos, const Vector &apex, const
 //-----------------------------------------------------------------------------
 CAI_TestHull::~CAI_TestHull(void)
 {
+#ifdef MAPBASE
+	// The threaded node graph build makes extra test hulls that aren't the shared one
+	if ( CAI_TestHull::pTestHull == this )
+#endif
 	CAI_TestHull::pTestHull = NULL;
 }
 
@@ -3254,7 +3254,11 @@ bool CAI_Navigator::SimplifyFlyPath(  const AI_ProgressFlyPathParams_t &params )
 // Input  :
 // Output :
 //-----------------------------------------------------------------------------
+#ifdef MAPBASE
+float CAI_Navigator::MovementCost( int moveType, Vector &vecStart, Vector &vecEnd, bool *pbOverridden )
+#else
 float CAI_Navigator::MovementCost( int moveType, Vector &vecStart, Vector &vecEnd )
+#endif
 {
 	float cost;
 	
@@ -3266,7 +3270,13 @@ float CAI_Navigator::MovementCost( int moveType, Vector &vecStart, Vector &vecEn
 	}
 
 	// Allow the NPC to override the movement cost
+#ifdef MAPBASE
+	bool bOverridden = GetOuter()->MovementCost( moveType, vecStart, vecEnd, &cost );
+	if ( pbOverridden )
+		*pbOverridden = bOverridden;
+#else
 	GetOuter()->MovementCost( moveType, vecStart, vecEnd, &cost );
+#endif
 	
 	return cost;
 }
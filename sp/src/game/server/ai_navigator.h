@@ -421,7 +421,12 @@ public:
 	bool				SimplifyFlyPath(  const AI_ProgressFlyPathParams_t &params );
 	
 	bool				CanFitAtNode(int nodeNum, unsigned int collisionMask = MASK_NPCSOLID_BRUSHONLY); 
+#ifdef MAPBASE
+	// pbOverridden is set if the NPC changed the cost, which means it can't be reused by other NPCs
+	float				MovementCost( int moveType, Vector &vecStart, Vector &vecEnd, bool *pbOverridden = NULL );
+#else
 	float				MovementCost( int moveType, Vector &vecStart, Vector &vecEnd );
+#endif
 
 	bool				CanFitAtPosition( const Vector &vStartPos, unsigned int collisionMask, bool bIgnoreTransients = false, bool bAllowPlayerAvoid = true );
 	bool				IsOnNetwork() const			{ return !m_bNotOnNetwork; }
@@ -14,6 +14,10 @@
 
 #include "ispatialpartition.h"
 #include "utlpriorityqueue.h"
+#ifdef MAPBASE
+#include "mapbase/ai_network_clusters.h"
+#include "mapbase/ai_route_cache.h"
+#endif
 
 // ------------------------------------
 
@@ -128,6 +132,12 @@ public:
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
 
+#ifdef MAPBASE
+	CAI_NetworkClusters &		GetClusters()		{ return m_Clusters; }
+	const CAI_NetworkClusters &	GetClusters() const	{ return m_Clusters; }
+	CAI_RouteCache &			GetRouteCache()		{ return m_RouteCache; }
+#endif
+
 #ifdef MAPBASE_VSCRIPT
 	Vector		ScriptGetNodePosition( int nodeID ) { return GetNodePosition( HULL_HUMAN, nodeID ); }
 	Vector		ScriptGetNodePositionWithHull( int nodeID, int hull ) { return GetNodePosition( (Hull_t)hull, nodeID ); }
@@ -178,6 +188,11 @@ private:
 	NearNodeCache_T		m_NearestCache[NEARNODE_CACHE_SIZE];	// Cache of nearest nodes
 	int					m_iNearestCacheNext;					// Oldest record in the cache
 
+#ifdef MAPBASE
+	CAI_NetworkClusters	m_Clusters;								// Coarse graph for long-distance pathfinding
+	CAI_RouteCache		m_RouteCache;							// Recently found node routes
+#endif
+
 #ifdef AI_NODE_TREE
 	ISpatialPartition * m_pNodeTree;
 	CUtlVector<int>		m_GatheredNodes;
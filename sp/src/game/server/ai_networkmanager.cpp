@@ -27,6 +27,7 @@
 #include "tier0/icommandline.h"
 #ifdef MAPBASE
 #include "gameinterface.h"
+#include "vstdlib/jobthread.h"
 #endif
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -79,6 +80,8 @@ ConVar g_ai_norebuildgraph_if_in_chapters( "ai_norebuildgraph_if_in_chapters", "
 
 extern CUtlVector<MODTITLECOMMENT> *Mapbase_GetChapterMaps();
 extern CUtlVector<MODCHAPTER> *Mapbase_GetChapterList();
+
+ConVar ai_network_build_threaded( "ai_network_build_threaded", "1", FCVAR_NONE, "Spreads the traces done while building the AI node graph across the job pool. The resulting graph is the same either way." );
 #endif
 
 
@@ -355,6 +358,16 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 		buf.PutInt( GetEditOps()->m_pNodeIndexTable[node] );
 	}
 
+#ifdef MAPBASE
+	// -------------------------------
+	// Dump node clusters
+	// -------------------------------
+	if ( m_pNetwork->GetClusters().IsValid( m_pNetwork ) )
+	{
+		m_pNetwork->GetClusters().Save( buf );
+	}
+#endif
+
 	// -------------------------------
 	// Write the file out
 	// -------------------------------
@@ -721,6 +734,17 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		DevMsg( "\n** Should run \"Check For Problems\" on the VMF then verify dynamic links\n" );
 #endif
 
+#ifdef MAPBASE
+	// -------------------------------
+	// Load node clusters
+	// -------------------------------
+	// Graphs saved before clusters were added don't have them, so just build them now
+	if ( !m_pNetwork->GetClusters().Load( buf, m_pNetwork ) )
+	{
+		m_pNetwork->GetClusters().Build( m_pNetwork );
+	}
+#endif
+
 	gm_fNetworksLoaded = true;
 	CAI_DynamicLink::gm_bInitialized = false;
 }
@@ -2245,6 +2269,12 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 		}
 	}
 
+#ifdef MAPBASE
+	// Zones aren't recomputed here either, the clusters will be rebuilt on the next full build
+	pNetwork->GetClusters().Purge();
+	pNetwork->GetRouteCache().Flush();
+#endif
+
 	g_pAINetworkManager->FixupHints();
 
 	EndBuild();
@@ -2263,6 +2293,10 @@ void CAI_NetworkBuilder::EndBuild()
 {
 	m_NeighborsTable.SetSize(0);
 	m_DidSetNeighborsTable.Resize(0);
+#ifdef MAPBASE
+	m_PrecomputedConnections.Purge();
+	m_PrecomputedConnectionMap.Purge();
+#endif
 	CAI_TestHull::ReturnTestHull();
 }
 
@@ -2298,15 +2332,26 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	DevMsg( "Initializing node positions...\n" );
 	timer.Start();
 	int i;
+#ifdef MAPBASE
+	bool bThreaded = ai_network_build_threaded.GetBool();
+	if ( bThreaded )
+		InitGroundNodePositionsThreaded( pNetwork, nNodes );
+#endif
 	for ( i = 0; i < nNodes; i++)
 	{
 		InitNodePosition( pNetwork, ppNodes[i] );
 		if ( pHelper )
 			pHelper->PostInitNodePosition( pNetwork, ppNodes[i] );
 	}
+#ifdef MAPBASE
+	m_bGroundNodesPositioned = false;
+#endif
 	nNodes = pNetwork->NumNodes(); // InitNodePosition can create nodes
 	timer.End();
 	DevMsg( "...done initializing node positions. %f seconds\n", timer.GetDuration().GetSeconds() );
+#ifdef MAPBASE
+	float flPositionTime = timer.GetDuration().GetSeconds();
+#endif
 
 	// ---------------------------
 	// Initialize node neighbors
@@ -2321,12 +2366,20 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		m_NeighborsTable[i].Resize( nNodes );
 		m_NeighborsTable[i].ClearAll();
 	}
+#ifdef MAPBASE
+	if ( bThreaded )
+		InitNeighborsThreaded( pNetwork, nNodes );
+	else
+#endif
 	for (i = 0; i < nNodes; i++)
 	{	
 		InitNeighbors( pNetwork, ppNodes[i] );
 	}
 	timer.End();
 	DevMsg( "...done initializing node neighbors. %f seconds\n", timer.GetDuration().GetSeconds() );
+#ifdef MAPBASE
+	float flNeighborTime = timer.GetDuration().GetSeconds();
+#endif
 
 	// ---------------------------
 	// Force node neighbors for dynamic links
@@ -2336,6 +2389,9 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	ForceDynamicLinkNeighbors();
 	timer.End();
 	DevMsg( "...done forcing dynamic link neighbors. %f seconds\n", timer.GetDuration().GetSeconds() );
+#ifdef MAPBASE
+	float flDynamicLinkTime = timer.GetDuration().GetSeconds();
+#endif
 
 	// ---------------------------
 	// Initialize accepted hulls
@@ -2347,12 +2403,19 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		// Make sure all the links are clear
 		ppNodes[i]->ClearLinks();
 	}
+#ifdef MAPBASE
+	if ( bThreaded )
+		PrecomputeConnections( pNetwork, nNodes );
+#endif
 	for (i = 0; i < nNodes; i++)
 	{	
 		InitLinks( pNetwork, ppNodes[i] );
 	}
 	timer.End();
 	DevMsg( "...done determining links. %f seconds\n", timer.GetDuration().GetSeconds() );
+#ifdef MAPBASE
+	float flLinkTime = timer.GetDuration().GetSeconds();
+#endif
 
 	// ------------------------------
 	// Initialize disconnected nodes
@@ -2361,9 +2424,35 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	timer.Start();
 	InitZones( pNetwork);
 	timer.End();
+#ifdef MAPBASE
+	DevMsg( "...done determining zones. %f seconds\n", timer.GetDuration().GetSeconds() );
+	float flZoneTime = timer.GetDuration().GetSeconds();
+
+	// ------------------------------
+	// Group nodes into clusters
+	// ------------------------------
+	DevMsg( "Building node clusters...\n" );
+	timer.Start();
+	pNetwork->GetClusters().Build( pNetwork );
+	pNetwork->GetRouteCache().Flush();
+	timer.End();
+	masterTimer.End();
+	DevMsg( "...done building %d node clusters. %f seconds\n", pNetwork->GetClusters().NumClusters(), timer.GetDuration().GetSeconds() );
+#else
 	masterTimer.End();
 	DevMsg( "...done determining zones. %f seconds\n", timer.GetDuration().GetSeconds() );
+#endif
 	DevMsg( "...done building AI node graph, %f seconds\n", masterTimer.GetDuration().GetSeconds() );
+#ifdef MAPBASE
+	DevMsg( "AI node graph build times (%d nodes, %s):\n", nNodes, bThreaded ? "threaded" : "serial" );
+	DevMsg( "    node positions:         %8.3f\n", flPositionTime );
+	DevMsg( "    node neighbors:         %8.3f\n", flNeighborTime );
+	DevMsg( "    dynamic link neighbors: %8.3f\n", flDynamicLinkTime );
+	DevMsg( "    links:                  %8.3f\n", flLinkTime );
+	DevMsg( "    zones:                  %8.3f\n", flZoneTime );
+	DevMsg( "    clusters:               %8.3f\n", timer.GetDuration().GetSeconds() );
+	DevMsg( "    total:                  %8.3f seconds\n", masterTimer.GetDuration().GetSeconds() );
+#endif
 
 	g_pAINetworkManager->FixupHints();
 
@@ -2373,6 +2462,343 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		UTIL_Remove( pHelper );
 }
 
+#ifdef MAPBASE
+//-----------------------------------------------------------------------------
+// Threaded build
+//
+// Each phase below only does the traces on the job pool. Anything that
+// depends on the order nodes are processed in is replayed on the main thread
+// afterwards, so the graph comes out identical to the serial build's.
+//-----------------------------------------------------------------------------
+
+#define NODE_NOT_DELETED	INT_MAX
+
+// Test hull used by connection jobs on the current thread
+static CThreadLocalPtr<CAI_TestHull> g_pJobTestHull;
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops ground nodes to the floor on the job pool.  Each node only
+//			traces from its own origin, so the order they're done in doesn't
+//			matter.  Climb nodes can create new nodes, so they're still done
+//			on the main thread by InitNodePosition().
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::InitGroundNodePositionsThreaded( CAI_Network *pNetwork, int nNodes )
+{
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+
+	CUtlVector<int> groundNodes;
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		if ( ppNodes[i]->GetType() == NODE_GROUND )
+			groundNodes.AddToTail( i );
+	}
+
+	m_pJobNetwork = pNetwork;
+	ParallelProcess( "CAI_NetworkBuilder::InitGroundNodePosition", groundNodes.Base(), groundNodes.Count(), this, &CAI_NetworkBuilder::InitGroundNodePositionJob );
+	m_pJobNetwork = NULL;
+
+	m_bGroundNodesPositioned = true;
+}
+
+void CAI_NetworkBuilder::InitGroundNodePositionJob( int &iNode )
+{
+	InitGroundNodePosition( m_pJobNetwork, m_pJobNetwork->AccessNodes()[iNode] );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Threaded version of calling InitNeighbors() on every node.
+//
+//			In the serial build a node copies its visibility to every earlier
+//			node from that node's (already pruned) row, and only traces to the
+//			nodes after it. Duplicate nodes are also deleted along the way, which
+//			hides them from every node processed afterwards. So the duplicates
+//			are worked out first, the traces to later nodes are done in parallel,
+//			and then the rows are finished off in order on the main thread.
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::InitNeighborsThreaded( CAI_Network *pNetwork, int nNodes )
+{
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+	int i, j;
+
+	// -----------------------------------
+	// Find out when each duplicate would have been deleted
+	// -----------------------------------
+	m_NodeDeletedOnTurn.SetCount( nNodes );
+	for ( i = 0; i < nNodes; i++ )
+	{
+		m_NodeDeletedOnTurn[i] = ( ppNodes[i]->GetType() == NODE_DELETED ) ? -1 : NODE_NOT_DELETED;
+	}
+
+	for ( i = 0; i < nNodes; i++ )
+	{
+		if ( m_NodeDeletedOnTurn[i] < i )
+			continue;
+
+		for ( j = 0; j < nNodes; j++ )
+		{
+			if ( j != i && ppNodes[j]->GetOrigin() == ppNodes[i]->GetOrigin() && ppNodes[j]->GetType() != NODE_CLIMB )
+			{
+				if ( m_NodeDeletedOnTurn[j] == NODE_NOT_DELETED )
+					m_NodeDeletedOnTurn[j] = i;
+
+				DevMsg( 2, "Probable duplicate node placed at %s\n", VecToString( ppNodes[j]->GetOrigin() ) );
+			}
+		}
+	}
+
+	// -----------------------------------
+	// Trace to the nodes after each node
+	// -----------------------------------
+	CUtlVector<int> visibilityNodes;
+	for ( i = 0; i < nNodes; i++ )
+	{
+		if ( m_NodeDeletedOnTurn[i] > i )
+			visibilityNodes.AddToTail( i );
+	}
+
+	m_pJobNetwork = pNetwork;
+	ParallelProcess( "CAI_NetworkBuilder::InitVisibility", visibilityNodes.Base(), visibilityNodes.Count(), this, &CAI_NetworkBuilder::InitVisibilityJob );
+	m_pJobNetwork = NULL;
+
+	// -----------------------------------
+	// Fill in the earlier nodes and prune, in order
+	// -----------------------------------
+	for ( i = 0; i < nNodes; i++ )
+	{
+		CAI_Node *pNode = ppNodes[i];
+
+		if ( m_NodeDeletedOnTurn[i] > i )
+		{
+			for ( j = 0; j < i; j++ )
+			{
+				if ( DebuggingConnect( i, j ) )
+				{
+					DevMsg( " " ); // break here..
+				}
+
+				if ( ppNodes[j]->GetOrigin() == pNode->GetOrigin() && ppNodes[j]->GetType() != NODE_CLIMB )
+					continue;
+
+				if ( m_NodeDeletedOnTurn[j] < i )
+					continue;
+
+				if ( m_NeighborsTable[j].IsBitSet( i ) )
+					m_NeighborsTable[i].Set( j );
+			}
+
+			// We know we can view ourself
+			m_NeighborsTable[i].Set( i );
+
+			PruneRedundantNeighbors( pNetwork, pNode );
+		}
+
+		m_DidSetNeighborsTable.Set( i );
+	}
+
+	for ( i = 0; i < nNodes; i++ )
+	{
+		if ( m_NodeDeletedOnTurn[i] >= 0 && m_NodeDeletedOnTurn[i] != NODE_NOT_DELETED )
+			ppNodes[i]->SetType( NODE_DELETED );
+	}
+
+	m_NodeDeletedOnTurn.Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The part of InitVisibility() that doesn't depend on other rows of
+//			the neighbors table.  Only writes to this node's row.
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::InitVisibilityJob( int &iNode )
+{
+	CAI_Node **ppNodes = m_pJobNetwork->AccessNodes();
+	CAI_Node *pNode = ppNodes[iNode];
+	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
+
+	for ( int testnode = iNode + 1; testnode < m_pJobNetwork->NumNodes(); testnode++ )
+	{
+		CAI_Node *pTestNode = ppNodes[testnode];
+
+		// Duplicates are either deleted or left alone (climb nodes), but never neighbors
+		if ( pTestNode->GetOrigin() == pNode->GetOrigin() && pTestNode->GetType() != NODE_CLIMB )
+			continue;
+
+		if ( m_NodeDeletedOnTurn[testnode] < iNode )
+			continue;
+
+		float flDistToCheckNode = ( pTestNode->GetOrigin() - pNode->GetOrigin() ).LengthSqr(); 
+
+		if ( pTestNode->GetType() == NODE_AIR )
+		{
+			if (flDistToCheckNode > MAX_AIR_NODE_LINK_DIST_SQ) 
+				continue;
+		}
+		else
+		{
+			if (flDistToCheckNode > MAX_NODE_LINK_DIST_SQ) 
+				continue;
+		}
+
+		if ( TestNodeVisibility( srcPos, pTestNode->GetPosition(HULL_SMALL_CENTERED) ) )
+			m_NeighborsTable[iNode].Set( testnode );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs ComputeConnection() on the job pool for the node pairs
+//			InitLinks() is going to ask about.  InitLinks() then picks the
+//			results up through GetConnection() as it creates the links in the
+//			usual order.
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::PrecomputeConnections( CAI_Network *pNetwork, int nNodes )
+{
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+	int i, j;
+
+	m_PrecomputedConnections.Purge();
+	m_PrecomputedConnectionMap.Purge();
+	m_PrecomputedConnectionMap.SetLessFunc( DefLessFunc( unsigned ) );
+
+	// Every thread that can pick up a job gets its own test hull
+	int nTestHulls = ( g_pThreadPool ) ? g_pThreadPool->NumThreads() + 1 : 1;
+	for ( i = 0; i < nTestHulls; i++ )
+	{
+		CAI_TestHull *pTestHull = CREATE_ENTITY( CAI_TestHull, "aitesthull" );
+		pTestHull->Spawn();
+		pTestHull->AddFlag( FL_NPC );
+		pTestHull->RemoveSolidFlags( FSOLID_NOT_SOLID );
+		pTestHull->GetNavigator()->SetNetwork( pNetwork );
+		m_JobTestHulls.AddToTail( pTestHull );
+	}
+
+	CUtlVector<int> jobs;
+
+	m_pJobNetwork = pNetwork;
+
+	// InitLinks() tests each pair of neighbors from the lower node first, then only tests
+	// from the higher node if that didn't produce a link.
+	for ( int iPass = 0; iPass < 2; iPass++ )
+	{
+		int iFirstConnection = m_PrecomputedConnections.Count();
+
+		for ( i = 0; i < nNodes; i++ )
+		{
+			if ( ppNodes[i]->m_eNodeInfo & bits_NODE_FALLEN )
+				continue;
+
+			for ( j = i + 1; j < nNodes; j++ )
+			{
+				if ( ppNodes[j]->m_eNodeInfo & bits_NODE_FALLEN )
+					continue;
+
+				int iSrc = i, iDest = j;
+				if ( iPass == 0 )
+				{
+					if ( !m_NeighborsTable[i].IsBitSet( j ) )
+						continue;
+				}
+				else
+				{
+					if ( !m_NeighborsTable[j].IsBitSet( i ) )
+						continue;
+
+					int iForward = m_PrecomputedConnectionMap.Find( ( (unsigned)i << 16 ) | j );
+					if ( iForward != m_PrecomputedConnectionMap.InvalidIndex() )
+					{
+						const AI_PrecomputedConnection_t &forward = m_PrecomputedConnections[m_PrecomputedConnectionMap[iForward]];
+
+						int hull;
+						for ( hull = 0; hull < NUM_HULLS; hull++ )
+						{
+							if ( forward.acceptedMotions[hull] != 0 )
+								break;
+						}
+
+						if ( hull < NUM_HULLS )
+							continue;
+					}
+
+					iSrc = j;
+					iDest = i;
+				}
+
+				int iConnection = m_PrecomputedConnections.AddToTail();
+				m_PrecomputedConnections[iConnection].iSrcNode = iSrc;
+				m_PrecomputedConnections[iConnection].iDestNode = iDest;
+				m_PrecomputedConnectionMap.Insert( ( (unsigned)iSrc << 16 ) | iDest, iConnection );
+			}
+		}
+
+		jobs.RemoveAll();
+		for ( i = iFirstConnection; i < m_PrecomputedConnections.Count(); i++ )
+		{
+			jobs.AddToTail( i );
+		}
+
+		// Test hulls can only be resized on the main thread, so go one hull size at a time
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			m_JobHull = (Hull_t)hull;
+			for ( i = 0; i < m_JobTestHulls.Count(); i++ )
+			{
+				m_JobTestHulls[i]->SetHullType( m_JobHull );
+				m_JobTestHulls[i]->SetHullSizeNormal( true );
+				m_JobTestHulls[i]->AddFlag( FL_ONGROUND );
+			}
+
+			m_iNextJobTestHull = 0;
+			ParallelProcess( "CAI_NetworkBuilder::ComputeConnection", jobs.Base(), jobs.Count(), this, &CAI_NetworkBuilder::ComputeConnectionJob,
+				&CAI_NetworkBuilder::BeginConnectionJob, &CAI_NetworkBuilder::EndConnectionJob, nTestHulls - 1 );
+		}
+	}
+
+	m_pJobNetwork = NULL;
+
+	for ( i = 0; i < m_JobTestHulls.Count(); i++ )
+	{
+		UTIL_RemoveImmediate( m_JobTestHulls[i] );
+	}
+	m_JobTestHulls.Purge();
+
+	DevMsg( 2, "Precomputed %d node connections on %d threads\n", m_PrecomputedConnections.Count(), nTestHulls );
+}
+
+void CAI_NetworkBuilder::BeginConnectionJob()
+{
+	int iTestHull = m_iNextJobTestHull++;
+	Assert( iTestHull < m_JobTestHulls.Count() );
+	g_pJobTestHull = m_JobTestHulls[iTestHull];
+}
+
+void CAI_NetworkBuilder::EndConnectionJob()
+{
+	g_pJobTestHull = (CAI_TestHull *)NULL;
+}
+
+void CAI_NetworkBuilder::ComputeConnectionJob( int &iConnection )
+{
+	AI_PrecomputedConnection_t &connection = m_PrecomputedConnections[iConnection];
+	CAI_Node **ppNodes = m_pJobNetwork->AccessNodes();
+
+	connection.acceptedMotions[m_JobHull] = ComputeConnection( g_pJobTestHull, ppNodes[connection.iSrcNode], ppNodes[connection.iDestNode], m_JobHull );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the precomputed connection between two nodes if there is
+//			one, otherwise computes it with the builder's test hull.
+//-----------------------------------------------------------------------------
+int CAI_NetworkBuilder::GetConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
+{
+	if ( m_PrecomputedConnectionMap.Count() )
+	{
+		int i = m_PrecomputedConnectionMap.Find( ( (unsigned)pSrcNode->m_iID << 16 ) | pDestNode->m_iID );
+		if ( i != m_PrecomputedConnectionMap.InvalidIndex() )
+			return m_PrecomputedConnections[m_PrecomputedConnectionMap[i]].acceptedMotions[hull];
+	}
+
+	return ComputeConnection( m_pTestHull, pSrcNode, pDestNode, hull );
+}
+#endif
+
 //------------------------------------------------------------------------------
 // Purpose : Forces testing of a connection between src and dest IDs for all dynamic links
 //			 	
@@ -2626,6 +3052,10 @@ void CAI_NetworkBuilder::InitNodePosition(CAI_Network *pNetwork, CAI_Node *pNode
 
 	else if (pNode->m_eNodeType == NODE_GROUND)
 	{
+#ifdef MAPBASE
+		// The threaded build has already dropped ground nodes to the floor
+		if ( !m_bGroundNodesPositioned )
+#endif
 		InitGroundNodePosition( pNetwork, pNode );
 
 		if (pNode->m_flVOffset[HULL_SMALL_CENTERED] < -100)
@@ -2728,62 +3158,7 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 		// position using the smallest hull to make sure were not in geometry
 		Vector destPos = pNetwork->GetNode( testnode )->GetPosition(HULL_SMALL_CENTERED);
 
-		trace_t	tr;
-		tr.m_pEnt = NULL;
-
-		// Try several line of sight checks
-
-		bool isVisible = false;
-
-		// ------------------
-		//  Bottom to bottom
-		// ------------------
-		AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-		if (!tr.startsolid && tr.fraction == 1.0)
-		{
-			isVisible = true;
-		}
-
-		// ------------------
-		//  Top to top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Top to Bottom
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Bottom to Top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Failure
-		// ------------------
-		if (!isVisible)
+		if ( !TestNodeVisibility( srcPos, destPos ) )
 		{
 			continue;
 		}
@@ -2838,6 +3213,66 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Can a node at srcPos see one at destPos?  Used by InitVisibility
+//-----------------------------------------------------------------------------
+bool CAI_NetworkBuilder::TestNodeVisibility( const Vector &srcPos, const Vector &destPos )
+{
+	trace_t	tr;
+	tr.m_pEnt = NULL;
+
+	// Try several line of sight checks
+
+	bool isVisible = false;
+
+	// ------------------
+	//  Bottom to bottom
+	// ------------------
+	AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{
+		isVisible = true;
+	}
+
+	// ------------------
+	//  Top to top
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	// ------------------
+	//  Top to Bottom
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	// ------------------
+	//  Bottom to Top
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	return isVisible;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Initializes the neighbors list
 // Input  :
@@ -2851,7 +3286,18 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	// Begin by establishing viewability to limit the number of nodes tested
 	InitVisibility( pNetwork, pNode );
 
-	AI_PROFILE_SCOPE_BEGIN( CAI_Node_InitNeighbors );
+	PruneRedundantNeighbors( pNetwork, pNode );
+
+	m_DidSetNeighborsTable.Set(pNode->m_iID);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes neighbors that are in roughly the same direction as a
+//			closer neighbor
+//-----------------------------------------------------------------------------
+void CAI_NetworkBuilder::PruneRedundantNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
+{
+	AI_PROFILE_SCOPE( CAI_Node_InitNeighbors );
 
 	// Now check each neighbor against all other neighbors to see if one of
 	// them is a redundant connection
@@ -2954,10 +3400,6 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 			}
 		}
 	}
-	
-	AI_PROFILE_SCOPE_END();
-
-	m_DidSetNeighborsTable.Set(pNode->m_iID);
 }
 
 //-----------------------------------------------------------------------------
@@ -3003,39 +3445,51 @@ static bool IsInLineForClimb( const Vector &srcPos, const Vector &srcFacing, con
 
 //-------------------------------------
 
+#ifdef MAPBASE
+int CAI_NetworkBuilder::ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
+{
+#else
 int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
 {
+	CAI_TestHull *pTestHull = m_pTestHull;
+#endif
 	int srcId = pSrcNode->m_iID;
 	int destId = pDestNode->m_iID;
 	int result = 0;
 	trace_t tr;
 	
 	// Set the size of the test hull
-	if ( m_pTestHull->GetHullType() != hull ) 
+	if ( pTestHull->GetHullType() != hull ) 
 	{
-		m_pTestHull->SetHullType( hull );
-		m_pTestHull->SetHullSizeNormal( true );
+		pTestHull->SetHullType( hull );
+		pTestHull->SetHullSizeNormal( true );
 	}
 
-	if ( !( m_pTestHull->GetFlags() & FL_ONGROUND ) )
+	if ( !( pTestHull->GetFlags() & FL_ONGROUND ) )
 	{
 		DevWarning( 2, "OFFGROUND!\n" );
+#ifdef MAPBASE
+		// Only touch the flags when they actually change, since this can run on a worker thread
+		pTestHull->AddFlag( FL_ONGROUND );
+#endif
 	}
-	m_pTestHull->AddFlag( FL_ONGROUND );
+#ifndef MAPBASE
+	pTestHull->AddFlag( FL_ONGROUND );
+#endif
 
 	// ==============================================================
 	// FIRST CHECK IF HULL CAN EVEN FIT AT THESE NODES
 	// ==============================================================
 	// @Note (toml 02-10-03): this should be optimized, caching the results of CanFitAtNode() 
 	if ( !( pSrcNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", srcId );
 		return 0;
 	}
 	
 	if (  !( pDestNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", destId );
 		return 0;
@@ -3051,7 +3505,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		// Air nodes only connect to other air nodes and nothing else
 		if (pSrcNode->m_eNodeType == NODE_AIR && pDestNode->GetType() == NODE_AIR)
 		{
-			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_FLY;
@@ -3076,7 +3530,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		{
 			AI_TraceHull( srcPos, destPos, 
 							NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), 
-							MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+							MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -3102,7 +3556,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 				return 0;
 			}
 
-			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -3130,13 +3584,13 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		Vector srcPos	 = pSrcNode->GetPosition(hull);
 		Vector destPos	 = pDestNode->GetPosition(hull);
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", srcId );
 			fStandFailed = true;
 		}
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", destId );
 			fStandFailed = true;
@@ -3147,7 +3601,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 		if ( !fStandFailed )
 		{
-			fWalkFailed = !m_pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
+			fWalkFailed = !pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
 			if ( fWalkFailed )
 				DebugConnectMsg( srcId, destId, "      Failed to walk between nodes\n" );
 		}
@@ -3173,15 +3627,15 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 			// Jumps aren't bi-directional.  We can jump down further than we can jump up so
 			// we have to test for either one
-			bool canDestJump = m_pTestHull->IsJumpLegal(srcPos, destPos, destPos);
-			bool canSrcJump  = m_pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
+			bool canDestJump = pTestHull->IsJumpLegal(srcPos, destPos, destPos);
+			bool canSrcJump  = pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
 
 			if (canDestJump || canSrcJump) 
 			{
-				CAI_MoveProbe *pMoveProbe = m_pTestHull->GetMoveProbe();
+				CAI_MoveProbe *pMoveProbe = pTestHull->GetMoveProbe();
 
 				bool fJumpLegal = false;
-				m_pTestHull->SetGravity(1.0);
+				pTestHull->SetGravity(1.0);
 
 				AIMoveTrace_t moveTrace;
 				pMoveProbe->MoveLimit( NAV_JUMP, srcPos,destPos, MASK_NPCWORLDSTATIC, NULL, &moveTrace);
@@ -3268,7 +3722,11 @@ void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
 				{
 					DebugConnectMsg( pNode->m_iID, i, "   Testing for hull %s\n", NAI_Hull::Name( (Hull_t)hull  ) );
 					
+#ifdef MAPBASE
+					acceptedMotions[hull] = GetConnection( pNode, pDestNode, (Hull_t)hull );
+#else
 					acceptedMotions[hull] = ComputeConnection( pNode, pDestNode, (Hull_t)hull );
+#endif
 					if ( acceptedMotions[hull] != 0 )
 						bAllFailed = false;
 				}
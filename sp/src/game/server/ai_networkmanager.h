@@ -9,6 +9,10 @@
 
 #include "utlvector.h"
 #include "bitstring.h"
+#ifdef MAPBASE
+#include "utlmap.h"
+#include "ai_hull.h"
+#endif
 
 #if defined( _WIN32 )
 #pragma once
@@ -105,6 +109,8 @@ public:
 private:
 	void			InitVisibility( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
+	bool			TestNodeVisibility( const Vector &srcPos, const Vector &destPos );
+	void			PruneRedundantNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitClimbNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitGroundNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitLinks( CAI_Network *pNetwork, CAI_Node *pNode );
@@ -112,11 +118,47 @@ private:
 	
 	void			FloodFillZone( CAI_Node **ppNodes, CAI_Node *pNode, int zone );
 
+#ifdef MAPBASE
+	int				ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+#else
 	int				ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+#endif
 	
 	void 			BeginBuild();
 	void			EndBuild();
 
+#ifdef MAPBASE
+	// Threaded build. Traces are farmed out to the job pool and the results are merged
+	// on the main thread in the same order the serial build would produce them.
+	void			InitGroundNodePositionsThreaded( CAI_Network *pNetwork, int nNodes );
+	void			InitNeighborsThreaded( CAI_Network *pNetwork, int nNodes );
+	void			PrecomputeConnections( CAI_Network *pNetwork, int nNodes );
+	int				GetConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+
+	void			InitGroundNodePositionJob( int &iNode );
+	void			InitVisibilityJob( int &iNode );
+	void			ComputeConnectionJob( int &iConnection );
+	void			BeginConnectionJob();
+	void			EndConnectionJob();
+
+	struct AI_PrecomputedConnection_t
+	{
+		int		iSrcNode;
+		int		iDestNode;
+		int		acceptedMotions[NUM_HULLS];
+	};
+
+	CAI_Network *							m_pJobNetwork;
+	Hull_t									m_JobHull;
+	CUtlVector<CAI_TestHull *>				m_JobTestHulls;			// One per thread that can run a connection job
+	CInterlockedInt							m_iNextJobTestHull;
+
+	CUtlVector<int>							m_NodeDeletedOnTurn;	// When the serial build would have deleted each node as a duplicate
+	CUtlVector<AI_PrecomputedConnection_t>	m_PrecomputedConnections;
+	CUtlMap<unsigned, int, int>				m_PrecomputedConnectionMap;
+	bool									m_bGroundNodesPositioned;
+#endif
+
 	CUtlVector<CVarBitVec>	m_NeighborsTable;
 	CVarBitVec				m_DidSetNeighborsTable;
 	CAI_TestHull *			m_pTestHull;
@@ -45,6 +45,18 @@ CAI_Link *CAI_Node::GetLink( int destNodeId )
 	return NULL;
 }
 
+#ifdef MAPBASE
+//-----------------------------------------------------------------------------
+// Purpose: Locked nodes are avoided by pathfinding, so cached routes through
+//			this node can't be trusted anymore
+//-----------------------------------------------------------------------------
+void CAI_Node::OnLockChanged()
+{
+	if ( g_pBigAINet )
+		g_pBigAINet->GetRouteCache().OnNodeLockChanged( m_iID, m_flNextUseTime );
+}
+#endif
+
 //-----------------------------------------------------------------------------
 // Purpose: Add a link to this node
 // Input  :
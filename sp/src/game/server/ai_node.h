@@ -116,8 +116,13 @@ public:
 	CAI_Link *		GetLinkByIndex( int i )	{ return m_Links[i]; }
 
 	bool 			IsLocked() const			{ return ( m_flNextUseTime > gpGlobals->curtime ); }
+#ifdef MAPBASE
+	void			Lock( float duration )		{ m_flNextUseTime = gpGlobals->curtime + duration; OnLockChanged(); }
+	void			Unlock()					{ m_flNextUseTime = gpGlobals->curtime; OnLockChanged(); }
+#else
 	void			Lock( float duration )		{ m_flNextUseTime = gpGlobals->curtime + duration; }
 	void			Unlock()					{ m_flNextUseTime = gpGlobals->curtime; }
+#endif
 
 	int 			GetZone() const			{ return m_zone; }
 	void 			SetZone( int zone )		{ m_zone = zone; }
@@ -143,6 +148,10 @@ public:
 
 	void			AddLink(CAI_Link *newLink);
 
+#ifdef MAPBASE
+	void			OnLockChanged();
+#endif
+
 	int				m_iID;					// ID for this node
 	Vector			m_vOrigin;				// location of this node in space
 
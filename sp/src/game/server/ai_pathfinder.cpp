@@ -21,6 +21,10 @@
 #include "ai_dynamiclink.h"
 #include "ai_hint.h"
 #include "bitstring.h"
+#ifdef MAPBASE
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
+#endif
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -33,6 +37,188 @@
 const float MAX_LOCAL_NAV_DIST_GROUND[2] = { (50*12), (25*12) };
 const float MAX_LOCAL_NAV_DIST_FLY[2] = { (750*12), (750*12) };
 
+#ifdef MAPBASE
+ConVar ai_pathfind_legacy_openlist( "ai_pathfind_legacy_openlist", "0", FCVAR_NONE, "Makes FindBestPath use the original linear-scan open list instead of the binary heap. Only useful for A/B comparisons." );
+ConVar ai_pathfind_hierarchical( "ai_pathfind_hierarchical", "1", FCVAR_NONE, "Plans long routes over the AI node clusters first, then only searches the nodes along that corridor." );
+ConVar ai_route_cache( "ai_route_cache", "1", FCVAR_NONE, "Reuses node routes found by FindBestPath for NPCs of the same class, hull and capabilities." );
+ConVar ai_pathfind_hierarchical_min_clusters( "ai_pathfind_hierarchical_min_clusters", "4", FCVAR_NONE, "How many clusters a coarse route has to cross before the node search is restricted to it." );
+
+// Nodes taken off the open list by FindBestPathOpenList(), for ai_path_bench
+static int g_nPathfindExpansions = 0;
+
+//-----------------------------------------------------------------------------
+// Purpose: Scratch space for FindBestPathOpenList().
+//
+//			The open list is an indexed binary min-heap on F, so pulling the
+//			cheapest node and lowering a node's cost are both O(log n) instead
+//			of scanning the whole network. Ties are broken on node ID, which
+//			gives the exact same expansion order as CAI_Network::FindBSSmallest().
+//
+//			Per-node state is stamped with a search serial so it doesn't have
+//			to be reset between searches; a node whose serial doesn't match
+//			the current search is treated as never having been reached.
+//-----------------------------------------------------------------------------
+class CAI_PathfindScratch
+{
+public:
+	CAI_PathfindScratch()
+	 :	m_iSerial( 0 )
+	{
+	}
+
+	void Begin( int nNodes )
+	{
+		int nOldNodes = m_Serial.Count();
+		if ( nOldNodes < nNodes )
+		{
+			m_G.EnsureCount( nNodes );
+			m_F.EnsureCount( nNodes );
+			m_Parent.EnsureCount( nNodes );
+			m_HeapIndex.EnsureCount( nNodes );
+			m_Serial.EnsureCount( nNodes );
+			for ( int i = nOldNodes; i < nNodes; i++ )
+				m_Serial[i] = 0;
+		}
+
+		// Wrapped around, wipe the stamps so nothing looks like it's from this search
+		if ( ++m_iSerial == 0 )
+		{
+			for ( int i = 0; i < m_Serial.Count(); i++ )
+				m_Serial[i] = 0;
+			m_iSerial = 1;
+		}
+
+		m_Heap.RemoveAll();
+	}
+
+	bool	WasReached( int iNode ) const	{ return ( m_Serial[iNode] == m_iSerial ); }
+	bool	IsOpen( int iNode ) const		{ return ( WasReached( iNode ) && m_HeapIndex[iNode] != -1 ); }
+	bool	IsOpenListEmpty() const			{ return ( m_Heap.Count() == 0 ); }
+
+	float	GetG( int iNode ) const			{ return m_G[iNode]; }
+	int *	GetParents()					{ return m_Parent.Base(); }
+	void	SetParent( int iNode, int iParent )	{ m_Parent[iNode] = iParent; }
+
+	// Records a (better) cost for the node and opens it, or re-sorts it if it's already open
+	void SetCost( int iNode, int iParent, float g, float f )
+	{
+		if ( !WasReached( iNode ) )
+		{
+			m_Serial[iNode] = m_iSerial;
+			m_HeapIndex[iNode] = -1;
+		}
+
+		m_Parent[iNode] = iParent;
+		m_G[iNode] = g;
+		m_F[iNode] = f;
+
+		if ( m_HeapIndex[iNode] == -1 )
+		{
+			m_HeapIndex[iNode] = m_Heap.AddToTail( iNode );
+		}
+
+		// Costs normally only go down while a node is open, but don't rely on it
+		SiftUp( m_HeapIndex[iNode] );
+		SiftDown( m_HeapIndex[iNode] );
+	}
+
+	int PopCheapest()
+	{
+		Assert( !IsOpenListEmpty() );
+
+		int iNode = m_Heap[0];
+		int iLast = m_Heap.Count() - 1;
+
+		if ( iLast > 0 )
+		{
+			m_Heap[0] = m_Heap[iLast];
+			m_HeapIndex[m_Heap[0]] = 0;
+		}
+		m_Heap.RemoveMultipleFromTail( 1 );
+		m_HeapIndex[iNode] = -1;
+
+		if ( m_Heap.Count() > 1 )
+		{
+			SiftDown( 0 );
+		}
+
+		return iNode;
+	}
+
+private:
+	bool IsCheaper( int iNodeA, int iNodeB ) const
+	{
+		if ( m_F[iNodeA] != m_F[iNodeB] )
+			return ( m_F[iNodeA] < m_F[iNodeB] );
+		return ( iNodeA < iNodeB );
+	}
+
+	void SiftUp( int iHeap )
+	{
+		int iNode = m_Heap[iHeap];
+		while ( iHeap > 0 )
+		{
+			int iParentHeap = ( iHeap - 1 ) >> 1;
+			if ( !IsCheaper( iNode, m_Heap[iParentHeap] ) )
+				break;
+
+			m_Heap[iHeap] = m_Heap[iParentHeap];
+			m_HeapIndex[m_Heap[iHeap]] = iHeap;
+			iHeap = iParentHeap;
+		}
+		m_Heap[iHeap] = iNode;
+		m_HeapIndex[iNode] = iHeap;
+	}
+
+	void SiftDown( int iHeap )
+	{
+		int nCount = m_Heap.Count();
+		int iNode = m_Heap[iHeap];
+		for (;;)
+		{
+			int iChildHeap = ( iHeap << 1 ) + 1;
+			if ( iChildHeap >= nCount )
+				break;
+
+			if ( iChildHeap + 1 < nCount && IsCheaper( m_Heap[iChildHeap + 1], m_Heap[iChildHeap] ) )
+				iChildHeap++;
+
+			if ( !IsCheaper( m_Heap[iChildHeap], iNode ) )
+				break;
+
+			m_Heap[iHeap] = m_Heap[iChildHeap];
+			m_HeapIndex[m_Heap[iHeap]] = iHeap;
+			iHeap = iChildHeap;
+		}
+		m_Heap[iHeap] = iNode;
+		m_HeapIndex[iNode] = iHeap;
+	}
+
+	CUtlVector<float>		m_G;
+	CUtlVector<float>		m_F;
+	CUtlVector<int>			m_Parent;
+	CUtlVector<int>			m_HeapIndex;
+	CUtlVector<unsigned>	m_Serial;
+
+	CUtlVector<int>			m_Heap;
+	unsigned				m_iSerial;
+};
+
+// Pathfinding normally only happens on the main thread, but this keeps the
+// scratch space safe if a search is ever kicked off from somewhere else.
+static CThreadLocalPtr<CAI_PathfindScratch> g_pPathfindScratch;
+static CThreadLocalPtr<CAI_PathfindScratch> g_pClusterPathfindScratch;
+
+static CAI_PathfindScratch &GetPathfindScratch( CThreadLocalPtr<CAI_PathfindScratch> &pScratch )
+{
+	if ( !pScratch )
+	{
+		pScratch = new CAI_PathfindScratch;
+	}
+	return *pScratch;
+}
+#endif
+
 //-----------------------------------------------------------------------------
 // CAI_Pathfinder
 //
@@ -287,6 +473,275 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
+#ifdef MAPBASE
+	// NPCs limited to a hint group can only use that group's nodes, which the key doesn't cover
+	if ( !ai_route_cache.GetBool() || GetOuter()->IsLimitingHintGroups() )
+		return FindBestPathUncached( startID, endID );
+
+	CAI_RouteCache &routeCache = GetNetwork()->GetRouteCache();
+	AI_RouteCacheKey_t key( startID, endID, GetHullType(), CapabilitiesGet(), GetOuter()->m_iClassname );
+
+	int nCachedNodes;
+	const int *pCachedNodes = routeCache.Find( key, &nCachedNodes );
+	if ( pCachedNodes )
+	{
+		routeCache.BeginRouteBuild();
+		AI_Waypoint_t *pRoute = BuildCachedRoute( pCachedNodes, nCachedNodes );
+		routeCache.EndRouteBuild();
+
+		if ( pRoute )
+			return pRoute;
+
+		routeCache.Reject( key );
+	}
+
+	m_bRouteCostOverridden = false;
+
+	routeCache.BeginRouteBuild();
+	AI_Waypoint_t *pRoute = FindBestPathUncached( startID, endID );
+	routeCache.EndRouteBuild();
+
+	// Routes that depended on this NPC's own movement costs or that ignored stale links aren't shared
+	if ( pRoute && !m_bRouteCostOverridden && !m_bIgnoreStaleLinks )
+	{
+		CUtlVectorFixedGrowable<int, 64> routeNodes;
+		for ( AI_Waypoint_t *pWaypoint = pRoute; pWaypoint; pWaypoint = pWaypoint->GetNext() )
+		{
+			routeNodes.AddToTail( pWaypoint->iNodeID );
+		}
+
+		routeCache.Add( key, routeNodes.Base(), routeNodes.Count() );
+	}
+
+	return pRoute;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs whichever search ai_pathfind_legacy_openlist and
+//			ai_pathfind_hierarchical select.
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathUncached( int startID, int endID )
+{
+	if ( ai_pathfind_legacy_openlist.GetBool() )
+		return FindBestPathLinearScan( startID, endID );
+
+	if ( ai_pathfind_hierarchical.GetBool() )
+		return FindBestPathHierarchical( startID, endID );
+
+	return FindBestPathOpenList( startID, endID );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Turns a route from the route cache into waypoints, or returns NULL
+//			if this NPC can't currently follow every node and link on it.
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::BuildCachedRoute( const int *pNodes, int nNodes )
+{
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+	int nNetworkNodes = GetNetwork()->NumNodes();
+
+	CAI_PathfindScratch &scratch = GetPathfindScratch( g_pPathfindScratch );
+	scratch.Begin( nNetworkNodes );
+
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		int nodeID = pNodes[i];
+		if ( nodeID < 0 || nodeID >= nNetworkNodes )
+			return NULL;
+
+		if ( GetOuter()->IsUnusableNode( nodeID, pAInode[nodeID]->GetHint() ) )
+			return NULL;
+
+		if ( i == 0 )
+		{
+			scratch.SetParent( nodeID, NO_NODE );
+			continue;
+		}
+
+		int prevID = pNodes[i - 1];
+		CAI_Link *pLink = pAInode[prevID]->GetLink( nodeID );
+		if ( !pLink || !IsLinkUsable( pLink, prevID ) )
+			return NULL;
+
+		int moveType = pLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+
+		Vector r1 = pAInode[prevID]->GetPosition( GetHullType() );
+		Vector r2 = pAInode[nodeID]->GetPosition( GetHullType() );
+		bool bOverridden = false;
+		float dist = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2, &bOverridden ); // MovementCost takes ref parameters!!
+		if ( dist == FLT_MAX || bOverridden )
+			return NULL;
+
+		scratch.SetParent( nodeID, prevID );
+	}
+
+	return MakeRouteFromParents( scratch.GetParents(), pNodes[nNodes - 1] );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A* over the cluster graph from startID's cluster to endID's.
+//			Marks the clusters along the cheapest coarse route in pCorridor and
+//			returns how many there are, or 0 if there's no coarse route.
+//-----------------------------------------------------------------------------
+int CAI_Pathfinder::BuildClusterCorridor( int startID, int endID, CVarBitVec *pCorridor )
+{
+	const CAI_NetworkClusters &clusters = GetNetwork()->GetClusters();
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+
+	int startCluster = clusters.GetNodeCluster( startID );
+	int endCluster = clusters.GetNodeCluster( endID );
+
+	// Links with jump override hints can be used without the jump capability, see IsLinkUsable()
+	int moveTypes = ( CapabilitiesGet() | bits_CAP_MOVE_JUMP );
+	Hull_t hull = GetHullType();
+
+	Vector vecEnd = pAInode[clusters.GetClusterCenterNode( endCluster )]->GetPosition( hull );
+
+	CAI_PathfindScratch &clusterScratch = GetPathfindScratch( g_pClusterPathfindScratch );
+	clusterScratch.Begin( clusters.NumClusters() );
+	clusterScratch.SetCost( startCluster, NO_NODE, 0, ( pAInode[clusters.GetClusterCenterNode( startCluster )]->GetPosition( hull ) - vecEnd ).Length() );
+
+	while ( !clusterScratch.IsOpenListEmpty() )
+	{
+		int iCluster = clusterScratch.PopCheapest();
+		if ( iCluster == endCluster )
+		{
+			int nClusters = 0;
+			for ( int i = endCluster; i != NO_NODE; i = clusterScratch.GetParents()[i] )
+			{
+				pCorridor->Set( i );
+				nClusters++;
+			}
+			return nClusters;
+		}
+
+		float flG = clusterScratch.GetG( iCluster );
+
+		for ( int i = 0; i < clusters.NumClusterEdges( iCluster ); i++ )
+		{
+			const AI_ClusterEdge_t &edge = clusters.GetClusterEdge( iCluster, i );
+			if ( !( edge.moveTypes[hull] & moveTypes ) )
+				continue;
+
+			float flNewG = flG + edge.flCost[hull];
+			if ( !clusterScratch.WasReached( edge.iDestCluster ) || flNewG < clusterScratch.GetG( edge.iDestCluster ) )
+			{
+				float flH = ( pAInode[clusters.GetClusterCenterNode( edge.iDestCluster )]->GetPosition( hull ) - vecEnd ).Length();
+				clusterScratch.SetCost( edge.iDestCluster, iCluster, flNewG, flNewG + flH );
+			}
+		}
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Plans the route over the node clusters, then refines it by only
+//			searching nodes in the clusters along that route.
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathHierarchical( int startID, int endID )
+{
+	const CAI_NetworkClusters &clusters = GetNetwork()->GetClusters();
+	if ( !clusters.IsValid( GetNetwork() ) || clusters.GetNodeCluster( startID ) == clusters.GetNodeCluster( endID ) )
+		return FindBestPathOpenList( startID, endID );
+
+	CVarBitVec corridor( clusters.NumClusters() );
+	int nCorridorClusters = BuildClusterCorridor( startID, endID, &corridor );
+
+	// The coarse graph includes every link regardless of whether it's turned off,
+	// so if it can't find a route, neither would the node search
+	if ( nCorridorClusters == 0 )
+		return NULL;
+
+	if ( nCorridorClusters >= ai_pathfind_hierarchical_min_clusters.GetInt() )
+	{
+		AI_Waypoint_t *pRoute = FindBestPathOpenList( startID, endID, &corridor );
+		if ( pRoute )
+			return pRoute;
+
+		// Something the coarse graph doesn't know about (turned off links, locked or
+		// unusable nodes) blocks the corridor, so fall back to searching everything
+	}
+
+	return FindBestPathOpenList( startID, endID );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A* over the node graph using a binary heap as the open list.
+//			Expands nodes in the same order as FindBestPathLinearScan().
+//			If pClusterCorridor is given, nodes outside of those clusters are ignored.
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathOpenList( int startID, int endID, const CVarBitVec *pClusterCorridor )
+{
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+	Vector vecEnd = pAInode[endID]->GetPosition( GetHullType() );
+
+	const CAI_NetworkClusters &clusters = GetNetwork()->GetClusters();
+
+	CAI_PathfindScratch &scratch = GetPathfindScratch( g_pPathfindScratch );
+	scratch.Begin( GetNetwork()->NumNodes() );
+
+	// Don't want to over estimate
+	scratch.SetCost( startID, NO_NODE, 0, 0.1 * ( pAInode[startID]->GetPosition( GetHullType() ) - vecEnd ).Length() );
+
+	while ( !scratch.IsOpenListEmpty() )
+	{
+		int smallestID = scratch.PopCheapest();
+		g_nPathfindExpansions++;
+
+		CAI_Node *pSmallestNode = pAInode[smallestID];
+
+		if ( GetOuter()->IsUnusableNode( smallestID, pSmallestNode->GetHint() ) )
+			continue;
+
+		if ( smallestID == endID )
+		{
+			return MakeRouteFromParents( scratch.GetParents(), endID );
+		}
+
+		float smallestG = scratch.GetG( smallestID );
+
+		for ( int link = 0; link < pSmallestNode->NumLinks(); link++ )
+		{
+			CAI_Link *nodeLink = pSmallestNode->GetLinkByIndex( link );
+
+			if ( pClusterCorridor && !pClusterCorridor->IsBitSet( clusters.GetNodeCluster( nodeLink->DestNodeID( smallestID ) ) ) )
+				continue;
+
+			if ( !IsLinkUsable( nodeLink, smallestID ) )
+				continue;
+
+			int moveType = nodeLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+			int testID	 = nodeLink->DestNodeID( smallestID );
+
+			Vector r1 = pSmallestNode->GetPosition( GetHullType() );
+			Vector r2 = pAInode[testID]->GetPosition( GetHullType() );
+			bool bOverridden = false;
+			float dist = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2, &bOverridden ); // MovementCost takes ref parameters!!
+			m_bRouteCostOverridden |= bOverridden;
+
+			if ( dist == FLT_MAX )
+				continue;
+
+			float new_g = smallestG + dist;
+
+			if ( !scratch.WasReached( testID ) || new_g < scratch.GetG( testID ) )
+			{
+				scratch.SetCost( testID, smallestID, new_g, new_g + ( pAInode[testID]->GetPosition( GetHullType() ) - vecEnd ).Length() );
+			}
+		}
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The original A* implementation, which scans every node in the
+//			network for the cheapest open one on each expansion.
+//-----------------------------------------------------------------------------
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathLinearScan( int startID, int endID )
+{
+#endif
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
@@ -346,7 +801,13 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 			Vector r1 = pSmallestNode->GetPosition(GetHullType());
 			Vector r2 = pAInode[testID]->GetPosition(GetHullType());
+#ifdef MAPBASE
+			bool bOverridden = false;
+			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2, &bOverridden ); // MovementCost takes ref parameters!!
+			m_bRouteCostOverridden |= bOverridden;
+#else
 			float dist   = GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
+#endif
 
 			if ( dist == FLT_MAX )
 				continue;
@@ -2153,3 +2614,123 @@ void CAI_Pathfinder::CTriDebugOverlay::AddTriOverlayLine(const Vector &origin, c
 }
 
 //-----------------------------------------------------------------------------
+
+#ifdef MAPBASE
+extern CBaseEntity *FindPickerEntity( CBasePlayer *pPlayer );
+
+//-----------------------------------------------------------------------------
+// Purpose: Times both open list implementations against the same set of
+//			random node pairs on the loaded graph.
+//-----------------------------------------------------------------------------
+CON_COMMAND( ai_path_bench, "Times FindBestPath between random node pairs using the NPC under the crosshair (or the first NPC). Format: ai_path_bench <pairs> <seed>" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !g_pBigAINet || g_pBigAINet->NumNodes() < 2 )
+	{
+		Msg( "ai_path_bench: No node graph loaded\n" );
+		return;
+	}
+
+	CAI_BaseNPC *pNPC = NULL;
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( pPlayer )
+	{
+		CBaseEntity *pEntity = FindPickerEntity( pPlayer );
+		if ( pEntity )
+			pNPC = pEntity->MyNPCPointer();
+	}
+
+	if ( !pNPC && g_AI_Manager.NumAIs() > 0 )
+		pNPC = g_AI_Manager.AccessAIs()[0];
+
+	if ( !pNPC || !pNPC->GetPathfinder() )
+	{
+		Msg( "ai_path_bench: Needs an NPC to path with\n" );
+		return;
+	}
+
+	int nPairs = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+	int nSeed = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0;
+	int nNodes = g_pBigAINet->NumNodes();
+
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( nSeed );
+
+	CUtlVector<int> endpoints;
+	endpoints.SetCount( nPairs * 2 );
+	for ( int i = 0; i < endpoints.Count(); i++ )
+	{
+		endpoints[i] = randomStream.RandomInt( 0, nNodes - 1 );
+	}
+
+	// Waypoint counts from the first run, used to make sure the linear scan returns the same routes
+	CUtlVector<int> routeLengths;
+	routeLengths.SetCount( nPairs );
+
+	CAI_Pathfinder *pPathfinder = pNPC->GetPathfinder();
+
+	Msg( "ai_path_bench: %d pairs on %d nodes (%d clusters) with %s (seed %d)\n", nPairs, nNodes, g_pBigAINet->GetClusters().NumClusters(), pNPC->GetDebugName(), nSeed );
+
+	enum
+	{
+		BENCH_BINARY_HEAP,
+		BENCH_HIERARCHICAL,
+		BENCH_LINEAR_SCAN,
+
+		NUM_BENCH_MODES
+	};
+
+	static const char *s_pszModeNames[NUM_BENCH_MODES] = { "binary heap", "hierarchical", "linear scan" };
+
+	for ( int iMode = 0; iMode < NUM_BENCH_MODES; iMode++ )
+	{
+		int nFound = 0;
+		int nMismatched = 0;
+		int nStartExpansions = g_nPathfindExpansions;
+
+		CFastTimer timer;
+		timer.Start();
+
+		for ( int i = 0; i < nPairs; i++ )
+		{
+			int startID = endpoints[i * 2];
+			int endID = endpoints[i * 2 + 1];
+
+			AI_Waypoint_t *pRoute;
+			switch ( iMode )
+			{
+			case BENCH_HIERARCHICAL:	pRoute = pPathfinder->FindBestPathHierarchical( startID, endID ); break;
+			case BENCH_LINEAR_SCAN:		pRoute = pPathfinder->FindBestPathLinearScan( startID, endID ); break;
+			default:					pRoute = pPathfinder->FindBestPathOpenList( startID, endID ); break;
+			}
+
+			int nWaypoints = 0;
+			for ( AI_Waypoint_t *pWaypoint = pRoute; pWaypoint; pWaypoint = pWaypoint->GetNext() )
+				nWaypoints++;
+
+			if ( iMode == BENCH_BINARY_HEAP )
+				routeLengths[i] = nWaypoints;
+			else if ( iMode == BENCH_LINEAR_SCAN && routeLengths[i] != nWaypoints )
+				nMismatched++;
+
+			if ( pRoute )
+			{
+				nFound++;
+				DeleteAll( pRoute );
+			}
+		}
+
+		timer.End();
+
+		double flMS = timer.GetDuration().GetMillisecondsF();
+		Msg( "  %-12s %8.2fms total, %6.3fms/path, %d/%d found", s_pszModeNames[iMode], flMS, flMS / nPairs, nFound, nPairs );
+		if ( iMode != BENCH_LINEAR_SCAN )
+			Msg( ", %.1f nodes expanded/path", (float)( g_nPathfindExpansions - nStartExpansions ) / nPairs );
+		else
+			Msg( ", %d mismatched", nMismatched );
+		Msg( "\n" );
+	}
+}
+#endif
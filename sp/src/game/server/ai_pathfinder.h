@@ -21,6 +21,7 @@ struct AI_Waypoint_t;
 class CAI_Link;
 class CAI_Network;
 class CAI_Node;
+class CVarBitVec;
 
 
 //-----------------------------------------------------------------------------
@@ -53,6 +54,9 @@ public:
 		m_flLastStaleLinkCheckTime( 0 ),
 		m_pNetwork( NULL )
 	{
+#ifdef MAPBASE
+		m_bRouteCostOverridden = false;
+#endif
 	}
 
 	void Init( CAI_Network *pNetwork );
@@ -65,6 +69,14 @@ public:
 	AI_Waypoint_t*	FindBestPath		(int startID, int endID);
 	AI_Waypoint_t*	FindShortRandomPath	(int startID, float minPathLength, const Vector &vDirection = vec3_origin);
 
+#ifdef MAPBASE
+	// FindBestPath() picks one of these based on ai_pathfind_legacy_openlist and ai_pathfind_hierarchical.
+	// They're public so that ai_path_bench can time them against each other.
+	AI_Waypoint_t*	FindBestPathOpenList	(int startID, int endID, const CVarBitVec *pClusterCorridor = NULL);
+	AI_Waypoint_t*	FindBestPathLinearScan	(int startID, int endID);
+	AI_Waypoint_t*	FindBestPathHierarchical(int startID, int endID);
+#endif
+
 	// --------------------------------
 
 	bool			IsLinkUsable(CAI_Link *pLink, int startID);
@@ -123,6 +135,13 @@ private:
 
 	bool			IsLinkStillStale(int moveType, CAI_Link *nodeLink);
 
+#ifdef MAPBASE
+	int				BuildClusterCorridor( int startID, int endID, CVarBitVec *pCorridor );
+
+	AI_Waypoint_t*	FindBestPathUncached( int startID, int endID );
+	AI_Waypoint_t*	BuildCachedRoute( const int *pNodes, int nNodes );
+#endif
+
 	// --------------------------------
 	
 	// Builds a simple route (no triangulation, no making way)
@@ -187,6 +206,9 @@ private:
 	
 	float m_flLastStaleLinkCheckTime;	// Last time I check for a stale link
 	bool m_bIgnoreStaleLinks;
+#ifdef MAPBASE
+	bool m_bRouteCostOverridden;		// The NPC changed a movement cost during the last search, so it can't be cached
+#endif
 
 	//---------------------------------
 	
@@ -18,6 +18,11 @@
 	#include "portal_util_shared.h"
 #endif
 
+#ifdef MAPBASE
+#include "mathlib/ssemath.h"
+#include "tier0/fasttimer.h"
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -41,6 +46,219 @@ CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
 //-----------------------------------------------------------------------------
 
+#ifdef MAPBASE
+ConVar ai_senses_batched( "ai_senses_batched", "1", FCVAR_NONE, "Distance cull the NPCs an NPC looks for against a SIMD snapshot of every NPC's position taken once per tick, instead of one NPC at a time." );
+ConVar ai_sensed_objects_grid( "ai_sensed_objects_grid", "1", FCVAR_NONE, "Only consider the sensed objects in the grid cells near an NPC when it looks for objects, instead of every object on the map." );
+ConVar ai_sensed_objects_grid_cell( "ai_sensed_objects_grid_cell", "512", FCVAR_NONE, "Size of the cells in the sensed objects grid." );
+ConVar ai_senses_batched_tolerance( "ai_senses_batched_tolerance", "128", FCVAR_NONE, "How far an NPC can move after the sensing snapshot was taken in the same tick and still be found by the batched distance cull. Teleports always retake the snapshot." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Positions of every NPC in g_AI_Manager in groups of four, so that each
+//			NPC's look can cull the whole list with a handful of SIMD compares.
+//			Survivors are checked against their actual position before they're
+//			looked at, so the snapshot only decides who gets that check.
+//
+//			It's retaken every tick and whenever an NPC is added, removed or
+//			teleported. An NPC that moves more than ai_senses_batched_tolerance
+//			some other way before the snapshot is retaken can be missed.
+//-----------------------------------------------------------------------------
+class CAI_SensingSnapshot
+{
+public:
+	enum
+	{
+		MAX_GROUPS = 64,
+		MAX_AIS = MAX_GROUPS * 4,
+	};
+
+	CAI_SensingSnapshot()
+	 :	m_flTime( -1 ),
+		m_iSerial( -1 ),
+		m_iTeleportSerial( -1 ),
+		m_nAIs( 0 ),
+		m_nSnapshots( 0 )
+	{
+	}
+
+	// Returns false if there are too many AIs to fit in the snapshot
+	bool	Update();
+
+	// Fills ppCandidates with every AI that might be within flDist of vecOrigin, in the same
+	// order as g_AI_Manager.AccessAIs(), and returns how many there are
+	int		GatherCandidates( const Vector &vecOrigin, float flDist, CAI_BaseNPC **ppCandidates );
+
+	int		NumSnapshots() const	{ return m_nSnapshots; }
+	void	ResetStats()			{ m_nSnapshots = 0; }
+
+private:
+	fltx4	m_X[MAX_GROUPS];
+	fltx4	m_Y[MAX_GROUPS];
+	fltx4	m_Z[MAX_GROUPS];
+	int		m_NoCullMask[MAX_GROUPS];	// Lanes of NPCs which return true in ShouldNotDistanceCull()
+
+	float	m_flTime;
+	int		m_iSerial;
+	int		m_iTeleportSerial;
+	int		m_nAIs;
+
+	int		m_nSnapshots;
+};
+
+static CAI_SensingSnapshot g_AI_SensingSnapshot;
+
+//-------------------------------------
+
+bool CAI_SensingSnapshot::Update()
+{
+	if ( m_flTime == gpGlobals->curtime && m_iSerial == g_AI_Manager.GetChangeSerial() && m_iTeleportSerial == g_AI_Manager.GetTeleportSerial() )
+		return true;
+
+	int nAIs = g_AI_Manager.NumAIs();
+	if ( nAIs > MAX_AIS )
+		return false;
+
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	int nGroups = ( nAIs + 3 ) / 4;
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		ALIGN16 float x[4] ALIGN16_POST;
+		ALIGN16 float y[4] ALIGN16_POST;
+		ALIGN16 float z[4] ALIGN16_POST;
+		int nNoCullMask = 0;
+
+		for ( int j = 0; j < 4; j++ )
+		{
+			int i = g * 4 + j;
+			if ( i < nAIs )
+			{
+				const Vector &vecOrigin = ppAIs[i]->GetAbsOrigin();
+				x[j] = vecOrigin.x;
+				y[j] = vecOrigin.y;
+				z[j] = vecOrigin.z;
+
+				if ( ppAIs[i]->ShouldNotDistanceCull() )
+					nNoCullMask |= ( 1 << j );
+			}
+			else
+			{
+				x[j] = y[j] = z[j] = 0;
+			}
+		}
+
+		m_X[g] = LoadAlignedSIMD( x );
+		m_Y[g] = LoadAlignedSIMD( y );
+		m_Z[g] = LoadAlignedSIMD( z );
+		m_NoCullMask[g] = nNoCullMask;
+	}
+
+	m_nAIs = nAIs;
+	m_flTime = gpGlobals->curtime;
+	m_iSerial = g_AI_Manager.GetChangeSerial();
+	m_iTeleportSerial = g_AI_Manager.GetTeleportSerial();
+	m_nSnapshots++;
+	return true;
+}
+
+//-------------------------------------
+
+int CAI_SensingSnapshot::GatherCandidates( const Vector &vecOrigin, float flDist, CAI_BaseNPC **ppCandidates )
+{
+	float flRadius = flDist + MAX( ai_senses_batched_tolerance.GetFloat(), 0.0f );
+	fltx4 fl4RadiusSqr = ReplicateX4( flRadius * flRadius );
+	fltx4 fl4OriginX = ReplicateX4( vecOrigin.x );
+	fltx4 fl4OriginY = ReplicateX4( vecOrigin.y );
+	fltx4 fl4OriginZ = ReplicateX4( vecOrigin.z );
+
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	int nGroups = ( m_nAIs + 3 ) / 4;
+	int nCandidates = 0;
+	for ( int g = 0; g < nGroups; g++ )
+	{
+		fltx4 fl4DeltaX = SubSIMD( m_X[g], fl4OriginX );
+		fltx4 fl4DeltaY = SubSIMD( m_Y[g], fl4OriginY );
+		fltx4 fl4DeltaZ = SubSIMD( m_Z[g], fl4OriginZ );
+		fltx4 fl4DistSqr = MulSIMD( fl4DeltaX, fl4DeltaX );
+		fl4DistSqr = MaddSIMD( fl4DeltaY, fl4DeltaY, fl4DistSqr );
+		fl4DistSqr = MaddSIMD( fl4DeltaZ, fl4DeltaZ, fl4DistSqr );
+
+		int nMask = TestSignSIMD( CmpLtSIMD( fl4DistSqr, fl4RadiusSqr ) ) | m_NoCullMask[g];
+		for ( int j = 0; nMask; j++, nMask >>= 1 )
+		{
+			int i = g * 4 + j;
+			if ( ( nMask & 1 ) && i < m_nAIs )
+				ppCandidates[nCandidates++] = ppAIs[i];
+		}
+	}
+
+	return nCandidates;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Counters for ai_senses_report, so the batched cull can be measured
+//			against the one-at-a-time loop.
+//-----------------------------------------------------------------------------
+struct AI_SensesStats_t
+{
+	void Reset()
+	{
+		for ( int i = 0; i < 2; i++ )
+		{
+			nGathers[i] = nConsidered[i] = nCandidates[i] = nLooks[i] = nSeen[i] = 0;
+			time[i].Init();
+		}
+
+		nFallbacks = 0;
+
+		nObjectGathers = nObjectsConsidered = nObjectCandidates = 0;
+		objectTime.Init();
+	}
+
+	int			nGathers[2];		// Full LookForNPCs() passes, legacy and batched
+	int			nConsidered[2];		// NPCs in g_AI_Manager during those passes
+	int			nCandidates[2];		// NPCs that reached the exact distance test
+	int			nLooks[2];			// NPCs that passed it and were looked at
+	int			nSeen[2];
+	CCycleCount	time[2];
+
+	int			nFallbacks;			// Batched passes that had to use the legacy loop
+
+	// LookForObjects() passes, and how many objects they tested with and without the grid
+	int			nObjectGathers;
+	int			nObjectsConsidered;
+	int			nObjectCandidates;
+	CCycleCount	objectTime;
+};
+
+static AI_SensesStats_t g_AI_SensesStats;
+
+CON_COMMAND( ai_senses_report, "Prints how much work NPCs have done looking for other NPCs and objects. Pass \"reset\" to clear the counters afterwards." )
+{
+	static const char *s_pszPaths[2] = { "Legacy", "Batched" };
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		const AI_SensesStats_t &stats = g_AI_SensesStats;
+		int nGathers = stats.nGathers[i];
+		Msg( "%s: %d passes, %.3f ms (%.4f ms per pass)\n", s_pszPaths[i], nGathers, stats.time[i].GetMillisecondsF(), ( nGathers ) ? stats.time[i].GetMillisecondsF() / nGathers : 0.0 );
+		Msg( "  %d NPCs considered, %d reached the distance test, %d looked at, %d seen\n", stats.nConsidered[i], stats.nCandidates[i], stats.nLooks[i], stats.nSeen[i] );
+	}
+
+	Msg( "%d snapshots, %d batched passes fell back to the legacy loop\n", g_AI_SensingSnapshot.NumSnapshots(), g_AI_SensesStats.nFallbacks );
+
+	const AI_SensesStats_t &stats = g_AI_SensesStats;
+	Msg( "Objects: %d passes, %.3f ms, %d objects on the map, %d near enough to test, %d grid rebuilds\n", stats.nObjectGathers, stats.objectTime.GetMillisecondsF(), stats.nObjectsConsidered, stats.nObjectCandidates, g_AI_SensedObjectsManager.NumGridRebuilds() );
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		g_AI_SensesStats.Reset();
+		g_AI_SensingSnapshot.ResetStats();
+		g_AI_SensedObjectsManager.ResetStats();
+	}
+}
+#endif
+
+//-----------------------------------------------------------------------------
+
 #pragma pack(push)
 #pragma pack(1)
 
@@ -460,16 +678,66 @@ int CAI_Senses::LookForNPCs( int iDistance )
 
 			CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
 			
+#ifdef MAPBASE
+			bool bBatched = ai_senses_batched.GetBool();
+			if ( bBatched && !g_AI_SensingSnapshot.Update() )
+			{
+				g_AI_SensesStats.nFallbacks++;
+				bBatched = false;
+			}
+
+			int iPath = ( bBatched ) ? 1 : 0;
+			CTimeAdder timer( &g_AI_SensesStats.time[iPath] );
+			g_AI_SensesStats.nGathers[iPath]++;
+			g_AI_SensesStats.nConsidered[iPath] += g_AI_Manager.NumAIs();
+
+			if ( bBatched )
+			{
+				CAI_BaseNPC *pCandidates[CAI_SensingSnapshot::MAX_AIS];
+				int nCandidates = g_AI_SensingSnapshot.GatherCandidates( origin, iDistance, pCandidates );
+				g_AI_SensesStats.nCandidates[iPath] += nCandidates;
+
+				int iSerial = g_AI_Manager.GetChangeSerial();
+				for ( i = 0; i < nCandidates; i++ )
+				{
+					CAI_BaseNPC *pCandidate = pCandidates[i];
+
+					// Looking can fire outputs, which might have removed NPCs from the list
+					if ( iSerial != g_AI_Manager.GetChangeSerial() && !g_AI_Manager.FindAI( pCandidate ) )
+						continue;
+
+					if ( pCandidate != GetOuter() && ( pCandidate->ShouldNotDistanceCull() || origin.DistToSqr(pCandidate->GetAbsOrigin()) < distSq ) )
+					{
+						g_AI_SensesStats.nLooks[iPath]++;
+						if ( Look( pCandidate ) )
+						{
+							nSeen++;
+						}
+					}
+				}
+			}
+			else
+			{
+				g_AI_SensesStats.nCandidates[iPath] += g_AI_Manager.NumAIs();
+#endif
 			for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
 			{
 				if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
 				{
+#ifdef MAPBASE
+					g_AI_SensesStats.nLooks[iPath]++;
+#endif
 					if ( Look( ppAIs[i] ) )
 					{
 						nSeen++;
 					}
 				}
 			}
+#ifdef MAPBASE
+			}
+
+			g_AI_SensesStats.nSeen[iPath] += nSeen;
+#endif
 
 			EndGather( nSeen, &m_SeenNPCs );
 
@@ -516,6 +784,35 @@ int CAI_Senses::LookForObjects( int iDistance )
 
 		float distSq = ( iDistance * iDistance );
 		const Vector &origin = GetAbsOrigin();
+#ifdef MAPBASE
+		CTimeAdder timer( &g_AI_SensesStats.objectTime );
+		g_AI_SensesStats.nObjectGathers++;
+		g_AI_SensesStats.nObjectsConsidered += g_AI_SensedObjectsManager.Count();
+
+		if ( ai_sensed_objects_grid.GetBool() )
+		{
+			CUtlVector<CBaseEntity *> objects;
+			g_AI_SensedObjectsManager.GetObjectsInRadius( origin, iDistance, &objects );
+			g_AI_SensesStats.nObjectCandidates += objects.Count();
+
+			for ( int i = 0; i < objects.Count(); i++ )
+			{
+				CBaseEntity *pEnt = objects[i];
+				if ( pEnt->GetFlags() & BOX_QUERY_MASK )
+				{
+					if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+					{
+						nSeen++;
+					}
+				}
+			}
+
+			EndGather( nSeen, &m_SeenMisc );
+			return nSeen;
+		}
+
+		g_AI_SensesStats.nObjectCandidates += g_AI_SensedObjectsManager.Count();
+#endif
 		int iter;
 		CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
 		while ( pEnt )
@@ -668,6 +965,12 @@ void CAI_Senses::PerformSensing( void )
 
 void CAI_SensedObjectsManager::Init()
 {
+#ifdef MAPBASE
+	m_bGridDirty = true;
+	m_flGridTime = -1;
+	m_nGridRebuilds = 0;
+#endif
+
 	CBaseEntity *pEnt = NULL;
 	while ( ( pEnt = gEntList.NextEnt( pEnt ) ) != NULL )
 	{
@@ -683,6 +986,11 @@ void CAI_SensedObjectsManager::Term()
 {
 	gEntList.RemoveListenerEntity( this );
 	m_SensedObjects.RemoveAll();
+#ifdef MAPBASE
+	m_GridBucketStart.Purge();
+	m_GridEntries.Purge();
+	m_bGridDirty = true;
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -721,6 +1029,9 @@ void CAI_SensedObjectsManager::OnEntitySpawned( CBaseEntity *pEntity )
 	if ( ( pEntity->GetFlags() & FL_OBJECT ) && !pEntity->IsPlayer() && !pEntity->IsNPC() )
 	{
 		m_SensedObjects.AddToTail( pEntity );
+#ifdef MAPBASE
+		m_bGridDirty = true;
+#endif
 	}
 }
 
@@ -732,7 +1043,12 @@ void CAI_SensedObjectsManager::OnEntityDeleted( CBaseEntity *pEntity )
 	{
 		int i = m_SensedObjects.Find( pEntity );
 		if ( i != m_SensedObjects.InvalidIndex() )
+		{
 			m_SensedObjects.FastRemove( i );
+#ifdef MAPBASE
+			m_bGridDirty = true;
+#endif
+		}
 	}
 }
 
@@ -747,6 +1063,126 @@ void CAI_SensedObjectsManager::AddEntity( CBaseEntity *pEntity )
 	// Add the object flag so it gets removed when it dies
 	pEntity->AddFlag( FL_OBJECT );
 	m_SensedObjects.AddToTail( pEntity );
+#ifdef MAPBASE
+	m_bGridDirty = true;
+#endif
+}
+
+#ifdef MAPBASE
+//-----------------------------------------------------------------------------
+
+int CAI_SensedObjectsManager::GetGridBucket( int x, int y ) const
+{
+	return ( ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ) & ( NUM_GRID_BUCKETS - 1 );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_SensedObjectsManager::UpdateGrid()
+{
+	// Objects are moved by physics every tick, so the grid is never good for longer than one
+	float flCellSize = MAX( ai_sensed_objects_grid_cell.GetFloat(), 64.0f );
+	if ( !m_bGridDirty && m_flGridTime == gpGlobals->curtime && m_flGridCellSize == flCellSize )
+		return;
+
+	m_flGridCellSize = flCellSize;
+
+	int nObjects = m_SensedObjects.Count();
+	CUtlVectorFixedGrowable<int, 256> buckets;
+	buckets.SetCount( nObjects );
+
+	m_GridBucketStart.SetCount( NUM_GRID_BUCKETS + 1 );
+	memset( m_GridBucketStart.Base(), 0, m_GridBucketStart.Count() * sizeof(int) );
+
+	for ( int i = 0; i < nObjects; i++ )
+	{
+		CBaseEntity *pEnt = m_SensedObjects[i];
+		if ( !pEnt )
+		{
+			buckets[i] = -1;
+			continue;
+		}
+
+		const Vector &vecOrigin = pEnt->GetAbsOrigin();
+		buckets[i] = GetGridBucket( (int)floorf( vecOrigin.x / m_flGridCellSize ), (int)floorf( vecOrigin.y / m_flGridCellSize ) );
+		m_GridBucketStart[buckets[i] + 1]++;
+	}
+
+	for ( int i = 0; i < NUM_GRID_BUCKETS; i++ )
+		m_GridBucketStart[i + 1] += m_GridBucketStart[i];
+
+	// Fill each bucket in list order so queries don't have to sort as much
+	m_GridEntries.SetCount( m_GridBucketStart[NUM_GRID_BUCKETS] );
+	CUtlVectorFixedGrowable<int, NUM_GRID_BUCKETS> next;
+	next.CopyArray( m_GridBucketStart.Base(), NUM_GRID_BUCKETS );
+	for ( int i = 0; i < nObjects; i++ )
+	{
+		if ( buckets[i] != -1 )
+			m_GridEntries[next[buckets[i]]++] = i;
+	}
+
+	m_bGridDirty = false;
+	m_flGridTime = gpGlobals->curtime;
+	m_nGridRebuilds++;
 }
 
+//-----------------------------------------------------------------------------
+
+static int __cdecl SensedObjectIndexCompare( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+int CAI_SensedObjectsManager::GetObjectsInRadius( const Vector &vecOrigin, float flRadius, CUtlVector<CBaseEntity *> *pResult )
+{
+	pResult->RemoveAll();
+
+	UpdateGrid();
+
+	// Objects can move after the grid was built this tick, so give them some leeway
+	flRadius += MAX( ai_senses_batched_tolerance.GetFloat(), 0.0f );
+
+	int x0 = (int)floorf( ( vecOrigin.x - flRadius ) / m_flGridCellSize );
+	int x1 = (int)floorf( ( vecOrigin.x + flRadius ) / m_flGridCellSize );
+	int y0 = (int)floorf( ( vecOrigin.y - flRadius ) / m_flGridCellSize );
+	int y1 = (int)floorf( ( vecOrigin.y + flRadius ) / m_flGridCellSize );
+
+	if ( ( x1 - x0 + 1 ) * ( y1 - y0 + 1 ) >= NUM_GRID_BUCKETS )
+	{
+		// The query covers so many cells that every bucket would be visited anyway
+		for ( int i = 0; i < m_SensedObjects.Count(); i++ )
+		{
+			if ( m_SensedObjects[i] )
+				pResult->AddToTail( m_SensedObjects[i] );
+		}
+		return pResult->Count();
+	}
+
+	CUtlVectorFixedGrowable<int, 128> indices;
+	for ( int x = x0; x <= x1; x++ )
+	{
+		for ( int y = y0; y <= y1; y++ )
+		{
+			int iBucket = GetGridBucket( x, y );
+			for ( int i = m_GridBucketStart[iBucket]; i < m_GridBucketStart[iBucket + 1]; i++ )
+				indices.AddToTail( m_GridEntries[i] );
+		}
+	}
+
+	// Several cells can hash to the same bucket, so there can be duplicates
+	indices.Sort( SensedObjectIndexCompare );
+	for ( int i = 0; i < indices.Count(); i++ )
+	{
+		if ( i > 0 && indices[i] == indices[i - 1] )
+			continue;
+
+		CBaseEntity *pEnt = m_SensedObjects[indices[i]];
+		if ( pEnt )
+			pResult->AddToTail( pEnt );
+	}
+
+	return pResult->Count();
+}
+#endif
+
 //=============================================================================
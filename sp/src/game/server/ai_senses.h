@@ -153,11 +153,41 @@ public:
 
 	virtual void 	AddEntity( CBaseEntity *pEntity );
 
+#ifdef MAPBASE
+	// Fills pResult with every sensed object that might be within flRadius of vecOrigin, in the
+	// order GetFirst()/GetNext() would return them. Callers still have to check the distance.
+	int				GetObjectsInRadius( const Vector &vecOrigin, float flRadius, CUtlVector<CBaseEntity *> *pResult );
+	int				Count() const			{ return m_SensedObjects.Count(); }
+
+	int				NumGridRebuilds() const	{ return m_nGridRebuilds; }
+	void			ResetStats()			{ m_nGridRebuilds = 0; }
+#endif
+
 private:
 	virtual void 	OnEntitySpawned( CBaseEntity *pEntity );
 	virtual void 	OnEntityDeleted( CBaseEntity *pEntity );
 
 	CUtlVector<EHANDLE> m_SensedObjects;
+
+#ifdef MAPBASE
+	// Uniform grid over the XY plane of the objects' positions, hashed into a fixed number of
+	// buckets. It's rebuilt at most once a tick, the first time it's queried after the objects
+	// could have moved or the list changed.
+	enum
+	{
+		NUM_GRID_BUCKETS = 1024,
+	};
+
+	void			UpdateGrid();
+	int				GetGridBucket( int x, int y ) const;
+
+	CUtlVector<int>	m_GridBucketStart;	// Index of each bucket's first entry in m_GridEntries, plus one past the end
+	CUtlVector<int>	m_GridEntries;		// Indices into m_SensedObjects, sorted by bucket
+	float			m_flGridCellSize;
+	float			m_flGridTime;
+	bool			m_bGridDirty;
+	int				m_nGridRebuilds;
+#endif
 };
 
 extern CAI_SensedObjectsManager g_AI_SensedObjectsManager;
@@ -0,0 +1,437 @@
+//========= Mapbase - https://github.com/mapbase-source/source-sdk-2013 ============//
+//
+// Purpose: Coarse cluster graph built on top of the AI node graph. Long routes
+//			are planned over clusters first, then refined over the nodes inside
+//			the resulting corridor.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "ai_network.h"
+#include "ai_node.h"
+#include "ai_link.h"
+#include "mapbase/ai_network_clusters.h"
+#include "utlbuffer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define AINET_CLUSTERS_ID		MAKEID('A','I','C','L')
+#define AINET_CLUSTERS_VERSION	1
+
+ConVar ai_cluster_radius( "ai_cluster_radius", "512", FCVAR_NONE, "How far a node can be from the first node of its cluster when AI node clusters are built." );
+ConVar ai_cluster_max_nodes( "ai_cluster_max_nodes", "32", FCVAR_NONE, "The most nodes a single AI node cluster can contain." );
+
+//-----------------------------------------------------------------------------
+
+static bool AnyHullUsesLink( const CAI_Link *pLink )
+{
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		if ( pLink->m_iAcceptedMoveTypes[hull] )
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+
+CAI_NetworkClusters::CAI_NetworkClusters()
+{
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Purge()
+{
+	m_NodeClusters.Purge();
+	m_Clusters.Purge();
+	m_Edges.Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::IsValid( const CAI_Network *pNetwork ) const
+{
+	return ( m_Clusters.Count() > 0 && m_NodeClusters.Count() == pNetwork->NumNodes() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Groups the network into clusters and works out how much it costs
+//			each hull to get from one cluster to its neighbours
+//-----------------------------------------------------------------------------
+void CAI_NetworkClusters::Build( CAI_Network *pNetwork )
+{
+	Purge();
+
+	if ( !pNetwork->NumNodes() )
+		return;
+
+	BuildClusterMembership( pNetwork );
+	BuildClusterEdges( pNetwork );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Flood fills outward from each unclaimed node (in ID order, so the
+//			result is deterministic) until the cluster is full or the next
+//			nodes are too far from where it started.
+//-----------------------------------------------------------------------------
+void CAI_NetworkClusters::BuildClusterMembership( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+
+	float flMaxDistSqr = Square( ai_cluster_radius.GetFloat() );
+	int nMaxMembers = MAX( ai_cluster_max_nodes.GetInt(), 1 );
+
+	m_NodeClusters.SetCount( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		m_NodeClusters[i] = -1;
+	}
+
+	CUtlVector<int> members;
+
+	for ( int iSeed = 0; iSeed < nNodes; iSeed++ )
+	{
+		if ( m_NodeClusters[iSeed] != -1 )
+			continue;
+
+		int iCluster = m_Clusters.AddToTail();
+		const Vector &vecSeed = ppNodes[iSeed]->GetOrigin();
+		Vector vecSum = vecSeed;
+
+		m_NodeClusters[iSeed] = iCluster;
+		members.RemoveAll();
+		members.AddToTail( iSeed );
+
+		for ( int iMember = 0; iMember < members.Count() && members.Count() < nMaxMembers; iMember++ )
+		{
+			CAI_Node *pNode = ppNodes[members[iMember]];
+			for ( int link = 0; link < pNode->NumLinks() && members.Count() < nMaxMembers; link++ )
+			{
+				CAI_Link *pLink = pNode->GetLinkByIndex( link );
+				if ( !AnyHullUsesLink( pLink ) )
+					continue;
+
+				int iOther = pLink->DestNodeID( pNode->GetId() );
+				if ( m_NodeClusters[iOther] != -1 )
+					continue;
+
+				const Vector &vecOther = ppNodes[iOther]->GetOrigin();
+				if ( vecOther.DistToSqr( vecSeed ) > flMaxDistSqr )
+					continue;
+
+				m_NodeClusters[iOther] = iCluster;
+				members.AddToTail( iOther );
+				vecSum += vecOther;
+			}
+		}
+
+		// The center is whichever member is closest to the middle of the cluster
+		Vector vecCentroid = vecSum / members.Count();
+		int iCenter = iSeed;
+		float flBestDistSqr = FLT_MAX;
+		for ( int iMember = 0; iMember < members.Count(); iMember++ )
+		{
+			float flDistSqr = ppNodes[members[iMember]]->GetOrigin().DistToSqr( vecCentroid );
+			if ( flDistSqr < flBestDistSqr )
+			{
+				flBestDistSqr = flDistSqr;
+				iCenter = members[iMember];
+			}
+		}
+
+		m_Clusters[iCluster].iCenterNode = iCenter;
+		m_Clusters[iCluster].iFirstEdge = 0;
+		m_Clusters[iCluster].nEdges = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Dijkstra from a cluster's center node to the other members, only
+//			walking links inside the cluster that the hull can use.
+//			Unreachable members are left at FLT_MAX.
+//-----------------------------------------------------------------------------
+void CAI_NetworkClusters::ComputeCenterDistances( CAI_Network *pNetwork, int iCluster, Hull_t hull, float *pDistances )
+{
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+	int iCenter = m_Clusters[iCluster].iCenterNode;
+
+	// Clusters are small, so a plain O(n^2) Dijkstra over the members is fine
+	CUtlVector<int> open;
+	pDistances[iCenter] = 0;
+	open.AddToTail( iCenter );
+
+	while ( open.Count() )
+	{
+		int iBest = 0;
+		for ( int i = 1; i < open.Count(); i++ )
+		{
+			if ( pDistances[open[i]] < pDistances[open[iBest]] )
+				iBest = i;
+		}
+
+		int iNode = open[iBest];
+		open.FastRemove( iBest );
+
+		CAI_Node *pNode = ppNodes[iNode];
+		Vector vecNode = pNode->GetPosition( hull );
+
+		for ( int link = 0; link < pNode->NumLinks(); link++ )
+		{
+			CAI_Link *pLink = pNode->GetLinkByIndex( link );
+			if ( !pLink->m_iAcceptedMoveTypes[hull] )
+				continue;
+
+			int iOther = pLink->DestNodeID( iNode );
+			if ( m_NodeClusters[iOther] != iCluster )
+				continue;
+
+			float flDist = pDistances[iNode] + ( ppNodes[iOther]->GetPosition( hull ) - vecNode ).Length();
+			if ( flDist < pDistances[iOther] )
+			{
+				if ( pDistances[iOther] == FLT_MAX )
+					open.AddToTail( iOther );
+				pDistances[iOther] = flDist;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the links that cross from one cluster to another and turns
+//			them into per-hull cluster edges
+//-----------------------------------------------------------------------------
+void CAI_NetworkClusters::BuildClusterEdges( CAI_Network *pNetwork )
+{
+	int nNodes = pNetwork->NumNodes();
+	int nClusters = m_Clusters.Count();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+
+	// Distance from the center of each node's cluster to the node, per hull
+	CUtlVector<float> centerDistances;
+	centerDistances.SetCount( NUM_HULLS * nNodes );
+	for ( int i = 0; i < centerDistances.Count(); i++ )
+	{
+		centerDistances[i] = FLT_MAX;
+	}
+
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		for ( int iCluster = 0; iCluster < nClusters; iCluster++ )
+		{
+			ComputeCenterDistances( pNetwork, iCluster, (Hull_t)hull, &centerDistances[hull * nNodes] );
+		}
+	}
+
+	// Bucket the nodes by cluster so each cluster's edges can be gathered together
+	CUtlVector<int> firstMember;
+	CUtlVector<int> members;
+	firstMember.SetCount( nClusters + 1 );
+	members.SetCount( nNodes );
+	for ( int i = 0; i <= nClusters; i++ )
+	{
+		firstMember[i] = 0;
+	}
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		firstMember[m_NodeClusters[i] + 1]++;
+	}
+	for ( int i = 0; i < nClusters; i++ )
+	{
+		firstMember[i + 1] += firstMember[i];
+	}
+	{
+		CUtlVector<int> nextMember;
+		nextMember.CopyArray( firstMember.Base(), nClusters );
+		for ( int i = 0; i < nNodes; i++ )
+		{
+			members[nextMember[m_NodeClusters[i]]++] = i;
+		}
+	}
+
+	for ( int iCluster = 0; iCluster < nClusters; iCluster++ )
+	{
+		AI_Cluster_t &cluster = m_Clusters[iCluster];
+		cluster.iFirstEdge = m_Edges.Count();
+		cluster.nEdges = 0;
+
+		for ( int iMember = firstMember[iCluster]; iMember < firstMember[iCluster + 1]; iMember++ )
+		{
+			int iNode = members[iMember];
+			CAI_Node *pNode = ppNodes[iNode];
+
+			for ( int link = 0; link < pNode->NumLinks(); link++ )
+			{
+				CAI_Link *pLink = pNode->GetLinkByIndex( link );
+				int iOther = pLink->DestNodeID( iNode );
+				int iOtherCluster = m_NodeClusters[iOther];
+				if ( iOtherCluster == iCluster || !AnyHullUsesLink( pLink ) )
+					continue;
+
+				// Find or add the edge to that cluster
+				int iEdge;
+				for ( iEdge = cluster.iFirstEdge; iEdge < m_Edges.Count(); iEdge++ )
+				{
+					if ( m_Edges[iEdge].iDestCluster == iOtherCluster )
+						break;
+				}
+
+				if ( iEdge == m_Edges.Count() )
+				{
+					iEdge = m_Edges.AddToTail();
+					m_Edges[iEdge].iDestCluster = iOtherCluster;
+					for ( int hull = 0; hull < NUM_HULLS; hull++ )
+					{
+						m_Edges[iEdge].moveTypes[hull] = 0;
+						m_Edges[iEdge].flCost[hull] = FLT_MAX;
+					}
+					cluster.nEdges++;
+				}
+
+				AI_ClusterEdge_t &edge = m_Edges[iEdge];
+
+				for ( int hull = 0; hull < NUM_HULLS; hull++ )
+				{
+					if ( !pLink->m_iAcceptedMoveTypes[hull] )
+						continue;
+
+					edge.moveTypes[hull] |= pLink->m_iAcceptedMoveTypes[hull];
+
+					Vector vecNode = pNode->GetPosition( hull );
+					Vector vecOther = ppNodes[iOther]->GetPosition( hull );
+
+					// If the portal can't be reached from the center without leaving the cluster,
+					// estimate with a straight line. It's only used to guide the coarse search.
+					float flFromCenter = centerDistances[hull * nNodes + iNode];
+					if ( flFromCenter == FLT_MAX )
+						flFromCenter = ( vecNode - ppNodes[cluster.iCenterNode]->GetPosition( hull ) ).Length();
+
+					float flToCenter = centerDistances[hull * nNodes + iOther];
+					if ( flToCenter == FLT_MAX )
+						flToCenter = ( ppNodes[m_Clusters[iOtherCluster].iCenterNode]->GetPosition( hull ) - vecOther ).Length();
+
+					float flCost = flFromCenter + ( vecOther - vecNode ).Length() + flToCenter;
+					if ( flCost < edge.flCost[hull] )
+						edge.flCost[hull] = flCost;
+				}
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkClusters::Save( CUtlBuffer &buf ) const
+{
+	buf.PutInt( AINET_CLUSTERS_ID );
+	buf.PutInt( AINET_CLUSTERS_VERSION );
+	buf.PutInt( NUM_HULLS );
+	buf.PutInt( m_NodeClusters.Count() );
+	buf.PutInt( m_Clusters.Count() );
+	buf.PutInt( m_Edges.Count() );
+
+	for ( int i = 0; i < m_NodeClusters.Count(); i++ )
+	{
+		buf.PutShort( m_NodeClusters[i] );
+	}
+
+	for ( int i = 0; i < m_Clusters.Count(); i++ )
+	{
+		buf.PutShort( m_Clusters[i].iCenterNode );
+		buf.PutShort( m_Clusters[i].nEdges );
+	}
+
+	for ( int i = 0; i < m_Edges.Count(); i++ )
+	{
+		buf.PutShort( m_Edges[i].iDestCluster );
+		buf.Put( m_Edges[i].moveTypes, sizeof( m_Edges[i].moveTypes ) );
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			buf.PutFloat( m_Edges[i].flCost[hull] );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkClusters::Load( CUtlBuffer &buf, CAI_Network *pNetwork )
+{
+	Purge();
+
+	const int nHeaderSize = 6 * sizeof( int );
+	if ( buf.GetBytesRemaining() < nHeaderSize )
+		return false;
+
+	int nStart = buf.TellGet();
+	if ( buf.GetInt() != AINET_CLUSTERS_ID || buf.GetInt() != AINET_CLUSTERS_VERSION || buf.GetInt() != NUM_HULLS )
+	{
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, nStart );
+		return false;
+	}
+
+	int nNodes = buf.GetInt();
+	int nClusters = buf.GetInt();
+	int nEdges = buf.GetInt();
+
+	const int nEdgeSize = sizeof( short ) + NUM_HULLS + NUM_HULLS * sizeof( float );
+	if ( nNodes != pNetwork->NumNodes() || nClusters <= 0 || nClusters > nNodes || nEdges < 0 ||
+		buf.GetBytesRemaining() < nNodes * (int)sizeof( short ) + nClusters * 2 * (int)sizeof( short ) + nEdges * nEdgeSize )
+	{
+		DevWarning( "AI node clusters don't match the graph, rebuilding\n" );
+		return false;
+	}
+
+	m_NodeClusters.SetCount( nNodes );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		m_NodeClusters[i] = buf.GetShort();
+		if ( m_NodeClusters[i] < 0 || m_NodeClusters[i] >= nClusters )
+		{
+			Purge();
+			return false;
+		}
+	}
+
+	int nTotalEdges = 0;
+	m_Clusters.SetCount( nClusters );
+	for ( int i = 0; i < nClusters; i++ )
+	{
+		m_Clusters[i].iCenterNode = buf.GetShort();
+		m_Clusters[i].nEdges = buf.GetShort();
+		m_Clusters[i].iFirstEdge = nTotalEdges;
+		nTotalEdges += m_Clusters[i].nEdges;
+
+		if ( m_Clusters[i].iCenterNode < 0 || m_Clusters[i].iCenterNode >= nNodes || m_Clusters[i].nEdges < 0 )
+		{
+			Purge();
+			return false;
+		}
+	}
+
+	if ( nTotalEdges != nEdges )
+	{
+		Purge();
+		return false;
+	}
+
+	m_Edges.SetCount( nEdges );
+	for ( int i = 0; i < nEdges; i++ )
+	{
+		m_Edges[i].iDestCluster = buf.GetShort();
+		buf.Get( m_Edges[i].moveTypes, sizeof( m_Edges[i].moveTypes ) );
+		for ( int hull = 0; hull < NUM_HULLS; hull++ )
+		{
+			m_Edges[i].flCost[hull] = buf.GetFloat();
+		}
+
+		if ( m_Edges[i].iDestCluster < 0 || m_Edges[i].iDestCluster >= nClusters )
+		{
+			Purge();
+			return false;
+		}
+	}
+
+	return true;
+}
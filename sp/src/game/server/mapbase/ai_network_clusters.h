@@ -0,0 +1,76 @@
+//========= Mapbase - https://github.com/mapbase-source/source-sdk-2013 ============//
+//
+// Purpose: Coarse cluster graph built on top of the AI node graph. Long routes
+//			are planned over clusters first, then refined over the nodes inside
+//			the resulting corridor.
+//
+//=============================================================================//
+
+#ifndef AI_NETWORK_CLUSTERS_H
+#define AI_NETWORK_CLUSTERS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "ai_hull.h"
+#include "utlvector.h"
+
+class CAI_Network;
+class CUtlBuffer;
+
+//-----------------------------------------------------------------------------
+// Connection between two neighbouring clusters. Costs are the shortest
+// hull-specific distance from one cluster's center node to the other's,
+// passing through the cheapest link (portal) that joins them.
+//-----------------------------------------------------------------------------
+struct AI_ClusterEdge_t
+{
+	short	iDestCluster;
+	byte	moveTypes[NUM_HULLS];	// Union of the move types accepted by the portal links, per hull
+	float	flCost[NUM_HULLS];		// FLT_MAX if the hull can't cross into the other cluster
+};
+
+//-----------------------------------------------------------------------------
+// CAI_NetworkClusters
+//-----------------------------------------------------------------------------
+class CAI_NetworkClusters
+{
+public:
+	CAI_NetworkClusters();
+
+	void	Build( CAI_Network *pNetwork );
+	void	Purge();
+
+	// Cluster data is appended to the .ain after the regular graph data.
+	// Loading fails without consuming anything if it isn't there.
+	void	Save( CUtlBuffer &buf ) const;
+	bool	Load( CUtlBuffer &buf, CAI_Network *pNetwork );
+
+	// False if the clusters don't match the network, e.g. nodes were added while editing
+	bool	IsValid( const CAI_Network *pNetwork ) const;
+
+	int		NumClusters() const					{ return m_Clusters.Count(); }
+	int		GetNodeCluster( int nodeID ) const	{ return m_NodeClusters[nodeID]; }
+	int		GetClusterCenterNode( int iCluster ) const	{ return m_Clusters[iCluster].iCenterNode; }
+
+	int		NumClusterEdges( int iCluster ) const	{ return m_Clusters[iCluster].nEdges; }
+	const AI_ClusterEdge_t &GetClusterEdge( int iCluster, int i ) const	{ return m_Edges[m_Clusters[iCluster].iFirstEdge + i]; }
+
+private:
+	void	BuildClusterMembership( CAI_Network *pNetwork );
+	void	BuildClusterEdges( CAI_Network *pNetwork );
+	void	ComputeCenterDistances( CAI_Network *pNetwork, int iCluster, Hull_t hull, float *pDistances );
+
+	struct AI_Cluster_t
+	{
+		int		iCenterNode;
+		int		iFirstEdge;
+		int		nEdges;
+	};
+
+	CUtlVector<short>				m_NodeClusters;		// Cluster each node belongs to
+	CUtlVector<AI_Cluster_t>		m_Clusters;
+	CUtlVector<AI_ClusterEdge_t>	m_Edges;			// Grouped by source cluster
+};
+
+#endif // AI_NETWORK_CLUSTERS_H
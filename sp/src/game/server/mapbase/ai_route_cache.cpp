@@ -0,0 +1,261 @@
+//========= Mapbase - https://github.com/mapbase-source/source-sdk-2013 ============//
+//
+// Purpose: Bounded LRU cache of node routes found by CAI_Pathfinder::FindBestPath,
+//			shared between NPCs that path between the same nodes the same way.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "ai_network.h"
+#include "mapbase/ai_route_cache.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar ai_route_cache_size( "ai_route_cache_size", "256", FCVAR_NONE, "The most node routes the AI route cache will hold before it starts discarding the least recently used ones." );
+
+//-----------------------------------------------------------------------------
+
+bool AI_RouteCacheKey_t::Less( const AI_RouteCacheKey_t &lhs, const AI_RouteCacheKey_t &rhs )
+{
+	if ( lhs.iStart != rhs.iStart )
+		return ( lhs.iStart < rhs.iStart );
+	if ( lhs.iEnd != rhs.iEnd )
+		return ( lhs.iEnd < rhs.iEnd );
+	if ( lhs.iHull != rhs.iHull )
+		return ( lhs.iHull < rhs.iHull );
+	if ( lhs.iCapabilities != rhs.iCapabilities )
+		return ( lhs.iCapabilities < rhs.iCapabilities );
+	return ( lhs.iszClass < rhs.iszClass );
+}
+
+//-----------------------------------------------------------------------------
+
+CAI_RouteCache::CAI_RouteCache()
+ :	m_Lookup( AI_RouteCacheKey_t::Less ),
+	m_iSerial( 0 ),
+	m_nRouteBuilds( 0 )
+{
+	ResetStats();
+}
+
+CAI_RouteCache::~CAI_RouteCache()
+{
+	FOR_EACH_LL( m_Entries, i )
+	{
+		delete [] m_Entries[i].pNodes;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+const int *CAI_RouteCache::Find( const AI_RouteCacheKey_t &key, int *pNumNodes )
+{
+	unsigned short iLookup = m_Lookup.Find( key );
+	if ( iLookup == m_Lookup.InvalidIndex() )
+	{
+		m_nMisses++;
+		return NULL;
+	}
+
+	unsigned short iEntry = m_Lookup[iLookup];
+	RouteCacheEntry_t &entry = m_Entries[iEntry];
+
+	// Locks run out on their own without an unlock, and the route may have gone around a node
+	// that was locked at the time, so it only holds until the first of those locks runs out
+	if ( gpGlobals->curtime >= entry.flExpireTime )
+	{
+		m_nLockInvalidated++;
+		m_nMisses++;
+		RemoveEntry( iEntry );
+		return NULL;
+	}
+
+	// Locked nodes are only avoided while they're locked, so a lock or unlock on any node
+	// the route passes through means the route might not be the one FindBestPath would pick
+	for ( int i = 0; i < entry.nNodes; i++ )
+	{
+		int iNode = entry.pNodes[i];
+		if ( iNode < m_NodeLockSerials.Count() && m_NodeLockSerials[iNode] > entry.iSerial )
+		{
+			m_nLockInvalidated++;
+			m_nMisses++;
+			RemoveEntry( iEntry );
+			return NULL;
+		}
+	}
+
+	m_Entries.Unlink( iEntry );
+	m_Entries.LinkToHead( iEntry );
+
+	m_nHits++;
+	*pNumNodes = entry.nNodes;
+	return entry.pNodes;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Add( const AI_RouteCacheKey_t &key, const int *pNodes, int nNodes )
+{
+	int nMaxEntries = ai_route_cache_size.GetInt();
+	if ( nMaxEntries <= 0 || nNodes <= 0 )
+		return;
+
+	unsigned short iLookup = m_Lookup.Find( key );
+	if ( iLookup != m_Lookup.InvalidIndex() )
+		RemoveEntry( m_Lookup[iLookup] );
+
+	while ( m_Entries.Count() >= nMaxEntries )
+	{
+		RemoveEntry( m_Entries.Tail() );
+		m_nEvicted++;
+	}
+
+	unsigned short iEntry = m_Entries.AddToHead();
+	RouteCacheEntry_t &entry = m_Entries[iEntry];
+	entry.key = key;
+	entry.pNodes = new int[nNodes];
+	entry.nNodes = nNodes;
+	entry.iSerial = m_iSerial;
+	entry.flExpireTime = GetNextUnlockTime();
+	memcpy( entry.pNodes, pNodes, nNodes * sizeof(int) );
+
+	m_Lookup.Insert( key, iEntry );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Reject( const AI_RouteCacheKey_t &key )
+{
+	unsigned short iLookup = m_Lookup.Find( key );
+	if ( iLookup == m_Lookup.InvalidIndex() )
+		return;
+
+	m_nRejected++;
+	RemoveEntry( m_Lookup[iLookup] );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::RemoveEntry( unsigned short iEntry )
+{
+	m_Lookup.Remove( m_Entries[iEntry].key );
+	delete [] m_Entries[iEntry].pNodes;
+	m_Entries.Remove( iEntry );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Flush()
+{
+	if ( m_Entries.Count() == 0 )
+		return;
+
+	FOR_EACH_LL( m_Entries, i )
+	{
+		delete [] m_Entries[i].pNodes;
+	}
+
+	m_Entries.RemoveAll();
+	m_Lookup.RemoveAll();
+	m_nFlushes++;
+}
+
+//-----------------------------------------------------------------------------
+
+float CAI_RouteCache::GetNextUnlockTime()
+{
+	float flNextUnlockTime = FLT_MAX;
+
+	FOR_EACH_VEC_BACK( m_LockedNodes, i )
+	{
+		if ( m_LockedNodes[i].flUnlockTime <= gpGlobals->curtime )
+		{
+			m_LockedNodes.FastRemove( i );
+			continue;
+		}
+
+		flNextUnlockTime = MIN( flNextUnlockTime, m_LockedNodes[i].flUnlockTime );
+	}
+
+	return flNextUnlockTime;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::OnNodeLockChanged( int iNode, float flUnlockTime )
+{
+	if ( m_nRouteBuilds > 0 )
+		return;
+
+	bool bWasLocked = false;
+	FOR_EACH_VEC( m_LockedNodes, i )
+	{
+		if ( m_LockedNodes[i].iNode == iNode )
+		{
+			bWasLocked = ( m_LockedNodes[i].flUnlockTime > gpGlobals->curtime );
+			m_LockedNodes.FastRemove( i );
+			break;
+		}
+	}
+
+	if ( flUnlockTime > gpGlobals->curtime )
+	{
+		LockedNode_t lockedNode = { iNode, flUnlockTime };
+		m_LockedNodes.AddToTail( lockedNode );
+	}
+	else if ( bWasLocked )
+	{
+		// Unlocked before its lock ran out. Routes found while it was locked went around it,
+		// so they aren't on it and can't be caught below - drop them all.
+		Flush();
+		return;
+	}
+
+	if ( m_Entries.Count() == 0 )
+		return;
+
+	int nOldCount = m_NodeLockSerials.Count();
+	if ( iNode >= nOldCount )
+	{
+		m_NodeLockSerials.EnsureCount( iNode + 1 );
+		for ( int i = nOldCount; i < m_NodeLockSerials.Count(); i++ )
+			m_NodeLockSerials[i] = 0;
+	}
+
+	m_NodeLockSerials[iNode] = ++m_iSerial;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::ReportStats() const
+{
+	int nLookups = m_nHits + m_nMisses;
+	Msg( "AI route cache: %d/%d routes\n", m_Entries.Count(), ai_route_cache_size.GetInt() );
+	Msg( "  %d lookups, %d hits (%.1f%%), %d misses\n", nLookups, m_nHits, ( nLookups ) ? 100.0f * m_nHits / nLookups : 0.0f, m_nMisses );
+	Msg( "  %d rejected by the NPC, %d invalidated by node locks\n", m_nRejected, m_nLockInvalidated );
+	Msg( "  %d evicted, %d flushes\n", m_nEvicted, m_nFlushes );
+}
+
+void CAI_RouteCache::ResetStats()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nRejected = 0;
+	m_nLockInvalidated = 0;
+	m_nEvicted = 0;
+	m_nFlushes = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ai_show_route_cache, "Prints AI route cache statistics. Pass \"reset\" to clear them afterwards." )
+{
+	if ( !g_pBigAINet )
+		return;
+
+	g_pBigAINet->GetRouteCache().ReportStats();
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+		g_pBigAINet->GetRouteCache().ResetStats();
+}
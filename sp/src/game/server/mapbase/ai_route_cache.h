@@ -0,0 +1,105 @@
+//========= Mapbase - https://github.com/mapbase-source/source-sdk-2013 ============//
+//
+// Purpose: Bounded LRU cache of node routes found by CAI_Pathfinder::FindBestPath,
+//			shared between NPCs that path between the same nodes the same way.
+//
+//=============================================================================//
+
+#ifndef AI_ROUTE_CACHE_H
+#define AI_ROUTE_CACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlmap.h"
+#include "utllinkedlist.h"
+
+//-----------------------------------------------------------------------------
+// Routes are only shared between NPCs of the same class with the same hull
+// and movement capabilities, since NPCs can override node and cost checks.
+//-----------------------------------------------------------------------------
+struct AI_RouteCacheKey_t
+{
+	AI_RouteCacheKey_t() {}
+	AI_RouteCacheKey_t( int start, int end, int hull, int capabilities, string_t iszClassname )
+	 :	iStart( start ), iEnd( end ), iHull( hull ), iCapabilities( capabilities ), iszClass( iszClassname )
+	{
+	}
+
+	static bool Less( const AI_RouteCacheKey_t &lhs, const AI_RouteCacheKey_t &rhs );
+
+	int			iStart;
+	int			iEnd;
+	int			iHull;
+	int			iCapabilities;
+	string_t	iszClass;
+};
+
+//-----------------------------------------------------------------------------
+// CAI_RouteCache
+//-----------------------------------------------------------------------------
+class CAI_RouteCache
+{
+public:
+	CAI_RouteCache();
+	~CAI_RouteCache();
+
+	// Returns the node IDs of the cached route from start to end, or NULL if there isn't one,
+	// one of its nodes has been locked or unlocked since it was added, or a lock that was
+	// active when it was added has run out. Unlocking a node early flushes everything.
+	const int *	Find( const AI_RouteCacheKey_t &key, int *pNumNodes );
+	void		Add( const AI_RouteCacheKey_t &key, const int *pNodes, int nNodes );
+
+	// The NPC couldn't use the route it was given
+	void		Reject( const AI_RouteCacheKey_t &key );
+
+	// Drops everything, e.g. when a dynamic link changes state
+	void		Flush();
+	void		OnNodeLockChanged( int iNode, float flUnlockTime );
+
+	// Locks the pathfinder places on nodes while turning a route into waypoints
+	// aren't changes to the network the route was found on
+	void		BeginRouteBuild()	{ m_nRouteBuilds++; }
+	void		EndRouteBuild()		{ m_nRouteBuilds--; }
+
+	void		ReportStats() const;
+	void		ResetStats();
+
+	int			Count() const	{ return m_Entries.Count(); }
+
+private:
+	struct RouteCacheEntry_t
+	{
+		AI_RouteCacheKey_t	key;
+		int *				pNodes;
+		int					nNodes;
+		int					iSerial;	// Value of m_iSerial when this was added
+		float				flExpireTime;	// When the first node lock active when this was added runs out
+	};
+
+	struct LockedNode_t
+	{
+		int					iNode;
+		float				flUnlockTime;
+	};
+
+	void		RemoveEntry( unsigned short iEntry );
+	float		GetNextUnlockTime();
+
+	CUtlLinkedList<RouteCacheEntry_t, unsigned short>	m_Entries;		// Most recently used at the head
+	CUtlMap<AI_RouteCacheKey_t, unsigned short>			m_Lookup;
+	CUtlVector<int>										m_NodeLockSerials;
+	int													m_iSerial;
+	CUtlVector<LockedNode_t>							m_LockedNodes;	// Nodes whose locks haven't run out yet
+	int													m_nRouteBuilds;
+
+	// Statistics for ai_show_route_cache
+	int			m_nHits;
+	int			m_nMisses;
+	int			m_nRejected;
+	int			m_nLockInvalidated;
+	int			m_nEvicted;
+	int			m_nFlushes;
+};
+
+#endif // AI_ROUTE_CACHE_H
@@ -35,6 +35,13 @@
 #include "team.h"
 #include "nav_entities.h"
 
+#ifdef MAPBASE
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
+
+extern ConVar nav_pathfind_parallel;
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -44,11 +51,19 @@ unsigned int CNavArea::m_nextID = 1;
 NavAreaVector TheNavAreas;
 
 unsigned int CNavArea::m_masterMarker = 1;
+#ifdef MAPBASE
+CUtlVector< CNavArea * > CNavArea::m_openHeap;
+unsigned int CNavArea::m_openSequenceCounter = 0;
+#else
 CNavArea *CNavArea::m_openList = NULL;
 CNavArea *CNavArea::m_openListTail = NULL;
+#endif
 
 bool CNavArea::m_isReset = false;
 uint32 CNavArea::s_nCurrVisTestCounter = 0;
+#ifdef MAPBASE
+CNavVisibilityTable CNavArea::s_visibilityTable;
+#endif
 
 ConVar nav_coplanar_slope_limit( "nav_coplanar_slope_limit", "0.99", FCVAR_CHEAT );
 ConVar nav_coplanar_slope_limit_displacement( "nav_coplanar_slope_limit_displacement", "0.7", FCVAR_CHEAT );
@@ -183,6 +198,10 @@ CNavArea::CNavArea( void )
 	m_nearNavSearchMarker = 0;
 	m_damagingTickCount = 0;
 	m_openMarker = 0;
+#ifdef MAPBASE
+	m_openHeapIndex = -1;
+	m_openSequence = 0;
+#endif
 
 	m_parent = NULL;
 	m_parentHow = GO_NORTH;
@@ -242,6 +261,9 @@ CNavArea::CNavArea( void )
 
 	m_inheritVisibilityFrom.area = NULL;
 	m_isInheritedFrom = false;
+#ifdef MAPBASE
+	m_visIndex = -1;
+#endif
 
 	m_funcNavCostVector.RemoveAll();
 }
@@ -534,6 +556,14 @@ CNavArea::~CNavArea()
 	if (m_isReset)
 		return;
 
+#ifdef MAPBASE
+	// queued path requests can't start or end here anymore
+	NavAbortPathRequests( this );
+
+	// the other areas keep their visibility of everything but us
+	s_visibilityTable.RemoveArea( this );
+
+#endif
 	// tell the other areas and ladders we are going away
 	AreaDestroyNotification notification( this );
 	TheNavMesh->ForAllAreas( notification );
@@ -3353,6 +3383,242 @@ void CNavArea::DrawConnectedAreas( void ) const
 }
 
 
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Heap order: cheapest total cost first, and among equal costs whoever was opened first,
+ * which is the order the sorted list used to give.
+ */
+inline bool CNavArea::IsCheaperThan( const CNavArea *other ) const
+{
+	if ( m_totalCost != other->m_totalCost )
+		return m_totalCost < other->m_totalCost;
+
+	return (int)( m_openSequence - other->m_openSequence ) < 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavArea::OpenHeapSiftUp( int index )
+{
+	CNavArea *area = m_openHeap[ index ];
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) >> 1;
+		if ( !area->IsCheaperThan( m_openHeap[ parent ] ) )
+			break;
+
+		m_openHeap[ index ] = m_openHeap[ parent ];
+		m_openHeap[ index ]->m_openHeapIndex = index;
+		index = parent;
+	}
+
+	m_openHeap[ index ] = area;
+	area->m_openHeapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavArea::OpenHeapSiftDown( int index )
+{
+	int count = m_openHeap.Count();
+	CNavArea *area = m_openHeap[ index ];
+	for( ;; )
+	{
+		int child = ( index << 1 ) + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && m_openHeap[ child + 1 ]->IsCheaperThan( m_openHeap[ child ] ) )
+			++child;
+
+		if ( !m_openHeap[ child ]->IsCheaperThan( area ) )
+			break;
+
+		m_openHeap[ index ] = m_openHeap[ child ];
+		m_openHeap[ index ]->m_openHeapIndex = index;
+		index = child;
+	}
+
+	m_openHeap[ index ] = area;
+	area->m_openHeapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add to open list in decreasing value order
+ */
+void CNavArea::AddToOpenList( void )
+{
+	if ( IsOpen() )
+	{
+		// already on list
+		return;
+	}
+
+	// mark as being on open list for quick check
+	m_openMarker = m_masterMarker;
+	m_openSequence = m_openSequenceCounter++;
+
+	Assert ( m_totalCost >= 0.0f );
+	m_openHeapIndex = m_openHeap.AddToTail( this );
+	OpenHeapSiftUp( m_openHeapIndex );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller value has been found, update this area on the open list
+ */
+void CNavArea::UpdateOnOpenList( void )
+{
+	Assert( IsOpen() && m_openHeap[ m_openHeapIndex ] == this );
+
+	// since value can only decrease, bubble this area up from current spot
+	OpenHeapSiftUp( m_openHeapIndex );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavArea::RemoveFromOpenList( void )
+{
+	if ( !IsOpen() )
+	{
+		// not on the list
+		return;
+	}
+
+	Assert( m_openHeap[ m_openHeapIndex ] == this );
+
+	// move the last area into our slot and let it find its place from there
+	int index = m_openHeapIndex;
+	int last = m_openHeap.Count() - 1;
+	if ( index != last )
+	{
+		CNavArea *lastArea = m_openHeap[ last ];
+		m_openHeap[ index ] = lastArea;
+		lastArea->m_openHeapIndex = index;
+		m_openHeap.RemoveMultipleFromTail( 1 );
+
+		OpenHeapSiftUp( index );
+		OpenHeapSiftDown( lastArea->m_openHeapIndex );
+	}
+	else
+	{
+		m_openHeap.RemoveMultipleFromTail( 1 );
+	}
+
+	// zero is an invalid marker
+	m_openMarker = 0;
+	m_openHeapIndex = -1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Clears the open and closed lists for a new search
+ */
+void CNavArea::ClearSearchLists( void )
+{
+	// a new marker leaves every area's open/closed state from the last search stale, so
+	// nothing has to be visited - only the heap itself needs emptying
+	CNavArea::MakeNewMarker();
+
+	m_openHeap.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void BenchPathfindCallback( const NavPathResult_t &result, void *userData )
+{
+	*(int *)userData = result.found ? result.areas.Count() : -1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time NavAreaBuildPath between random pairs of areas on the loaded mesh, one at a time on the
+ * main thread and then all at once as async requests
+ */
+CON_COMMAND_F( nav_bench_pathfind, "Times A* searches between random pairs of nav areas. Format: nav_bench_pathfind <queries> <seed>", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int areaCount = TheNavAreas.Count();
+	if ( areaCount < 2 )
+	{
+		Msg( "nav_bench_pathfind: No nav mesh loaded\n" );
+		return;
+	}
+
+	int queryCount = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 1000;
+	int seed = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0;
+
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( seed );
+
+	// pick all the pairs up front so only the searches get timed
+	CUtlVector< CNavArea * > endpoints;
+	endpoints.SetCount( queryCount * 2 );
+	FOR_EACH_VEC( endpoints, i )
+	{
+		endpoints[i] = TheNavAreas[ randomStream.RandomInt( 0, areaCount - 1 ) ];
+	}
+
+	// areas on each path, -1 if there wasn't one
+	CUtlVector< int > pathLengths, asyncPathLengths;
+	pathLengths.SetCount( queryCount );
+	asyncPathLengths.SetCount( queryCount );
+
+	int foundCount = 0;
+	int pathAreaCount = 0;
+	ShortestPathCost cost;
+
+	CFastTimer timer;
+	timer.Start();
+
+	for( int i=0; i<queryCount; ++i )
+	{
+		CNavArea *goalArea = endpoints[ i*2 + 1 ];
+		pathLengths[i] = -1;
+		if ( NavAreaBuildPath( endpoints[ i*2 ], goalArea, NULL, cost ) )
+		{
+			++foundCount;
+
+			// walk it now, the next search overwrites the parent pointers
+			pathLengths[i] = 0;
+			for( CNavArea *area = goalArea; area; area = area->GetParent() )
+			{
+				++pathLengths[i];
+			}
+			pathAreaCount += pathLengths[i];
+		}
+	}
+
+	timer.End();
+
+	float seconds = timer.GetDuration().GetSeconds();
+	Msg( "nav_bench_pathfind: %d queries on %d areas (seed %d): %d found, %.1f areas per path\n",
+		queryCount, areaCount, seed, foundCount, foundCount ? (float)pathAreaCount / foundCount : 0.0f );
+	Msg( "  main thread: %.2f ms total, %.0f queries/sec\n", seconds * 1000.0f, ( seconds > 0.0f ) ? queryCount / seconds : 0.0f );
+
+	// anything else waiting gets run (and timed) along with these
+	for( int i=0; i<queryCount; ++i )
+	{
+		NavAreaBuildPathAsync( endpoints[ i*2 ], endpoints[ i*2 + 1 ], NULL, cost, BenchPathfindCallback, &asyncPathLengths[i] );
+	}
+
+	timer.Start();
+	NavRunPathRequests();
+	timer.End();
+
+	int mismatchCount = 0;
+	for( int i=0; i<queryCount; ++i )
+	{
+		if ( asyncPathLengths[i] != pathLengths[i] )
+			++mismatchCount;
+	}
+
+	seconds = timer.GetDuration().GetSeconds();
+	Msg( "  async (%s): %.2f ms total, %.0f queries/sec, %d paths differ from the main thread's\n",
+		nav_pathfind_parallel.GetBool() ? "parallel" : "serial", seconds * 1000.0f, ( seconds > 0.0f ) ? queryCount / seconds : 0.0f, mismatchCount );
+}
+#else
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Add to open list in decreasing value order
@@ -3553,6 +3819,7 @@ void CNavArea::ClearSearchLists( void )
 	m_openList = NULL;
 	m_openListTail = NULL;
 }
+#endif
 
 //--------------------------------------------------------------------------------------------------------------
 void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
@@ -5252,7 +5519,22 @@ CUtlHash< NavVisPair_t, CVisPairHashFuncs, CVisPairHashFuncs > *g_pNavVisPairHas
 void CNavArea::SetupPVS( void ) const
 {
 	m_nPVSSize = sizeof( m_PVS );
+#ifdef MAPBASE
+	SetupPVS( m_PVS, m_nPVSSize );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Set the given PVS to include everything seen from anywhere within this nav area.
+ * Uses the engine's PVS state, so this has to run on the main thread.
+ */
+void CNavArea::SetupPVS( byte *pvs, int pvsSize ) const
+{
+	engine->ResetPVS( pvs, pvsSize );
+#else
 	engine->ResetPVS( m_PVS, m_nPVSSize );
+#endif
 
 	const float margin = GenerationStepSize/2.0f;
 	Vector eye( 0, 0, 0.75f * HumanHeight );
@@ -5303,6 +5585,28 @@ bool CNavArea::IsInPVS( void ) const
  */
 CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS, bool *pOutsidePVS ) const
 {
+#ifdef MAPBASE
+	if ( !isPVSValid )
+	{
+		// don't bother setting up the PVS if it's too far away to be visible anyway
+		if ( nav_max_view_distance.GetFloat() > 0.00001f && area->GetCenter().DistToSqr( GetCenter() ) > Sqr( nav_max_view_distance.GetFloat() ) )
+			return NOT_VISIBLE;
+
+		SetupPVS();
+	}
+
+	return ComputeVisibilityInPVS( area, bCheckPVS ? m_PVS : NULL, m_nPVSSize, pOutsidePVS );
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Do actual line-of-sight traces to determine if any part of given area is visible from this area,
+ * rejecting it up front if it isn't in 'pvs'
+ */
+CNavArea::VisibilityType CNavArea::ComputeVisibilityInPVS( const CNavArea *area, const byte *pvs, int pvsSize, bool *pOutsidePVS ) const
+{
+#endif
 	float distanceSq = area->GetCenter().DistToSqr( GetCenter() );
 
 	if ( nav_max_view_distance.GetFloat() > 0.00001f )
@@ -5315,14 +5619,20 @@ CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool
 		}
 	}
 
+#ifndef MAPBASE
 	if ( !isPVSValid )
 	{
 		SetupPVS();
 	}
+#endif
 
 	Vector eye( 0, 0, 0.75f * HumanHeight );
 
+#ifdef MAPBASE
+	if ( pvs )
+#else
 	if ( bCheckPVS )
+#endif
 	{
 		Extent areaExtent;
 		areaExtent.lo = areaExtent.hi = area->GetCenter() + eye;
@@ -5330,7 +5640,11 @@ CNavArea::VisibilityType CNavArea::ComputeVisibility( const CNavArea *area, bool
 		areaExtent.Encompass( area->GetCorner( NORTH_EAST ) + eye );
 		areaExtent.Encompass( area->GetCorner( SOUTH_WEST ) + eye );
 		areaExtent.Encompass( area->GetCorner( SOUTH_EAST ) + eye );
+#ifdef MAPBASE
+		if ( !engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, pvs, pvsSize ) )
+#else
 		if ( !engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, m_PVS, m_nPVSSize ) )
+#endif
 		{
 			if ( pOutsidePVS )
 				*pOutsidePVS = true;
@@ -5578,6 +5892,10 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
  */
 void CNavArea::ComputeVisibilityToMesh( void )
 {
+#ifdef MAPBASE
+	CNavArea *area = this;
+	ComputeVisibilityToMesh( &area, 1 );
+#else
 	m_inheritVisibilityFrom.area = NULL;
 	m_isInheritedFrom = false;
 
@@ -5623,9 +5941,140 @@ void CNavArea::ComputeVisibilityToMesh( void )
 		Assert( g_pNavVisPairHash->Find( visPair ) == g_pNavVisPairHash->InvalidHandle() );
 		g_pNavVisPairHash->Insert( visPair );
 	}
+#endif
 }
 
 
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------
+// A pair of areas whose visibility to each other is computed on the thread pool
+struct NavVisPairJob_t
+{
+	CNavArea *area;
+	CNavArea *other;
+	const byte *pvs;							// PVS seen from 'area'
+	int pvsSize;
+
+	CNavArea::VisibilityType visThisToOther;	// stored on 'area'
+	CNavArea::VisibilityType visOtherToThis;	// stored on 'other'
+};
+
+//--------------------------------------------------------------------------------------------------------
+static void ComputeVisPairJob( NavVisPairJob_t &job )
+{
+	job.visThisToOther = ( job.other == job.area ) ? CNavArea::COMPLETELY_VISIBLE : CNavArea::NOT_VISIBLE;
+	job.visOtherToThis = CNavArea::NOT_VISIBLE;
+
+	if ( job.other == job.area )
+		return;
+
+	bool bOutsidePVS = false;
+
+	job.visOtherToThis = job.area->ComputeVisibilityInPVS( job.other, job.pvs, job.pvsSize, &bOutsidePVS );
+
+	if ( !bOutsidePVS && ( job.visOtherToThis || ( job.area->GetCenter() - job.other->GetCenter() ).LengthSqr() < Sqr( nav_max_view_distance.GetFloat() ) ) )
+	{
+		job.visThisToOther = job.other->ComputeVisibilityInPVS( job.area, NULL, 0 );
+	}
+
+	if ( !job.visOtherToThis && job.visThisToOther )
+	{
+		job.visOtherToThis = CNavArea::POTENTIALLY_VISIBLE;
+	}
+
+	if ( !job.visThisToOther && job.visOtherToThis )
+	{
+		job.visThisToOther = CNavArea::POTENTIALLY_VISIBLE;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Compute visibility to the mesh for a run of areas at once. The pairs are picked on this thread in
+ * the same order ComputeVisibilityToMesh() would pick them one area at a time, all of their traces
+ * run on the thread pool, then the results are stored in pair order - so the visibility lists come
+ * out the same however many threads there are or however the areas are batched.
+ * Returns the number of area pairs checked.
+ */
+int CNavArea::ComputeVisibilityToMesh( CNavArea **areas, int count )
+{
+	float radius = nav_max_view_distance.GetFloat();
+	if ( radius == 0.0f )
+	{
+		radius = DEF_NAV_VIEW_DISTANCE;
+	}
+
+	// each area gets its own PVS so they can all be checked at once
+	const int pvsSize = sizeof( m_PVS );
+	CUtlVector< byte > pvsBuffer;
+	pvsBuffer.SetCount( count * pvsSize );
+
+	CUtlVector< NavVisPairJob_t > jobs;
+	jobs.EnsureCapacity( count * 256 );
+
+	NavAreaCollector collector;
+	collector.m_area.EnsureCapacity( 1000 );
+
+	NavVisPair_t visPair;
+
+	for( int a=0; a<count; ++a )
+	{
+		CNavArea *area = areas[a];
+
+		area->m_inheritVisibilityFrom.area = NULL;
+		area->m_isInheritedFrom = false;
+
+		// collect all possible nav areas that could be visible from this area
+		collector.m_area.RemoveAll();
+		TheNavMesh->ForAllAreasInRadius( collector, area->GetCenter(), radius );
+
+		byte *pvs = &pvsBuffer[ a * pvsSize ];
+		area->SetupPVS( pvs, pvsSize );
+
+		FOR_EACH_VEC( collector.m_area, it )
+		{
+			// skip pairs an earlier area already took care of
+			visPair.SetPair( area, collector.m_area[it] );
+			if ( g_pNavVisPairHash->Find( visPair ) != g_pNavVisPairHash->InvalidHandle() )
+				continue;
+
+			g_pNavVisPairHash->Insert( visPair );
+
+			NavVisPairJob_t &job = jobs[ jobs.AddToTail() ];
+			job.area = area;
+			job.other = collector.m_area[it];
+			job.pvs = pvs;
+			job.pvsSize = pvsSize;
+		}
+	}
+
+	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", jobs.Base(), jobs.Count(), &ComputeVisPairJob );
+
+	AreaBindInfo info;
+	FOR_EACH_VEC( jobs, it )
+	{
+		const NavVisPairJob_t &job = jobs[it];
+
+		if ( job.visThisToOther != NOT_VISIBLE )
+		{
+			info.area = job.other;
+			info.attributes = job.visThisToOther;
+			job.area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		if ( job.visOtherToThis != NOT_VISIBLE )
+		{
+			info.area = job.area;
+			info.attributes = job.visOtherToThis;
+			job.other->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+	}
+
+	return jobs.Count();
+}
+#endif
+
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * The center and all four corners must ALL be visible
@@ -5721,6 +6170,14 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+#ifdef MAPBASE
+	if ( IsInVisibilityTable() )
+	{
+		// the table has our inherited visibility resolved already
+		return viewedArea->IsInVisibilityTable() && s_visibilityTable.GetVisibility( m_visIndex, viewedArea->m_visIndex ) != NOT_VISIBLE;
+	}
+
+#endif
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5766,6 +6223,14 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+#ifdef MAPBASE
+	if ( IsInVisibilityTable() )
+	{
+		// the table has our inherited visibility resolved already
+		return viewedArea->IsInVisibilityTable() && ( s_visibilityTable.GetVisibility( m_visIndex, viewedArea->m_visIndex ) & COMPLETELY_VISIBLE ) != 0;
+	}
+
+#endif
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5802,6 +6267,17 @@ bool CNavArea::IsPotentiallyVisibleToTeam( int teamIndex ) const
 {
 	VPROF_BUDGET( "CNavArea::IsPotentiallyVisibleToTeam", "NextBot" );
 
+#ifdef MAPBASE
+	if ( IsInVisibilityTable() )
+	{
+		const CVarBitVec *visible = GetVisibleToTeam( teamIndex, false );
+		if ( visible )
+		{
+			return visible->IsBitSet( m_visIndex );
+		}
+	}
+
+#endif
 	CTeam *team = GetGlobalTeam( teamIndex );
 
 	for( int i = 0; i < team->GetNumPlayers(); ++i )
@@ -5829,6 +6305,17 @@ bool CNavArea::IsCompletelyVisibleToTeam( int teamIndex ) const
 {
 	VPROF_BUDGET( "CNavArea::IsCompletelyVisibleToTeam", "NextBot" );
 
+#ifdef MAPBASE
+	if ( IsInVisibilityTable() )
+	{
+		const CVarBitVec *visible = GetVisibleToTeam( teamIndex, true );
+		if ( visible )
+		{
+			return visible->IsBitSet( m_visIndex );
+		}
+	}
+
+#endif
 	CTeam *team = GetGlobalTeam( teamIndex );
 
 	for( int i = 0; i < team->GetNumPlayers(); ++i )
@@ -5848,6 +6335,96 @@ bool CNavArea::IsCompletelyVisibleToTeam( int teamIndex ) const
 }
 
 
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------
+struct NavTeamVisibility_t
+{
+	int tickcount;
+	unsigned int generation;
+	CVarBitVec potentially;
+	CVarBitVec completely;
+};
+
+static NavTeamVisibility_t s_teamVisibility[ MAX_TEAMS ];
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Return the set of areas potentially (or completely) visible to anyone on the given team.
+ * It's the union of the visibility table rows of the areas the team's players are in, OR'd
+ * together a word at a time once per tick, so checking an area against it is one bit test.
+ */
+const CVarBitVec *CNavArea::GetVisibleToTeam( int teamIndex, bool completely )
+{
+	if ( teamIndex < 0 || teamIndex >= MAX_TEAMS || !s_visibilityTable.IsBuilt() )
+		return NULL;
+
+	NavTeamVisibility_t &visibility = s_teamVisibility[ teamIndex ];
+
+	if ( visibility.tickcount != gpGlobals->tickcount || visibility.generation != s_visibilityTable.GetGeneration() || 
+		 visibility.potentially.GetNumBits() != s_visibilityTable.GetAreaCount() )
+	{
+		visibility.tickcount = gpGlobals->tickcount;
+		visibility.generation = s_visibilityTable.GetGeneration();
+		visibility.potentially.Resize( s_visibilityTable.GetAreaCount(), true );
+		visibility.completely.Resize( s_visibilityTable.GetAreaCount(), true );
+
+		CTeam *team = GetGlobalTeam( teamIndex );
+
+		for( int i = 0; team && i < team->GetNumPlayers(); ++i )
+		{
+			if ( team->GetPlayer(i)->IsAlive() )
+			{
+				CNavArea *from = (CNavArea *)team->GetPlayer(i)->GetLastKnownArea();
+
+				// areas made since the table was built can't see anything
+				if ( from && from->IsInVisibilityTable() )
+				{
+					s_visibilityTable.AddRowToSets( from->m_visIndex, &visibility.potentially, &visibility.completely );
+
+					// can always see ourselves
+					visibility.potentially.Set( from->m_visIndex );
+					visibility.completely.Set( from->m_visIndex );
+				}
+			}
+		}
+	}
+
+	return ( completely ) ? &visibility.completely : &visibility.potentially;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Return the visibility list the .nav file stores for us - from the visibility table once our list
+ * has been resolved into it, as a delta from the area we inherit visibility from.
+ */
+void CNavArea::GetPotentiallyVisibleAreaList( CUtlVector< AreaBindInfo > *list ) const
+{
+	list->RemoveAll();
+
+	if ( !IsInVisibilityTable() )
+	{
+		list->AddMultipleToTail( m_potentiallyVisibleAreas.Count(), m_potentiallyVisibleAreas.Base() );
+		return;
+	}
+
+	const CNavArea *anchor = m_inheritVisibilityFrom.area;
+	int anchorIndex = ( anchor && anchor->IsInVisibilityTable() ) ? anchor->m_visIndex : -1;
+
+	CUtlVector< NavVisibilityEntry_t > entries;
+	s_visibilityTable.GetSaveList( m_visIndex, anchorIndex, &entries );
+
+	list->EnsureCapacity( entries.Count() );
+	FOR_EACH_VEC( entries, it )
+	{
+		AreaBindInfo &info = (*list)[ list->AddToTail() ];
+		info.area = s_visibilityTable.GetArea( entries[ it ].index );
+		info.attributes = entries[ it ].attributes;
+	}
+}
+#endif
+
+
 //--------------------------------------------------------------------------------------------------------
 Vector CNavArea::GetRandomPoint( void ) const
 {
@@ -14,6 +14,7 @@
 
 #include "nav_ladder.h"
 #include "tier1/memstack.h"
+#include "nav_visibility.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
 enum { MAX_NAV_TEAMS = 2 };
@@ -225,7 +226,12 @@ protected:
 	/* 60 */	float m_totalCost;											// the distance so far plus an estimate of the distance left
 	/* 64 */	float m_costSoFar;											// distance travelled so far
 
+#ifdef MAPBASE
+	/* 68 */	int m_openHeapIndex;										// where we are in m_openHeap, only valid if m_openMarker == m_masterMarker
+	/* 72 */	unsigned int m_openSequence;								// when we were put on the open list, so equal costs come off it first-in first-out
+#else
 	/* 68 */	CNavArea *m_nextOpen, *m_prevOpen;							// only valid if m_openMarker == m_masterMarker
+#endif
 	/* 76 */	unsigned int m_openMarker;									// if this equals the current marker value, we are on the open list
 
 	/* 80 */	int	m_attributeFlags;										// set of attribute bit flags (see NavAttributeType)
@@ -433,7 +439,9 @@ public:
 
 	bool IsOpen( void ) const;									// true if on "open list"
 	void AddToOpenList( void );									// add to open list in decreasing value order
+#ifndef MAPBASE
 	void AddToOpenListTail( void );								// add to tail of the open list
+#endif
 	void UpdateOnOpenList( void );								// a smaller value has been found, update this area on the open list
 	void RemoveFromOpenList( void );
 	static bool IsOpenListEmpty( void );
@@ -496,6 +504,10 @@ public:
 	};
 
 	VisibilityType ComputeVisibility( const CNavArea *area, bool isPVSValid, bool bCheckPVS = true, bool *pOutsidePVS = NULL ) const;	// do actual line-of-sight traces to determine if any part of given area is visible from this area
+#ifdef MAPBASE
+	VisibilityType ComputeVisibilityInPVS( const CNavArea *area, const byte *pvs, int pvsSize, bool *pOutsidePVS = NULL ) const;	// as ComputeVisibility(), checking against the given PVS (or none if NULL) - safe to call from any thread
+	void SetupPVS( byte *pvs, int pvsSize ) const;				// fill in the given PVS instead of the shared one
+#endif
 	void SetupPVS( void ) const;
 	bool IsInPVS( void ) const;					// return true if this area is within the current PVS
 
@@ -532,6 +544,13 @@ public:
 	template < typename Functor >
 	bool ForAllPotentiallyVisibleAreas( Functor &func )
 	{
+#ifdef MAPBASE
+		if ( IsInVisibilityTable() )
+		{
+			return s_visibilityTable.ForEachVisibleArea( m_visIndex, false, func );
+		}
+
+#endif
 		int i;
 
 		++s_nCurrVisTestCounter;
@@ -589,6 +608,13 @@ public:
 	template < typename Functor >
 	bool ForAllCompletelyVisibleAreas( Functor &func )
 	{
+#ifdef MAPBASE
+		if ( IsInVisibilityTable() )
+		{
+			return s_visibilityTable.ForEachVisibleArea( m_visIndex, true, func );
+		}
+
+#endif
 		int i;
 
 		++s_nCurrVisTestCounter;
@@ -643,6 +669,9 @@ private:
 	friend class CNavMesh;
 	friend class CNavLadder;
 	friend class CCSNavArea;									// allow CS load code to complete replace our default load behavior
+#ifdef MAPBASE
+	friend class CNavVisibilityTable;
+#endif
 
 	static bool m_isReset;										// if true, don't bother cleaning up in destructor since everything is going away
 
@@ -704,8 +733,19 @@ private:
 	//- A* pathfinding algorithm ------------------------------------------------------------------------
 	static unsigned int m_masterMarker;
 
+#ifdef MAPBASE
+	// The open list is a binary min-heap on total cost, so adding an area and lowering its
+	// cost are O(log n) instead of a walk along a sorted list. Areas know their own index.
+	static CUtlVector< CNavArea * > m_openHeap;
+	static unsigned int m_openSequenceCounter;
+
+	bool IsCheaperThan( const CNavArea *other ) const;
+	static void OpenHeapSiftUp( int index );
+	static void OpenHeapSiftDown( int index );
+#else
 	static CNavArea *m_openList;
 	static CNavArea *m_openListTail;
+#endif
 
 	//- connections to adjacent areas -------------------------------------------------------------------
 	NavConnectVector m_incomingConnect[ NUM_DIRECTIONS ];		// a list of adjacent areas for each direction that connect TO us, but we have no connection back to them
@@ -737,6 +777,9 @@ private:
 
 	//- visibility --------------------------------------------------------------------------------------
 	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
+#ifdef MAPBASE
+	static int ComputeVisibilityToMesh( CNavArea **areas, int count );	// same as calling ComputeVisibilityToMesh() on each in order, with the traces run on the thread pool
+#endif
 	void ResetPotentiallyVisibleAreas();
 	static void ComputeVisToArea( CNavArea *&pOtherArea );
 
@@ -755,6 +798,16 @@ private:
 	uint32 m_nVisTestCounter;
 	static uint32 s_nCurrVisTestCounter;
 
+#ifdef MAPBASE
+	// Once the mesh is loaded or analyzed, the visibility lists are resolved into this table and freed
+	static CNavVisibilityTable s_visibilityTable;
+	int m_visIndex;												// our row and column in s_visibilityTable
+
+	bool IsInVisibilityTable( void ) const						{ return s_visibilityTable.GetArea( m_visIndex ) == this; }
+	void GetPotentiallyVisibleAreaList( CUtlVector< AreaBindInfo > *list ) const;	// the visibility list the .nav file stores for us
+	static const CVarBitVec *GetVisibleToTeam( int teamIndex, bool completely );	// areas visible to the given team's players, NULL if they can't be tracked
+#endif
+
 	CUtlVector< CHandle< CFuncNavCost > > m_funcNavCostVector;	// active, overlapping cost entities
 };
 
@@ -830,6 +883,24 @@ inline bool CNavArea::IsOpen( void ) const
 	return (m_openMarker == m_masterMarker) ? true : false;
 }
 
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavArea::IsOpenListEmpty( void )
+{
+	return m_openHeap.Count() == 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::PopOpenList( void )
+{
+	if ( m_openHeap.Count() == 0 )
+		return NULL;
+
+	CNavArea *area = m_openHeap[0];
+	area->RemoveFromOpenList();
+	return area;
+}
+#else
 //--------------------------------------------------------------------------------------------------------------
 inline bool CNavArea::IsOpenListEmpty( void )
 {
@@ -860,6 +931,7 @@ inline CNavArea *CNavArea::PopOpenList( void )
 
 	return NULL;
 }
+#endif
 
 //--------------------------------------------------------------------------------------------------------------
 inline bool CNavArea::IsClosed( void ) const
@@ -181,6 +181,149 @@ PlaceDirectory placeDirectory;
 	#define FORMAT_NAVFILE "maps\\%s.nav"
 #endif
 
+#ifdef MAPBASE
+#define FORMAT_NAVCOMPACTFILE FORMAT_NAVFILE "c"
+
+//--------------------------------------------------------------------------------------------------------------
+//
+// The compact nav file (.navc) holds the mesh as it was loaded from the .nav file, laid out so it can
+// be loaded without parsing. Each kind of data is a flat array of fixed size records in its own
+// section, found by its offset from the start of the file, and records refer to areas, hiding spots
+// and ladders by their index in those arrays rather than by ID. Loading it is one read of the file,
+// then each record is copied into its object and each index is turned into a pointer - there are no
+// ID lookups and the grid cells are stored already filled in.
+//
+// It's written in the byte order of the machine that wrote it and is only used while the .nav it
+// came from has the same size and time stamp, so it's a cache rather than a distributable format.
+// Meshes from derived classes with their own sub-version data always load from the .nav.
+//
+#define NAV_COMPACT_MAGIC_NUMBER 0xFEEDC0DE
+
+/// The current version of the compact nav file format
+const unsigned int NavCompactVersion = 1;
+
+const unsigned int NavCompactInvalidIndex = 0xFFFFFFFF;
+
+ConVar nav_compact_load( "nav_compact_load", "0", FCVAR_GAMEDLL, "Load the nav mesh from a compact .navc file next to the .nav file, writing one after loading the .nav file if there isn't an up to date one." );
+
+enum NavCompactSectionType
+{
+	NAV_COMPACT_PLACES,				// NUL-terminated place names (count is in bytes)
+	NAV_COMPACT_AREAS,				// NavCompactArea_t
+	NAV_COMPACT_CONNECTIONS,		// uint32 area index
+	NAV_COMPACT_HIDING_SPOTS,		// NavCompactHidingSpot_t
+	NAV_COMPACT_ENCOUNTERS,			// NavCompactEncounter_t
+	NAV_COMPACT_ENCOUNTER_SPOTS,	// NavCompactSpotOrder_t
+	NAV_COMPACT_LADDER_CONNECTIONS,	// uint32 ladder index
+	NAV_COMPACT_VISIBILITY,			// NavCompactVisibility_t
+	NAV_COMPACT_LADDERS,			// ladders as CNavLadder::Save() writes them (count is in bytes)
+	NAV_COMPACT_GRID_CELLS,			// uint32 index of each grid cell's first area in NAV_COMPACT_GRID_AREAS, then the total
+	NAV_COMPACT_GRID_AREAS,			// uint32 area index
+
+	NAV_COMPACT_SECTION_COUNT
+};
+
+struct NavCompactSection_t
+{
+	uint32 offset;					// from the start of the file
+	uint32 count;
+};
+
+struct NavCompactRange_t
+{
+	uint32 first;
+	uint32 count;
+};
+
+struct NavCompactHeader_t
+{
+	uint32 magic;
+	uint32 version;
+	uint32 navVersion;				// version of the .nav file the mesh was loaded from
+	uint32 navFileSize;				// size and time stamp of the .nav file, to tell when it changes
+	uint32 navFileTime;
+	uint32 bspSize;					// size of the bsp the .nav file was built from
+	uint32 isAnalyzed;
+	uint32 placeCount;
+	uint32 ladderCount;
+
+	float gridCellSize;
+	float gridMinX;
+	float gridMinY;
+	int32 gridSizeX;
+	int32 gridSizeY;
+
+	NavCompactSection_t section[ NAV_COMPACT_SECTION_COUNT ];
+};
+
+struct NavCompactArea_t
+{
+	uint32 id;
+	int32 attributeFlags;
+	float nwCorner[3];
+	float seCorner[3];
+	float neZ;
+	float swZ;
+	float earliestOccupyTime[ MAX_NAV_TEAMS ];
+	float lightIntensity[ NUM_CORNERS ];
+	uint32 place;					// index into the place names plus one, 0 for none
+	uint32 inheritVisibilityFrom;	// area index
+
+	NavCompactRange_t connect[ NUM_DIRECTIONS ];
+	NavCompactRange_t hidingSpots;
+	NavCompactRange_t encounters;
+	NavCompactRange_t ladder[ CNavLadder::NUM_LADDER_DIRECTIONS ];
+	NavCompactRange_t visibility;
+};
+
+struct NavCompactHidingSpot_t
+{
+	uint32 id;
+	float pos[3];
+	uint32 flags;
+};
+
+struct NavCompactEncounter_t
+{
+	uint32 from;					// area index
+	uint32 fromDir;
+	uint32 to;						// area index
+	uint32 toDir;
+	NavCompactRange_t spots;
+};
+
+struct NavCompactSpotOrder_t
+{
+	uint32 spot;					// hiding spot index
+	float t;
+};
+
+struct NavCompactVisibility_t
+{
+	uint32 area;					// area index
+	uint32 attributes;
+};
+
+// Set while the areas loaded from a compact file are post-loaded, since their references are already pointers
+static bool s_navAreasPreBound = false;
+
+// What the last .nav file loaded had in its header, for writing the compact file
+static unsigned int s_loadedNavVersion = 0;
+static unsigned int s_loadedNavBspSize = 0;
+
+// Lets nav_compare_load pick which file CNavMesh::Load() uses, whatever nav_compact_load is set to
+enum NavLoadFormat
+{
+	NAV_LOAD_DEFAULT,
+	NAV_LOAD_CLASSIC,
+	NAV_LOAD_COMPACT
+};
+static NavLoadFormat s_navLoadFormat = NAV_LOAD_DEFAULT;
+
+// Whether the last CNavMesh::Load() got the mesh from the compact file
+static bool s_navLoadedCompact = false;
+#endif
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Replace extension with "bsp"
@@ -363,17 +506,23 @@ void CNavArea::Save( CUtlBuffer &fileBuffer, unsigned int version ) const
 	}
 
 	// save visible area set
-	unsigned int visibleAreaCount = m_potentiallyVisibleAreas.Count();
+#ifdef MAPBASE
+	CUtlVector< AreaBindInfo > potentiallyVisibleAreas;
+	GetPotentiallyVisibleAreaList( &potentiallyVisibleAreas );
+#else
+	const CAreaBindInfoArray &potentiallyVisibleAreas = m_potentiallyVisibleAreas;
+#endif
+	unsigned int visibleAreaCount = potentiallyVisibleAreas.Count();
 	fileBuffer.PutUnsignedInt( visibleAreaCount );
 
-	for ( int vit=0; vit<m_potentiallyVisibleAreas.Count(); ++vit )
+	for ( int vit=0; vit<potentiallyVisibleAreas.Count(); ++vit )
 	{
-		CNavArea *area = m_potentiallyVisibleAreas[ vit ].area;
+		CNavArea *area = potentiallyVisibleAreas[ vit ].area;
 
 		unsigned int id = area ? area->GetID() : 0;
 
 		fileBuffer.PutUnsignedInt( id );
-		fileBuffer.PutUnsignedChar( m_potentiallyVisibleAreas[ vit ].attributes );
+		fileBuffer.PutUnsignedChar( potentiallyVisibleAreas[ vit ].attributes );
 	}
 
 	// store area we inherit visibility from
@@ -680,7 +829,12 @@ NavErrorType CNavArea::PostLoad( void )
 {
 	NavErrorType error = NAV_OK;
 
+#ifdef MAPBASE
+	// the compact loader has already turned everything into pointers
+	for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS && !s_navAreasPreBound; ++dir )
+#else
 	for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+#endif
 	{
 		FOR_EACH_VEC( m_ladder[dir], it )
 		{
@@ -710,6 +864,9 @@ NavErrorType CNavArea::PostLoad( void )
 
 			// convert connect ID into an actual area
 			unsigned int id = connect->id;
+#ifdef MAPBASE
+			if ( !s_navAreasPreBound )
+#endif
 			connect->area = TheNavMesh->GetNavAreaByID( id );
 			if (id && connect->area == NULL)
 			{
@@ -726,6 +883,9 @@ NavErrorType CNavArea::PostLoad( void )
 	{
 		e = m_spotEncounters[ it ];
 
+#ifdef MAPBASE
+		if ( !s_navAreasPreBound )
+#endif
 		e->from.area = TheNavMesh->GetNavAreaByID( e->from.id );
 		if (e->from.area == NULL)
 		{
@@ -733,6 +893,9 @@ NavErrorType CNavArea::PostLoad( void )
 			error = NAV_CORRUPT_DATA;
 		}
 
+#ifdef MAPBASE
+		if ( !s_navAreasPreBound )
+#endif
 		e->to.area = TheNavMesh->GetNavAreaByID( e->to.id );
 		if (e->to.area == NULL)
 		{
@@ -757,6 +920,9 @@ NavErrorType CNavArea::PostLoad( void )
 		{
 			SpotOrder *order = &e->spots[ sit ];
 
+#ifdef MAPBASE
+			if ( !s_navAreasPreBound )
+#endif
 			order->spot = GetHidingSpotByID( order->id );
 			if (order->spot == NULL)
 			{
@@ -771,6 +937,9 @@ NavErrorType CNavArea::PostLoad( void )
 	{
 		AreaBindInfo &info = m_potentiallyVisibleAreas[ it ];
 
+#ifdef MAPBASE
+		if ( !s_navAreasPreBound )
+#endif
 		info.area = TheNavMesh->GetNavAreaByID( info.id );
 		if ( info.area == NULL )
 		{
@@ -778,6 +947,9 @@ NavErrorType CNavArea::PostLoad( void )
 		}		
 	}
 
+#ifdef MAPBASE
+	if ( !s_navAreasPreBound )
+#endif
 	m_inheritVisibilityFrom.area = TheNavMesh->GetNavAreaByID( m_inheritVisibilityFrom.id );
 	Assert( m_inheritVisibilityFrom.area != this );
 
@@ -1397,6 +1569,28 @@ NavErrorType CNavMesh::Load( void )
 	char filename[256];
 	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
 
+#ifdef MAPBASE
+	bool useCompact = nav_compact_load.GetBool();
+	if ( s_navLoadFormat != NAV_LOAD_DEFAULT )
+	{
+		useCompact = ( s_navLoadFormat == NAV_LOAD_COMPACT );
+	}
+	useCompact = useCompact && !IsX360() && GetSubVersionNumber() == 0;
+
+	s_navLoadedCompact = false;
+	if ( useCompact )
+	{
+		NavErrorType compactResult;
+		if ( LoadCompact( &compactResult ) )
+		{
+			s_navLoadedCompact = true;
+			return compactResult;
+		}
+
+		// nothing was loaded from it, carry on with the .nav file
+	}
+#endif
+
 	bool navIsInBsp = false;
 	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
 	if ( !filesystem->ReadFile( filename, "MOD", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
@@ -1448,10 +1642,18 @@ NavErrorType CNavMesh::Load( void )
 		}
 	}
 
+#ifdef MAPBASE
+	s_loadedNavVersion = version;
+	s_loadedNavBspSize = 0;
+#endif
+
 	if ( version >= 4 )
 	{
 		// get size of source bsp file and verify that the bsp hasn't changed
 		unsigned int saveBspSize = fileBuffer.GetUnsignedInt();
+#ifdef MAPBASE
+		s_loadedNavBspSize = saveBspSize;
+#endif
 
 		// verify size
 		char *bspFilename = GetBspFilename( filename );
@@ -1575,6 +1777,14 @@ NavErrorType CNavMesh::Load( void )
 
 	WarnIfMeshNeedsAnalysis( version );
 
+#ifdef MAPBASE
+	// the compact file for the next load; nav_compare_load writes its own
+	if ( loadResult == NAV_OK && useCompact && !navIsInBsp && s_navLoadFormat == NAV_LOAD_DEFAULT )
+	{
+		SaveCompact();
+	}
+#endif
+
 	return loadResult;
 }
 
@@ -1689,8 +1899,932 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 		m_avoidanceObstacles[i]->OnNavMeshLoaded();
 	}
 
+#ifdef MAPBASE
+	// the areas only need their visibility lists again when they're saved
+	CNavArea::s_visibilityTable.Build( TheNavAreas );
+
+#endif
 	// the Navigation Mesh has been successfully loaded
 	m_isLoaded = true;
 	
 	return NAV_OK;
 }
+
+
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read-only view of a compact nav file in memory
+ */
+class CNavCompactFile
+{
+public:
+	bool Init( const void *data, unsigned int size );		// point into the file data, returns false if it's malformed
+
+	unsigned int GetCount( NavCompactSectionType type ) const	{ return m_header->section[ type ].count; }
+
+	const NavCompactHeader_t *m_header;
+	const char *m_places;
+	const NavCompactArea_t *m_areas;
+	const uint32 *m_connections;
+	const NavCompactHidingSpot_t *m_hidingSpots;
+	const NavCompactEncounter_t *m_encounters;
+	const NavCompactSpotOrder_t *m_encounterSpots;
+	const uint32 *m_ladderConnections;
+	const NavCompactVisibility_t *m_visibility;
+	const char *m_ladders;
+	const uint32 *m_gridCells;
+	const uint32 *m_gridAreas;
+
+private:
+	template < typename T >
+	bool GetSection( NavCompactSectionType type, const T **elements ) const
+	{
+		const NavCompactSection_t &section = m_header->section[ type ];
+		if ( section.offset % sizeof( uint32 ) || section.offset > m_size || section.count > ( m_size - section.offset ) / sizeof( T ) )
+			return false;
+
+		*elements = (const T *)( m_base + section.offset );
+		return true;
+	}
+
+	bool IsValidRange( const NavCompactRange_t &range, NavCompactSectionType type ) const
+	{
+		return range.first <= GetCount( type ) && range.count <= GetCount( type ) - range.first;
+	}
+
+	bool IsValidIndex( uint32 index, unsigned int count, bool canBeInvalid = false ) const
+	{
+		return index < count || ( canBeInvalid && index == NavCompactInvalidIndex );
+	}
+
+	const byte *m_base;
+	unsigned int m_size;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find each section and check every range and index in it, so the loader can use them as they are
+ */
+bool CNavCompactFile::Init( const void *data, unsigned int size )
+{
+	m_base = (const byte *)data;
+	m_size = size;
+
+	if ( size < sizeof( NavCompactHeader_t ) )
+		return false;
+
+	m_header = (const NavCompactHeader_t *)data;
+	if ( m_header->magic != NAV_COMPACT_MAGIC_NUMBER || m_header->version != NavCompactVersion )
+		return false;
+
+	if ( !GetSection( NAV_COMPACT_PLACES, &m_places ) ||
+		 !GetSection( NAV_COMPACT_AREAS, &m_areas ) ||
+		 !GetSection( NAV_COMPACT_CONNECTIONS, &m_connections ) ||
+		 !GetSection( NAV_COMPACT_HIDING_SPOTS, &m_hidingSpots ) ||
+		 !GetSection( NAV_COMPACT_ENCOUNTERS, &m_encounters ) ||
+		 !GetSection( NAV_COMPACT_ENCOUNTER_SPOTS, &m_encounterSpots ) ||
+		 !GetSection( NAV_COMPACT_LADDER_CONNECTIONS, &m_ladderConnections ) ||
+		 !GetSection( NAV_COMPACT_VISIBILITY, &m_visibility ) ||
+		 !GetSection( NAV_COMPACT_LADDERS, &m_ladders ) ||
+		 !GetSection( NAV_COMPACT_GRID_CELLS, &m_gridCells ) ||
+		 !GetSection( NAV_COMPACT_GRID_AREAS, &m_gridAreas ) )
+	{
+		return false;
+	}
+
+	unsigned int areaCount = GetCount( NAV_COMPACT_AREAS );
+	if ( areaCount == 0 )
+		return false;
+
+	// the place names have to hold as many strings as there are places
+	unsigned int placeNameCount = 0;
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_PLACES ); ++i )
+	{
+		if ( m_places[i] == '\0' )
+			++placeNameCount;
+	}
+
+	if ( placeNameCount < m_header->placeCount || ( GetCount( NAV_COMPACT_PLACES ) && m_places[ GetCount( NAV_COMPACT_PLACES ) - 1 ] != '\0' ) )
+		return false;
+
+	for ( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavCompactArea_t &area = m_areas[i];
+
+		if ( area.place > m_header->placeCount || !IsValidIndex( area.inheritVisibilityFrom, areaCount, true ) )
+			return false;
+
+		for ( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			if ( !IsValidRange( area.connect[d], NAV_COMPACT_CONNECTIONS ) )
+				return false;
+		}
+
+		for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+		{
+			if ( !IsValidRange( area.ladder[dir], NAV_COMPACT_LADDER_CONNECTIONS ) )
+				return false;
+		}
+
+		if ( !IsValidRange( area.hidingSpots, NAV_COMPACT_HIDING_SPOTS ) ||
+			 !IsValidRange( area.encounters, NAV_COMPACT_ENCOUNTERS ) ||
+			 !IsValidRange( area.visibility, NAV_COMPACT_VISIBILITY ) )
+		{
+			return false;
+		}
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_CONNECTIONS ); ++i )
+	{
+		if ( !IsValidIndex( m_connections[i], areaCount ) )
+			return false;
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_ENCOUNTERS ); ++i )
+	{
+		const NavCompactEncounter_t &encounter = m_encounters[i];
+
+		if ( !IsValidIndex( encounter.from, areaCount, true ) || !IsValidIndex( encounter.to, areaCount, true ) ||
+			 !IsValidRange( encounter.spots, NAV_COMPACT_ENCOUNTER_SPOTS ) )
+		{
+			return false;
+		}
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_ENCOUNTER_SPOTS ); ++i )
+	{
+		if ( !IsValidIndex( m_encounterSpots[i].spot, GetCount( NAV_COMPACT_HIDING_SPOTS ), true ) )
+			return false;
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_LADDER_CONNECTIONS ); ++i )
+	{
+		if ( !IsValidIndex( m_ladderConnections[i], m_header->ladderCount ) )
+			return false;
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_VISIBILITY ); ++i )
+	{
+		if ( !IsValidIndex( m_visibility[i].area, areaCount ) )
+			return false;
+	}
+
+	// one entry per grid cell plus the end, each cell's areas following the previous cell's
+	if ( m_header->gridSizeX <= 0 || m_header->gridSizeY <= 0 ||
+		 (uint64)m_header->gridSizeX * m_header->gridSizeY + 1 != GetCount( NAV_COMPACT_GRID_CELLS ) )
+	{
+		return false;
+	}
+
+	unsigned int cellCount = GetCount( NAV_COMPACT_GRID_CELLS ) - 1;
+	if ( m_gridCells[0] != 0 || m_gridCells[ cellCount ] != GetCount( NAV_COMPACT_GRID_AREAS ) )
+		return false;
+
+	for ( unsigned int i=0; i<cellCount; ++i )
+	{
+		if ( m_gridCells[i] > m_gridCells[ i+1 ] )
+			return false;
+	}
+
+	for ( unsigned int i=0; i<GetCount( NAV_COMPACT_GRID_AREAS ); ++i )
+	{
+		if ( !IsValidIndex( m_gridAreas[i], areaCount ) )
+			return false;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load the mesh from the compact nav file. Returns false, having loaded nothing, if there isn't one
+ * that is up to date with the .nav file or its ladder data is corrupt - otherwise 'result' is the
+ * result of loading it.
+ */
+bool CNavMesh::LoadCompact( NavErrorType *result )
+{
+	double startTime = Plat_FloatTime();
+
+	char filename[256];
+	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
+
+	char compactFilename[256];
+	Q_snprintf( compactFilename, sizeof( compactFilename ), FORMAT_NAVCOMPACTFILE, STRING( gpGlobals->mapname ) );
+
+	// a .nav file embedded in the .bsp doesn't get a compact file
+	unsigned int navSize = filesystem->Size( filename, "MOD" );
+	if ( navSize == 0 )
+		return false;
+
+	CUtlBuffer fileBuffer;
+	if ( !filesystem->ReadFile( compactFilename, "MOD", fileBuffer ) )
+		return false;
+
+	CNavCompactFile nav;
+	if ( !nav.Init( fileBuffer.Base(), fileBuffer.TellPut() ) )
+	{
+		Warning( "Invalid compact navigation file '%s'.\n", compactFilename );
+		return false;
+	}
+
+	const NavCompactHeader_t &header = *nav.m_header;
+	if ( header.navFileSize != navSize || header.navFileTime != (uint32)filesystem->GetFileTime( filename, "MOD" ) || header.gridCellSize != m_gridCellSize )
+	{
+		DevMsg( "Compact navigation file '%s' is out of date.\n", compactFilename );
+		return false;
+	}
+
+	char *bspFilename = GetBspFilename( filename );
+	if ( bspFilename == NULL )
+		return false;
+
+	//
+	// From here on the compact file is the mesh
+	//
+	if ( header.navVersion >= 4 && filesystem->Size( bspFilename ) != header.bspSize )
+	{
+		if ( engine->IsDedicatedServer() )
+		{
+			// Warning doesn't print to the dedicated server console, so we'll use Msg instead
+			DevMsg( "The Navigation Mesh was built using a different version of this map.\n" );
+		}
+		else
+		{
+			DevWarning( "The Navigation Mesh was built using a different version of this map.\n" );
+		}
+		m_isOutOfDate = true;
+	}
+
+	m_isAnalyzed = header.isAnalyzed != 0;
+
+	CUtlVector< Place > places;
+	places.EnsureCapacity( header.placeCount + 1 );
+	places.AddToTail( UNDEFINED_PLACE );
+	for ( const char *placeName = nav.m_places; places.Count() <= (int)header.placeCount; placeName += V_strlen( placeName ) + 1 )
+	{
+		Place place = NameToPlace( placeName );
+		if ( place == UNDEFINED_PLACE )
+		{
+			Warning( "Warning: NavMesh place %s is undefined?\n", placeName );
+		}
+		places.AddToTail( place );
+	}
+
+	//
+	// Create the areas and their hiding spots, in the order the .nav file had them
+	//
+	unsigned int areaCount = nav.GetCount( NAV_COMPACT_AREAS );
+
+	CUtlVector< HidingSpot * > hidingSpots;
+	hidingSpots.SetCount( nav.GetCount( NAV_COMPACT_HIDING_SPOTS ) );
+	V_memset( hidingSpots.Base(), 0, hidingSpots.Count() * sizeof( HidingSpot * ) );
+
+	PreLoadAreas( areaCount );
+	TheNavAreas.EnsureCapacity( areaCount );
+
+	for ( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavCompactArea_t &data = nav.m_areas[i];
+		CNavArea *area = CreateArea();
+
+		area->m_id = data.id;
+
+		// update nextID to avoid collisions
+		if ( area->m_id >= CNavArea::m_nextID )
+			CNavArea::m_nextID = area->m_id + 1;
+
+		area->m_attributeFlags = data.attributeFlags;
+
+		area->m_nwCorner.Init( data.nwCorner[0], data.nwCorner[1], data.nwCorner[2] );
+		area->m_seCorner.Init( data.seCorner[0], data.seCorner[1], data.seCorner[2] );
+
+		area->m_center.x = ( area->m_nwCorner.x + area->m_seCorner.x ) / 2.0f;
+		area->m_center.y = ( area->m_nwCorner.y + area->m_seCorner.y ) / 2.0f;
+		area->m_center.z = ( area->m_nwCorner.z + area->m_seCorner.z ) / 2.0f;
+
+		if ( ( area->m_seCorner.x - area->m_nwCorner.x ) > 0.0f && ( area->m_seCorner.y - area->m_nwCorner.y ) > 0.0f )
+		{
+			area->m_invDxCorners = 1.0f / ( area->m_seCorner.x - area->m_nwCorner.x );
+			area->m_invDyCorners = 1.0f / ( area->m_seCorner.y - area->m_nwCorner.y );
+		}
+		else
+		{
+			area->m_invDxCorners = area->m_invDyCorners = 0;
+
+			DevWarning( "Degenerate Navigation Area #%d at setpos %g %g %g\n", 
+				area->m_id, area->m_center.x, area->m_center.y, area->m_center.z );
+		}
+
+		area->m_neZ = data.neZ;
+		area->m_swZ = data.swZ;
+
+		area->CheckWaterLevel();
+
+		for ( int t=0; t<MAX_NAV_TEAMS; ++t )
+		{
+			area->m_earliestOccupyTime[t] = data.earliestOccupyTime[t];
+		}
+
+		for ( int c=0; c<NUM_CORNERS; ++c )
+		{
+			area->m_lightIntensity[c] = data.lightIntensity[c];
+		}
+
+		area->SetPlace( places[ data.place ] );
+		placeDirectory.AddPlace( area->GetPlace() );
+
+		area->m_hidingSpots.EnsureCapacity( data.hidingSpots.count );
+		for ( uint32 h=data.hidingSpots.first; h<data.hidingSpots.first + data.hidingSpots.count; ++h )
+		{
+			const NavCompactHidingSpot_t &spotData = nav.m_hidingSpots[h];
+
+			// create new hiding spot and put on master list
+			HidingSpot *spot = CreateHidingSpot();
+
+			spot->m_id = spotData.id;
+			spot->m_pos.Init( spotData.pos[0], spotData.pos[1], spotData.pos[2] );
+			spot->m_flags = spotData.flags;
+
+			// update next ID to avoid ID collisions by later spots
+			if ( spot->m_id >= HidingSpot::m_nextID )
+				HidingSpot::m_nextID = spot->m_id + 1;
+
+			area->m_hidingSpots.AddToTail( spot );
+			hidingSpots[h] = spot;
+		}
+
+		TheNavAreas.AddToTail( area );
+		AddNavAreaToHash( area );
+	}
+
+	// the grid cells are stored filled in
+	m_grid.RemoveAll();
+	m_minX = header.gridMinX;
+	m_minY = header.gridMinY;
+	m_gridSizeX = header.gridSizeX;
+	m_gridSizeY = header.gridSizeY;
+	m_grid.SetCount( m_gridSizeX * m_gridSizeY );
+
+	FOR_EACH_VEC( m_grid, it )
+	{
+		NavAreaVector &cell = m_grid[ it ];
+
+		cell.EnsureCapacity( nav.m_gridCells[ it+1 ] - nav.m_gridCells[ it ] );
+		for ( uint32 g=nav.m_gridCells[ it ]; g<nav.m_gridCells[ it+1 ]; ++g )
+		{
+			cell.AddToTail( TheNavAreas[ nav.m_gridAreas[g] ] );
+		}
+	}
+
+	//
+	// Ladders are few enough that they're stored the way the .nav file has them
+	//
+	CUtlBuffer ladderBuffer( nav.m_ladders, nav.GetCount( NAV_COMPACT_LADDERS ), CUtlBuffer::READ_ONLY );
+	m_ladders.EnsureCapacity( header.ladderCount );
+
+	for ( unsigned int i=0; i<header.ladderCount; ++i )
+	{
+		CNavLadder *ladder = new CNavLadder;
+		ladder->Load( ladderBuffer, NavCurrentVersion );
+		m_ladders.AddToTail( ladder );
+	}
+
+	if ( !ladderBuffer.IsValid() )
+	{
+		Warning( "CNavMesh::LoadCompact: Corrupt navigation ladder data in '%s'.\n", compactFilename );
+
+		// throw away what was loaded so far, the caller falls back to the .nav file
+		Reset();
+		placeDirectory.Reset();
+		CNavVectorNoEditAllocator::Reset();
+		CNavArea::m_nextID = 1;
+
+		*result = NAV_CORRUPT_DATA;
+		return false;
+	}
+
+	//
+	// Turn the indices into pointers
+	//
+	for ( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavCompactArea_t &data = nav.m_areas[i];
+		CNavArea *area = TheNavAreas[i];
+
+		for ( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			area->m_connect[d].EnsureCapacity( data.connect[d].count );
+			for ( uint32 c=data.connect[d].first; c<data.connect[d].first + data.connect[d].count; ++c )
+			{
+				NavConnect connect;
+				connect.area = TheNavAreas[ nav.m_connections[c] ];
+				area->m_connect[d].AddToTail( connect );
+			}
+		}
+
+		for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+		{
+			area->m_ladder[dir].EnsureCapacity( data.ladder[dir].count );
+			for ( uint32 l=data.ladder[dir].first; l<data.ladder[dir].first + data.ladder[dir].count; ++l )
+			{
+				NavLadderConnect connect;
+				connect.ladder = m_ladders[ nav.m_ladderConnections[l] ];
+				area->m_ladder[dir].AddToTail( connect );
+			}
+		}
+
+		area->m_spotEncounters.EnsureCapacity( data.encounters.count );
+		for ( uint32 e=data.encounters.first; e<data.encounters.first + data.encounters.count; ++e )
+		{
+			const NavCompactEncounter_t &encounterData = nav.m_encounters[e];
+			SpotEncounter *encounter = new SpotEncounter;
+
+			encounter->from.area = ( encounterData.from != NavCompactInvalidIndex ) ? TheNavAreas[ encounterData.from ] : NULL;
+			encounter->fromDir = static_cast<NavDirType>( encounterData.fromDir );
+			encounter->to.area = ( encounterData.to != NavCompactInvalidIndex ) ? TheNavAreas[ encounterData.to ] : NULL;
+			encounter->toDir = static_cast<NavDirType>( encounterData.toDir );
+
+			encounter->spots.EnsureCapacity( encounterData.spots.count );
+			for ( uint32 s=encounterData.spots.first; s<encounterData.spots.first + encounterData.spots.count; ++s )
+			{
+				SpotOrder order;
+				order.spot = ( nav.m_encounterSpots[s].spot != NavCompactInvalidIndex ) ? hidingSpots[ nav.m_encounterSpots[s].spot ] : NULL;
+				order.t = nav.m_encounterSpots[s].t;
+				encounter->spots.AddToTail( order );
+			}
+
+			area->m_spotEncounters.AddToTail( encounter );
+		}
+
+		area->m_potentiallyVisibleAreas.EnsureCapacity( data.visibility.count );
+		for ( uint32 v=data.visibility.first; v<data.visibility.first + data.visibility.count; ++v )
+		{
+			CNavArea::AreaBindInfo info;
+			info.area = TheNavAreas[ nav.m_visibility[v].area ];
+			info.attributes = nav.m_visibility[v].attributes;
+			area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		area->m_inheritVisibilityFrom.area = ( data.inheritVisibilityFrom != NavCompactInvalidIndex ) ? TheNavAreas[ data.inheritVisibilityFrom ] : NULL;
+	}
+
+	// mark stairways (TODO: this can be removed once all maps are re-saved with this attribute in them)
+	MarkStairAreas();
+
+	s_navAreasPreBound = true;
+	*result = PostLoad( header.navVersion );
+	s_navAreasPreBound = false;
+
+	WarnIfMeshNeedsAnalysis( header.navVersion );
+
+	DevMsg( "Loaded compact navigation file '%s' in %.2f ms.\n", compactFilename, ( Plat_FloatTime() - startTime ) * 1000.0 );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append a section to the compact file being built, aligned so its records can be used in place
+ */
+static void PutCompactSection( CUtlBuffer &fileBuffer, NavCompactHeader_t *header, NavCompactSectionType type, const void *data, int count, int size )
+{
+	while ( fileBuffer.TellPut() % 8 )
+	{
+		fileBuffer.PutUnsignedChar( 0 );
+	}
+
+	header->section[ type ].offset = fileBuffer.TellPut();
+	header->section[ type ].count = count;
+
+	if ( count )
+	{
+		fileBuffer.Put( data, count * size );
+	}
+}
+
+template < typename T >
+static void PutCompactSection( CUtlBuffer &fileBuffer, NavCompactHeader_t *header, NavCompactSectionType type, const CUtlVector< T > &elements )
+{
+	PutCompactSection( fileBuffer, header, type, elements.Base(), elements.Count(), sizeof( T ) );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+static uint32 GetCompactIndex( const CUtlMap< unsigned int, uint32, int > &indices, unsigned int id )
+{
+	int it = indices.Find( id );
+	return ( it == indices.InvalidIndex() ) ? NavCompactInvalidIndex : indices[ it ];
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Write the mesh loaded from the .nav file to the compact nav file next to it.
+ * Only valid right after the .nav file has been loaded, before anything has changed the mesh.
+ */
+bool CNavMesh::SaveCompact( void ) const
+{
+	// derived meshes' custom data only goes in the .nav file
+	if ( IsX360() || GetSubVersionNumber() != 0 || !TheNavAreas.Count() )
+		return false;
+
+	char filename[256];
+	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
+
+	char compactFilename[256];
+	Q_snprintf( compactFilename, sizeof( compactFilename ), FORMAT_NAVCOMPACTFILE, STRING( gpGlobals->mapname ) );
+
+	// a .nav file embedded in the .bsp doesn't get a compact file
+	unsigned int navSize = filesystem->Size( filename, "MOD" );
+	if ( navSize == 0 )
+		return false;
+
+	NavCompactHeader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+
+	header.magic = NAV_COMPACT_MAGIC_NUMBER;
+	header.version = NavCompactVersion;
+	header.navVersion = s_loadedNavVersion;
+	header.navFileSize = navSize;
+	header.navFileTime = (uint32)filesystem->GetFileTime( filename, "MOD" );
+	header.bspSize = s_loadedNavBspSize;
+	header.isAnalyzed = m_isAnalyzed;
+	header.ladderCount = m_ladders.Count();
+	header.gridCellSize = m_gridCellSize;
+	header.gridMinX = m_minX;
+	header.gridMinY = m_minY;
+	header.gridSizeX = m_gridSizeX;
+	header.gridSizeY = m_gridSizeY;
+
+	// areas and hiding spots are referred to by where they are in the file
+	CUtlMap< unsigned int, uint32, int > areaIndices( DefLessFunc( unsigned int ) );
+	CUtlMap< unsigned int, uint32, int > spotIndices( DefLessFunc( unsigned int ) );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		areaIndices.Insert( area->GetID(), it );
+
+		FOR_EACH_VEC( area->m_hidingSpots, hit )
+		{
+			spotIndices.Insert( area->m_hidingSpots[ hit ]->GetID(), spotIndices.Count() );
+		}
+	}
+
+	PlaceDirectory places;
+
+	CUtlVector< NavCompactArea_t > areas;
+	CUtlVector< uint32 > connections;
+	CUtlVector< NavCompactHidingSpot_t > hidingSpots;
+	CUtlVector< NavCompactEncounter_t > encounters;
+	CUtlVector< NavCompactSpotOrder_t > encounterSpots;
+	CUtlVector< uint32 > ladderConnections;
+	CUtlVector< NavCompactVisibility_t > visibility;
+	CUtlVector< CNavArea::AreaBindInfo > visibleAreas;
+
+	areas.SetCount( TheNavAreas.Count() );
+	V_memset( areas.Base(), 0, areas.Count() * sizeof( NavCompactArea_t ) );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		NavCompactArea_t &data = areas[ it ];
+
+		data.id = area->m_id;
+		data.attributeFlags = area->m_attributeFlags;
+		V_memcpy( data.nwCorner, area->m_nwCorner.Base(), sizeof( data.nwCorner ) );
+		V_memcpy( data.seCorner, area->m_seCorner.Base(), sizeof( data.seCorner ) );
+		data.neZ = area->m_neZ;
+		data.swZ = area->m_swZ;
+
+		for ( int t=0; t<MAX_NAV_TEAMS; ++t )
+		{
+			data.earliestOccupyTime[t] = area->m_earliestOccupyTime[t];
+		}
+
+		for ( int c=0; c<NUM_CORNERS; ++c )
+		{
+			data.lightIntensity[c] = area->m_lightIntensity[c];
+		}
+
+		places.AddPlace( area->GetPlace() );
+		data.place = places.GetIndex( area->GetPlace() );
+
+		data.inheritVisibilityFrom = ( area->m_inheritVisibilityFrom.area ) ? GetCompactIndex( areaIndices, area->m_inheritVisibilityFrom.area->GetID() ) : NavCompactInvalidIndex;
+
+		for ( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			data.connect[d].first = connections.Count();
+			FOR_EACH_VEC( area->m_connect[d], cit )
+			{
+				connections.AddToTail( GetCompactIndex( areaIndices, area->m_connect[d][ cit ].area->GetID() ) );
+			}
+			data.connect[d].count = connections.Count() - data.connect[d].first;
+		}
+
+		data.hidingSpots.first = hidingSpots.Count();
+		FOR_EACH_VEC( area->m_hidingSpots, hit )
+		{
+			const HidingSpot *spot = area->m_hidingSpots[ hit ];
+
+			NavCompactHidingSpot_t &spotData = hidingSpots[ hidingSpots.AddToTail() ];
+			spotData.id = spot->GetID();
+			V_memcpy( spotData.pos, spot->GetPosition().Base(), sizeof( spotData.pos ) );
+			spotData.flags = spot->GetFlags();
+		}
+		data.hidingSpots.count = hidingSpots.Count() - data.hidingSpots.first;
+
+		data.encounters.first = encounters.Count();
+		FOR_EACH_VEC( area->m_spotEncounters, eit )
+		{
+			const SpotEncounter *encounter = area->m_spotEncounters[ eit ];
+
+			NavCompactEncounter_t &encounterData = encounters[ encounters.AddToTail() ];
+			encounterData.from = ( encounter->from.area ) ? GetCompactIndex( areaIndices, encounter->from.area->GetID() ) : NavCompactInvalidIndex;
+			encounterData.fromDir = encounter->fromDir;
+			encounterData.to = ( encounter->to.area ) ? GetCompactIndex( areaIndices, encounter->to.area->GetID() ) : NavCompactInvalidIndex;
+			encounterData.toDir = encounter->toDir;
+
+			encounterData.spots.first = encounterSpots.Count();
+			FOR_EACH_VEC( encounter->spots, sit )
+			{
+				const SpotOrder &order = encounter->spots[ sit ];
+
+				NavCompactSpotOrder_t &orderData = encounterSpots[ encounterSpots.AddToTail() ];
+				orderData.spot = ( order.spot ) ? GetCompactIndex( spotIndices, order.spot->GetID() ) : NavCompactInvalidIndex;
+				orderData.t = order.t;
+			}
+			encounterData.spots.count = encounterSpots.Count() - encounterData.spots.first;
+		}
+		data.encounters.count = encounters.Count() - data.encounters.first;
+
+		for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+		{
+			data.ladder[dir].first = ladderConnections.Count();
+			FOR_EACH_VEC( area->m_ladder[dir], lit )
+			{
+				int ladderIndex = m_ladders.Find( area->m_ladder[dir][ lit ].ladder );
+				if ( ladderIndex != m_ladders.InvalidIndex() )
+				{
+					ladderConnections.AddToTail( ladderIndex );
+				}
+			}
+			data.ladder[dir].count = ladderConnections.Count() - data.ladder[dir].first;
+		}
+
+		area->GetPotentiallyVisibleAreaList( &visibleAreas );
+
+		data.visibility.first = visibility.Count();
+		FOR_EACH_VEC( visibleAreas, vit )
+		{
+			const CNavArea::AreaBindInfo &info = visibleAreas[ vit ];
+			if ( !info.area )
+				continue;
+
+			NavCompactVisibility_t &visibilityData = visibility[ visibility.AddToTail() ];
+			visibilityData.area = GetCompactIndex( areaIndices, info.area->GetID() );
+			visibilityData.attributes = info.attributes;
+		}
+		data.visibility.count = visibility.Count() - data.visibility.first;
+	}
+
+	// place names, in directory order
+	CUtlVector< char > placeNames;
+	const CUtlVector< Place > *placeList = places.GetPlaces();
+	FOR_EACH_VEC( (*placeList), pit )
+	{
+		const char *placeName = PlaceToName( (*placeList)[ pit ] );
+		if ( !placeName )
+		{
+			placeName = "";
+		}
+		placeNames.AddMultipleToTail( V_strlen( placeName ) + 1, placeName );
+	}
+	header.placeCount = placeList->Count();
+
+	// grid cells, as runs of area indices
+	CUtlVector< uint32 > gridCells;
+	CUtlVector< uint32 > gridAreas;
+	gridCells.EnsureCapacity( m_grid.Count() + 1 );
+	FOR_EACH_VEC( m_grid, git )
+	{
+		gridCells.AddToTail( gridAreas.Count() );
+		FOR_EACH_VEC( m_grid[ git ], ait )
+		{
+			gridAreas.AddToTail( GetCompactIndex( areaIndices, m_grid[ git ][ ait ]->GetID() ) );
+		}
+	}
+	gridCells.AddToTail( gridAreas.Count() );
+
+	CUtlBuffer ladderBuffer( 4096, 1024*1024 );
+	FOR_EACH_VEC( m_ladders, lit )
+	{
+		m_ladders[ lit ]->Save( ladderBuffer, NavCurrentVersion );
+	}
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024 );
+
+	// the header gets written again once the offsets are known
+	fileBuffer.Put( &header, sizeof( header ) );
+
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_PLACES, placeNames );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_AREAS, areas );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_CONNECTIONS, connections );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_HIDING_SPOTS, hidingSpots );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_ENCOUNTERS, encounters );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_ENCOUNTER_SPOTS, encounterSpots );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_LADDER_CONNECTIONS, ladderConnections );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_VISIBILITY, visibility );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_LADDERS, ladderBuffer.Base(), ladderBuffer.TellPut(), 1 );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_GRID_CELLS, gridCells );
+	PutCompactSection( fileBuffer, &header, NAV_COMPACT_GRID_AREAS, gridAreas );
+
+	V_memcpy( fileBuffer.Base(), &header, sizeof( header ) );
+
+	if ( !filesystem->WriteFile( compactFilename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save %d bytes to %s\n", fileBuffer.TellPut(), compactFilename );
+		return false;
+	}
+
+	DevMsg( "Size of compact nav file '%s' is %d bytes.\n", compactFilename, fileBuffer.TellPut() );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void ChecksumAreaID( CRC32_t *crc, const CNavArea *area )
+{
+	unsigned int id = ( area ) ? area->GetID() : 0;
+	CRC32_ProcessBuffer( crc, &id, sizeof( id ) );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Checksum everything an area or ladder loads from a nav file, to tell whether two loads came out the same
+ */
+CRC32_t CNavMesh::ComputeChecksum( void ) const
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	CUtlVector< CNavArea::AreaBindInfo > visibleAreas;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		ChecksumAreaID( &crc, area );
+		CRC32_ProcessBuffer( &crc, &area->m_attributeFlags, sizeof( area->m_attributeFlags ) );
+		CRC32_ProcessBuffer( &crc, &area->m_nwCorner, sizeof( area->m_nwCorner ) );
+		CRC32_ProcessBuffer( &crc, &area->m_seCorner, sizeof( area->m_seCorner ) );
+		CRC32_ProcessBuffer( &crc, &area->m_neZ, sizeof( area->m_neZ ) );
+		CRC32_ProcessBuffer( &crc, &area->m_swZ, sizeof( area->m_swZ ) );
+		CRC32_ProcessBuffer( &crc, &area->m_place, sizeof( area->m_place ) );
+		CRC32_ProcessBuffer( &crc, area->m_earliestOccupyTime, sizeof( area->m_earliestOccupyTime ) );
+		CRC32_ProcessBuffer( &crc, area->m_lightIntensity, sizeof( area->m_lightIntensity ) );
+
+		for ( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			FOR_EACH_VEC( area->m_connect[d], cit )
+			{
+				ChecksumAreaID( &crc, area->m_connect[d][ cit ].area );
+			}
+		}
+
+		FOR_EACH_VEC( area->m_hidingSpots, hit )
+		{
+			const HidingSpot *spot = area->m_hidingSpots[ hit ];
+			CRC32_ProcessBuffer( &crc, &spot->m_id, sizeof( spot->m_id ) );
+			CRC32_ProcessBuffer( &crc, &spot->m_pos, sizeof( spot->m_pos ) );
+			CRC32_ProcessBuffer( &crc, &spot->m_flags, sizeof( spot->m_flags ) );
+		}
+
+		FOR_EACH_VEC( area->m_spotEncounters, eit )
+		{
+			const SpotEncounter *encounter = area->m_spotEncounters[ eit ];
+			ChecksumAreaID( &crc, encounter->from.area );
+			CRC32_ProcessBuffer( &crc, &encounter->fromDir, sizeof( encounter->fromDir ) );
+			ChecksumAreaID( &crc, encounter->to.area );
+			CRC32_ProcessBuffer( &crc, &encounter->toDir, sizeof( encounter->toDir ) );
+
+			FOR_EACH_VEC( encounter->spots, sit )
+			{
+				unsigned int spotID = ( encounter->spots[ sit ].spot ) ? encounter->spots[ sit ].spot->GetID() : 0;
+				CRC32_ProcessBuffer( &crc, &spotID, sizeof( spotID ) );
+				CRC32_ProcessBuffer( &crc, &encounter->spots[ sit ].t, sizeof( encounter->spots[ sit ].t ) );
+			}
+		}
+
+		for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+		{
+			FOR_EACH_VEC( area->m_ladder[dir], lit )
+			{
+				unsigned int ladderID = area->m_ladder[dir][ lit ].ladder->GetID();
+				CRC32_ProcessBuffer( &crc, &ladderID, sizeof( ladderID ) );
+			}
+		}
+
+		area->GetPotentiallyVisibleAreaList( &visibleAreas );
+		FOR_EACH_VEC( visibleAreas, vit )
+		{
+			ChecksumAreaID( &crc, visibleAreas[ vit ].area );
+			CRC32_ProcessBuffer( &crc, &visibleAreas[ vit ].attributes, sizeof( visibleAreas[ vit ].attributes ) );
+		}
+
+		ChecksumAreaID( &crc, area->m_inheritVisibilityFrom.area );
+	}
+
+	FOR_EACH_VEC( m_ladders, lit )
+	{
+		const CNavLadder *ladder = m_ladders[ lit ];
+
+		unsigned int ladderID = ladder->GetID();
+		CRC32_ProcessBuffer( &crc, &ladderID, sizeof( ladderID ) );
+		CRC32_ProcessBuffer( &crc, &ladder->m_top, sizeof( ladder->m_top ) );
+		CRC32_ProcessBuffer( &crc, &ladder->m_bottom, sizeof( ladder->m_bottom ) );
+		CRC32_ProcessBuffer( &crc, &ladder->m_width, sizeof( ladder->m_width ) );
+		ChecksumAreaID( &crc, ladder->m_topForwardArea );
+		ChecksumAreaID( &crc, ladder->m_topLeftArea );
+		ChecksumAreaID( &crc, ladder->m_topRightArea );
+		ChecksumAreaID( &crc, ladder->m_topBehindArea );
+		ChecksumAreaID( &crc, ladder->m_bottomArea );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load the mesh from the .nav file and then from the compact file, and report how long each took
+ * and whether they came out the same
+ */
+void CommandNavCompareLoad( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	char filename[256];
+	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
+
+	char compactFilename[256];
+	Q_snprintf( compactFilename, sizeof( compactFilename ), FORMAT_NAVCOMPACTFILE, STRING( gpGlobals->mapname ) );
+
+	s_navLoadFormat = NAV_LOAD_CLASSIC;
+
+	double startTime = Plat_FloatTime();
+	NavErrorType result = TheNavMesh->Load();
+	double navTime = Plat_FloatTime() - startTime;
+
+	s_navLoadFormat = NAV_LOAD_DEFAULT;
+
+	if ( result != NAV_OK )
+	{
+		Warning( "nav_compare_load: Couldn't load '%s'.\n", filename );
+		return;
+	}
+
+	CRC32_t navChecksum = TheNavMesh->ComputeChecksum();
+
+	if ( !TheNavMesh->SaveCompact() )
+	{
+		Warning( "nav_compare_load: Couldn't write '%s'.\n", compactFilename );
+		return;
+	}
+
+	s_navLoadFormat = NAV_LOAD_COMPACT;
+	s_navLoadedCompact = false;
+
+	startTime = Plat_FloatTime();
+	result = TheNavMesh->Load();
+	double compactTime = Plat_FloatTime() - startTime;
+
+	s_navLoadFormat = NAV_LOAD_DEFAULT;
+
+	if ( !s_navLoadedCompact || result != NAV_OK )
+	{
+		Warning( "nav_compare_load: Couldn't load '%s'.\n", compactFilename );
+		return;
+	}
+
+	CRC32_t compactChecksum = TheNavMesh->ComputeChecksum();
+
+	Msg( "nav_compare_load: %d areas, %d hiding spots, %d ladders\n", TheNavAreas.Count(), TheHidingSpots.Count(), TheNavMesh->GetLadders().Count() );
+	Msg( "  %-24s %8.2f ms  %10u bytes\n", filename, navTime * 1000.0, filesystem->Size( filename, "MOD" ) );
+	Msg( "  %-24s %8.2f ms  %10u bytes  (%.1fx)\n", compactFilename, compactTime * 1000.0, filesystem->Size( compactFilename, "MOD" ), ( compactTime > 0.0 ) ? navTime / compactTime : 0.0 );
+
+	if ( navChecksum == compactChecksum )
+	{
+		Msg( "  Meshes match (checksum %08x)\n", navChecksum );
+	}
+	else
+	{
+		Warning( "  Meshes differ (checksums %08x and %08x)\n", navChecksum, compactChecksum );
+	}
+}
+static ConCommand nav_compare_load( "nav_compare_load", CommandNavCompareLoad, "Loads the navigation mesh from the .nav file and from the compact .navc file, reporting how long each took and whether they match.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+#endif // MAPBASE
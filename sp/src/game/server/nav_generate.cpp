@@ -17,6 +17,9 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#ifdef MAPBASE
+#include "vstdlib/jobthread.h"
+#endif
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -42,6 +45,9 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+#ifdef MAPBASE
+ConVar nav_analyze_batch_size( "nav_analyze_batch_size", "64", FCVAR_CHEAT, "How many nav areas at a time get their sniper spots and mesh visibility computed on the thread pool during analysis" );
+#endif
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3392,6 +3398,34 @@ void CNavMesh::AddWalkableSeeds( void )
 }
 
 
+#ifdef MAPBASE
+static double s_generationStepStartTime;	// when the current generation step began
+
+//--------------------------------------------------------------------------------------------------------------
+static void StartGenerationStep( void )
+{
+	s_generationStepStartTime = Plat_FloatTime();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Report how long a generation step took and start timing the next one
+ */
+static void FinishGenerationStep( const char *step )
+{
+	double now = Plat_FloatTime();
+	Msg( "%sDONE  %0.1f seconds elapsed.\n", step, now - s_generationStepStartTime );
+	s_generationStepStartTime = now;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+static void ComputeSniperSpotsJob( CNavArea *&area )
+{
+	area->ComputeSniperSpots();
+}
+#endif
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Initiate the generation process
@@ -3463,6 +3497,9 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	Msg( "Generating Navigation Mesh...\n" );
 	m_generationStartTime = Plat_FloatTime();
+#ifdef MAPBASE
+	StartGenerationStep();
+#endif
 }
 
 
@@ -3530,6 +3567,9 @@ void CNavMesh::BeginAnalysis( bool quitWhenFinished )
 	m_bQuitWhenFinished = quitWhenFinished;
 	lastMsgTime = 0.0f;
 	m_generationStartTime = Plat_FloatTime();
+#ifdef MAPBASE
+	StartGenerationStep();
+#endif
 }
 
 
@@ -3620,6 +3660,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 	static CountdownTimer s_playerSettleTimer;		// Settle time after moving the player for lighting calcs
 	static CUtlVector<CNavArea *> s_unlitAreas;
 	static CUtlVector<CNavArea *> s_unlitSeedAreas;
+#ifdef MAPBASE
+	static int s_visPairCount;						// area pairs checked for mesh visibility
+#endif
 
 	static ConVarRef host_thread_mode( "host_thread_mode" );
 
@@ -3640,6 +3683,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			// sampling is complete, now build nav areas
+#ifdef MAPBASE
+			FinishGenerationStep( "Sampling walkable space..." );
+#endif
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
 			return true;
@@ -3688,6 +3734,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Creating navigation areas from sampled data..." );
+#endif
 			m_generationState = FIND_HIDING_SPOTS;
 			m_generationIndex = 0;
 			return true;
@@ -3711,7 +3760,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Finding hiding spots..." );
+#else
 			Msg( "Finding hiding spots...DONE\n" );
+#endif
 
 			m_generationState = FIND_ENCOUNTER_SPOTS;
 			m_generationIndex = 0;
@@ -3736,7 +3789,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Finding encounter spots..." );
+#else
 			Msg( "Finding encounter spots...DONE\n" );
+#endif
 
 			m_generationState = FIND_SNIPER_SPOTS;
 			m_generationIndex = 0;
@@ -3748,10 +3805,17 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
+#ifdef MAPBASE
+				// each area only classifies its own hiding spots, so a batch of them can run at once
+				int batchCount = MIN( MAX( nav_analyze_batch_size.GetInt(), 1 ), TheNavAreas.Count() - m_generationIndex );
+				ParallelProcess( "CNavArea::ComputeSniperSpots", TheNavAreas.Base() + m_generationIndex, batchCount, &ComputeSniperSpotsJob );
+				m_generationIndex += batchCount;
+#else
 				CNavArea *area = TheNavAreas[ m_generationIndex ];
 				++m_generationIndex;
 
 				area->ComputeSniperSpots();
+#endif
 
 				// don't go over our time allotment
 				if( Plat_FloatTime() - startTime > maxTime )
@@ -3761,7 +3825,12 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Finding sniper spots..." );
+			s_visPairCount = 0;
+#else
 			Msg( "Finding sniper spots...DONE\n" );
+#endif
 
 			m_generationState = COMPUTE_MESH_VISIBILITY;
 			m_generationIndex = 0;
@@ -3776,10 +3845,16 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
+#ifdef MAPBASE
+				int batchCount = MIN( MAX( nav_analyze_batch_size.GetInt(), 1 ), TheNavAreas.Count() - m_generationIndex );
+				s_visPairCount += CNavArea::ComputeVisibilityToMesh( TheNavAreas.Base() + m_generationIndex, batchCount );
+				m_generationIndex += batchCount;
+#else
 				CNavArea *area = TheNavAreas[ m_generationIndex ];
 				++m_generationIndex;
 
 				area->ComputeVisibilityToMesh();
+#endif
 
 				// don't go over our time allotment
 				if ( Plat_FloatTime() - startTime > maxTime )
@@ -3793,7 +3868,12 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			EndVisibilityComputations();
 
+#ifdef MAPBASE
+			Msg( "Checked visibility between %d pairs of areas.\n", s_visPairCount );
+			FinishGenerationStep( "Computing mesh visibility..." );
+#else
 			Msg( "Computing mesh visibility...DONE\n" );
+#endif
 
 			m_generationState = FIND_EARLIEST_OCCUPY_TIMES;
 			m_generationIndex = 0;
@@ -3818,7 +3898,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Finding earliest occupy times..." );
+#else
 			Msg( "Finding earliest occupy times...DONE\n" );
+#endif
 
 #ifdef NAV_ANALYZE_LIGHT_INTENSITY
 			bool shouldSkipLightComputation = ( m_generationMode == GENERATE_INCREMENTAL || engine->IsDedicatedServer() );
@@ -3856,7 +3940,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			if ( !s_unlitAreas.Count() || !host )
 			{
+#ifdef MAPBASE
+				FinishGenerationStep( "Finding light intensity..." );
+#else
 				Msg( "Finding light intensity...DONE\n" );
+#endif
 
 				m_generationState = CUSTOM;
 				m_generationIndex = 0;
@@ -3927,7 +4015,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 				}
 			}
 
+#ifdef MAPBASE
+			FinishGenerationStep( "Finding light intensity..." );
+#else
 			Msg( "Finding light intensity...DONE\n" );
+#endif
 
 			m_generationState = CUSTOM;
 			m_generationIndex = 0;
@@ -3939,6 +4031,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			if ( m_generationIndex == 0 )
 			{
+#ifdef MAPBASE
+				StartGenerationStep();
+#endif
 				BeginCustomAnalysis( m_generationMode == GENERATE_INCREMENTAL );
 				Msg( "Start custom...\n ");
 			}
@@ -3961,7 +4056,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			PostCustomAnalysis();
 
 			EndCustomAnalysis();
+#ifdef MAPBASE
+			FinishGenerationStep( "Custom game-specific analysis..." );
+#else
 			Msg( "Custom game-specific analysis...DONE\n" );
+#endif
 
 			m_generationState = SAVE_NAV_MESH;
 			m_generationIndex = 0;
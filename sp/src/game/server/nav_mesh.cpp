@@ -20,6 +20,9 @@
 #include "func_simpleladder.h"
 #endif
 #include "functorutils.h"
+#ifdef MAPBASE
+#include "nav_pathfind.h"
+#endif
 
 #ifdef NEXT_BOT
 #include "NextBot/NavMeshEntities/func_nav_prerequisite.h"
@@ -97,6 +100,10 @@ CNavMesh::~CNavMesh()
  */
 void CNavMesh::Reset( void )
 {
+#ifdef MAPBASE
+	NavDiscardPathRequests();
+#endif
+
 	DestroyNavigationMesh();
 
 	m_generationMode = GENERATE_NONE;
@@ -182,6 +189,10 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 
 		CNavArea::m_isReset = false;
 
+#ifdef MAPBASE
+		CNavArea::s_visibilityTable.Reset();
+#endif
+
 
 		// destroy ladder representations
 		DestroyLadders();
@@ -266,6 +277,11 @@ void CNavMesh::Update( void )
 	UpdateBlockedAreas();
 	UpdateAvoidanceObstacleAreas();
 
+#ifdef MAPBASE
+	// now that blocked areas are up to date, run the path requests queued since the last update
+	NavRunPathRequests();
+#endif
+
 	if (nav_edit.GetBool())
 	{
 		if (m_isEditing == false)
@@ -484,6 +500,17 @@ void CNavMesh::AddNavArea( CNavArea *area )
 		}
 	}
 
+#ifdef MAPBASE
+	AddNavAreaToHash( area );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add an area to the ID hash table and area bookkeeping, for when the grid is filled in separately
+ */
+void CNavMesh::AddNavAreaToHash( CNavArea *area )
+{
+#endif
 	// add to hash table
 	int key = ComputeHashKey( area->GetID() );
 
@@ -3199,6 +3226,11 @@ void CNavMesh::BeginVisibilityComputations( void )
 		g_pNavVisPairHash->RemoveAll();
 	}
 
+#ifdef MAPBASE
+	// the lists are being recomputed, look things up in them until they're resolved into the table again
+	CNavArea::s_visibilityTable.Reset();
+
+#endif
 	FOR_EACH_VEC( TheNavAreas, it )
 	{
 		CNavArea *area = TheNavAreas[ it ];
@@ -3219,6 +3251,19 @@ void CNavMesh::EndVisibilityComputations( void )
 	int maxVisLength = 0;
 	int minVisLength = 999999999;
 
+#ifdef MAPBASE
+	// Every area has its full list now. Resolve them into the visibility table, which is also
+	// what the deltas below are counted with - the lists themselves are saved from the table.
+	CUtlVector< int > visLengths;
+	visLengths.SetCount( TheNavAreas.Count() );
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		visLengths[ it ] = TheNavAreas[ it ]->m_potentiallyVisibleAreas.Count();
+	}
+
+	CNavArea::s_visibilityTable.Build( TheNavAreas );
+#endif
+
 	// Optimize visibility storage of nav mesh by doing a kind of run-length encoding.
 	// Pick an "anchor" area and compare adjacent areas visibility lists to it. If the delta is
 	// small, point back to the anchor and just store the delta.
@@ -3226,7 +3271,11 @@ void CNavMesh::EndVisibilityComputations( void )
 	{
 		CNavArea *area = (CNavArea *)TheNavAreas[ it ];
 
+#ifdef MAPBASE
+		int visLength = visLengths[ it ];
+#else
 		int visLength = area->m_potentiallyVisibleAreas.Count();
+#endif
 		avgVisLength += visLength;
 		if ( visLength < minVisLength )
 		{
@@ -3244,7 +3293,11 @@ void CNavMesh::EndVisibilityComputations( void )
 		}
 
 		// find adjacent area with the smallest change from our visibility list
+#ifdef MAPBASE
+		int bestDeltaCount = 0;
+#else
 		CNavArea::CAreaBindInfoArray bestDelta;
+#endif
 		CNavArea *anchor = NULL;
 
 		for( int dir = NORTH; dir < NUM_DIRECTIONS; ++dir )
@@ -3262,6 +3315,17 @@ void CNavMesh::EndVisibilityComputations( void )
 						continue;	// don't try to inherit visibility from ourselves
 				}
 
+#ifdef MAPBASE
+				int deltaCount = CNavArea::s_visibilityTable.CountDifferences( area->m_visIndex, adjArea->m_visIndex );
+
+				// keep the smallest delta
+				if ( !anchor || deltaCount < bestDeltaCount )
+				{
+					bestDeltaCount = deltaCount;
+					anchor = adjArea;
+					Assert( anchor != area );
+				}
+#else
 				const CNavArea::CAreaBindInfoArray &delta = area->ComputeVisibilityDelta( adjArea );
 
 				// keep the smallest delta
@@ -3271,15 +3335,23 @@ void CNavMesh::EndVisibilityComputations( void )
 					anchor = adjArea;
 					Assert( anchor != area );
 				}
+#endif
 			}
 		}
 
 		// if best delta is small enough, inherit our data from this anchor
+#ifdef MAPBASE
+		if ( anchor && bestDeltaCount <= nav_max_vis_delta_list_length.GetInt() && anchor != area )
+		{
+			// inherit from anchor area's visibility list - the delta is made from the table when saving
+			area->m_inheritVisibilityFrom.area = anchor;
+#else
 		if ( anchor && bestDelta.Count() <= nav_max_vis_delta_list_length.GetInt() && anchor != area )
 		{
 			// inherit from anchor area's visibility list
 			area->m_inheritVisibilityFrom.area = anchor;
 			area->m_potentiallyVisibleAreas = bestDelta;
+#endif
 
 			// mark inherited-from area so it doesn't later try to inherit
 			anchor->m_isInheritedFrom = true;
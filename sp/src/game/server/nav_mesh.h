@@ -21,6 +21,9 @@
 
 #include "utlbuffer.h"
 #include "filesystem.h"
+#ifdef MAPBASE
+#include "checksum_crc.h"
+#endif
 #include "GameEventListener.h"
 
 #include "nav.h"
@@ -283,6 +286,10 @@ public:
 	virtual bool IsAuthoritative( void ) const { return false; }		
 
 	const CUtlVector< Place > *GetPlacesFromNavFile( bool *hasUnnamedPlaces );	// Reads the used place names from the nav file (can be used to selectively precache before the nav is loaded)
+#ifdef MAPBASE
+	bool SaveCompact( void ) const;										// write the mesh loaded from the .nav file to a compact .navc file next to it
+	CRC32_t ComputeChecksum( void ) const;								// checksum of the loaded areas and ladders, for comparing loads
+#endif
 
 	virtual bool Save( void ) const;									// store Navigation Mesh to a file
 	bool IsOutOfDate( void ) const	{ return m_isOutOfDate; }			// return true if the Navigation Mesh is older than the current map version
@@ -1086,6 +1093,10 @@ private:
 	void GridToWorld( int gridX, int gridY, Vector *pos ) const;
 
 	void AddNavArea( CNavArea *area );							// add an area to the grid
+#ifdef MAPBASE
+	void AddNavAreaToHash( CNavArea *area );					// everything AddNavArea() does except adding to the grid
+	bool LoadCompact( NavErrorType *result );					// load from the .navc file, false if there isn't a usable one
+#endif
 
 	void DestroyNavigationMesh( bool incremental = false );		// free all resources of the mesh and reset it to empty state
 	void DestroyHidingSpots( void );
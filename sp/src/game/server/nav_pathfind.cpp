@@ -0,0 +1,398 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Nav mesh path searches that don't keep their state on the areas,
+//			and the queue of async path requests that runs them in parallel.
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "tier0/tslist.h"
+#include "vstdlib/jobthread.h"
+
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#ifdef MAPBASE
+
+ConVar nav_pathfind_parallel( "nav_pathfind_parallel", "1", FCVAR_CHEAT, "Run queued async nav path requests on the thread pool. 0 runs them one at a time on the main thread." );
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathfindContext::CNavPathfindContext( void )
+{
+	m_marker = 0;
+	m_openSequenceCounter = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Start a new search. Entries stamped with an older marker read as unreached.
+ */
+void CNavPathfindContext::ClearSearchLists( void )
+{
+	++m_marker;
+	if ( m_marker == 0 )
+	{
+		// wrapped - wipe the stamps so nothing looks like it's from this search
+		FOR_EACH_VEC( m_nodes, i )
+		{
+			m_nodes[i].marker = 0;
+		}
+		m_marker = 1;
+	}
+
+	m_openHeap.RemoveAll();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavPathfindContext::IsCheaper( const CNavArea *area, const CNavArea *other ) const
+{
+	const SearchNode &node = m_nodes[ area->GetID() ];
+	const SearchNode &otherNode = m_nodes[ other->GetID() ];
+
+	if ( node.totalCost != otherNode.totalCost )
+		return node.totalCost < otherNode.totalCost;
+
+	return (int)( node.openSequence - otherNode.openSequence ) < 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfindContext::SiftUp( int index )
+{
+	CNavArea *area = m_openHeap[ index ];
+	while( index > 0 )
+	{
+		int parent = ( index - 1 ) >> 1;
+		if ( !IsCheaper( area, m_openHeap[ parent ] ) )
+			break;
+
+		m_openHeap[ index ] = m_openHeap[ parent ];
+		m_nodes[ m_openHeap[ index ]->GetID() ].heapIndex = index;
+		index = parent;
+	}
+
+	m_openHeap[ index ] = area;
+	m_nodes[ area->GetID() ].heapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfindContext::SiftDown( int index )
+{
+	int count = m_openHeap.Count();
+	CNavArea *area = m_openHeap[ index ];
+	for( ;; )
+	{
+		int child = ( index << 1 ) + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && IsCheaper( m_openHeap[ child + 1 ], m_openHeap[ child ] ) )
+			++child;
+
+		if ( !IsCheaper( m_openHeap[ child ], area ) )
+			break;
+
+		m_openHeap[ index ] = m_openHeap[ child ];
+		m_nodes[ m_openHeap[ index ]->GetID() ].heapIndex = index;
+		index = child;
+	}
+
+	m_openHeap[ index ] = area;
+	m_nodes[ area->GetID() ].heapIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfindContext::AddToOpenList( CNavArea *area )
+{
+	SearchNode &node = Touch( area );
+	if ( node.heapIndex >= 0 )
+	{
+		// already on list
+		return;
+	}
+
+	node.openSequence = m_openSequenceCounter++;
+	node.heapIndex = m_openHeap.AddToTail( area );
+	SiftUp( node.heapIndex );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller value has been found, update this area on the open list
+ */
+void CNavPathfindContext::UpdateOnOpenList( CNavArea *area )
+{
+	Assert( IsOpen( area ) );
+	SiftUp( m_nodes[ area->GetID() ].heapIndex );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavArea *CNavPathfindContext::PopOpenList( void )
+{
+	if ( m_openHeap.Count() == 0 )
+		return NULL;
+
+	CNavArea *area = m_openHeap[0];
+	int last = m_openHeap.Count() - 1;
+	if ( last > 0 )
+	{
+		m_openHeap[0] = m_openHeap[ last ];
+		m_nodes[ m_openHeap[0]->GetID() ].heapIndex = 0;
+	}
+	m_openHeap.RemoveMultipleFromTail( 1 );
+
+	if ( m_openHeap.Count() > 1 )
+	{
+		SiftDown( 0 );
+	}
+
+	m_nodes[ area->GetID() ].heapIndex = -1;
+	return area;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathRequest::CNavPathRequest( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, NavPathCallback callback, void *userData, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
+	m_startArea = startArea;
+	m_goalArea = goalArea;
+	m_hasGoalPos = ( goalPos != NULL );
+	m_goalPos = goalPos ? *goalPos : vec3_origin;
+	m_maxPathLength = maxPathLength;
+	m_teamID = teamID;
+	m_ignoreNavBlockers = ignoreNavBlockers;
+	m_isAborted = false;
+
+	m_callback = callback;
+	m_userData = userData;
+
+	m_result.found = false;
+	m_result.closestArea = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Do the search and copy the path out of the context. May run on any thread.
+ */
+void CNavPathRequest::Run( CNavPathfindContext &context )
+{
+	m_result.found = false;
+	m_result.closestArea = NULL;
+	m_result.areas.RemoveAll();
+	m_result.how.RemoveAll();
+
+	if ( m_isAborted )
+		return;
+
+	m_result.found = Search( context );
+
+	// walk back from the end of the path, then flip it so it starts at the start area
+	for( CNavArea *area = m_result.closestArea; area; area = context.GetParent( area ) )
+	{
+		m_result.areas.AddToTail( area );
+		m_result.how.AddToTail( context.GetParentHow( area ) );
+	}
+
+	for( int i=0, j=m_result.areas.Count()-1; i<j; ++i, --j )
+	{
+		V_swap( m_result.areas[i], m_result.areas[j] );
+		V_swap( m_result.how[i], m_result.how[j] );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The path is only filled in once the request has run, so this catches areas deleted
+ * between the search and the callback
+ */
+bool CNavPathRequest::Uses( const CNavArea *area ) const
+{
+	if ( m_startArea == area || m_goalArea == area )
+		return true;
+
+	FOR_EACH_VEC( m_result.areas, i )
+	{
+		if ( m_result.areas[i] == area )
+			return true;
+	}
+
+	return false;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequest::Complete( void )
+{
+	if ( m_isAborted )
+	{
+		m_result.found = false;
+		m_result.closestArea = NULL;
+		m_result.areas.RemoveAll();
+		m_result.how.RemoveAll();
+	}
+
+	if ( m_callback )
+	{
+		m_callback( m_result, m_userData );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static CUtlVector< CNavPathRequest * > s_pendingPathRequests;
+
+// The batch NavRunPathRequests() is calling back, so the callbacks can cancel or abort
+// the rest of it. Requests are set to NULL as they complete.
+static CUtlVector< CNavPathRequest * > *s_dispatchingPathRequests = NULL;
+
+// Contexts are big (an entry per area), so they're kept around and shared by whichever thread needs one
+static CTSList< CNavPathfindContext * > s_freePathfindContexts;
+
+//--------------------------------------------------------------------------------------------------------------
+static void RunPathRequest( CNavPathRequest *&request )
+{
+	CNavPathfindContext *context;
+	if ( !s_freePathfindContexts.PopItem( &context ) )
+	{
+		context = new CNavPathfindContext;
+	}
+
+	request->Run( *context );
+
+	s_freePathfindContexts.PushItem( context );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void NavQueuePathRequest( CNavPathRequest *request )
+{
+	Assert( ThreadInMainThread() );
+	s_pendingPathRequests.AddToTail( request );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void NavCancelPathRequests( void *userData )
+{
+	FOR_EACH_VEC_BACK( s_pendingPathRequests, i )
+	{
+		if ( s_pendingPathRequests[i]->GetUserData() == userData )
+		{
+			delete s_pendingPathRequests[i];
+			s_pendingPathRequests.Remove( i );
+		}
+	}
+
+	if ( s_dispatchingPathRequests )
+	{
+		FOR_EACH_VEC( *s_dispatchingPathRequests, i )
+		{
+			CNavPathRequest *request = s_dispatchingPathRequests->Element( i );
+			if ( request && request->GetUserData() == userData )
+			{
+				request->Cancel();
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The area is being deleted - don't search from or to it, or hand out a path through it
+ */
+void NavAbortPathRequests( const CNavArea *area )
+{
+	FOR_EACH_VEC( s_pendingPathRequests, i )
+	{
+		if ( s_pendingPathRequests[i]->Uses( area ) )
+		{
+			s_pendingPathRequests[i]->Abort();
+		}
+	}
+
+	if ( s_dispatchingPathRequests )
+	{
+		FOR_EACH_VEC( *s_dispatchingPathRequests, i )
+		{
+			CNavPathRequest *request = s_dispatchingPathRequests->Element( i );
+			if ( request && request->Uses( area ) )
+			{
+				request->Abort();
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Run every queued request, in parallel if there's more than one, then call them back in the
+ * order they were queued. Requests queued by the callbacks wait for the next update, and
+ * requests the callbacks cancel or abort are still completed, without a callback or a path.
+ */
+void NavRunPathRequests( void )
+{
+	if ( s_pendingPathRequests.Count() == 0 )
+		return;
+
+	VPROF( "NavRunPathRequests" );
+
+	CUtlVector< CNavPathRequest * > requests;
+	requests.Swap( s_pendingPathRequests );
+
+	if ( nav_pathfind_parallel.GetBool() && requests.Count() > 1 )
+	{
+		// the mesh can't change under the searches, the main thread waits for them here
+		ParallelProcess( "NavRunPathRequests", requests.Base(), requests.Count(), &RunPathRequest );
+	}
+	else
+	{
+		FOR_EACH_VEC( requests, i )
+		{
+			RunPathRequest( requests[i] );
+		}
+	}
+
+	Assert( s_dispatchingPathRequests == NULL );
+	s_dispatchingPathRequests = &requests;
+
+	FOR_EACH_VEC( requests, i )
+	{
+		CNavPathRequest *request = requests[i];
+		requests[i] = NULL;
+
+		request->Complete();
+		delete request;
+	}
+
+	s_dispatchingPathRequests = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The mesh is going away - drop the queued requests and the contexts sized for it
+ */
+void NavDiscardPathRequests( void )
+{
+	s_pendingPathRequests.PurgeAndDeleteElements();
+
+	// a callback is tearing down the mesh, the rest of its batch mustn't call back with the old areas
+	if ( s_dispatchingPathRequests )
+	{
+		FOR_EACH_VEC( *s_dispatchingPathRequests, i )
+		{
+			if ( s_dispatchingPathRequests->Element( i ) )
+			{
+				s_dispatchingPathRequests->Element( i )->Cancel();
+			}
+		}
+	}
+
+	CNavPathfindContext *context;
+	while( s_freePathfindContexts.PopItem( &context ) )
+	{
+		delete context;
+	}
+}
+
+#endif // MAPBASE
@@ -39,7 +39,17 @@ enum RouteType
 class ShortestPathCost
 {
 public:
+#ifdef MAPBASE
 	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return (*this)( area, fromArea, ladder, elevator, length, fromArea ? fromArea->GetCostSoFar() : 0.0f );
+	}
+
+	// Searches that keep their state in a CNavPathfindContext pass in fromArea's cost so far
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, float fromCostSoFar )
+#else
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+#endif
 	{
 		if ( fromArea == NULL )
 		{
@@ -64,7 +74,11 @@ public:
 				dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
 			}
 
+#ifdef MAPBASE
+			float cost = dist + fromCostSoFar;
+#else
 			float cost = dist + fromArea->GetCostSoFar();
+#endif
 
 			// if this is a "crouch" area, add penalty
 			if ( area->GetAttributes() & NAV_MESH_CROUCH )
@@ -85,6 +99,615 @@ public:
 	}
 };
 
+#ifdef MAPBASE
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search state for one path query, kept off the areas so several queries can run at once on
+ * different threads, each with its own context. Entries are indexed by area ID and stamped
+ * with the search they belong to, so starting a new search doesn't have to touch them.
+ * The open list is the same binary heap CNavArea uses, so searches expand areas in the same
+ * order either way. The mesh itself must not change while a search is running.
+ */
+class CNavPathfindContext
+{
+public:
+	CNavPathfindContext( void );
+
+	void ClearSearchLists( void );								// start a new search
+
+	bool IsOpen( const CNavArea *area ) const;
+	bool IsClosed( const CNavArea *area ) const;
+	void AddToOpenList( CNavArea *area );
+	void UpdateOnOpenList( CNavArea *area );
+	void AddToClosedList( CNavArea *area )				{ Touch( area ).marked = true; }
+	void RemoveFromClosedList( CNavArea *area )			{ }	// "closed" is marked and not open, like on the areas
+	bool IsOpenListEmpty( void ) const					{ return m_openHeap.Count() == 0; }
+	CNavArea *PopOpenList( void );
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area ) const	{ const SearchNode *node = Find( area ); return node ? node->parent : NULL; }
+	NavTraverseType GetParentHow( const CNavArea *area ) const	{ const SearchNode *node = Find( area ); return node ? (NavTraverseType)node->parentHow : NUM_TRAVERSE_TYPES; }
+
+	void SetTotalCost( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).totalCost = value; }
+	float GetTotalCost( const CNavArea *area ) const	{ const SearchNode *node = Find( area ); return node ? node->totalCost : 0.0f; }
+	void SetCostSoFar( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).costSoFar = value; }
+	float GetCostSoFar( const CNavArea *area ) const	{ const SearchNode *node = Find( area ); return node ? node->costSoFar : 0.0f; }
+	void SetPathLengthSoFar( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).pathLengthSoFar = value; }
+	float GetPathLengthSoFar( const CNavArea *area ) const	{ const SearchNode *node = Find( area ); return node ? node->pathLengthSoFar : 0.0f; }
+
+	// cost functors see fromArea's cost so far as an extra argument, since it isn't on the area
+	template< typename CostFunctor >
+	float ComputeCost( CostFunctor &costFunc, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return costFunc( area, fromArea, ladder, elevator, length, fromArea ? GetCostSoFar( fromArea ) : 0.0f );
+	}
+
+private:
+	struct SearchNode
+	{
+		unsigned int marker;									// this entry is part of the current search if it equals m_marker
+		int heapIndex;											// where the area is in m_openHeap, -1 if it isn't open
+		unsigned int openSequence;								// when the area was opened, so equal costs come off the heap first-in first-out
+		bool marked;											// visited - closed unless it's been reopened
+		unsigned char parentHow;
+		CNavArea *parent;
+		float totalCost;
+		float costSoFar;
+		float pathLengthSoFar;
+	};
+
+	SearchNode &Touch( const CNavArea *area );					// the area's entry, reset first if it's left over from an older search
+	const SearchNode *Find( const CNavArea *area ) const		// the area's entry, or NULL if this search hasn't reached it
+	{
+		unsigned int id = area->GetID();
+		if ( id >= (unsigned int)m_nodes.Count() || m_nodes[ id ].marker != m_marker )
+			return NULL;
+		return &m_nodes[ id ];
+	}
+
+	bool IsCheaper( const CNavArea *area, const CNavArea *other ) const;
+	void SiftUp( int index );
+	void SiftDown( int index );
+
+	CUtlVector< SearchNode > m_nodes;
+	CUtlVector< CNavArea * > m_openHeap;
+	unsigned int m_marker;
+	unsigned int m_openSequenceCounter;
+};
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavPathfindContext::SearchNode &CNavPathfindContext::Touch( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_nodes.Count() )
+	{
+		int oldCount = m_nodes.Count();
+		m_nodes.SetCount( id + 1 + id / 4 );
+		for( int i=oldCount; i<m_nodes.Count(); ++i )
+		{
+			m_nodes[i].marker = 0;
+		}
+	}
+
+	SearchNode &node = m_nodes[ id ];
+	if ( node.marker != m_marker )
+	{
+		node.marker = m_marker;
+		node.heapIndex = -1;
+		node.marked = false;
+		node.parentHow = NUM_TRAVERSE_TYPES;
+		node.parent = NULL;
+		node.totalCost = 0.0f;
+		node.costSoFar = 0.0f;
+		node.pathLengthSoFar = 0.0f;
+	}
+	return node;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavPathfindContext::IsOpen( const CNavArea *area ) const
+{
+	const SearchNode *node = Find( area );
+	return node && node->heapIndex >= 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavPathfindContext::IsClosed( const CNavArea *area ) const
+{
+	const SearchNode *node = Find( area );
+	return node && node->marked && node->heapIndex < 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavPathfindContext::SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	SearchNode &node = Touch( area );
+	node.parent = parent;
+	node.parentHow = how;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The search lists NavAreaBuildPath() has always used: state stored on the areas themselves and
+ * the open list shared by the whole mesh, so only one of these searches can run at a time.
+ */
+class CNavAreaSearchLists
+{
+public:
+	void ClearSearchLists( void )								{ CNavArea::ClearSearchLists(); }
+
+	bool IsOpen( const CNavArea *area ) const					{ return area->IsOpen(); }
+	bool IsClosed( const CNavArea *area ) const					{ return area->IsClosed(); }
+	void AddToOpenList( CNavArea *area )						{ area->AddToOpenList(); }
+	void UpdateOnOpenList( CNavArea *area )						{ area->UpdateOnOpenList(); }
+	void AddToClosedList( CNavArea *area )						{ area->AddToClosedList(); }
+	void RemoveFromClosedList( CNavArea *area )					{ area->RemoveFromClosedList(); }
+	bool IsOpenListEmpty( void ) const							{ return CNavArea::IsOpenListEmpty(); }
+	CNavArea *PopOpenList( void )								{ return CNavArea::PopOpenList(); }
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ area->SetParent( parent, how ); }
+	CNavArea *GetParent( const CNavArea *area ) const			{ return area->GetParent(); }
+
+	void SetTotalCost( CNavArea *area, float value )			{ area->SetTotalCost( value ); }
+	float GetTotalCost( const CNavArea *area ) const			{ return area->GetTotalCost(); }
+	void SetCostSoFar( CNavArea *area, float value )			{ area->SetCostSoFar( value ); }
+	float GetCostSoFar( const CNavArea *area ) const			{ return area->GetCostSoFar(); }
+	void SetPathLengthSoFar( CNavArea *area, float value )		{ area->SetPathLengthSoFar( value ); }
+	float GetPathLengthSoFar( const CNavArea *area ) const		{ return area->GetPathLengthSoFar(); }
+
+	template< typename CostFunctor >
+	float ComputeCost( CostFunctor &costFunc, CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return costFunc( area, fromArea, ladder, elevator, length );
+	}
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
+ * If cost functor returns -1 for an area, that area is considered a dead end.
+ * This doesn't actually build a path, but the path is defined by following parent
+ * pointers back from goalArea to startArea.
+ * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
+ * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
+ * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
+ * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
+ * Returns true if a path exists.
+ */
+#define IGNORE_NAV_BLOCKERS true
+template< typename CostFunctor, typename SearchLists >
+bool NavAreaBuildPathInternal( SearchLists &searchLists, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
+	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
+
+	if ( closestArea )
+	{
+		*closestArea = startArea;
+	}
+
+	// the debug counter and drawing aren't thread safe
+	bool isDebug = ThreadInMainThread() && ( g_DebugPathfindCounter-- > 0 );
+
+	if (startArea == NULL)
+		return false;
+
+	// start search - before anything's recorded in the lists, since a context forgets
+	// everything from the previous search when it starts a new one
+	searchLists.ClearSearchLists();
+
+	searchLists.SetParent( startArea, NULL );
+
+	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
+		goalArea = NULL;
+
+	if (goalArea == NULL && goalPos == NULL)
+		return false;
+
+	// if we are already in the goal area, build trivial path
+	if (startArea == goalArea)
+	{
+		return true;
+	}
+
+	// determine actual goal position
+	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
+
+	// compute estimate of path length
+	/// @todo Cost might work as "manhattan distance"
+	searchLists.SetTotalCost( startArea, (startArea->GetCenter() - actualGoalPos).Length() );
+
+	float initCost = searchLists.ComputeCost( costFunc, startArea, NULL, NULL, NULL, -1.0f );	
+	if (initCost < 0.0f)
+		return false;
+	searchLists.SetCostSoFar( startArea, initCost );
+	searchLists.SetPathLengthSoFar( startArea, 0.0 );
+
+	searchLists.AddToOpenList( startArea );
+
+	// keep track of the area we visit that is closest to the goal
+	float closestAreaDist = searchLists.GetTotalCost( startArea );
+
+	// do A* search
+	while( !searchLists.IsOpenListEmpty() )
+	{
+		// get next area to check
+		CNavArea *area = searchLists.PopOpenList();
+
+		if ( isDebug )
+		{
+			area->DrawFilled( 0, 255, 0, 128, 30.0f );
+		}
+
+		// don't consider blocked areas
+		if ( area->IsBlocked( teamID, ignoreNavBlockers ) )
+			continue;
+
+		// check if we have found the goal area or position
+		if (area == goalArea || (goalArea == NULL && goalPos && area->Contains( *goalPos )))
+		{
+			if (closestArea)
+			{
+				*closestArea = area;
+			}
+
+			return true;
+		}
+
+		// search adjacent areas
+		enum SearchType
+		{
+			SEARCH_FLOOR, SEARCH_LADDERS, SEARCH_ELEVATORS
+		};
+		SearchType searchWhere = SEARCH_FLOOR;
+		int searchIndex = 0;
+
+		int dir = NORTH;
+		const NavConnectVector *floorList = area->GetAdjacentAreas( NORTH );
+
+		bool ladderUp = true;
+		const NavLadderConnectVector *ladderList = NULL;
+		enum { AHEAD = 0, LEFT, RIGHT, BEHIND, NUM_TOP_DIRECTIONS };
+		int ladderTopDir = AHEAD;
+		bool bHaveMaxPathLength = ( maxPathLength > 0.0f );
+		float length = -1;
+		
+		while( true )
+		{
+			CNavArea *newArea = NULL;
+			NavTraverseType how;
+			const CNavLadder *ladder = NULL;
+			const CFuncElevator *elevator = NULL;
+
+			//
+			// Get next adjacent area - either on floor or via ladder
+			//
+			if ( searchWhere == SEARCH_FLOOR )
+			{
+				// if exhausted adjacent connections in current direction, begin checking next direction
+				if ( searchIndex >= floorList->Count() )
+				{
+					++dir;
+
+					if ( dir == NUM_DIRECTIONS )
+					{
+						// checked all directions on floor - check ladders next
+						searchWhere = SEARCH_LADDERS;
+
+						ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+						searchIndex = 0;
+						ladderTopDir = AHEAD;
+					}
+					else
+					{
+						// start next direction
+						floorList = area->GetAdjacentAreas( (NavDirType)dir );
+						searchIndex = 0;
+					}
+
+					continue;
+				}
+
+				const NavConnect &floorConnect = floorList->Element( searchIndex );
+				newArea = floorConnect.area;
+				length = floorConnect.length;
+				how = (NavTraverseType)dir;
+				++searchIndex;
+
+				if ( IsX360() && searchIndex < floorList->Count() )
+				{
+					PREFETCH360( floorList->Element( searchIndex ).area, 0  );
+				}
+			}
+			else if ( searchWhere == SEARCH_LADDERS )
+			{
+				if ( searchIndex >= ladderList->Count() )
+				{
+					if ( !ladderUp )
+					{
+						// checked both ladder directions - check elevators next
+						searchWhere = SEARCH_ELEVATORS;
+						searchIndex = 0;
+						ladder = NULL;
+					}
+					else
+					{
+						// check down ladders
+						ladderUp = false;
+						ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+						searchIndex = 0;
+					}
+					continue;
+				}
+
+				if ( ladderUp )
+				{
+					ladder = ladderList->Element( searchIndex ).ladder;
+
+					// do not use BEHIND connection, as its very hard to get to when going up a ladder
+					if ( ladderTopDir == AHEAD )
+					{
+						newArea = ladder->m_topForwardArea;
+					}
+					else if ( ladderTopDir == LEFT )
+					{
+						newArea = ladder->m_topLeftArea;
+					}
+					else if ( ladderTopDir == RIGHT )
+					{
+						newArea = ladder->m_topRightArea;
+					}
+					else
+					{
+						++searchIndex;
+						ladderTopDir = AHEAD;
+						continue;
+					}
+
+					how = GO_LADDER_UP;
+					++ladderTopDir;
+				}
+				else
+				{
+					newArea = ladderList->Element( searchIndex ).ladder->m_bottomArea;
+					how = GO_LADDER_DOWN;
+					ladder = ladderList->Element(searchIndex).ladder;
+					++searchIndex;
+				}
+
+				if ( newArea == NULL )
+					continue;
+
+				length = -1.0f;
+			}
+			else // if ( searchWhere == SEARCH_ELEVATORS )
+			{
+				const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+
+				elevator = area->GetElevator();
+
+				if ( elevator == NULL || searchIndex >= elevatorAreas.Count() )
+				{
+					// done searching connected areas
+					elevator = NULL;
+					break;
+				}
+
+				newArea = elevatorAreas[ searchIndex++ ].area;
+				if ( newArea->GetCenter().z > area->GetCenter().z )
+				{
+					how = GO_ELEVATOR_UP;
+				}
+				else
+				{
+					how = GO_ELEVATOR_DOWN;
+				}
+
+				length = -1.0f;
+			}
+
+
+			// don't backtrack
+			Assert( newArea );
+			if ( newArea == searchLists.GetParent( area ) )
+				continue;
+			if ( newArea == area ) // self neighbor?
+				continue;
+
+			// don't consider blocked areas
+			if ( newArea->IsBlocked( teamID, ignoreNavBlockers ) )
+				continue;
+
+			float newCostSoFar = searchLists.ComputeCost( costFunc, newArea, area, ladder, elevator, length );
+			
+			// check if cost functor says this area is a dead-end
+			if ( newCostSoFar < 0.0f )
+				continue;
+
+			// Safety check against a bogus functor.  The cost of the path
+			// A...B, C should always be at least as big as the path A...B.
+			Assert( newCostSoFar >= searchLists.GetCostSoFar( area ) );
+
+			// And now that we've asserted, let's be a bit more defensive.
+			// Make sure that any jump to a new area incurs some pathfinsing
+			// cost, to avoid us spinning our wheels over insignificant cost
+			// benefit, floating point precision bug, or busted cost functor.
+			float minNewCostSoFar = searchLists.GetCostSoFar( area ) * 1.00001 + 0.00001;
+			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
+				
+			// stop if path length limit reached
+			if ( bHaveMaxPathLength )
+			{
+				// keep track of path length so far
+				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
+				float newLengthSoFar = searchLists.GetPathLengthSoFar( area ) + deltaLength;
+				if ( newLengthSoFar > maxPathLength )
+					continue;
+				
+				searchLists.SetPathLengthSoFar( newArea, newLengthSoFar );
+			}
+
+			if ( ( searchLists.IsOpen( newArea ) || searchLists.IsClosed( newArea ) ) && searchLists.GetCostSoFar( newArea ) <= newCostSoFar )
+			{
+				// this is a worse path - skip it
+				continue;
+			}
+			else
+			{
+				// compute estimate of distance left to go
+				float distSq = ( newArea->GetCenter() - actualGoalPos ).LengthSqr();
+				float newCostRemaining = ( distSq > 0.0 ) ? FastSqrt( distSq ) : 0.0 ;
+
+				// track closest area to goal in case path fails
+				if ( closestArea && newCostRemaining < closestAreaDist )
+				{
+					*closestArea = newArea;
+					closestAreaDist = newCostRemaining;
+				}
+				
+				searchLists.SetCostSoFar( newArea, newCostSoFar );
+				searchLists.SetTotalCost( newArea, newCostSoFar + newCostRemaining );
+
+				if ( searchLists.IsClosed( newArea ) )
+				{
+					searchLists.RemoveFromClosedList( newArea );
+				}
+
+				if ( searchLists.IsOpen( newArea ) )
+				{
+					// area already on open list, update the list order to keep costs sorted
+					searchLists.UpdateOnOpenList( newArea );
+				}
+				else
+				{
+					searchLists.AddToOpenList( newArea );
+				}
+
+				searchLists.SetParent( newArea, area, how );
+			}
+		}
+
+		// we have searched this area
+		searchLists.AddToClosedList( area );
+	}
+
+	return false;
+}
+
+
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	CNavAreaSearchLists searchLists;
+	return NavAreaBuildPathInternal( searchLists, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Same search, but kept in 'context' instead of on the areas, so it can run on any thread as long
+ * as each thread has its own context. Follow the path with context.GetParent() instead of
+ * CNavArea::GetParent(). The cost functor is called with fromArea's cost so far as an extra
+ * argument (see ShortestPathCost), and must be safe to call from the thread the search runs on.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavPathfindContext &context, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	return NavAreaBuildPathInternal( context, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Path from an async NavAreaBuildPath request, handed to its callback on the main thread
+ */
+struct NavPathResult_t
+{
+	bool found;													// what NavAreaBuildPath() returned
+	CNavArea *closestArea;										// the goal if found, otherwise the area closest to it
+	CUtlVector< CNavArea * > areas;								// the start area first, through closestArea
+	CUtlVector< NavTraverseType > how;							// how[i] is how to get into areas[i] from areas[i-1]
+};
+
+typedef void (*NavPathCallback)( const NavPathResult_t &result, void *userData );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A queued path query. The search runs on a worker thread with its own CNavPathfindContext,
+ * the callback on the main thread.
+ */
+class CNavPathRequest
+{
+public:
+	CNavPathRequest( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, NavPathCallback callback, void *userData, float maxPathLength, int teamID, bool ignoreNavBlockers );
+	virtual ~CNavPathRequest() { }
+
+	void Run( CNavPathfindContext &context );					// do the search and collect the path
+	void Complete( void );										// call the callback with the result
+
+	void Abort( void )									{ m_isAborted = true; }
+	void Cancel( void )									{ m_callback = NULL; }		// complete without calling back
+	bool Uses( const CNavArea *area ) const;					// searches from or to it, or the path found goes through it
+	void *GetUserData( void ) const						{ return m_userData; }
+
+protected:
+	virtual bool Search( CNavPathfindContext &context ) = 0;
+
+	CNavArea *m_startArea;
+	CNavArea *m_goalArea;
+	Vector m_goalPos;
+	bool m_hasGoalPos;
+	float m_maxPathLength;
+	int m_teamID;
+	bool m_ignoreNavBlockers;
+	bool m_isAborted;
+
+	NavPathCallback m_callback;
+	void *m_userData;
+
+	NavPathResult_t m_result;
+};
+
+template< typename CostFunctor >
+class CNavPathRequestT : public CNavPathRequest
+{
+public:
+	CNavPathRequestT( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, NavPathCallback callback, void *userData, float maxPathLength, int teamID, bool ignoreNavBlockers )
+		: CNavPathRequest( startArea, goalArea, goalPos, callback, userData, maxPathLength, teamID, ignoreNavBlockers ), m_costFunc( costFunc )
+	{
+	}
+
+protected:
+	virtual bool Search( CNavPathfindContext &context )
+	{
+		return NavAreaBuildPath( context, m_startArea, m_goalArea, m_hasGoalPos ? &m_goalPos : NULL, m_costFunc, &m_result.closestArea, m_maxPathLength, m_teamID, m_ignoreNavBlockers );
+	}
+
+	CostFunctor m_costFunc;
+};
+
+extern void NavQueuePathRequest( CNavPathRequest *request );
+extern void NavCancelPathRequests( void *userData );			// drop queued requests with this user data without calling back
+extern void NavAbortPathRequests( const CNavArea *area );		// requests from, to or through this area report no path
+extern void NavRunPathRequests( void );							// run everything queued, called from CNavMesh::Update()
+extern void NavDiscardPathRequests( void );						// drop everything queued without calling back
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue a NavAreaBuildPath() for the next CNavMesh::Update(), which runs all queued requests in
+ * parallel on the thread pool and then calls each one's callback on the main thread.
+ * Use this for bots and NPCs that don't need the path this tick. The cost functor is copied
+ * and must be thread safe. Anything that goes away before then must cancel its requests with
+ * NavCancelPathRequests().
+ */
+template< typename CostFunctor >
+void NavAreaBuildPathAsync( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, NavPathCallback callback, void *userData, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	NavQueuePathRequest( new CNavPathRequestT< CostFunctor >( startArea, goalArea, goalPos, costFunc, callback, userData, maxPathLength, teamID, ignoreNavBlockers ) );
+}
+#else
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
@@ -413,6 +1036,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 	return false;
 }
+#endif
 
 
 //--------------------------------------------------------------------------------------------------------------
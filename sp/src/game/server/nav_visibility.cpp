@@ -0,0 +1,479 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compressed table of which nav areas can see each other, built from
+//			the visibility lists the areas load from the .nav file.
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "nav_mesh.h"
+#include "nav_visibility.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#ifdef MAPBASE
+
+//--------------------------------------------------------------------------------------------------------------
+static inline int CountBitsInWord( uint32 word )
+{
+	word = word - ( ( word >> 1 ) & 0x55555555 );
+	word = ( word & 0x33333333 ) + ( ( word >> 2 ) & 0x33333333 );
+	return ( ( ( word + ( word >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+static int __cdecl CompareVisibilityEntries( const NavVisibilityEntry_t *a, const NavVisibilityEntry_t *b )
+{
+	return a->index - b->index;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavVisibilityTable::CNavVisibilityTable( void )
+{
+	m_wordCount = 0;
+	m_generation = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavVisibilityTable::Reset( void )
+{
+	m_areas.Purge();
+	m_rows.Purge();
+	m_data.Purge();
+	m_wordCount = 0;
+	++m_generation;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Resolve each area's visibility list, and the list it inherits from, into a row of the table.
+ * The lists aren't needed once it's built - GetSaveList() recreates them for saving.
+ */
+void CNavVisibilityTable::Build( const CUtlVector< CNavArea * > &areas )
+{
+	Reset();
+
+	if ( areas.Count() == 0 )
+		return;
+
+	m_areas.CopyArray( areas.Base(), areas.Count() );
+	m_wordCount = CalcNumIntsForBits( m_areas.Count() );
+
+	FOR_EACH_VEC( m_areas, it )
+	{
+		m_areas[ it ]->m_visIndex = it;
+	}
+
+	// which row last had an entry for each area, so the first entry for an area wins like it does in the lists
+	CUtlVector< int > lastRow;
+	lastRow.SetCount( m_areas.Count() );
+	FOR_EACH_VEC( lastRow, it )
+	{
+		lastRow[ it ] = -1;
+	}
+
+	size_t listBytes = 0;
+	int denseRows = 0;
+
+	CUtlVector< NavVisibilityEntry_t > entries;
+	m_rows.EnsureCapacity( m_areas.Count() );
+
+	FOR_EACH_VEC( m_areas, it )
+	{
+		const CNavArea *area = m_areas[ it ];
+		entries.RemoveAll();
+
+		// our own list first, then whatever it doesn't mention from the area we inherit from
+		const CNavArea *source = area;
+		for ( int pass=0; pass<2 && source; ++pass, source = area->m_inheritVisibilityFrom.area )
+		{
+			const CNavArea::CAreaBindInfoArray &list = source->m_potentiallyVisibleAreas;
+			for ( int i=0; i<list.Count(); ++i )
+			{
+				const CNavArea *visibleArea = list[i].area;
+				if ( !visibleArea || GetArea( visibleArea->m_visIndex ) != visibleArea )
+					continue;
+
+				int index = visibleArea->m_visIndex;
+				if ( lastRow[ index ] == it )
+					continue;
+
+				lastRow[ index ] = it;
+
+				// NOT_VISIBLE entries only hide the inherited ones
+				if ( list[i].attributes == CNavArea::NOT_VISIBLE )
+					continue;
+
+				NavVisibilityEntry_t &entry = entries[ entries.AddToTail() ];
+				entry.index = index;
+				entry.attributes = list[i].attributes & ATTRIBUTE_MASK;
+			}
+		}
+
+		entries.Sort( CompareVisibilityEntries );
+		AddRow( entries );
+
+		if ( m_rows[ it ].runCount == DENSE_ROW )
+		{
+			++denseRows;
+		}
+	}
+
+	FOR_EACH_VEC( m_areas, it )
+	{
+		CNavArea *area = m_areas[ it ];
+
+		// Lookups only ever went one level deep, so an area inheriting from an area that inherits
+		// from another has been resolved against the middle area's list alone. Saving that as a
+		// delta from the middle area's resolved row would change it, so it gets saved in full.
+		if ( area->m_inheritVisibilityFrom.area && area->m_inheritVisibilityFrom.area->m_inheritVisibilityFrom.area )
+		{
+			area->m_inheritVisibilityFrom.area = NULL;
+		}
+
+		listBytes += area->m_potentiallyVisibleAreas.Count() * sizeof( CNavArea::AreaBindInfo );
+		area->m_potentiallyVisibleAreas.Purge();
+	}
+
+	m_data.Compact();
+
+	DevMsg( "Nav visibility table: %d areas, %d dense rows, %d KB (visibility lists were %d KB)\n",
+			m_areas.Count(), denseRows, (int)( GetMemoryUsage() / 1024 ), (int)( listBytes / 1024 ) );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Forget a deleted area. Its index stays allocated so the other rows don't have to be rewritten -
+ * they skip it from now on, since it no longer maps to an area.
+ */
+void CNavVisibilityTable::RemoveArea( const CNavArea *area )
+{
+	int index = area->m_visIndex;
+	if ( GetArea( index ) != area )
+		return;
+
+	m_areas[ index ] = NULL;
+	m_rows[ index ].runCount = 0;
+	++m_generation;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add a row made of the given entries, which are in index order, in whichever form is smaller
+ */
+void CNavVisibilityTable::AddRow( const CUtlVector< NavVisibilityEntry_t > &entries )
+{
+	Row &row = m_rows[ m_rows.AddToTail() ];
+	row.offset = m_data.Count();
+
+	int runCount = 0;
+	for ( int i=0; i<entries.Count(); ++i )
+	{
+		if ( i == 0 || entries[i].index != entries[ i-1 ].index + 1 || entries[i].attributes != entries[ i-1 ].attributes )
+		{
+			++runCount;
+		}
+	}
+
+	if ( runCount >= m_wordCount )
+	{
+		// as big as a pair of bit vectors - use those, they can be indexed directly
+		row.runCount = DENSE_ROW;
+
+		int base = m_data.AddMultipleToTail( 2 * m_wordCount );
+		V_memset( m_data.Base() + base, 0, 2 * m_wordCount * sizeof( uint32 ) );
+
+		uint32 *potentially = m_data.Base() + base;
+		uint32 *completely = potentially + m_wordCount;
+
+		for ( int i=0; i<entries.Count(); ++i )
+		{
+			int index = entries[i].index;
+			uint32 bit = 1 << ( index & ( BITS_PER_INT - 1 ) );
+
+			if ( entries[i].attributes & ~ATTRIBUTE_COMPLETELY_VISIBLE )
+			{
+				potentially[ index >> LOG2_BITS_PER_INT ] |= bit;
+			}
+
+			if ( entries[i].attributes & ATTRIBUTE_COMPLETELY_VISIBLE )
+			{
+				completely[ index >> LOG2_BITS_PER_INT ] |= bit;
+			}
+		}
+		return;
+	}
+
+	row.runCount = runCount;
+	m_data.EnsureCapacity( m_data.Count() + 2 * runCount );
+
+	for ( int i=0; i<entries.Count(); )
+	{
+		int first = i;
+		for ( ++i; i<entries.Count(); ++i )
+		{
+			if ( entries[i].index != entries[ i-1 ].index + 1 || entries[i].attributes != entries[ first ].attributes )
+				break;
+		}
+
+		m_data.AddToTail( entries[ first ].index );
+		m_data.AddToTail( ( ( i - first ) << ATTRIBUTE_BITS ) | entries[ first ].attributes );
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the VisibilityType of area 'to' from area 'from'
+ */
+unsigned char CNavVisibilityTable::GetVisibility( int from, int to ) const
+{
+	const Row &row = m_rows[ from ];
+	const uint32 *data = m_data.Base() + row.offset;
+
+	if ( row.runCount == DENSE_ROW )
+	{
+		int word = to >> LOG2_BITS_PER_INT;
+		uint32 bit = 1 << ( to & ( BITS_PER_INT - 1 ) );
+
+		unsigned char attributes = ( data[ word ] & bit ) ? ( ATTRIBUTE_MASK & ~ATTRIBUTE_COMPLETELY_VISIBLE ) : 0;
+		if ( data[ m_wordCount + word ] & bit )
+		{
+			attributes |= ATTRIBUTE_COMPLETELY_VISIBLE;
+		}
+		return attributes;
+	}
+
+	// find the last run starting at or before 'to'
+	int lo = 0;
+	int hi = (int)row.runCount - 1;
+	while ( lo <= hi )
+	{
+		int mid = ( lo + hi ) >> 1;
+		int first = data[ 2*mid ];
+
+		if ( to < first )
+		{
+			hi = mid - 1;
+		}
+		else if ( to >= first + (int)( data[ 2*mid + 1 ] >> ATTRIBUTE_BITS ) )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			return data[ 2*mid + 1 ] & ATTRIBUTE_MASK;
+		}
+	}
+
+	return 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Everything visible from 'from' - skipping areas that have been removed - in index order
+ */
+void CNavVisibilityTable::GetRow( int from, CUtlVector< NavVisibilityEntry_t > *entries ) const
+{
+	entries->RemoveAll();
+
+	const Row &row = m_rows[ from ];
+	const uint32 *data = m_data.Base() + row.offset;
+
+	if ( row.runCount == DENSE_ROW )
+	{
+		for ( int w=0; w<m_wordCount; ++w )
+		{
+			uint32 bits = data[w] | data[ m_wordCount + w ];
+			while ( bits )
+			{
+				int index = FirstBitInWord( bits, w << LOG2_BITS_PER_INT );
+				bits &= bits - 1;
+
+				if ( !m_areas[ index ] )
+					continue;
+
+				NavVisibilityEntry_t &entry = (*entries)[ entries->AddToTail() ];
+				entry.index = index;
+				entry.attributes = GetVisibility( from, index );
+			}
+		}
+		return;
+	}
+
+	for ( uint32 r=0; r<row.runCount; ++r )
+	{
+		int first = data[ 2*r ];
+		int count = data[ 2*r + 1 ] >> ATTRIBUTE_BITS;
+
+		for ( int i=first; i<first + count; ++i )
+		{
+			if ( !m_areas[i] )
+				continue;
+
+			NavVisibilityEntry_t &entry = (*entries)[ entries->AddToTail() ];
+			entry.index = i;
+			entry.attributes = data[ 2*r + 1 ] & ATTRIBUTE_MASK;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Fill in a bit vector for each VisibilityType bit of the row
+ */
+void CNavVisibilityTable::DecodeRow( int from, CVarBitVec *potentially, CVarBitVec *completely ) const
+{
+	potentially->Resize( m_areas.Count(), true );
+	completely->Resize( m_areas.Count(), true );
+
+	const Row &row = m_rows[ from ];
+	const uint32 *data = m_data.Base() + row.offset;
+
+	if ( row.runCount == DENSE_ROW )
+	{
+		V_memcpy( potentially->Base(), data, m_wordCount * sizeof( uint32 ) );
+		V_memcpy( completely->Base(), data + m_wordCount, m_wordCount * sizeof( uint32 ) );
+		return;
+	}
+
+	for ( uint32 r=0; r<row.runCount; ++r )
+	{
+		int first = data[ 2*r ];
+		int count = data[ 2*r + 1 ] >> ATTRIBUTE_BITS;
+		unsigned char attributes = data[ 2*r + 1 ] & ATTRIBUTE_MASK;
+
+		for ( int i=first; i<first + count; ++i )
+		{
+			if ( attributes & ~ATTRIBUTE_COMPLETELY_VISIBLE )
+			{
+				potentially->Set( i );
+			}
+
+			if ( attributes & ATTRIBUTE_COMPLETELY_VISIBLE )
+			{
+				completely->Set( i );
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * OR everything visible from 'from' into 'potentially', and everything completely visible into 'completely'
+ */
+void CNavVisibilityTable::AddRowToSets( int from, CVarBitVec *potentially, CVarBitVec *completely ) const
+{
+	Assert( potentially->GetNumBits() == m_areas.Count() && completely->GetNumBits() == m_areas.Count() );
+
+	const Row &row = m_rows[ from ];
+	const uint32 *data = m_data.Base() + row.offset;
+
+	if ( row.runCount == DENSE_ROW )
+	{
+		uint32 *potentiallyWords = potentially->Base();
+		uint32 *completelyWords = completely->Base();
+
+		for ( int w=0; w<m_wordCount; ++w )
+		{
+			potentiallyWords[w] |= data[w] | data[ m_wordCount + w ];
+			completelyWords[w] |= data[ m_wordCount + w ];
+		}
+		return;
+	}
+
+	for ( uint32 r=0; r<row.runCount; ++r )
+	{
+		int first = data[ 2*r ];
+		int count = data[ 2*r + 1 ] >> ATTRIBUTE_BITS;
+		bool isCompletelyVisible = ( data[ 2*r + 1 ] & ATTRIBUTE_COMPLETELY_VISIBLE ) != 0;
+
+		for ( int i=first; i<first + count; ++i )
+		{
+			potentially->Set( i );
+
+			if ( isCompletelyVisible )
+			{
+				completely->Set( i );
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the number of areas whose visibility from 'from' and 'other' differs - the length of
+ * the delta list 'from' would need to inherit from 'other'
+ */
+int CNavVisibilityTable::CountDifferences( int from, int other ) const
+{
+	CVarBitVec fromPotentially, fromCompletely;
+	CVarBitVec otherPotentially, otherCompletely;
+
+	DecodeRow( from, &fromPotentially, &fromCompletely );
+	DecodeRow( other, &otherPotentially, &otherCompletely );
+
+	int count = 0;
+	for ( int w=0; w<m_wordCount; ++w )
+	{
+		count += CountBitsInWord( ( fromPotentially.GetDWord( w ) ^ otherPotentially.GetDWord( w ) ) |
+								  ( fromCompletely.GetDWord( w ) ^ otherCompletely.GetDWord( w ) ) );
+	}
+
+	return count;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Recreate the visibility list the .nav file stores for area 'from'. If 'anchor' isn't -1 it's the
+ * delta from that area's row - what differs, and NOT_VISIBLE for what the anchor sees and we don't.
+ */
+void CNavVisibilityTable::GetSaveList( int from, int anchor, CUtlVector< NavVisibilityEntry_t > *entries ) const
+{
+	GetRow( from, entries );
+
+	if ( anchor < 0 )
+		return;
+
+	CUtlVector< NavVisibilityEntry_t > visible;
+	CUtlVector< NavVisibilityEntry_t > inherited;
+	visible.Swap( *entries );
+	GetRow( anchor, &inherited );
+
+	// both rows are in index order
+	int i = 0;
+	FOR_EACH_VEC( visible, it )
+	{
+		while ( i < inherited.Count() && inherited[i].index < visible[ it ].index )
+			++i;
+
+		if ( i == inherited.Count() || inherited[i].index != visible[ it ].index || inherited[i].attributes != visible[ it ].attributes )
+		{
+			entries->AddToTail( visible[ it ] );
+		}
+	}
+
+	i = 0;
+	FOR_EACH_VEC( inherited, it )
+	{
+		while ( i < visible.Count() && visible[i].index < inherited[ it ].index )
+			++i;
+
+		if ( i == visible.Count() || visible[i].index != inherited[ it ].index )
+		{
+			NavVisibilityEntry_t &entry = (*entries)[ entries->AddToTail() ];
+			entry.index = inherited[ it ].index;
+			entry.attributes = CNavArea::NOT_VISIBLE;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+size_t CNavVisibilityTable::GetMemoryUsage( void ) const
+{
+	return m_areas.NumAllocated() * sizeof( CNavArea * ) + m_rows.NumAllocated() * sizeof( Row ) + m_data.NumAllocated() * sizeof( uint32 );
+}
+
+#endif // MAPBASE
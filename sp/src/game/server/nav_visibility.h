@@ -0,0 +1,154 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compressed table of which nav areas can see each other, built from
+//			the visibility lists the areas load from the .nav file.
+//
+//=============================================================================//
+
+#ifndef _NAV_VISIBILITY_H_
+#define _NAV_VISIBILITY_H_
+
+#include "utlvector.h"
+#include "bitvec.h"
+
+class CNavArea;
+
+#ifdef MAPBASE
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * One area in a visibility table row, and its CNavArea::VisibilityType bits
+ */
+struct NavVisibilityEntry_t
+{
+	int index;
+	unsigned char attributes;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The potentially visible areas of every area, with inheritance already resolved.
+ *
+ * Each area gets an index when the table is built, and each area's row is kept
+ * in whichever of two forms is smaller:
+ *
+ *   - runs of consecutive indices with the same attributes, as (first index, count << 2 | attributes)
+ *     word pairs, which are binary searched
+ *   - two bit vectors over all the indices, one for each VisibilityType bit, which are indexed directly
+ *
+ * Rows can be OR'd into bit vectors a word at a time, for finding everything a group
+ * of areas can see at once.
+ *
+ * Deleted areas keep their index, with a NULL area and an empty row, until the table is rebuilt.
+ */
+class CNavVisibilityTable
+{
+public:
+	CNavVisibilityTable( void );
+
+	void Reset( void );
+	void Build( const CUtlVector< CNavArea * > &areas );		// build from the areas' visibility lists, and free the lists
+	void RemoveArea( const CNavArea *area );					// the area is being deleted - drop its row, and it from the other rows
+
+	bool IsBuilt( void ) const				{ return m_areas.Count() > 0; }
+	int GetAreaCount( void ) const			{ return m_areas.Count(); }
+	unsigned int GetGeneration( void ) const	{ return m_generation; }	// changes each time the table is built, reset, or loses an area
+
+	CNavArea *GetArea( int index ) const	{ return ( index >= 0 && index < m_areas.Count() ) ? m_areas[ index ] : NULL; }
+
+	unsigned char GetVisibility( int from, int to ) const;			// VisibilityType of area 'to' from area 'from'
+
+	void GetRow( int from, CUtlVector< NavVisibilityEntry_t > *entries ) const;		// everything visible from 'from', in index order
+	void AddRowToSets( int from, CVarBitVec *potentially, CVarBitVec *completely ) const;	// OR what's visible from 'from' into the given sets, each sized GetAreaCount()
+	int CountDifferences( int from, int other ) const;					// number of areas whose visibility from the two differs
+
+	// the visibility list the .nav file stores for area 'from', as a delta from 'anchor' if it's valid
+	void GetSaveList( int from, int anchor, CUtlVector< NavVisibilityEntry_t > *entries ) const;
+
+	size_t GetMemoryUsage( void ) const;
+
+	template < typename Functor >
+	bool ForEachVisibleArea( int from, bool completelyOnly, Functor &func ) const;
+
+private:
+	struct Row
+	{
+		uint32 offset;				// into m_data
+		uint32 runCount;			// number of runs, or DENSE_ROW
+	};
+
+	enum
+	{
+		DENSE_ROW = 0xFFFFFFFF,
+		ATTRIBUTE_BITS = 2,
+		ATTRIBUTE_MASK = ( 1 << ATTRIBUTE_BITS ) - 1,
+		ATTRIBUTE_COMPLETELY_VISIBLE = 0x02,		// same as CNavArea::COMPLETELY_VISIBLE
+	};
+
+	void AddRow( const CUtlVector< NavVisibilityEntry_t > &entries );
+
+	void DecodeRow( int from, CVarBitVec *potentially, CVarBitVec *completely ) const;
+
+	CUtlVector< CNavArea * > m_areas;
+	CUtlVector< Row > m_rows;
+	CUtlVector< uint32 > m_data;
+	int m_wordCount;				// words in a dense row's bit vector
+	unsigned int m_generation;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Apply the functor to every area visible from 'from' (completely visible, if 'completelyOnly').
+ * Returns false if the functor did.
+ */
+template < typename Functor >
+inline bool CNavVisibilityTable::ForEachVisibleArea( int from, bool completelyOnly, Functor &func ) const
+{
+	const Row &row = m_rows[ from ];
+	const uint32 *data = m_data.Base() + row.offset;
+
+	if ( row.runCount == DENSE_ROW )
+	{
+		const uint32 *potentially = data;
+		const uint32 *completely = data + m_wordCount;
+
+		for ( int w=0; w<m_wordCount; ++w )
+		{
+			uint32 bits = ( completelyOnly ) ? completely[w] : ( potentially[w] | completely[w] );
+			while ( bits )
+			{
+				int index = FirstBitInWord( bits, w << LOG2_BITS_PER_INT );
+				bits &= bits - 1;
+
+				if ( m_areas[ index ] && func( m_areas[ index ] ) == false )
+					return false;
+			}
+		}
+	}
+	else
+	{
+		for ( uint32 r=0; r<row.runCount; ++r )
+		{
+			int first = data[ 2*r ];
+			int count = data[ 2*r + 1 ] >> ATTRIBUTE_BITS;
+			unsigned char attributes = data[ 2*r + 1 ] & ATTRIBUTE_MASK;
+
+			if ( completelyOnly && ( attributes & ATTRIBUTE_COMPLETELY_VISIBLE ) == 0 )
+				continue;
+
+			for ( int i=first; i<first + count; ++i )
+			{
+				if ( m_areas[i] && func( m_areas[i] ) == false )
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+#endif // MAPBASE
+
+#endif // _NAV_VISIBILITY_H_
@@ -41,6 +41,14 @@ public:
 
 };
 
+// two packets of four rays, traced together by RayTracingEnvironment::Trace8Rays. Each packet
+// is exactly what would be passed to Trace4Rays on its own.
+class EightRays
+{
+public:
+	FourRays packets[2];									// rays 0-3 and 4-7
+};
+
 /// The format a triangle is stored in for intersections. size of this structure is important.
 /// This structure can be in one of two forms. Before the ray tracing environment is set up, the
 /// ProjectedEdgeEquations hold the coordinates of the 3 vertices, for facilitating bounding box
@@ -220,6 +228,9 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_BINNED_SAH_BUILD 8						// build the kd-tree with binned SAH on all cores
+#define RTE_FLAGS_VEB_LAYOUT 16								// reorder the kd-tree's nodes in van Emde Boas order
+#define RTE_FLAGS_DISABLE_AVX 32							// Trace8Rays traces two 4 ray packets even on AVX cpus
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -232,9 +243,9 @@ class RayStream
 {
 	friend class RayTracingEnvironment;
 
-	RayTracingSingleResult *PendingStreamOutputs[8][4];
+	RayTracingSingleResult *PendingStreamOutputs[8][8];
 	int n_in_stream[8];
-	FourRays PendingRays[8];
+	EightRays PendingRays[8];
 
 public:
 	RayStream(void)
@@ -257,6 +268,8 @@ class RayTracingEnvironment
 {
 public:
 	uint32 Flags;											// RTE_FLAGS_xxx above
+	int m_nBuildThreads;									// threads for RTE_FLAGS_BINNED_SAH_BUILD. 0 = one per core
+	bool m_bTraceAVX;										// Trace8Rays can use AVX. set up by SetupAccelerationStructure
 	Vector m_MinBound;
 	Vector m_MaxBound;
 
@@ -273,6 +286,8 @@ public:
 	{
 		BackgroundColor.DuplicateVector(Vector(1,0,0));		// red
 		Flags=0;
+		m_nBuildThreads=0;
+		m_bTraceAVX=false;
 	}
 
 
@@ -310,6 +325,19 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// fire 8 rays through the scene as two 4 ray packets. TMin, TMax, rslt_out and
+	// ppCallbacks (if not NULL) hold one entry per packet. On cpus with AVX, packets
+	// with the same direction signs are traced together, giving the same results as
+	// tracing each one with Trace4Rays.
+	void Trace8Rays(const EightRays &rays, fltx4 const *TMin, fltx4 const *TMax,
+					RayTracingResult *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback **ppCallbacks = NULL);
+
+	// same, for when all 8 rays are known to have the direction signs in DirectionSignMask
+	void Trace8Rays(const EightRays &rays, fltx4 const *TMin, fltx4 const *TMax,
+					int DirectionSignMask, RayTracingResult *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback **ppCallbacks = NULL);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -330,7 +358,7 @@ public:
 					 
 	/// raytracing stream - lets you trace an array of rays by feeding them to this function.
 	/// results will not be returned until FinishStream is called. This function handles sorting
-	/// the rays by direction, tracing them 4 at a time, and de-interleaving the results.
+	/// the rays by direction, tracing them 8 at a time, and de-interleaving the results.
 
 	void AddToRayStream(RayStream &s,
 						Vector const &start,Vector const &end,RayTracingSingleResult *rslt_out);
@@ -356,6 +384,26 @@ public:
 	void CalculateTriangleListBounds(int32 const *tris,int ntris,
 									 Vector &minout, Vector &maxout);
 
+	// renumbers the kd-tree's nodes so that each subtree of half the tree's height is
+	// contiguous in memory, recursively. sibling nodes stay next to each other.
+	void ReorderKDTreeVEB(void);
+
+	// node count, leaf count, deepest leaf and total triangle references in the leaves
+	void GetKDTreeStats(int &nNodes, int &nLeaves, int &nMaxDepth, int &nTriangleRefs) const;
+
+	// CRC of the triangles added so far and the flags that affect the kd-tree build. call
+	// before SetupAccelerationStructure.
+	uint32 GetGeometryCRC(void) const;
+
+	// writes the kd-tree and the intersection format triangles to a cache file once
+	// SetupAccelerationStructure is done. nKey identifies the geometry they were built from.
+	bool SaveAccelerationStructure(const char *pFileName, uint32 nKey) const;
+
+	// reads back a cache file written for the same triangles instead of calling
+	// SetupAccelerationStructure. fails, leaving the environment untouched, if the file is
+	// missing or its key or triangle count doesn't match.
+	bool LoadAccelerationStructure(const char *pFileName, uint32 nKey);
+
 	void AddInfinitePointLight(Vector position,				// light center
 							   Vector intensity);			// rgb amount
 
@@ -5,6 +5,9 @@
 #include <filesystem_tools.h>
 #include <cmdlib.h>
 #include <stdio.h>
+#include <immintrin.h>
+#include "tier1/processor_detect.h"
+#include "tier1/checksum_crc.h"
 
 static bool SameSign(float a, float b)
 {
@@ -599,6 +602,323 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 }
 
 
+//-----------------------------------------------------------------------------
+// 8-wide tracing. The two packets are traversed together, with each node and
+// stack entry recording which of them would have visited it in Trace4Rays. A
+// packet only intersects triangles in its own leaves, stops when Trace4Rays
+// would have returned, and does the same floating point operations on each
+// ray, so the results are identical to tracing the packets separately.
+//-----------------------------------------------------------------------------
+#ifdef __GNUC__
+#define AVX_FUNC __attribute__(( target( "avx" ) ))
+#else
+#define AVX_FUNC
+#endif
+
+struct NodeToVisit8 {
+	CacheOptimizedKDNode const *node;
+	__m256 TMin;
+	__m256 TMax;
+	int packets;											// which of the 2 packets visit it
+};
+
+static inline AVX_FUNC __m256 CombinePackets(const fltx4 &lo, const fltx4 &hi)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo),hi,1);
+}
+
+static inline AVX_FUNC fltx4 PacketOf(const __m256 &v, int packet)
+{
+	return packet ? _mm256_extractf128_ps(v,1) : _mm256_castps256_ps128(v);
+}
+
+// mask of packets that have any lanes set
+static inline AVX_FUNC int PacketsWithAnyLane(const __m256 &v)
+{
+	int lanes=_mm256_movemask_ps(v);
+	return ((lanes & 0x0f) ? 1 : 0) | ((lanes & 0xf0) ? 2 : 0);
+}
+
+static inline AVX_FUNC __m256 LanesOfPackets(int packets)
+{
+	return _mm256_castsi256_ps(_mm256_set_epi32(
+		-(packets>>1),-(packets>>1),-(packets>>1),-(packets>>1),
+		-(packets&1),-(packets&1),-(packets&1),-(packets&1)));
+}
+
+static inline AVX_FUNC __m256 Select8(const __m256 &mask, const __m256 &a, const __m256 &b)
+{
+	// mask ? a : b
+	return _mm256_or_ps(_mm256_and_ps(a,mask),_mm256_andnot_ps(mask,b));
+}
+
+static AVX_FUNC void Trace8RaysAVX(RayTracingEnvironment *pEnv, const EightRays &rays,
+								   fltx4 const *TMin4, fltx4 const *TMax4, int DirectionSignMask,
+								   RayTracingResult *rslt_out, int32 skip_id,
+								   ITransparentTriangleCallback **ppCallbacks)
+{
+	__m256 HitIds=_mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	__m256 HitDistance=_mm256_set1_ps(1.0e23);
+	__m256 Normal[3];
+	__m256 Origin[3];
+	__m256 Direction[3];
+	__m256 OneOverRayDir[3];
+
+	FourVectors OneOverRayDir4[2];
+	for(int p=0;p<2;p++)
+	{
+		OneOverRayDir4[p]=rays.packets[p].direction;
+		OneOverRayDir4[p].MakeReciprocalSaturate();
+	}
+	for(int c=0;c<3;c++)
+	{
+		Normal[c]=_mm256_setzero_ps();
+		Origin[c]=CombinePackets(rays.packets[0].origin[c],rays.packets[1].origin[c]);
+		Direction[c]=CombinePackets(rays.packets[0].direction[c],rays.packets[1].direction[c]);
+		OneOverRayDir[c]=CombinePackets(OneOverRayDir4[0][c],OneOverRayDir4[1][c]);
+	}
+
+	// now, clip rays against bounding box
+	__m256 TMin=CombinePackets(TMin4[0],TMin4[1]);
+	__m256 TMax=CombinePackets(TMax4[0],TMax4[1]);
+	for(int c=0;c<3;c++)
+	{
+		__m256 isect_min_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(pEnv->m_MinBound[c]),Origin[c]),OneOverRayDir[c]);
+		__m256 isect_max_t=
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(pEnv->m_MaxBound[c]),Origin[c]),OneOverRayDir[c]);
+		TMin=_mm256_max_ps(TMin,_mm256_min_ps(isect_min_t,isect_max_t));
+		TMax=_mm256_min_ps(TMax,_mm256_max_ps(isect_min_t,isect_max_t));
+	}
+	// packets that haven't finished. a packet that misses the bounding box is done already
+	int active_packets=PacketsWithAnyLane(_mm256_cmp_ps(TMin,TMax,_CMP_LE_OS));
+
+	int32 mailboxids[2][MAILBOX_HASH_SIZE];					// one per packet, since they don't
+	memset(mailboxids,0xff,sizeof(mailboxids));				// visit the same leaves
+
+	int front_idx[3],back_idx[3];
+	for(int c=0;c<3;c++)
+	{
+		back_idx[c]=(DirectionSignMask & (1<<c)) ? 0 : 1;
+		front_idx[c]=1-back_idx[c];
+	}
+
+	const __m256 Epsilons=CombinePackets(FourEpsilons,FourEpsilons);
+	const __m256 Zeros=CombinePackets(FourZeros,FourZeros);
+	const __m256 NegativeEpsilons=CombinePackets(FourNegativeEpsilons,FourNegativeEpsilons);
+	const __m256 Ones=CombinePackets(Four_Ones,Four_Ones);
+
+	NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+	NodeToVisit8 *stack_ptr=&NodeQueue[MAX_NODE_STACK_LEN];
+	CacheOptimizedKDNode const *CurNode=&(pEnv->OptimizedKDTree[0]);
+	int packets=active_packets;
+	while(active_packets)
+	{
+		while (CurNode->NodeType() != KDNODE_STATE_LEAF)		// traverse until next leaf
+		{
+			int split_plane_number=CurNode->NodeType();
+			CacheOptimizedKDNode const *FrontChild=&(pEnv->OptimizedKDTree[CurNode->LeftChild()]);
+
+			__m256 dist_to_sep_plane=						// dist=(split-org)/dir
+				_mm256_mul_ps(
+					_mm256_sub_ps(_mm256_set1_ps(CurNode->SplittingPlaneValue),
+								  Origin[split_plane_number]),OneOverRayDir[split_plane_number]);
+			__m256 activeLocl=_mm256_cmp_ps(TMin,TMax,_CMP_LE_OS);
+
+			// a packet that misses the front only visits the back. one that hits it also
+			// visits the back if it hits that too
+			int front_packets=packets & PacketsWithAnyLane(
+				_mm256_and_ps(activeLocl,_mm256_cmp_ps(dist_to_sep_plane,TMin,_CMP_GE_OS)));
+			int back_packets=packets & ( ~front_packets | PacketsWithAnyLane(
+				_mm256_and_ps(activeLocl,_mm256_cmp_ps(dist_to_sep_plane,TMax,_CMP_LE_OS))));
+			if (! front_packets)
+			{
+				CurNode=FrontChild+back_idx[split_plane_number];
+				TMin=_mm256_max_ps(TMin,dist_to_sep_plane);
+			}
+			else if (! back_packets)
+			{
+				CurNode=FrontChild+front_idx[split_plane_number];
+				TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+				packets=front_packets;
+			}
+			else
+			{
+				// push far, traverse near
+				assert(stack_ptr>NodeQueue);
+				--stack_ptr;
+				stack_ptr->node=FrontChild+back_idx[split_plane_number];
+				stack_ptr->TMin=_mm256_max_ps(TMin,dist_to_sep_plane);
+				stack_ptr->TMax=TMax;
+				stack_ptr->packets=back_packets;
+				CurNode=FrontChild+front_idx[split_plane_number];
+				TMax=_mm256_min_ps(TMax,dist_to_sep_plane);
+				packets=front_packets;
+			}
+		}
+		// hit a leaf! must do intersection check
+		int ntris=CurNode->NumberOfTrianglesInLeaf();
+		if (ntris)
+		{
+			int32 const *tlist=&(pEnv->TriangleIndexList[CurNode->TriangleIndexStart()]);
+			do
+			{
+				int tnum=*(tlist++);
+				// check mailboxes
+				int mbox_slot=tnum & (MAILBOX_HASH_SIZE-1);
+				TriIntersectData_t const *tri = &( pEnv->OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( tri->m_nTriangleID == skip_id )
+					continue;
+				int test_packets=0;
+				for(int p=0;p<2;p++)
+				{
+					if ( ( packets & (1<<p) ) && ( mailboxids[p][mbox_slot] != tnum ) )
+					{
+						mailboxids[p][mbox_slot] = tnum;
+						test_packets |= 1<<p;
+					}
+				}
+				if (! test_packets)
+					continue;
+
+				// compute plane intersection
+				__m256 N[3];
+				N[0] = _mm256_set1_ps( tri->m_flNx );
+				N[1] = _mm256_set1_ps( tri->m_flNy );
+				N[2] = _mm256_set1_ps( tri->m_flNz );
+
+				__m256 DDotN = _mm256_mul_ps( Direction[0], N[0] );
+				DDotN = _mm256_add_ps( _mm256_mul_ps( Direction[1], N[1] ), DDotN );
+				DDotN = _mm256_add_ps( _mm256_mul_ps( Direction[2], N[2] ), DDotN );
+				// mask off zero or near zero (ray parallel to surface)
+				__m256 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Epsilons, _CMP_GT_OS ),
+											   _mm256_cmp_ps( DDotN, NegativeEpsilons, _CMP_LT_OS ) );
+
+				__m256 ODotN = _mm256_mul_ps( Origin[0], N[0] );
+				ODotN = _mm256_add_ps( _mm256_mul_ps( Origin[1], N[1] ), ODotN );
+				ODotN = _mm256_add_ps( _mm256_mul_ps( Origin[2], N[2] ), ODotN );
+				__m256 numerator = _mm256_sub_ps( _mm256_set1_ps( tri->m_flD ), ODotN );
+
+				__m256 isect_t = _mm256_div_ps( numerator, DDotN );
+				// now, we have the distance to the plane. lets update our mask
+				did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Zeros, _CMP_GT_OS ) );
+				did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, HitDistance, _CMP_LT_OS ) );
+				did_hit = _mm256_and_ps( did_hit, LanesOfPackets( test_packets ) );
+
+				if ( ! _mm256_movemask_ps( did_hit ) )
+					continue;
+
+				// now, check 3 edges
+				__m256 hitc1 = _mm256_add_ps( Origin[tri->m_nCoordSelect0],
+											  _mm256_mul_ps( isect_t, Direction[tri->m_nCoordSelect0] ) );
+				__m256 hitc2 = _mm256_add_ps( Origin[tri->m_nCoordSelect1],
+											  _mm256_mul_ps( isect_t, Direction[tri->m_nCoordSelect1] ) );
+
+				// do barycentric coordinate check
+				__m256 B0 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+				B0 = _mm256_add_ps( B0, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+				B0 = _mm256_add_ps( B0, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[2] ) );
+				did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Zeros, _CMP_GE_OS ) );
+
+				__m256 B1 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+				B1 = _mm256_add_ps( B1, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[4] ), hitc2 ) );
+				B1 = _mm256_add_ps( B1, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[5] ) );
+				did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Zeros, _CMP_GE_OS ) );
+
+				__m256 B2 = _mm256_add_ps( B1, B0 );
+				did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Ones, _CMP_LE_OS ) );
+
+				if ( ! _mm256_movemask_ps( did_hit ) )
+					continue;
+
+				// if the triangle is transparent, each packet's callback sees what it would
+				// have in Trace4Rays
+				if ( ( tri->m_nFlags & FCACHETRI_TRANSPARENT ) && ppCallbacks )
+				{
+					__m256 b2 = _mm256_sub_ps( Ones, B2 );
+					fltx4 hit4[2];
+					for(int p=0;p<2;p++)
+					{
+						hit4[p] = PacketOf( did_hit, p );
+						if ( ppCallbacks[p] && IsAnyNegative( hit4[p] ) )
+						{
+							// same 1, 2, 0 order as Trace4Rays
+							fltx4 B1_4 = PacketOf( B1, p );
+							fltx4 b2_4 = PacketOf( b2, p );
+							fltx4 B0_4 = PacketOf( B0, p );
+							if ( ppCallbacks[p]->VisitTriangle_ShouldContinue( *tri, rays.packets[p], &hit4[p], &B1_4, &b2_4, &B0_4, tnum ) )
+							{
+								hit4[p] = Four_Zeros;
+							}
+						}
+					}
+					did_hit = CombinePackets( hit4[0], hit4[1] );
+				}
+				// now, set the hit_id and closest_hit fields for any enabled rays
+				HitIds = Select8( did_hit, _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) ), HitIds );
+				HitDistance = Select8( did_hit, isect_t, HitDistance );
+				for(int c=0;c<3;c++)
+					Normal[c] = Select8( did_hit, N[c], Normal[c] );
+			} while (--ntris);
+			// now, check if all rays of each packet have terminated
+			int unfinished_packets=PacketsWithAnyLane(_mm256_cmp_ps(TMax,HitDistance,_CMP_LE_OS));
+			active_packets &= ~( packets & ~unfinished_packets );
+		}
+
+		// pop the next node that an unfinished packet visits
+		while ( ( stack_ptr!=&NodeQueue[MAX_NODE_STACK_LEN] ) && !( stack_ptr->packets & active_packets ) )
+			stack_ptr++;
+		if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+			break;
+		CurNode=stack_ptr->node;
+		TMin=stack_ptr->TMin;
+		TMax=stack_ptr->TMax;
+		packets=stack_ptr->packets & active_packets;
+		stack_ptr++;
+	}
+
+	for(int p=0;p<2;p++)
+	{
+		StoreAlignedSIMD((float *) rslt_out[p].HitIds,PacketOf(HitIds,p));
+		rslt_out[p].HitDistance=PacketOf(HitDistance,p);
+		rslt_out[p].surface_normal.x=PacketOf(Normal[0],p);
+		rslt_out[p].surface_normal.y=PacketOf(Normal[1],p);
+		rslt_out[p].surface_normal.z=PacketOf(Normal[2],p);
+	}
+	_mm256_zeroupper();
+}
+
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, fltx4 const *TMin, fltx4 const *TMax,
+									   RayTracingResult *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	int msk=rays.packets[0].CalculateDirectionSignMask();
+	if ( ( msk!=-1 ) && ( msk==rays.packets[1].CalculateDirectionSignMask() ) )
+		Trace8Rays(rays,TMin,TMax,msk,rslt_out,skip_id,ppCallbacks);
+	else
+	{
+		for(int p=0;p<2;p++)
+			Trace4Rays(rays.packets[p],TMin[p],TMax[p],&rslt_out[p],skip_id,ppCallbacks ? ppCallbacks[p] : NULL);
+	}
+}
+
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, fltx4 const *TMin, fltx4 const *TMax,
+									   int DirectionSignMask, RayTracingResult *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	if ( m_bTraceAVX )
+	{
+		rays.packets[0].Check();
+		rays.packets[1].Check();
+		Trace8RaysAVX(this,rays,TMin,TMax,DirectionSignMask,rslt_out,skip_id,ppCallbacks);
+	}
+	else
+	{
+		for(int p=0;p<2;p++)
+			Trace4Rays(rays.packets[p],TMin[p],TMax[p],DirectionSignMask,&rslt_out[p],skip_id,ppCallbacks ? ppCallbacks[p] : NULL);
+	}
+}
+
 int RayTracingEnvironment::MakeLeafNode(int first_tri, int last_tri)
 {
 	CacheOptimizedKDNode ret;
@@ -876,24 +1196,667 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 }
 
 
-void RayTracingEnvironment::SetupAccelerationStructure(void)
+//-----------------------------------------------------------------------------
+// Binned SAH builder for RTE_FLAGS_BINNED_SAH_BUILD.
+//
+// RefineNode() above evaluates the exact cost of a few dozen candidate planes per
+// axis, each of which is a pass over every triangle in the node. This instead drops
+// each triangle's extent along an axis into a fixed number of bins, reads the cost
+// of every bin boundary off running sums, and only classifies the triangles exactly
+// against the winning plane. It uses the same cost model, leaf criteria and empty
+// space growing as RefineNode().
+//
+// The top of the tree is built on the calling thread. Subtrees below a size
+// threshold are handed out to worker threads, which build them into their own node
+// and index lists; those are spliced into the environment's lists in a fixed order
+// afterwards, so the result doesn't depend on thread timing.
+//-----------------------------------------------------------------------------
+#define KDBUILD_NUM_BINS 32
+#define KDBUILD_MIN_JOB_TRIS 512
+
+struct KDBuildJob_t
+{
+	int m_nNode;											// node in OptimizedKDTree the subtree's root goes in
+	CUtlVector<int32> m_Tris;
+	Vector m_MinBound;
+	Vector m_MaxBound;
+	int m_nDepth;
+
+	CUtlVector<CacheOptimizedKDNode> m_Nodes;				// the subtree, root first
+	CUtlVector<int32> m_TriangleIndices;
+};
+
+class CKDTreeBuilder
 {
+public:
+	CKDTreeBuilder( RayTracingEnvironment *pEnv ) : m_pEnv( pEnv ), m_nNextJob( 0 ), m_nJobTris( 0 ) {}
+	~CKDTreeBuilder()
+	{
+		m_Jobs.PurgeAndDeleteElements();
+	}
+
+	void Build( int nThreads );
+
+private:
+	void RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &indices, int node_number,
+					 int32 const *tri_list, int ntris, Vector MinBound, Vector MaxBound, int depth, bool bSpawnJobs );
+	void MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &indices, int node_number,
+				   int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound );
+	bool FindBinnedSplit( int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound,
+						  int &split_plane, float &split_value );
+
+	inline int Classify( int32 tri, int split_plane, float split_value ) const
+	{
+		// same test as CacheOptimizedTriangle::ClassifyAgainstAxisSplit()
+		if ( m_TriMins[tri][split_plane] >= split_value )
+			return PLANECHECK_POSITIVE;
+		if ( m_TriMaxs[tri][split_plane] <= split_value )
+			return PLANECHECK_NEGATIVE;
+		return PLANECHECK_STRADDLING;
+	}
+
+	static unsigned RunJobs( void *pParam );
+
+	RayTracingEnvironment *m_pEnv;
+	CUtlVector<Vector> m_TriMins;
+	CUtlVector<Vector> m_TriMaxs;
+	CUtlVector<KDBuildJob_t *> m_Jobs;
+	CUtlVector<KDBuildJob_t *> m_JobQueue;					// m_Jobs, biggest first
+	int32 volatile m_nNextJob;
+	int m_nJobTris;											// subtrees with no more tris than this become jobs
+};
+
+void CKDTreeBuilder::Build( int nThreads )
+{
+	int ntris = m_pEnv->OptimizedTriangleList.Count();
+	m_TriMins.SetCount( ntris );
+	m_TriMaxs.SetCount( ntris );
+	CUtlVector<int32> root_triangle_list;
+	root_triangle_list.SetCount( ntris );
+	for ( int t = 0; t < ntris; t++ )
+	{
+		CacheOptimizedTriangle &tri = m_pEnv->OptimizedTriangleList[t];
+		m_TriMins[t] = tri.Vertex( 0 );
+		m_TriMaxs[t] = tri.Vertex( 0 );
+		for ( int v = 1; v < 3; v++ )
+		{
+			VectorMin( m_TriMins[t], tri.Vertex( v ), m_TriMins[t] );
+			VectorMax( m_TriMaxs[t], tri.Vertex( v ), m_TriMaxs[t] );
+		}
+		root_triangle_list[t] = t;
+	}
+
+	if ( nThreads <= 0 )
+		nThreads = GetCPUInformation()->m_nLogicalProcessors;
+	nThreads = max( nThreads, 1 );
+
+	// aim for several jobs per thread so that uneven subtrees even out
+	bool bSpawnJobs = ( nThreads > 1 );
+	m_nJobTris = max( KDBUILD_MIN_JOB_TRIS, ntris / ( nThreads * 8 ) );
+
 	CacheOptimizedKDNode root;
-	OptimizedKDTree.AddToTail(root);
+	m_pEnv->OptimizedKDTree.AddToTail( root );
+	RefineNode( m_pEnv->OptimizedKDTree, m_pEnv->TriangleIndexList, 0, root_triangle_list.Base(), ntris,
+				m_pEnv->m_MinBound, m_pEnv->m_MaxBound, 0, bSpawnJobs );
+
+	if ( m_Jobs.Count() == 0 )
+		return;
+
+	m_JobQueue.CopyArray( m_Jobs.Base(), m_Jobs.Count() );
+	for ( int i = 1; i < m_JobQueue.Count(); i++ )
+	{
+		// insertion sort, there aren't many
+		KDBuildJob_t *pJob = m_JobQueue[i];
+		int j = i - 1;
+		for ( ; j >= 0 && m_JobQueue[j]->m_Tris.Count() < pJob->m_Tris.Count(); j-- )
+			m_JobQueue[j + 1] = m_JobQueue[j];
+		m_JobQueue[j + 1] = pJob;
+	}
+
+	nThreads = min( nThreads, m_Jobs.Count() );
+	CUtlVector<ThreadHandle_t> threads;
+	for ( int i = 1; i < nThreads; i++ )
+		threads.AddToTail( CreateSimpleThread( RunJobs, this ) );
+	RunJobs( this );
+	for ( int i = 0; i < threads.Count(); i++ )
+	{
+		ThreadJoin( threads[i] );
+		ReleaseThreadHandle( threads[i] );
+	}
+
+	// splice the subtrees in. each one's root goes in the node that was left for it and
+	// the rest are appended, keeping sibling pairs together
+	for ( int i = 0; i < m_Jobs.Count(); i++ )
+	{
+		KDBuildJob_t *pJob = m_Jobs[i];
+		int nBase = m_pEnv->OptimizedKDTree.Count() - 1;
+		int nIndexBase = m_pEnv->TriangleIndexList.Count();
+		for ( int n = 0; n < pJob->m_Nodes.Count(); n++ )
+		{
+			CacheOptimizedKDNode node = pJob->m_Nodes[n];
+			if ( node.NodeType() == KDNODE_STATE_LEAF )
+				node.Children = KDNODE_STATE_LEAF + ( ( node.TriangleIndexStart() + nIndexBase ) << 2 );
+			else
+				node.Children = node.NodeType() + ( ( node.LeftChild() + nBase ) << 2 );
+
+			if ( n == 0 )
+				m_pEnv->OptimizedKDTree[pJob->m_nNode] = node;
+			else
+				m_pEnv->OptimizedKDTree.AddToTail( node );
+		}
+		m_pEnv->TriangleIndexList.AddVectorToTail( pJob->m_TriangleIndices );
+	}
+}
+
+unsigned CKDTreeBuilder::RunJobs( void *pParam )
+{
+	CKDTreeBuilder *pBuilder = (CKDTreeBuilder *) pParam;
+	for (;;)
+	{
+		int nJob = ThreadInterlockedIncrement( &pBuilder->m_nNextJob ) - 1;
+		if ( nJob >= pBuilder->m_JobQueue.Count() )
+			break;
+
+		KDBuildJob_t *pJob = pBuilder->m_JobQueue[nJob];
+		CacheOptimizedKDNode root;
+		pJob->m_Nodes.AddToTail( root );
+		pBuilder->RefineNode( pJob->m_Nodes, pJob->m_TriangleIndices, 0, pJob->m_Tris.Base(), pJob->m_Tris.Count(),
+							  pJob->m_MinBound, pJob->m_MaxBound, pJob->m_nDepth, false );
+		pJob->m_Tris.Purge();
+	}
+	return 0;
+}
+
+void CKDTreeBuilder::MakeLeaf( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &indices, int node_number,
+							   int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound )
+{
+	nodes[node_number].Children = KDNODE_STATE_LEAF + ( indices.Count() << 2 );
+	nodes[node_number].SetNumberOfTrianglesInLeafNode( ntris );
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	indices.AddMultipleToTail( ntris, tri_list );
+}
+
+bool CKDTreeBuilder::FindBinnedSplit( int32 const *tri_list, int ntris, Vector const &MinBound, Vector const &MaxBound,
+									  int &split_plane, float &split_value )
+{
+	float best_cost = 1.0e23;
+	bool bFound = false;
+	float ISA = 1.0 / BoxSurfaceArea( MinBound, MaxBound );
+
+	for ( int axis = 0; axis < 3; axis++ )
+	{
+		float lo = MinBound[axis];
+		float hi = MaxBound[axis];
+		if ( !( hi > lo ) )
+			continue;
+
+		int nStarts[KDBUILD_NUM_BINS];
+		int nEnds[KDBUILD_NUM_BINS];
+		memset( nStarts, 0, sizeof( nStarts ) );
+		memset( nEnds, 0, sizeof( nEnds ) );
+
+		float scale = KDBUILD_NUM_BINS / ( hi - lo );
+		for ( int t = 0; t < ntris; t++ )
+		{
+			int b0 = (int) ( ( m_TriMins[tri_list[t]][axis] - lo ) * scale );
+			int b1 = (int) ( ( m_TriMaxs[tri_list[t]][axis] - lo ) * scale );
+			nStarts[clamp( b0, 0, KDBUILD_NUM_BINS - 1 )]++;
+			nEnds[clamp( b1, 0, KDBUILD_NUM_BINS - 1 )]++;
+		}
+
+		// sweep the boundaries between bins. triangles that end before a boundary go left,
+		// ones that start after it go right and everything else straddles it
+		int nleft = 0;
+		int nright = ntris;
+		for ( int b = 1; b < KDBUILD_NUM_BINS; b++ )
+		{
+			nleft += nEnds[b - 1];
+			nright -= nStarts[b - 1];
+			int nboth = ntris - nleft - nright;
+
+			float trial_splitvalue = lo + ( hi - lo ) * b / KDBUILD_NUM_BINS;
+			Vector LeftMaxes = MaxBound;
+			Vector RightMins = MinBound;
+			LeftMaxes[axis] = trial_splitvalue;
+			RightMins[axis] = trial_splitvalue;
+			float SA_L = BoxSurfaceArea( MinBound, LeftMaxes );
+			float SA_R = BoxSurfaceArea( RightMins, MaxBound );
+			float trial_cost = COST_OF_TRAVERSAL + COST_OF_INTERSECTION * ( nboth +
+				( SA_L * ISA * nleft ) + ( SA_R * ISA * nright ) );
+			if ( trial_cost < best_cost )
+			{
+				best_cost = trial_cost;
+				split_plane = axis;
+				split_value = trial_splitvalue;
+				bFound = true;
+			}
+		}
+	}
+
+	return bFound;
+}
+
+void CKDTreeBuilder::RefineNode( CUtlVector<CacheOptimizedKDNode> &nodes, CUtlVector<int32> &indices, int node_number,
+								 int32 const *tri_list, int ntris, Vector MinBound, Vector MaxBound, int depth, bool bSpawnJobs )
+{
+	if ( ntris < 3 )
+	{
+		MakeLeaf( nodes, indices, node_number, tri_list, ntris, MinBound, MaxBound );
+		return;
+	}
+
+	if ( bSpawnJobs && ntris <= m_nJobTris )
+	{
+		// leave this node for a worker to fill in
+		KDBuildJob_t *pJob = new KDBuildJob_t;
+		pJob->m_nNode = node_number;
+		pJob->m_Tris.CopyArray( tri_list, ntris );
+		pJob->m_MinBound = MinBound;
+		pJob->m_MaxBound = MaxBound;
+		pJob->m_nDepth = depth;
+		m_Jobs.AddToTail( pJob );
+		return;
+	}
+
+	int split_plane = 0;
+	float split_value = 0;
+	if ( !FindBinnedSplit( tri_list, ntris, MinBound, MaxBound, split_plane, split_value ) )
+	{
+		MakeLeaf( nodes, indices, node_number, tri_list, ntris, MinBound, MaxBound );
+		return;
+	}
+
+	// classify exactly against the chosen plane
+	int nleft = 0, nright = 0, nboth = 0;
+	float min_coord = 1.0e23, max_coord = -1.0e23;
+	for ( int t = 0; t < ntris; t++ )
+	{
+		min_coord = min( min_coord, m_TriMins[tri_list[t]][split_plane] );
+		max_coord = max( max_coord, m_TriMaxs[tri_list[t]][split_plane] );
+		switch ( Classify( tri_list[t], split_plane, split_value ) )
+		{
+			case PLANECHECK_NEGATIVE:	nleft++;	break;
+			case PLANECHECK_POSITIVE:	nright++;	break;
+			default:					nboth++;	break;
+		}
+	}
+
+	// if the split resulted in one half being empty, "grow" the empty half
+	if ( nleft && ( nboth == 0 ) && ( nright == 0 ) )
+		split_value = max_coord;
+	if ( nright && ( nboth == 0 ) && ( nleft == 0 ) )
+		split_value = min_coord;
+
+	Vector LeftMins = MinBound;
+	Vector LeftMaxes = MaxBound;
+	Vector RightMins = MinBound;
+	Vector RightMaxes = MaxBound;
+	LeftMaxes[split_plane] = split_value;
+	RightMins[split_plane] = split_value;
+	float SA_L = BoxSurfaceArea( LeftMins, LeftMaxes );
+	float SA_R = BoxSurfaceArea( RightMins, RightMaxes );
+	float ISA = 1.0 / BoxSurfaceArea( MinBound, MaxBound );
+	float cost_of_split = COST_OF_TRAVERSAL + COST_OF_INTERSECTION * ( nboth +
+		( SA_L * ISA * nleft ) + ( SA_R * ISA * nright ) );
+
+	float cost_of_no_split = COST_OF_INTERSECTION * ntris;
+	if ( ( cost_of_no_split <= cost_of_split ) || ( depth > MAX_TREE_DEPTH ) )
+	{
+		MakeLeaf( nodes, indices, node_number, tri_list, ntris, MinBound, MaxBound );
+		return;
+	}
+
+	// left tris at the start, straddling ones in the middle and right ones at the end, so the
+	// children's lists overlap
+	CUtlVector<int32> new_triangle_list;
+	new_triangle_list.SetCount( ntris );
+	int n_left_output = 0;
+	int n_both_output = 0;
+	int n_right_output = 0;
+	for ( int t = 0; t < ntris; t++ )
+	{
+		// classifying against the grown split value still puts everything on the same side
+		switch ( Classify( tri_list[t], split_plane, split_value ) )
+		{
+			case PLANECHECK_NEGATIVE:
+				new_triangle_list[n_left_output++] = tri_list[t];
+				break;
+			case PLANECHECK_POSITIVE:
+				n_right_output++;
+				new_triangle_list[ntris - n_right_output] = tri_list[t];
+				break;
+			default:
+				new_triangle_list[nleft + n_both_output] = tri_list[t];
+				n_both_output++;
+				break;
+		}
+	}
+	Assert( n_left_output == nleft && n_right_output == nright && n_both_output == nboth );
+
+	int left_child = nodes.Count();
+	int right_child = left_child + 1;
+	nodes[node_number].Children = split_plane + ( left_child << 2 );
+	nodes[node_number].SplittingPlaneValue = split_value;
+#ifdef DEBUG_RAYTRACE
+	nodes[node_number].vecMins = MinBound;
+	nodes[node_number].vecMaxs = MaxBound;
+#endif
+	CacheOptimizedKDNode newnode;
+	nodes.AddToTail( newnode );
+	nodes.AddToTail( newnode );
+
+	if ( ( ntris < 20 ) && ( ( nleft == 0 ) || ( nright == 0 ) ) )
+		depth += 100;
+	RefineNode( nodes, indices, left_child, new_triangle_list.Base(), nleft + nboth, LeftMins, LeftMaxes, depth + 1, bSpawnJobs );
+	RefineNode( nodes, indices, right_child, new_triangle_list.Base() + nleft, nright + nboth, RightMins, RightMaxes, depth + 1, bSpawnJobs );
+}
+
+//-----------------------------------------------------------------------------
+// van Emde Boas layout. The nodes are handled in units that have to stay together:
+// the root on its own, and each pair of siblings. A tree of units of height h is
+// laid out as its top h/2 levels followed by each of the subtrees hanging off them,
+// each of those laid out the same way.
+//-----------------------------------------------------------------------------
+class CKDTreeVEBLayout
+{
+public:
+	CKDTreeVEBLayout( CUtlVector<CacheOptimizedKDNode> const &nodes ) : m_Nodes( nodes ) {}
+
+	void Layout( CUtlVector<int> &order )
+	{
+		m_pOrder = &order;
+		Layout( 0, UnitHeight( 0 ), NULL );
+	}
+
+private:
+	// the first node of each child unit of the unit starting at nFirst
+	int ChildUnits( int nFirst, int *pChildren ) const
+	{
+		int nChildren = 0;
+		int nNodes = ( nFirst == 0 ) ? 1 : 2;
+		for ( int n = nFirst; n < nFirst + nNodes; n++ )
+		{
+			if ( m_Nodes[n].NodeType() != KDNODE_STATE_LEAF )
+				pChildren[nChildren++] = m_Nodes[n].LeftChild();
+		}
+		return nChildren;
+	}
+
+	int UnitHeight( int nFirst ) const
+	{
+		int children[2];
+		int nChildren = ChildUnits( nFirst, children );
+		int nHeight = 0;
+		for ( int i = 0; i < nChildren; i++ )
+		{
+			int nChildHeight = UnitHeight( children[i] );
+			nHeight = max( nHeight, nChildHeight );
+		}
+		return nHeight + 1;
+	}
+
+	void Layout( int nFirst, int nHeight, CUtlVector<int> *pFrontier )
+	{
+		if ( nHeight <= 1 )
+		{
+			m_pOrder->AddToTail( nFirst );
+			if ( pFrontier )
+			{
+				int children[2];
+				int nChildren = ChildUnits( nFirst, children );
+				pFrontier->AddMultipleToTail( nChildren, children );
+			}
+			return;
+		}
+
+		int nTopHeight = nHeight / 2;
+		CUtlVector<int> bottoms;
+		Layout( nFirst, nTopHeight, &bottoms );
+		for ( int i = 0; i < bottoms.Count(); i++ )
+			Layout( bottoms[i], nHeight - nTopHeight, pFrontier );
+	}
+
+	CUtlVector<CacheOptimizedKDNode> const &m_Nodes;
+	CUtlVector<int> *m_pOrder;
+};
+
+void RayTracingEnvironment::ReorderKDTreeVEB(void)
+{
+	if ( OptimizedKDTree.Count() < 3 )
+		return;
+
+	CUtlVector<int> units;
+	CKDTreeVEBLayout layout( OptimizedKDTree );
+	layout.Layout( units );
+	Assert( units[0] == 0 );
+
+	CUtlVector<int> new_index;
+	new_index.SetCount( OptimizedKDTree.Count() );
+	int nNext = 0;
+	for ( int u = 0; u < units.Count(); u++ )
+	{
+		int nNodes = ( units[u] == 0 ) ? 1 : 2;
+		for ( int n = 0; n < nNodes; n++ )
+			new_index[units[u] + n] = nNext++;
+	}
+	Assert( nNext == OptimizedKDTree.Count() );
+
+	CUtlVector<CacheOptimizedKDNode> reordered;
+	reordered.SetCount( OptimizedKDTree.Count() );
+	for ( int n = 0; n < OptimizedKDTree.Count(); n++ )
+	{
+		CacheOptimizedKDNode node = OptimizedKDTree[n];
+		if ( node.NodeType() != KDNODE_STATE_LEAF )
+			node.Children = node.NodeType() + ( new_index[node.LeftChild()] << 2 );
+		reordered[new_index[n]] = node;
+	}
+	OptimizedKDTree.Swap( reordered );
+}
+
+void RayTracingEnvironment::GetKDTreeStats(int &nNodes, int &nLeaves, int &nMaxDepth, int &nTriangleRefs) const
+{
+	nNodes = OptimizedKDTree.Count();
+	nLeaves = 0;
+	nMaxDepth = 0;
+	nTriangleRefs = 0;
+	if ( !nNodes )
+		return;
+
+	CUtlVector<int> stack;
+	CUtlVector<int> depths;
+	stack.AddToTail( 0 );
+	depths.AddToTail( 0 );
+	while ( stack.Count() )
+	{
+		int n = stack.Tail();
+		int depth = depths.Tail();
+		stack.RemoveMultipleFromTail( 1 );
+		depths.RemoveMultipleFromTail( 1 );
+
+		CacheOptimizedKDNode const &node = OptimizedKDTree[n];
+		if ( node.NodeType() == KDNODE_STATE_LEAF )
+		{
+			nLeaves++;
+			nTriangleRefs += node.NumberOfTrianglesInLeaf();
+			nMaxDepth = max( nMaxDepth, depth );
+		}
+		else
+		{
+			stack.AddToTail( node.LeftChild() );
+			stack.AddToTail( node.RightChild() );
+			depths.AddToTail( depth + 1 );
+			depths.AddToTail( depth + 1 );
+		}
+	}
+}
+
+
+void RayTracingEnvironment::SetupAccelerationStructure(void)
+{
 	int32 *root_triangle_list=new int32[OptimizedTriangleList.Count()];
 	for(int t=0;t<OptimizedTriangleList.Count();t++)
 		root_triangle_list[t]=t;
 	CalculateTriangleListBounds(root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,
 								m_MaxBound);
-	RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	if ( Flags & RTE_FLAGS_BINNED_SAH_BUILD )
+	{
+		CKDTreeBuilder builder( this );
+		builder.Build( m_nBuildThreads );
+	}
+	else
+	{
+		CacheOptimizedKDNode root;
+		OptimizedKDTree.AddToTail(root);
+		RefineNode(0,root_triangle_list,OptimizedTriangleList.Count(),m_MinBound,m_MaxBound,0);
+	}
 	delete[] root_triangle_list;
 
+	if ( Flags & RTE_FLAGS_VEB_LAYOUT )
+		ReorderKDTreeVEB();
+
+	m_bTraceAVX = !( Flags & RTE_FLAGS_DISABLE_AVX ) && CheckAVXTechnology();
+
 	// now, convert all triangles to "intersection format"
 	for(int i=0;i<OptimizedTriangleList.Count();i++)
 		OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
 }
 
 
+// layout of the file written by SaveAccelerationStructure. the header is followed by the
+// kd-tree nodes, the leaf triangle indices and the triangles in intersection format, each
+// stored as one flat array so that they can be read straight into place.
+#define RTCACHE_MAGIC ( ( 'R' << 0 ) | ( 'T' << 8 ) | ( 'C' << 16 ) | ( 'H' << 24 ) )
+#define RTCACHE_VERSION 1
+
+struct RTCacheHeader_t
+{
+	uint32 m_nMagic;
+	uint32 m_nVersion;
+	uint32 m_nKey;
+	int32 m_nNodeSize;										// sizeof the structures, in case
+	int32 m_nTriangleSize;									// their layout changes
+	int32 m_nNodes;
+	int32 m_nTriangleIndices;
+	int32 m_nTriangles;
+	float m_MinBound[3];
+	float m_MaxBound[3];
+};
+
+uint32 RayTracingEnvironment::GetGeometryCRC(void) const
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	// RTE_FLAGS_DISABLE_AVX only matters when tracing
+	uint32 nBuildFlags = Flags & ~RTE_FLAGS_DISABLE_AVX;
+	CRC32_ProcessBuffer( &crc, &nBuildFlags, sizeof( nBuildFlags ) );
+
+	// only hash the fields AddTriangle sets. the kd-tree builder's scratch fields and the
+	// padding after them aren't part of the geometry
+	for(int i=0;i<OptimizedTriangleList.Count();i++)
+	{
+		TriGeometryData_t const &tri = OptimizedTriangleList[i].m_Data.m_GeometryData;
+		CRC32_ProcessBuffer( &crc, &tri.m_nTriangleID, sizeof( tri.m_nTriangleID ) );
+		CRC32_ProcessBuffer( &crc, tri.m_VertexCoordData, sizeof( tri.m_VertexCoordData ) );
+		CRC32_ProcessBuffer( &crc, &tri.m_nFlags, sizeof( tri.m_nFlags ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+bool RayTracingEnvironment::SaveAccelerationStructure(const char *pFileName, uint32 nKey) const
+{
+	FILE *fp = fopen( pFileName, "wb" );
+	if ( !fp )
+		return false;
+
+	RTCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nMagic = RTCACHE_MAGIC;
+	header.m_nVersion = RTCACHE_VERSION;
+	header.m_nKey = nKey;
+	header.m_nNodeSize = sizeof( CacheOptimizedKDNode );
+	header.m_nTriangleSize = sizeof( CacheOptimizedTriangle );
+	header.m_nNodes = OptimizedKDTree.Count();
+	header.m_nTriangleIndices = TriangleIndexList.Count();
+	header.m_nTriangles = OptimizedTriangleList.Count();
+	for ( int c = 0; c < 3; c++ )
+	{
+		header.m_MinBound[c] = m_MinBound[c];
+		header.m_MaxBound[c] = m_MaxBound[c];
+	}
+
+	bool bOk = ( fwrite( &header, sizeof( header ), 1, fp ) == 1 );
+	if ( bOk && header.m_nNodes )
+		bOk = ( fwrite( OptimizedKDTree.Base(), sizeof( CacheOptimizedKDNode ), header.m_nNodes, fp ) == (size_t)header.m_nNodes );
+	if ( bOk && header.m_nTriangleIndices )
+		bOk = ( fwrite( TriangleIndexList.Base(), sizeof( int32 ), header.m_nTriangleIndices, fp ) == (size_t)header.m_nTriangleIndices );
+
+	// the triangles live in a block vector, so they go out one at a time
+	for ( int i = 0; bOk && i < header.m_nTriangles; i++ )
+		bOk = ( fwrite( &OptimizedTriangleList[i], sizeof( CacheOptimizedTriangle ), 1, fp ) == 1 );
+
+	if ( fclose( fp ) != 0 )
+		bOk = false;
+
+	// don't leave a truncated file around for the next run to trip over
+	if ( !bOk )
+		remove( pFileName );
+	return bOk;
+}
+
+bool RayTracingEnvironment::LoadAccelerationStructure(const char *pFileName, uint32 nKey)
+{
+	FILE *fp = fopen( pFileName, "rb" );
+	if ( !fp )
+		return false;
+
+	RTCacheHeader_t header;
+	if ( fread( &header, sizeof( header ), 1, fp ) != 1 ||
+		 header.m_nMagic != RTCACHE_MAGIC || header.m_nVersion != RTCACHE_VERSION ||
+		 header.m_nKey != nKey ||
+		 header.m_nNodeSize != sizeof( CacheOptimizedKDNode ) ||
+		 header.m_nTriangleSize != sizeof( CacheOptimizedTriangle ) ||
+		 header.m_nTriangles != OptimizedTriangleList.Count() ||
+		 header.m_nNodes <= 0 || header.m_nTriangleIndices < 0 )
+	{
+		fclose( fp );
+		return false;
+	}
+
+	// read everything before touching the environment, so a short file leaves it as it was
+	CUtlVector<CacheOptimizedKDNode> nodes;
+	CUtlVector<int32> indices;
+	CUtlVector<CacheOptimizedTriangle> triangles;
+	nodes.SetCount( header.m_nNodes );
+	indices.SetCount( header.m_nTriangleIndices );
+	triangles.SetCount( header.m_nTriangles );
+
+	bool bOk = ( fread( nodes.Base(), sizeof( CacheOptimizedKDNode ), header.m_nNodes, fp ) == (size_t)header.m_nNodes );
+	if ( bOk && header.m_nTriangleIndices )
+		bOk = ( fread( indices.Base(), sizeof( int32 ), header.m_nTriangleIndices, fp ) == (size_t)header.m_nTriangleIndices );
+	if ( bOk && header.m_nTriangles )
+		bOk = ( fread( triangles.Base(), sizeof( CacheOptimizedTriangle ), header.m_nTriangles, fp ) == (size_t)header.m_nTriangles );
+	fclose( fp );
+	if ( !bOk )
+		return false;
+
+	OptimizedKDTree.Swap( nodes );
+	TriangleIndexList.Swap( indices );
+	for ( int i = 0; i < header.m_nTriangles; i++ )
+		OptimizedTriangleList[i] = triangles[i];
+	m_MinBound.Init( header.m_MinBound[0], header.m_MinBound[1], header.m_MinBound[2] );
+	m_MaxBound.Init( header.m_MaxBound[0], header.m_MaxBound[1], header.m_MaxBound[2] );
+
+	m_bTraceAVX = !( Flags & RTE_FLAGS_DISABLE_AVX ) && CheckAVXTechnology();
+	return true;
+}
+
+
 
 void RayTracingEnvironment::AddInfinitePointLight(Vector position, Vector intensity)
 {
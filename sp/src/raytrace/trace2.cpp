@@ -307,22 +307,34 @@ inline void RayTracingEnvironment::FlushStreamEntry(RayStream &s,int msk)
 {
 	assert(msk>=0);
 	assert(msk<8);
-	fltx4 tmax=s.PendingRays[msk].direction.length();
-	fltx4 scl=ReciprocalSaturateSIMD(tmax);
-	s.PendingRays[msk].direction*=scl;					// normalize
-	RayTracingResult tmpresult;
-	Trace4Rays(s.PendingRays[msk],Four_Zeros,tmax,msk,&tmpresult);
-	// now, write out results
-	for(int r=0;r<4;r++)
+	// a full entry is traced as one 8 ray packet. a partial one left over at the end of the
+	// stream has been padded out to 4 or 8 rays
+	int npackets=(s.n_in_stream[msk]>4)?2:1;
+	fltx4 tmax[2];
+	for(int p=0;p<npackets;p++)
 	{
-		RayTracingSingleResult *out=s.PendingStreamOutputs[msk][r];
-		out->ray_length=SubFloat( tmax, r );
-		out->surface_normal.x=tmpresult.surface_normal.X(r);
-		out->surface_normal.y=tmpresult.surface_normal.Y(r);
-		out->surface_normal.z=tmpresult.surface_normal.Z(r);
-		out->HitID=tmpresult.HitIds[r];
-		out->HitDistance=SubFloat( tmpresult.HitDistance, r );
+		tmax[p]=s.PendingRays[msk].packets[p].direction.length();
+		fltx4 scl=ReciprocalSaturateSIMD(tmax[p]);
+		s.PendingRays[msk].packets[p].direction*=scl;		// normalize
 	}
+	fltx4 tmin[2]={Four_Zeros,Four_Zeros};
+	RayTracingResult tmpresult[2];
+	if (npackets==2)
+		Trace8Rays(s.PendingRays[msk],tmin,tmax,msk,tmpresult);
+	else
+		Trace4Rays(s.PendingRays[msk].packets[0],Four_Zeros,tmax[0],msk,&tmpresult[0]);
+	// now, write out results
+	for(int p=0;p<npackets;p++)
+		for(int r=0;r<4;r++)
+		{
+			RayTracingSingleResult *out=s.PendingStreamOutputs[msk][4*p+r];
+			out->ray_length=SubFloat( tmax[p], r );
+			out->surface_normal.x=tmpresult[p].surface_normal.X(r);
+			out->surface_normal.y=tmpresult[p].surface_normal.Y(r);
+			out->surface_normal.z=tmpresult[p].surface_normal.Z(r);
+			out->HitID=tmpresult[p].HitIds[r];
+			out->HitDistance=SubFloat( tmpresult[p].HitDistance, r );
+		}
 	s.n_in_stream[msk]=0;
 }
 
@@ -336,20 +348,20 @@ void RayTracingEnvironment::AddToRayStream(RayStream &s,
 	assert(msk>=0);
 	assert(msk<8);
 	int pos=s.n_in_stream[msk];
-	assert(pos<4);
-	s.PendingRays[msk].origin.X(pos)=start.x;
-	s.PendingRays[msk].origin.Y(pos)=start.y;
-	s.PendingRays[msk].origin.Z(pos)=start.z;
-	s.PendingRays[msk].direction.X(pos)=delta.x;
-	s.PendingRays[msk].direction.Y(pos)=delta.y;
-	s.PendingRays[msk].direction.Z(pos)=delta.z;
+	assert(pos<8);
+	FourRays &rays=s.PendingRays[msk].packets[pos>>2];
+	rays.origin.X(pos&3)=start.x;
+	rays.origin.Y(pos&3)=start.y;
+	rays.origin.Z(pos&3)=start.z;
+	rays.direction.X(pos&3)=delta.x;
+	rays.direction.Y(pos&3)=delta.y;
+	rays.direction.Z(pos&3)=delta.z;
 	s.PendingStreamOutputs[msk][pos]=rslt_out;
-	if (pos==3)
+	s.n_in_stream[msk]++;
+	if (pos==7)
 	{
 		FlushStreamEntry(s,msk);
 	}
-	else
-		s.n_in_stream[msk]++;
 }
 
 void RayTracingEnvironment::FinishRayStream(RayStream &s)
@@ -359,16 +371,18 @@ void RayTracingEnvironment::FinishRayStream(RayStream &s)
 		int cnt=s.n_in_stream[msk];
 		if (cnt)
 		{
-			// fill in unfilled entries with dups of first
-			for(int c=cnt;c<4;c++)
+			// fill in unfilled entries of the last packet with dups of its first
+			FourRays &rays=s.PendingRays[msk].packets[(cnt-1)>>2];
+			int first=(cnt-1)&~3;
+			for(int c=cnt-first;c<4;c++)
 			{
-				s.PendingRays[msk].origin.X(c) = s.PendingRays[msk].origin.X(0);
-				s.PendingRays[msk].origin.Y(c) = s.PendingRays[msk].origin.Y(0);
-				s.PendingRays[msk].origin.Z(c) = s.PendingRays[msk].origin.Z(0);
-				s.PendingRays[msk].direction.X(c) = s.PendingRays[msk].direction.X(0);
-				s.PendingRays[msk].direction.Y(c) = s.PendingRays[msk].direction.Y(0);
-				s.PendingRays[msk].direction.Z(c) = s.PendingRays[msk].direction.Z(0);
-				s.PendingStreamOutputs[msk][c]=s.PendingStreamOutputs[msk][0];
+				rays.origin.X(c) = rays.origin.X(0);
+				rays.origin.Y(c) = rays.origin.Y(0);
+				rays.origin.Z(c) = rays.origin.Z(0);
+				rays.direction.X(c) = rays.direction.X(0);
+				rays.direction.Y(c) = rays.direction.Y(0);
+				rays.direction.Z(c) = rays.direction.Z(0);
+				s.PendingStreamOutputs[msk][first+c]=s.PendingStreamOutputs[msk][first];
 			}
 			FlushStreamEntry(s,msk);
 		}
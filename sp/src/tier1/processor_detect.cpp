@@ -12,6 +12,9 @@ bool CheckMMXTechnology(void) { return false; }
 bool CheckSSETechnology(void) { return false; }
 bool CheckSSE2Technology(void) { return false; }
 bool Check3DNowTechnology(void) { return false; }
+#ifdef _X360
+bool CheckAVXTechnology(void) { return false; }
+#endif
 
 #elif defined( _WIN32 ) && !defined( _X360 )
 
@@ -272,3 +275,22 @@ bool Check3DNowTechnology(void)
 #pragma optimize( "", on )
 
 #endif // _WIN32
+
+#if defined( _WIN32 ) && !defined( _X360 )
+
+#include <intrin.h>
+
+bool CheckAVXTechnology(void)
+{
+	int cpuInfo[4];
+	__cpuid( cpuInfo, 1 );
+
+	// bit 27 of ecx is set if the OS uses xsave, bit 28 if the processor has AVX
+	if ( ( cpuInfo[2] & 0x18000000 ) != 0x18000000 )
+		return false;
+
+	// the OS has to save the xmm and ymm registers on context switches
+	return ( _xgetbv( 0 ) & 6 ) == 6;
+}
+
+#endif // _WIN32
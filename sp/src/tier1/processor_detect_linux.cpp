@@ -45,3 +45,19 @@ bool Check3DNowTechnology(void)
     }
     return false;
 }
+
+bool CheckAVXTechnology(void)
+{
+    unsigned long eax,ebx,ecx,unused;
+    cpuid(1,eax,ebx,ecx,unused);
+
+	// bit 27 of ecx is set if the OS uses xsave, bit 28 if the processor has AVX
+	if ( ( ecx & 0x18000000 ) != 0x18000000 )
+		return false;
+
+	// the OS has to save the xmm and ymm registers on context switches. this is xgetbv,
+	// spelled out for assemblers that don't know it
+	unsigned int xcr0_lo, xcr0_hi;
+	asm( ".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0) );
+	return ( xcr0_lo & 6 ) == 6;
+}
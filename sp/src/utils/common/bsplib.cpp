@@ -27,6 +27,15 @@
 #include "lumpfiles.h"
 #include "vtf/vtf.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 //=============================================================================
 
 // Boundary each lump should be aligned to
@@ -537,6 +546,10 @@ const char *GetLumpName( unsigned int lumpnum )
 // out the HDR lumps for lightmaps, ambient leaves, and lights sources.
 bool g_bHDR = false;
 
+// "-mmap" reads lumps straight out of a copy-on-write mapping of the bsp
+// instead of loading the whole file into memory first
+bool g_bMapBSPFile = false;
+
 // Set to true to generate Xbox360 native output files
 static bool g_bSwapOnLoad = false;
 static bool g_bSwapOnWrite = false;
@@ -714,6 +727,139 @@ CGameLump	g_GameLumps;
 
 static IZip *s_pakFile = 0;
 
+// pakfile lump in the bsp mapping that hasn't been parsed yet
+static byte *s_pUnparsedPakLump = NULL;
+static int s_nUnparsedPakLumpSize = 0;
+
+struct BSPFileMapping_t
+{
+	byte	*pBase;
+	size_t	nSize;
+	bool	bLumpsReferenced;	// lumps point into the mapping, keep it after CloseBSPFile()
+#ifdef _WIN32
+	HANDLE	hFile;
+	HANDLE	hMapping;
+#endif
+} s_BSPMapping;
+
+//-----------------------------------------------------------------------------
+// Purpose: Maps a bsp copy-on-write, so pages are only read in as lumps are
+//          copied out and writing to one (e.g. swapping the header) doesn't
+//          touch the file.
+// Output : the start of the file, or NULL if it couldn't be mapped
+//-----------------------------------------------------------------------------
+static byte *MapBSPFile( const char *filename )
+{
+	Assert( !s_BSPMapping.pBase );
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFile( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	LARGE_INTEGER size;
+	HANDLE hMapping = NULL;
+	void *pBase = NULL;
+	if ( GetFileSizeEx( hFile, &size ) && size.QuadPart >= (LONGLONG)sizeof( dheader_t ) )
+	{
+		hMapping = CreateFileMapping( hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		if ( hMapping )
+		{
+			pBase = MapViewOfFile( hMapping, FILE_MAP_COPY, 0, 0, 0 );
+		}
+	}
+
+	if ( !pBase )
+	{
+		if ( hMapping )
+			CloseHandle( hMapping );
+		CloseHandle( hFile );
+		return NULL;
+	}
+
+	s_BSPMapping.hFile = hFile;
+	s_BSPMapping.hMapping = hMapping;
+	s_BSPMapping.nSize = (size_t)size.QuadPart;
+#else
+	int fd = open( filename, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	struct stat st;
+	void *pBase = MAP_FAILED;
+	if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t)sizeof( dheader_t ) )
+	{
+		pBase = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	}
+
+	// the mapping keeps its own reference to the file
+	close( fd );
+
+	if ( pBase == MAP_FAILED )
+		return NULL;
+
+	s_BSPMapping.nSize = st.st_size;
+#endif
+
+	s_BSPMapping.pBase = (byte *)pBase;
+	s_BSPMapping.bLumpsReferenced = false;
+	return s_BSPMapping.pBase;
+}
+
+static void UnmapBSPFile( void )
+{
+	if ( !s_BSPMapping.pBase )
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile( s_BSPMapping.pBase );
+	CloseHandle( s_BSPMapping.hMapping );
+	CloseHandle( s_BSPMapping.hFile );
+#else
+	munmap( s_BSPMapping.pBase, s_BSPMapping.nSize );
+#endif
+
+	memset( &s_BSPMapping, 0, sizeof( s_BSPMapping ) );
+}
+
+static bool IsInBSPMapping( const void *p )
+{
+	return s_BSPMapping.pBase && (const byte *)p >= s_BSPMapping.pBase && (const byte *)p < s_BSPMapping.pBase + s_BSPMapping.nSize;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies out any lumps that still point into the bsp mapping and
+//          unmaps it. Has to happen before the bsp is written over.
+//-----------------------------------------------------------------------------
+void ReleaseBSPFileMapping( void )
+{
+	if ( !s_BSPMapping.pBase )
+		return;
+
+	// parses the pakfile if nothing has asked for it yet
+	if ( s_pUnparsedPakLump )
+	{
+		GetPakFile();
+	}
+
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		if ( IsInBSPMapping( g_Lumps.pLumps[i] ) )
+		{
+			void *pCopy = malloc( g_Lumps.size[i] );
+			memcpy( pCopy, g_Lumps.pLumps[i], g_Lumps.size[i] );
+			g_Lumps.pLumps[i] = pCopy;
+		}
+	}
+
+	if ( g_pBSPHeader == (dheader_t *)s_BSPMapping.pBase )
+	{
+		g_pBSPHeader = NULL;
+	}
+
+	UnmapBSPFile();
+}
+
 //-----------------------------------------------------------------------------
 // Keep the file position aligned to an arbitrary boundary.
 // Returns updated file position.
@@ -764,6 +910,16 @@ IZip* GetPakFile( void )
 	{
 		s_pakFile = IZip::CreateZip();
 	}
+
+	// a mapped bsp leaves the pakfile lump until something uses it
+	if ( s_pUnparsedPakLump )
+	{
+		byte *pakbuffer = s_pUnparsedPakLump;
+		s_pUnparsedPakLump = NULL;
+
+		s_pakFile->ActivateByteSwapping( IsX360() );
+		s_pakFile->ParseFromBuffer( pakbuffer, s_nUnparsedPakLumpSize );
+	}
 	return s_pakFile;
 }
 
@@ -775,6 +931,7 @@ void ReleasePakFileLumps( void )
 	// Release the pak files
 	IZip::ReleaseZip( s_pakFile );
 	s_pakFile = NULL;
+	s_pUnparsedPakLump = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -1940,7 +2097,18 @@ void Lumps_Parse( void )
 	{
 		if ( !g_Lumps.bLumpParsed[i] && g_pBSPHeader->lumps[i].filelen )
 		{
-			g_Lumps.size[i] = CopyVariableLump<byte>( FIELD_CHARACTER, i, &g_Lumps.pLumps[i], -1 );
+			if ( IsInBSPMapping( g_pBSPHeader ) )
+			{
+				// these are only written back out as they are, so leave them in the mapping
+				g_Lumps.bLumpParsed[i] = true;
+				g_Lumps.pLumps[i] = (byte *)g_pBSPHeader + g_pBSPHeader->lumps[i].fileofs;
+				g_Lumps.size[i] = g_pBSPHeader->lumps[i].filelen;
+				s_BSPMapping.bLumpsReferenced = true;
+			}
+			else
+			{
+				g_Lumps.size[i] = CopyVariableLump<byte>( FIELD_CHARACTER, i, &g_Lumps.pLumps[i], -1 );
+			}
 			Msg( "Reading unknown lump #%d (%d bytes)\n", i, g_Lumps.size[i] );
 		}
 	}
@@ -1959,7 +2127,8 @@ void Lumps_Write( void )
 		}
 		if ( g_Lumps.pLumps[i] )
 		{
-			free( g_Lumps.pLumps[i] );
+			if ( !IsInBSPMapping( g_Lumps.pLumps[i] ) )
+				free( g_Lumps.pLumps[i] );
 			g_Lumps.pLumps[i] = NULL;
 		}
 	}
@@ -2123,10 +2292,17 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 //-----------------------------------------------------------------------------
 void OpenBSPFile( const char *filename )
 {
+	// a mapping left from the last LoadBSPFile() is done with now
+	ReleaseBSPFileMapping();
+
 	Lumps_Init();
 
 	// load the file header
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	g_pBSPHeader = g_bMapBSPFile ? (dheader_t *)MapBSPFile( filename ) : NULL;
+	if ( !g_pBSPHeader )
+	{
+		LoadFile( filename, (void **)&g_pBSPHeader );
+	}
 
 	if ( g_bSwapOnLoad )
 	{
@@ -2144,7 +2320,18 @@ void OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( void )
 {
-	free( g_pBSPHeader );
+	if ( IsInBSPMapping( g_pBSPHeader ) )
+	{
+		// unknown lumps and the pakfile may still be read out of the mapping
+		if ( !s_BSPMapping.bLumpsReferenced )
+		{
+			UnmapBSPFile();
+		}
+	}
+	else
+	{
+		free( g_pBSPHeader );
+	}
 	g_pBSPHeader = NULL;
 }
 
@@ -2242,19 +2429,36 @@ void LoadBSPFile( const char *filename )
 	*/
 		
 	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
-	if ( paksize > 0 )
+	if ( IsInBSPMapping( g_pBSPHeader ) )
 	{
-		GetPakFile()->ActivateByteSwapping( IsX360() );
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		// tools that never touch the pakfile don't have to parse it, it's
+		// done from the mapping the first time GetPakFile() is called
+		GetPakFile()->Reset();
+
+		g_Lumps.bLumpParsed[LUMP_PAKFILE] = true;
+		if ( HasLump( LUMP_PAKFILE ) )
+		{
+			s_pUnparsedPakLump = (byte *)g_pBSPHeader + g_pBSPHeader->lumps[LUMP_PAKFILE].fileofs;
+			s_nUnparsedPakLumpSize = g_pBSPHeader->lumps[LUMP_PAKFILE].filelen;
+			s_BSPMapping.bLumpsReferenced = true;
+		}
 	}
 	else
 	{
-		GetPakFile()->Reset();
-	}
+		byte *pakbuffer = NULL;
+		int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+		if ( paksize > 0 )
+		{
+			GetPakFile()->ActivateByteSwapping( IsX360() );
+			GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		}
+		else
+		{
+			GetPakFile()->Reset();
+		}
 
-	free( pakbuffer );
+		free( pakbuffer );
+	}
 
 	g_GameLumps.ParseGameLump( g_pBSPHeader );
 
@@ -2273,6 +2477,8 @@ void LoadBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void UnloadBSPFile()
 {
+	ReleaseBSPFileMapping();
+
 	nummodels = 0;
 	numvertexes = 0;
 	numplanes = 0;
@@ -2572,6 +2778,9 @@ void WriteBSPFile( const char *filename, char *pUnused )
 		return;
 	}
 
+	// the bsp being written may be the one that's mapped
+	ReleaseBSPFileMapping();
+
 	dheader_t outHeader;
 	g_pBSPHeader = &outHeader;
 	memset( g_pBSPHeader, 0, sizeof( dheader_t ) );
@@ -40,6 +40,9 @@ class IZip;
 // this is only true in vrad
 extern bool g_bHDR;
 
+// set by -mmap in vrad and vvis, LoadBSPFile() maps the bsp instead of reading it all in
+extern bool g_bMapBSPFile;
+
 // default width/height of luxels in world units.
 #define DEFAULT_LUXEL_SIZE ( 16.0f )
 
@@ -295,6 +298,7 @@ void	WriteBSPFile( const char *filename, char *pUnused = NULL );
 void	PrintBSPFileSizes(void);
 void	PrintBSPPackDirectory(void);
 void	ReleasePakFileLumps(void);
+void	ReleaseBSPFileMapping(void);
 bool	SwapBSPFile( const char *filename, const char *swapFilename, bool bSwapOnLoad, VTFConvertFunc_t pVTFConvertFunc, VHVFixupFunc_t pVHVFixupFunc, CompressFunc_t pCompressFunc );
 bool	GetPakFileLump( const char *pBSPFilename, void **pPakData, int *pPakSize );
 bool	SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *pPakData, int pakSize );
@@ -18,6 +18,8 @@
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
 
 #ifdef MAPBASE
 // This was suggested in that Source 2013 pull request that fixed Vrad.
@@ -39,16 +41,178 @@ public:
 CRunThreadsData g_RunThreadsData[MAX_THREADS];
 
 
-int		dispatch;
 int		workcount;
 qboolean		pacifier;
 
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
+bool g_bThreadStats = false;
 
 HANDLE g_ThreadHandles[MAX_THREADS];
 
 
+//-----------------------------------------------------------------------------
+// Work dispatch. Thread i starts out owning every numthreads'th work item from
+// i, so the items are still started in roughly ascending order, and takes them
+// from the front of its range with a compare-and-swap on its own cache line.
+// When its range runs out it steals the back half of the biggest range left.
+// Ranges are packed into one int64 so they can be swapped atomically:
+//
+//		bits 0-27	first slot left in the range
+//		bits 28-55	end of the range
+//		bits 56-63	the thread the range started out with, which decides
+//					the work items the slots stand for
+//-----------------------------------------------------------------------------
+#define WORK_SLOT_BITS	28
+#define WORK_SLOT_MASK	( ( (int64)1 << WORK_SLOT_BITS ) - 1 )
+
+static inline int64 MakeWorkRange( int nBegin, int nEnd, int iOwner )
+{
+	return (int64)nBegin | ( (int64)nEnd << WORK_SLOT_BITS ) | ( (int64)iOwner << ( 2 * WORK_SLOT_BITS ) );
+}
+
+static inline int WorkRangeBegin( int64 range )	{ return (int)( range & WORK_SLOT_MASK ); }
+static inline int WorkRangeEnd( int64 range )	{ return (int)( ( range >> WORK_SLOT_BITS ) & WORK_SLOT_MASK ); }
+static inline int WorkRangeOwner( int64 range )	{ return (int)( range >> ( 2 * WORK_SLOT_BITS ) ); }
+
+// aligned and padded to 128 bytes so each queue gets its own cache line, and the
+// adjacent line prefetcher doesn't drag a neighbour's line along with it
+class ALIGN128 CThreadWorkQueue
+{
+public:
+	int64 volatile	m_Range;
+	int				m_nItems;			// work items this thread took, for the pacifier and -threadstats
+	int				m_nStolen;			// work items it stole from other threads
+	double			m_flFinishTime;		// when it ran out of work
+
+	byte			m_Pad[128 - sizeof( int64 ) - 2 * sizeof( int ) - sizeof( double )];
+} ALIGN128_POST;
+
+// one per thread, plus one for GetThreadWork calls from outside the worker threads
+static CThreadWorkQueue g_WorkQueues[MAX_THREADS+1];
+
+// worker thread index + 1, or 0 if this isn't a worker thread
+static CThreadLocalInt<> g_iWorkThread;
+
+static const float	*g_pWorkCosts = NULL;
+static CUtlVector<int> g_WorkOrder;		// work items, most expensive first, when g_pWorkCosts was given
+
+void SetThreadWorkCosts( const float *pCosts )
+{
+	g_pWorkCosts = pCosts;
+}
+
+static int __cdecl CompareWorkCosts( const void *pLeft, const void *pRight )
+{
+	float flLeft = g_pWorkCosts[*(const int *)pLeft];
+	float flRight = g_pWorkCosts[*(const int *)pRight];
+	if ( flLeft != flRight )
+		return ( flLeft > flRight ) ? -1 : 1;
+	return *(const int *)pLeft - *(const int *)pRight;
+}
+
+static void InitThreadWork( int nThreads )
+{
+	if ( workcount > WORK_SLOT_MASK )
+		Error( "RunThreadsOn: %d work items is more than the %d it can dispatch\n", workcount, (int)WORK_SLOT_MASK );
+
+	g_WorkOrder.RemoveAll();
+	if ( g_pWorkCosts )
+	{
+		g_WorkOrder.SetCount( workcount );
+		for ( int i = 0; i < workcount; i++ )
+			g_WorkOrder[i] = i;
+		qsort( g_WorkOrder.Base(), workcount, sizeof( int ), CompareWorkCosts );
+		g_pWorkCosts = NULL;
+	}
+
+	for ( int i = 0; i <= MAX_THREADS; i++ )
+	{
+		CThreadWorkQueue &queue = g_WorkQueues[i];
+		int nSlots = ( i < nThreads ) ? ( workcount - i + nThreads - 1 ) / nThreads : 0;
+		queue.m_Range = MakeWorkRange( 0, max( nSlots, 0 ), i );
+		queue.m_nItems = 0;
+		queue.m_nStolen = 0;
+		queue.m_flFinishTime = 0;
+	}
+}
+
+// reads a range that other threads may be changing
+static inline int64 ReadWorkRange( int64 volatile *pRange )
+{
+	return ThreadInterlockedCompareExchange64( pRange, 0, 0 );
+}
+
+// takes the first slot from a thread's own range
+static bool PopThreadWork( CThreadWorkQueue &queue, int *pSlot, int *pOwner )
+{
+	while ( 1 )
+	{
+		int64 range = ReadWorkRange( &queue.m_Range );
+		int nBegin = WorkRangeBegin( range );
+		if ( nBegin >= WorkRangeEnd( range ) )
+			return false;
+
+		int64 newRange = MakeWorkRange( nBegin + 1, WorkRangeEnd( range ), WorkRangeOwner( range ) );
+		if ( ThreadInterlockedCompareExchange64( &queue.m_Range, newRange, range ) == range )
+		{
+			*pSlot = nBegin;
+			*pOwner = WorkRangeOwner( range );
+			return true;
+		}
+	}
+}
+
+// moves the back half of the biggest range another thread has left into iThread's queue,
+// which must be empty
+static bool StealThreadWork( int iThread )
+{
+	while ( 1 )
+	{
+		int iVictim = -1;
+		int64 victimRange = 0;
+		int nMostLeft = 0;
+		for ( int i = 0; i <= MAX_THREADS; i++ )
+		{
+			if ( i == iThread )
+				continue;
+
+			int64 range = ReadWorkRange( &g_WorkQueues[i].m_Range );
+			int nLeft = WorkRangeEnd( range ) - WorkRangeBegin( range );
+			if ( nLeft > nMostLeft )
+			{
+				iVictim = i;
+				victimRange = range;
+				nMostLeft = nLeft;
+			}
+		}
+
+		// nothing left anywhere. work is never added while threads run, so we're done
+		if ( iVictim == -1 )
+			return false;
+
+		int nEnd = WorkRangeEnd( victimRange );
+		int nSplit = nEnd - ( nMostLeft + 1 ) / 2;
+		int iOwner = WorkRangeOwner( victimRange );
+		int64 newVictimRange = MakeWorkRange( WorkRangeBegin( victimRange ), nSplit, iOwner );
+		if ( ThreadInterlockedCompareExchange64( &g_WorkQueues[iVictim].m_Range, newVictimRange, victimRange ) != victimRange )
+			continue;
+
+		// nobody steals from an empty range, so nobody else is writing this one
+		CThreadWorkQueue &queue = g_WorkQueues[iThread];
+		ThreadInterlockedCompareExchange64( &queue.m_Range, MakeWorkRange( nSplit, nEnd, iOwner ), ReadWorkRange( &queue.m_Range ) );
+		queue.m_nStolen += nEnd - nSplit;
+		return true;
+	}
+}
+
+int GetThreadIndex (void)
+{
+	int iThread = g_iWorkThread - 1;
+	if ( iThread < 0 )
+		iThread = THREADINDEX_MAIN;
+	return iThread;
+}
 
 /*
 =============
@@ -58,23 +222,33 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	int iThread = GetThreadIndex();
 
-	ThreadLock ();
+	CThreadWorkQueue &queue = g_WorkQueues[iThread];
 
-	if (dispatch == workcount)
+	int nSlot, iOwner;
+	while ( !PopThreadWork( queue, &nSlot, &iOwner ) )
 	{
-		ThreadUnlock ();
-		return -1;
+		if ( !StealThreadWork( iThread ) )
+		{
+			queue.m_flFinishTime = Plat_FloatTime();
+			return -1;
+		}
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	queue.m_nItems++;
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
+	// UpdatePacifier isn't thread safe, so only one thread draws it
+	if ( iThread == 0 && pacifier )
+	{
+		int nDone = 0;
+		for ( int i = 0; i <= MAX_THREADS; i++ )
+			nDone += g_WorkQueues[i].m_nItems;
+		UpdatePacifier( (float)nDone / workcount );
+	}
 
-	return r;
+	int nPosition = nSlot * max( numthreads, 1 ) + iOwner;
+	return g_WorkOrder.Count() ? g_WorkOrder[nPosition] : nPosition;
 }
 
 
@@ -175,6 +349,7 @@ void ThreadUnlock (void)
 DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	g_iWorkThread = pData->m_iThread + 1;
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
 	return 0;
 }
@@ -236,21 +411,26 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	int		start, end;
 
 	start = Plat_FloatTime();
-	dispatch = 0;
 	workcount = workcnt;
 	StartPacifier("");
 	pacifier = showpacifier;
 
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+	InitThreadWork( numthreads );
+
 #ifdef _PROFILE
 	threaded = false;
 	(*func)( 0 );
 	return;
 #endif
 
+	double flStart = Plat_FloatTime();
 	
 	RunThreads_Start( fn, pUserData );
 	RunThreads_End();
 
+	double flEnd = Plat_FloatTime();
 
 	end = Plat_FloatTime();
 	if (pacifier)
@@ -258,6 +438,18 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 		EndPacifier(false);
 		printf (" (%i)\n", end-start);
 	}
+
+	if ( g_bThreadStats && workcnt > 0 )
+	{
+		// a thread is idle from when it runs out of work to when the last one finishes
+		for ( int i = 0; i < numthreads; i++ )
+		{
+			const CThreadWorkQueue &queue = g_WorkQueues[i];
+			double flFinish = ( queue.m_flFinishTime > 0 ) ? queue.m_flFinishTime : flEnd;
+			Msg( "    thread %2d: %7d items (%d stolen), busy %.2fs, idle %.2fs\n", i, queue.m_nItems, queue.m_nStolen,
+				flFinish - flStart, flEnd - flFinish );
+		}
+	}
 }
 
 
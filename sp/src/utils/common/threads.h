@@ -33,6 +33,9 @@ extern	int		numthreads;
 // If set to true, then all the threads that are created are low priority.
 extern bool	g_bLowPriorityThreads;
 
+// If set to true, RunThreadsOn prints how long each thread was busy and idle.
+extern bool	g_bThreadStats;
+
 typedef void (*ThreadWorkerFn)( int iThread, int iWorkItem );
 typedef void (*RunThreadsFn)( int iThread, void *pUserData );
 
@@ -51,6 +54,14 @@ void SetLowPriority();
 void ThreadSetDefault (void);
 int	GetThreadWork (void);
 
+// Index of the calling RunThreadsOn worker, or THREADINDEX_MAIN from any other thread.
+int	GetThreadIndex (void);
+
+// Optional estimate of how long each work item of the next RunThreadsOn or
+// RunThreadsOnIndividual call will take, so the most expensive ones can be started
+// first. pCosts needs an entry per work item and must stay valid until that call.
+void SetThreadWorkCosts( const float *pCosts );
+
 void RunThreadsOnIndividual ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn );
 
 void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData=NULL );
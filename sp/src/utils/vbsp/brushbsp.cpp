@@ -303,6 +303,21 @@ tree_t *AllocTree (void)
 	return tree;
 }
 
+//-----------------------------------------------------------------------------
+// Nodes and brushes are recycled through per-thread free lists so the threaded
+// tree build doesn't serialize on the heap. Brushes are pooled by side count;
+// anything bigger than MAX_BRUSH_SIDES goes straight to the heap.
+//-----------------------------------------------------------------------------
+#define NODE_POOL_CHUNK		256
+
+struct BSPAllocPool_t
+{
+	node_t		*m_pFreeNodes;		// linked through parent
+	bspbrush_t	*m_pFreeBrushes[MAX_BRUSH_SIDES+1];	// linked through next
+};
+
+static BSPAllocPool_t s_BSPPools[MAX_TOOL_THREADS+1];
+
 /*
 ================
 AllocNode
@@ -312,18 +327,43 @@ node_t *AllocNode (void)
 {
 	static int s_NodeCount = 0;
 
+	BSPAllocPool_t &pool = s_BSPPools[GetThreadIndex()];
 	node_t	*node;
 
-	node = (node_t*)malloc(sizeof(*node));
+	if (!pool.m_pFreeNodes)
+	{
+		node = (node_t*)malloc(NODE_POOL_CHUNK * sizeof(*node));
+		for (int i=0 ; i<NODE_POOL_CHUNK ; i++)
+		{
+			node[i].parent = pool.m_pFreeNodes;
+			pool.m_pFreeNodes = &node[i];
+		}
+	}
+
+	node = pool.m_pFreeNodes;
+	pool.m_pFreeNodes = node->parent;
+
 	memset (node, 0, sizeof(*node));
-	node->id = s_NodeCount;
+	node->id = ThreadInterlockedIncrement (&s_NodeCount) - 1;
 	node->diskId = -1;
-
-	s_NodeCount++;
+	node->texinfo = -1;
 
 	return node;
 }
 
+/*
+================
+FreeNode
+================
+*/
+void FreeNode (node_t *node)
+{
+	BSPAllocPool_t &pool = s_BSPPools[GetThreadIndex()];
+
+	node->parent = pool.m_pFreeNodes;
+	pool.m_pFreeNodes = node;
+}
+
 
 /*
 ================
@@ -334,13 +374,22 @@ bspbrush_t *AllocBrush (int numsides)
 {
 	static int s_BrushId = 0;
 
-	bspbrush_t	*bb;
+	bspbrush_t	*bb = NULL;
 	int			c;
 
 	c = (int)&(((bspbrush_t *)0)->sides[numsides]);
-	bb = (bspbrush_t*)malloc(c);
+	if (numsides <= MAX_BRUSH_SIDES)
+	{
+		bspbrush_t **ppFree = &s_BSPPools[GetThreadIndex()].m_pFreeBrushes[numsides];
+		bb = *ppFree;
+		if (bb)
+			*ppFree = bb->next;
+	}
+	if (!bb)
+		bb = (bspbrush_t*)malloc(c);
 	memset (bb, 0, c);
-	bb->id = s_BrushId++;
+	bb->id = ThreadInterlockedIncrement (&s_BrushId) - 1;
+	bb->maxsides = numsides;
 	if (numthreads == 1)
 		c_active_brushes++;
 	return bb;
@@ -358,7 +407,16 @@ void FreeBrush (bspbrush_t *brushes)
 	for (i=0 ; i<brushes->numsides ; i++)
 		if (brushes->sides[i].winding)
 			FreeWinding(brushes->sides[i].winding);
-	free (brushes);
+	if (brushes->maxsides <= MAX_BRUSH_SIDES)
+	{
+		bspbrush_t **ppFree = &s_BSPPools[GetThreadIndex()].m_pFreeBrushes[brushes->maxsides];
+		brushes->next = *ppFree;
+		*ppFree = brushes;
+	}
+	else
+	{
+		free (brushes);
+	}
 	if (numthreads == 1)
 		c_active_brushes--;
 }
@@ -398,6 +456,7 @@ bspbrush_t *CopyBrush (bspbrush_t *brush)
 
 	newbrush = AllocBrush (brush->numsides);
 	memcpy (newbrush, brush, size);
+	newbrush->maxsides = brush->numsides;
 
 	for (i=0 ; i<brush->numsides ; i++)
 	{
@@ -839,6 +898,113 @@ qboolean CheckPlaneAgainstVolume (int pnum, node_t *node)
 	return good;
 }
 
+/*
+================
+EvaluateSplitSide
+
+Tests every brush against the plane of a candidate splitter and returns
+how good a split it makes. With bMarkBrushes, also leaves each brush's
+side of the plane in testside and flags the brush sides on the plane as
+tested, which the threaded scoring can't do since the brushes are shared.
+================
+*/
+static int EvaluateSplitSide (bspbrush_t *brushes, side_t *side, int pnum, bool bMarkBrushes)
+{
+	int			value;
+	bspbrush_t	*test;
+	int			j;
+	int			s;
+	int			front, back, both, facing, splits;
+	int			bsplits;
+	int			epsilonbrush;
+	qboolean	hintsplit = false;
+
+	front = 0;
+	back = 0;
+	both = 0;
+	facing = 0;
+	splits = 0;
+	epsilonbrush = 0;
+
+	for (test = brushes ; test ; test=test->next)
+	{
+		s = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
+
+		splits += bsplits;
+		if (bsplits && (s&PSIDE_FACING) )
+			Error ("PSIDE_FACING with splits");
+
+		if (bMarkBrushes)
+			test->testside = s;
+		// if the brush shares this face, don't bother
+		// testing that facenum as a splitter again
+		if (s & PSIDE_FACING)
+		{
+			facing++;
+			if (bMarkBrushes)
+			{
+				for (j=0 ; j<test->numsides ; j++)
+				{
+					if ( (test->sides[j].planenum&~1) == pnum)
+						test->sides[j].tested = true;
+				}
+			}
+		}
+		if (s & PSIDE_FRONT)
+			front++;
+		if (s & PSIDE_BACK)
+			back++;
+		if (s == PSIDE_BOTH)
+			both++;
+	}
+
+	// give a value estimate for using this plane
+	value =  5*facing - 5*splits - abs(front-back);
+//	value =  -5*splits;
+//	value =  5*facing - 5*splits;
+	if (g_MainMap->mapplanes[pnum].type < 3)
+		value+=5;		// axial is better
+	value -= epsilonbrush*1000;	// avoid!
+
+	// trans should split last
+	if ( side->surf & SURF_TRANS )
+	{
+		value -= 500;
+	}
+
+	// never split a hint side except with another hint
+	if (hintsplit && !(side->surf & SURF_HINT) )
+		value = -9999999;
+
+	// water should split first
+	if (side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
+		value = 9999999;
+
+	return value;
+}
+
+/*
+================
+IsSplitCandidate
+
+True if side can be tried as a splitter on the given pass.
+================
+*/
+static bool IsSplitCandidate (side_t *side, int pass)
+{
+	if (side->bevel)
+		return false;	// never use a bevel as a spliter
+	if (!side->winding)
+		return false;	// nothing visible, so it can't split
+	if (side->texinfo == TEXINFO_NODE)
+		return false;	// allready a node splitter
+	if (side->surf & SURF_SKIP)
+		return false;	// skip surfaces are never chosen
+	if ( side->visible ^ (pass<1) )
+		return false;	// only check visible faces on first pass
+	return true;
+}
+
 /*
 ================
 SelectSplitSide
@@ -854,18 +1020,11 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 	int			value, bestvalue;
 	bspbrush_t	*brush, *test;
 	side_t		*side, *bestside;
-	int			i, j, pass, numpasses;
+	int			i, pass, numpasses;
 	int			pnum;
-	int			s;
-	int			front, back, both, facing, splits;
-	int			bsplits;
-	int			bestsplits;
-	int			epsilonbrush;
-	qboolean	hintsplit = false;
 
 	bestside = NULL;
 	bestvalue = -99999;
-	bestsplits = 0;
 
 	// the search order goes: visible-structural, nonvisible-structural
 	// If any valid plane is available in a pass, no further
@@ -879,18 +1038,10 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 			{
 				side = brush->sides + i;
 
-				if (side->bevel)
-					continue;	// never use a bevel as a spliter
-				if (!side->winding)
-					continue;	// nothing visible, so it can't split
-				if (side->texinfo == TEXINFO_NODE)
-					continue;	// allready a node splitter
 				if (side->tested)
 					continue;	// we allready have metrics for this plane
-				if (side->surf & SURF_SKIP)
-					continue;	// skip surfaces are never chosen
-				if ( side->visible ^ (pass<1) )
-					continue;	// only check visible faces on first pass
+				if (!IsSplitCandidate (side, pass))
+					continue;
 				
 				pnum = side->planenum;
 				pnum &= ~1;	// allways use positive facing plane
@@ -900,62 +1051,7 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 				if (!CheckPlaneAgainstVolume (pnum, node))
 					continue;	// would produce a tiny volume
 
-				front = 0;
-				back = 0;
-				both = 0;
-				facing = 0;
-				splits = 0;
-				epsilonbrush = 0;
-
-				for (test = brushes ; test ; test=test->next)
-				{
-					s = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
-
-					splits += bsplits;
-					if (bsplits && (s&PSIDE_FACING) )
-						Error ("PSIDE_FACING with splits");
-
-					test->testside = s;
-					// if the brush shares this face, don't bother
-					// testing that facenum as a splitter again
-					if (s & PSIDE_FACING)
-					{
-						facing++;
-						for (j=0 ; j<test->numsides ; j++)
-						{
-							if ( (test->sides[j].planenum&~1) == pnum)
-								test->sides[j].tested = true;
-						}
-					}
-					if (s & PSIDE_FRONT)
-						front++;
-					if (s & PSIDE_BACK)
-						back++;
-					if (s == PSIDE_BOTH)
-						both++;
-				}
-
-				// give a value estimate for using this plane
-				value =  5*facing - 5*splits - abs(front-back);
-//					value =  -5*splits;
-//					value =  5*facing - 5*splits;
-				if (g_MainMap->mapplanes[pnum].type < 3)
-					value+=5;		// axial is better
-				value -= epsilonbrush*1000;	// avoid!
-
-				// trans should split last
-				if ( side->surf & SURF_TRANS )
-				{
-					value -= 500;
-				}
-
-				// never split a hint side except with another hint
-				if (hintsplit && !(side->surf & SURF_HINT) )
-					value = -9999999;
-
-				// water should split first
-				if (side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
-					value = 9999999;
+				value = EvaluateSplitSide (brushes, side, pnum, true);
 
 				// save off the side test so we don't need
 				// to recalculate it when we actually seperate
@@ -964,7 +1060,6 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 				{
 					bestvalue = value;
 					bestside = side;
-					bestsplits = splits;
 					for (test = brushes ; test ; test=test->next)
 						test->side = test->testside;
 				}
@@ -974,14 +1069,7 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 		// if we found a good plane, don't bother trying any
 		// other passes
 		if (bestside)
-		{
-			if (pass > 0)
-			{
-				if (numthreads == 1)
-					c_nonvis++;
-			}
 			break;
-		}
 	}
 
 	//
@@ -997,6 +1085,127 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 }
 
 
+//-----------------------------------------------------------------------------
+// Threaded split selection, for the big nodes at the top of the tree
+//-----------------------------------------------------------------------------
+struct SplitCandidate_t
+{
+	side_t	*m_pSide;
+	int		m_nPlane;
+	int		m_nValue;
+	bool	m_bValid;	// false if splitting the node's volume with it leaves a tiny piece
+};
+
+// Below this many brush tests it's cheaper to score a node's candidates on one thread
+#define THREADED_SPLIT_MIN_TESTS	65536
+
+static CUtlVector<SplitCandidate_t>	s_SplitCandidates;
+static bspbrush_t	*s_pSplitBrushes;
+static node_t		*s_pSplitNode;
+
+static void ScoreSplitCandidate_Thread (int iThread, int iCandidate)
+{
+	SplitCandidate_t &candidate = s_SplitCandidates[iCandidate];
+
+	candidate.m_bValid = CheckPlaneAgainstVolume (candidate.m_nPlane, s_pSplitNode) != 0;
+	if (candidate.m_bValid)
+		candidate.m_nValue = EvaluateSplitSide (s_pSplitBrushes, candidate.m_pSide, candidate.m_nPlane, false);
+}
+
+/*
+================
+SelectSplitSideThreaded
+
+Picks the same side as SelectSplitSide, but scores the candidates on all
+threads. SelectSplitSide skips any side whose plane an earlier candidate
+has already been tested against, so here each plane is only a candidate
+the first time it comes up.
+================
+*/
+static side_t *SelectSplitSideThreaded (bspbrush_t *brushes, node_t *node)
+{
+	static CUtlVector<byte> s_PlaneTried;
+
+	bspbrush_t	*brush;
+	side_t		*side, *bestside;
+	int			bestvalue;
+	int			i, pass;
+	int			pnum;
+	int			nBrushes;
+
+	bestside = NULL;
+	bestvalue = -99999;
+	nBrushes = CountBrushList (brushes);
+
+	s_PlaneTried.SetCount (g_MainMap->nummapplanes);
+	memset (s_PlaneTried.Base(), 0, s_PlaneTried.Count());
+
+	s_pSplitBrushes = brushes;
+	s_pSplitNode = node;
+
+	for (pass = 0 ; pass < 2 ; pass++)
+	{
+		s_SplitCandidates.RemoveAll();
+		for (brush = brushes ; brush ; brush=brush->next)
+		{
+			for (i=0 ; i<brush->numsides ; i++)
+			{
+				side = brush->sides + i;
+				if (!IsSplitCandidate (side, pass))
+					continue;
+
+				pnum = side->planenum & ~1;
+				if (s_PlaneTried[pnum])
+					continue;
+				s_PlaneTried[pnum] = true;
+
+				CheckPlaneAgainstParents (pnum, node);
+
+				SplitCandidate_t &candidate = s_SplitCandidates[s_SplitCandidates.AddToTail()];
+				candidate.m_pSide = side;
+				candidate.m_nPlane = pnum;
+				candidate.m_bValid = false;
+			}
+		}
+
+		if ((float)s_SplitCandidates.Count() * nBrushes >= THREADED_SPLIT_MIN_TESTS)
+		{
+			RunThreadsOnIndividual (s_SplitCandidates.Count(), false, ScoreSplitCandidate_Thread);
+		}
+		else
+		{
+			for (i=0 ; i<s_SplitCandidates.Count() ; i++)
+				ScoreSplitCandidate_Thread (0, i);
+		}
+
+		// the first of the best wins, as it does in SelectSplitSide
+		for (i=0 ; i<s_SplitCandidates.Count() ; i++)
+		{
+			if (s_SplitCandidates[i].m_bValid && s_SplitCandidates[i].m_nValue > bestvalue)
+			{
+				bestvalue = s_SplitCandidates[i].m_nValue;
+				bestside = s_SplitCandidates[i].m_pSide;
+			}
+		}
+
+		if (bestside)
+			break;
+	}
+
+	// SplitBrushList needs each brush's side of the winning plane
+	if (bestside)
+	{
+		int			bsplits, epsilonbrush = 0;
+		qboolean	hintsplit;
+
+		for (brush = brushes ; brush ; brush=brush->next)
+			brush->side = TestBrushToPlanenum (brush, bestside->planenum & ~1, &bsplits, &hintsplit, &epsilonbrush);
+	}
+
+	return bestside;
+}
+
+
 /*
 ==================
 BrushMostlyOnSide
@@ -1326,23 +1535,16 @@ void SplitBrushList (bspbrush_t *brushes,
 
 /*
 ================
-BuildTree_r
+SplitTreeNode
+
+Makes node a leaf if there is no splitter, otherwise divides its
+brushes and volume between two new children. Returns false for a leaf.
 ================
 */
-
-
-node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+static bool SplitTreeNode (node_t *node, bspbrush_t *brushes, side_t *bestside, bspbrush_t **children)
 {
 	node_t		*newnode;
-	side_t		*bestside;
 	int			i;
-	bspbrush_t	*children[2];
-
-	if (numthreads == 1)
-		c_nodes++;
-
-	// find the best plane to use as a splitter
-	bestside = SelectSplitSide (brushes, node);
 
 	if (!bestside)
 	{
@@ -1350,15 +1552,22 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 		node->side = NULL;
 		node->planenum = -1;
 		LeafNode (node, brushes);
-		return node;
+		return false;
 	}
 			 
 	// this is a splitplane node
 	node->side = bestside;
 	node->planenum = bestside->planenum & ~1;	// always use front facing
 
+	node->texinfo = bestside->texinfo;
+
+	// count it now, bestside belongs to one of the brushes freed below
+	if (!bestside->visible)
+		ThreadInterlockedIncrement (&c_nonvis);
+
 	SplitBrushList (brushes, node, &children[0], &children[1]);
 	FreeBrushList (brushes);
+	node->side = NULL;
 
 	// allocate children before recursing
 	for (i=0 ; i<2 ; i++)
@@ -1371,6 +1580,26 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	SplitBrush (node->volume, node->planenum, &node->children[0]->volume,
 		&node->children[1]->volume);
 
+	return true;
+}
+
+
+/*
+================
+BuildTree_r
+================
+*/
+
+
+node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+{
+	int			i;
+	bspbrush_t	*children[2];
+
+	// find the best plane to use as a splitter
+	if (!SplitTreeNode (node, brushes, SelectSplitSide (brushes, node), children))
+		return node;
+
 	// recursively process children
 	for (i=0 ; i<2 ; i++)
 	{
@@ -1379,6 +1608,116 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 
 	return node;
 }
+
+
+//-----------------------------------------------------------------------------
+// Threaded tree build
+//-----------------------------------------------------------------------------
+int g_nBrushBSPThreads = 1;
+
+// Subtrees with fewer brushes than this are built on one thread without splitting them further
+#define THREADED_SUBTREE_MIN_BRUSHES	64
+
+struct BuildTreeTask_t
+{
+	node_t		*m_pNode;
+	bspbrush_t	*m_pBrushes;
+	int			m_nBrushes;
+};
+
+static CUtlVector<BuildTreeTask_t> s_BuildTreeTasks;
+
+static void AddBuildTreeTask (node_t *node, bspbrush_t *brushes)
+{
+	BuildTreeTask_t &task = s_BuildTreeTasks[s_BuildTreeTasks.AddToTail()];
+	task.m_pNode = node;
+	task.m_pBrushes = brushes;
+	task.m_nBrushes = CountBrushList (brushes);
+}
+
+static void BuildTree_Thread (int iThread, int iTask)
+{
+	BuildTree_r (s_BuildTreeTasks[iTask].m_pNode, s_BuildTreeTasks[iTask].m_pBrushes);
+}
+
+/*
+================
+BuildTreeThreaded
+
+Splits the biggest nodes at the top of the tree here, scoring each one's
+candidates on all threads, until there are enough subtrees to keep every
+thread busy, then builds the subtrees in parallel. A node only depends on
+its own brushes, volume and parents, so the tree matches BuildTree_r's.
+================
+*/
+static void BuildTreeThreaded (node_t *headnode, bspbrush_t *brushes)
+{
+	bspbrush_t	*children[2];
+	int			i, nSavedThreads;
+
+	nSavedThreads = numthreads;
+	numthreads = g_nBrushBSPThreads;
+
+	s_BuildTreeTasks.RemoveAll();
+	AddBuildTreeTask (headnode, brushes);
+
+	while (s_BuildTreeTasks.Count() < numthreads * 8)
+	{
+		int iBiggest = 0;
+		for (i=1 ; i<s_BuildTreeTasks.Count() ; i++)
+		{
+			if (s_BuildTreeTasks[i].m_nBrushes > s_BuildTreeTasks[iBiggest].m_nBrushes)
+				iBiggest = i;
+		}
+
+		if (!s_BuildTreeTasks.Count() || s_BuildTreeTasks[iBiggest].m_nBrushes < THREADED_SUBTREE_MIN_BRUSHES)
+			break;
+
+		BuildTreeTask_t task = s_BuildTreeTasks[iBiggest];
+		s_BuildTreeTasks.Remove (iBiggest);
+
+		if (!SplitTreeNode (task.m_pNode, task.m_pBrushes, SelectSplitSideThreaded (task.m_pBrushes, task.m_pNode), children))
+			continue;
+
+		for (i=0 ; i<2 ; i++)
+			AddBuildTreeTask (task.m_pNode->children[i], children[i]);
+	}
+
+	if (s_BuildTreeTasks.Count())
+	{
+		// picking a splitter tests every candidate against every brush,
+		// so a subtree costs about the square of its brush count
+		CUtlVector<float> costs;
+		costs.SetCount (s_BuildTreeTasks.Count());
+		for (i=0 ; i<s_BuildTreeTasks.Count() ; i++)
+			costs[i] = (float)s_BuildTreeTasks[i].m_nBrushes * s_BuildTreeTasks[i].m_nBrushes;
+
+		SetThreadWorkCosts (costs.Base());
+		RunThreadsOnIndividual (s_BuildTreeTasks.Count(), false, BuildTree_Thread);
+	}
+
+	s_BuildTreeTasks.Purge();
+	numthreads = nSavedThreads;
+}
+
+/*
+================
+CountTreeNodes_r
+
+Counts the BrushBSP nodes after the tree is built, since the
+threaded build can't count them as it goes. Nonvisible splits are
+counted by SplitTreeNode.
+================
+*/
+static void CountTreeNodes_r (node_t *node)
+{
+	c_nodes++;
+	if (node->planenum == PLANENUM_LEAF)
+		return;
+
+	CountTreeNodes_r (node->children[0]);
+	CountTreeNodes_r (node->children[1]);
+}
 	  
 
 //===========================================================
@@ -1447,7 +1786,12 @@ tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs)
 
 	tree->headnode = node;
 
-	node = BuildTree_r (node, brushlist);
+	if (g_nBrushBSPThreads > 1)
+		BuildTreeThreaded (node, brushlist);
+	else
+		BuildTree_r (node, brushlist);
+
+	CountTreeNodes_r (node);
 	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
 	qprintf ("%5i nonvis nodes\n", c_nonvis);
 	qprintf ("%5i leafs\n", (c_nodes+1)/2);
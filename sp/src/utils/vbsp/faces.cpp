@@ -64,41 +64,104 @@ float	g_maxLightmapDimension = 32;
 
 face_t *NewFaceFromFace (face_t *f);
 
-// Used to speed up GetEdge2(). Holds a list of edges connected to each vert.
-CUtlVector<int> g_VertEdgeList[MAX_MAP_VERTS];
-
-
 //===========================================================================
 
-typedef struct hashvert_s
-{
-	struct hashvert_s	*next;
-	int		num;
-} hashvert_t;
-
+// vertexes are hashed by the cube of (1<<HASH_BITS) units they fall in. the
+// bucket table grows with the number of vertexes so chains stay short
 #define HASH_BITS	7
 #define	HASH_SIZE	(COORD_EXTENT>>HASH_BITS)
-
+#define	MIN_VERT_HASH_BUCKETS	4096
 
 int	vertexchain[MAX_MAP_VERTS];		// the next vertex in a hash chain
-int	hashverts[HASH_SIZE*HASH_SIZE];	// a vertex number, or 0 for no verts
+CUtlVector<int>	g_VertHash;			// a vertex number, or 0 for no verts
+int	g_nHashedVerts;
+
+// edges of the model being written, hashed by their (v[0], v[1]) pair so
+// GetEdge2() can find the edge a face shares backwards without a search
+#define	MIN_EDGE_HASH_BUCKETS	4096
+
+int	edgechain[MAX_MAP_EDGES];		// the next edge in a hash chain
+CUtlVector<int>	g_EdgeHash;			// an edge number, or 0 for no edges
+int	g_nFirstHashedEdge;				// the edges from here to numedges are hashed
 
 //face_t		*edgefaces[MAX_MAP_EDGES][2];
 
 //============================================================================
 
 
-unsigned HashVec (Vector& vec)
+inline int HashCell (vec_t x)
+{
+	return (int)floor (x + MAX_COORD_INTEGER) >> HASH_BITS;
+}
+
+inline unsigned HashCellBucket (int x, int y, int z)
+{
+	return ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ^ ( (unsigned)z * 83492791u );
+}
+
+unsigned HashVec (const Vector& vec)
 {
-	int			x, y;
+	int			x, y, z;
 
-	x = (MAX_COORD_INTEGER + (int)(vec[0]+0.5)) >> HASH_BITS;
-	y = (MAX_COORD_INTEGER + (int)(vec[1]+0.5)) >> HASH_BITS;
+	x = HashCell (vec[0]);
+	y = HashCell (vec[1]);
+	z = HashCell (vec[2]);
 
-	if ( x < 0 || x >= HASH_SIZE || y < 0 || y >= HASH_SIZE )
+	if ( x < 0 || x >= HASH_SIZE || y < 0 || y >= HASH_SIZE || z < 0 || z >= HASH_SIZE )
 		Error ("HashVec: point outside valid range");
 	
-	return y*HASH_SIZE + x;
+	return HashCellBucket (x, y, z) & (g_VertHash.Count() - 1);
+}
+
+/*
+=============
+ClearVertexHash
+=============
+*/
+void ClearVertexHash (void)
+{
+	g_VertHash.SetCount (MIN_VERT_HASH_BUCKETS);
+	memset (g_VertHash.Base(), 0, g_VertHash.Count() * sizeof(int));
+	g_nHashedVerts = 0;
+}
+
+/*
+=============
+HashVertex
+
+Links a vertex into the hash, doubling the bucket table
+once there are more vertexes than buckets
+=============
+*/
+void HashVertex (int vnum)
+{
+	int		h;
+
+	if (g_nHashedVerts >= g_VertHash.Count())
+	{
+		CUtlVector<int>	oldHash;
+		int		i, next;
+
+		oldHash.Swap (g_VertHash);
+		g_VertHash.SetCount (oldHash.Count() * 2);
+		memset (g_VertHash.Base(), 0, g_VertHash.Count() * sizeof(int));
+
+		for (i=0 ; i<oldHash.Count() ; i++)
+		{
+			for (int v=oldHash[i] ; v ; v=next)
+			{
+				next = vertexchain[v];
+				h = HashVec (dvertexes[v].point);
+				vertexchain[v] = g_VertHash[h];
+				g_VertHash[h] = v;
+			}
+		}
+	}
+
+	h = HashVec (dvertexes[vnum].point);
+	vertexchain[vnum] = g_VertHash[h];
+	g_VertHash[h] = vnum;
+	g_nHashedVerts++;
 }
 
 #ifdef USE_HASHING
@@ -111,10 +174,15 @@ Uses hashing
 */
 int	GetVertexnum (Vector& in)
 {
-	int			h;
 	int			i;
 	Vector		vert;
 	int			vnum;
+	int			mins[3], maxs[3];
+	int			x, y, z;
+	int			match;
+
+	if (!g_VertHash.Count())
+		ClearVertexHash ();
 
 	c_totalverts++;
 
@@ -124,18 +192,36 @@ int	GetVertexnum (Vector& in)
 			vert[i] = (int)(in[i]+0.5);
 		else
 			vert[i] = in[i];
+
+		// a match can be across a cell boundary, so check
+		// every cell within POINT_EPSILON of the vertex
+		mins[i] = HashCell (vert[i] - POINT_EPSILON);
+		maxs[i] = HashCell (vert[i] + POINT_EPSILON);
 	}
-	
-	h = HashVec (vert);
-	
-	for (vnum=hashverts[h] ; vnum ; vnum=vertexchain[vnum])
+
+	// the newest vertex in range wins, no matter what order the chains are in
+	match = 0;
+	for (x=mins[0] ; x<=maxs[0] ; x++)
 	{
-		Vector& p = dvertexes[vnum].point;
-		if ( fabs(p[0]-vert[0])<POINT_EPSILON
-		&& fabs(p[1]-vert[1])<POINT_EPSILON
-		&& fabs(p[2]-vert[2])<POINT_EPSILON )
-			return vnum;
+		for (y=mins[1] ; y<=maxs[1] ; y++)
+		{
+			for (z=mins[2] ; z<=maxs[2] ; z++)
+			{
+				int h = HashCellBucket (x, y, z) & (g_VertHash.Count() - 1);
+				for (vnum=g_VertHash[h] ; vnum ; vnum=vertexchain[vnum])
+				{
+					Vector& p = dvertexes[vnum].point;
+					if ( vnum > match
+					&& fabs(p[0]-vert[0])<POINT_EPSILON
+					&& fabs(p[1]-vert[1])<POINT_EPSILON
+					&& fabs(p[2]-vert[2])<POINT_EPSILON )
+						match = vnum;
+				}
+			}
+		}
 	}
+	if (match)
+		return match;
 	
 // emit a vertex
 	if (numvertexes == MAX_MAP_VERTS)
@@ -145,8 +231,7 @@ int	GetVertexnum (Vector& in)
 	dvertexes[numvertexes].point[1] = vert[1];
 	dvertexes[numvertexes].point[2] = vert[2];
 
-	vertexchain[numvertexes] = hashverts[h];
-	hashverts[h] = numvertexes;
+	HashVertex (numvertexes);
 
 	c_uniqueverts++;
 
@@ -336,63 +421,61 @@ void EmitLeafFaceVertexes( face_t **ppLeafFaceList )
 ==========
 FindEdgeVerts
 
-Uses the hash tables to cut down to a small number
+Uses the hash tables to cut down to a small number.
+The box is padded by OFF_EPSILON so vertexes just
+across a cell boundary from the edge are found
 ==========
 */
 void FindEdgeVerts (Vector& v1, Vector& v2)
 {
-	int		x1, x2, y1, y2, t;
-	int		x, y;
+	int		mins[3], maxs[3];
+	int		i, x, y, z;
 	int		vnum;
+	int		numcells;
 
-#if 0
-{
-	int		i;
-	num_edge_verts = numvertexes-1;
-	for (i=0 ; i<numvertexes-1 ; i++)
-		edge_verts[i] = i+1;
-}
-#endif
-
-	x1 = (MAX_COORD_INTEGER + (int)(v1[0]+0.5)) >> HASH_BITS;
-	y1 = (MAX_COORD_INTEGER + (int)(v1[1]+0.5)) >> HASH_BITS;
-	x2 = (MAX_COORD_INTEGER + (int)(v2[0]+0.5)) >> HASH_BITS;
-	y2 = (MAX_COORD_INTEGER + (int)(v2[1]+0.5)) >> HASH_BITS;
-
-	if (x1 > x2)
+	numcells = 1;
+	for (i=0 ; i<3 ; i++)
 	{
-		t = x1;
-		x1 = x2;
-		x2 = t;
+		mins[i] = HashCell ((v1[i] < v2[i] ? v1[i] : v2[i]) - OFF_EPSILON);
+		maxs[i] = HashCell ((v1[i] < v2[i] ? v2[i] : v1[i]) + OFF_EPSILON);
+		numcells *= maxs[i] - mins[i] + 1;
 	}
-	if (y1 > y2)
+
+	num_edge_verts = 0;
+
+	// long diagonal edges cover more cells than there are buckets,
+	// so just walk all of the chains once
+	if (numcells >= g_VertHash.Count())
 	{
-		t = y1;
-		y1 = y2;
-		y2 = t;
+		for (i=0 ; i<g_VertHash.Count() ; i++)
+		{
+			for (vnum=g_VertHash[i] ; vnum ; vnum=vertexchain[vnum])
+			{
+				Vector& p = dvertexes[vnum].point;
+				x = HashCell (p[0]);
+				y = HashCell (p[1]);
+				z = HashCell (p[2]);
+				if (x >= mins[0] && x <= maxs[0] && y >= mins[1] && y <= maxs[1] && z >= mins[2] && z <= maxs[2])
+					edge_verts[num_edge_verts++] = vnum;
+			}
+		}
+		return;
 	}
-#if 0
-	x1--;
-	x2++;
-	y1--;
-	y2++;
-	if (x1 < 0)
-		x1 = 0;
-	if (x2 >= HASH_SIZE)
-		x2 = HASH_SIZE;
-	if (y1 < 0)
-		y1 = 0;
-	if (y2 >= HASH_SIZE)
-		y2 = HASH_SIZE;
-#endif
-	num_edge_verts = 0;
-	for (x=x1 ; x <= x2 ; x++)
+
+	for (x=mins[0] ; x <= maxs[0] ; x++)
 	{
-		for (y=y1 ; y <= y2 ; y++)
+		for (y=mins[1] ; y <= maxs[1] ; y++)
 		{
-			for (vnum=hashverts[y*HASH_SIZE+x] ; vnum ; vnum=vertexchain[vnum])
+			for (z=mins[2] ; z <= maxs[2] ; z++)
 			{
-				edge_verts[num_edge_verts++] = vnum;
+				int h = HashCellBucket (x, y, z) & (g_VertHash.Count() - 1);
+				for (vnum=g_VertHash[h] ; vnum ; vnum=vertexchain[vnum])
+				{
+					// skip the other cells that share this bucket
+					Vector& p = dvertexes[vnum].point;
+					if (HashCell (p[0]) == x && HashCell (p[1]) == y && HashCell (p[2]) == z)
+						edge_verts[num_edge_verts++] = vnum;
+				}
 			}
 		}
 	}
@@ -739,19 +822,23 @@ FixTjuncs
 
 face_t *FixTjuncs (node_t *headnode, face_t *pLeafFaceList)
 {
+	double	start;
+
 	// snap and merge all vertexes
 	qprintf ("---- snap verts ----\n");
-	memset (hashverts, 0, sizeof(hashverts));
-	memset (vertexchain, 0, sizeof(vertexchain));
+	start = Plat_FloatTime();
+	ClearVertexHash ();
 	c_totalverts = 0;
 	c_uniqueverts = 0;
 	c_faceoverflows = 0;
 	EmitNodeFaceVertexes_r (headnode);
+	qprintf ("%i node verts welded in %.2f seconds\n", c_totalverts, Plat_FloatTime() - start);
 
 	// UNDONE: This count is wrong with tjuncs off on details - since 
 
 	// break edges on tjunctions
 	qprintf ("---- tjunc ----\n");
+	start = Plat_FloatTime();
 	c_tryedges = 0;
 	c_degenerate = 0;
 	c_facecollapse = 0;
@@ -774,7 +861,8 @@ face_t *FixTjuncs (node_t *headnode, face_t *pLeafFaceList)
 	}
 
 
-	qprintf ("%i unique from %i\n", c_uniqueverts, c_totalverts);
+	qprintf ("tjuncs fixed in %.2f seconds\n", Plat_FloatTime() - start);
+	qprintf ("%i unique from %i (%i hash buckets)\n", c_uniqueverts, c_totalverts, g_VertHash.Count());
 	qprintf ("%5i edges degenerated\n", c_degenerate);
 	qprintf ("%5i faces degenerated\n", c_facecollapse);
 	qprintf ("%5i edges added by tjunctions\n", c_tjunctions);
@@ -839,28 +927,47 @@ void FreeFaceList( face_t *pFaces )
 
 //========================================================
 
+inline int HashEdge (int v1, int v2)
+{
+	return ( (unsigned)v1 * 2654435761u ^ (unsigned)v2 ) & (g_EdgeHash.Count() - 1);
+}
+
 void GetEdge2_InitOptimizedList()
 {
-	for( int i=0; i < MAX_MAP_VERTS; i++ )
-		g_VertEdgeList[i].RemoveAll();
+	g_EdgeHash.SetCount( MIN_EDGE_HASH_BUCKETS );
+	memset( g_EdgeHash.Base(), 0, g_EdgeHash.Count() * sizeof(int) );
+	g_nFirstHashedEdge = numedges;
 }
 
 
-void IntSort( CUtlVector<int> &theList )
+//-----------------------------------------------------------------------------
+// Purpose: Links an edge into the edge hash, doubling the bucket table once
+//          there are more edges than buckets.
+//-----------------------------------------------------------------------------
+static void HashEdgeNum( int iEdge )
 {
-	for( int i=0; i < theList.Size()-1; i++ )
+	int h;
+
+	if ( !g_EdgeHash.Count() )
+		GetEdge2_InitOptimizedList();
+
+	if ( iEdge - g_nFirstHashedEdge >= g_EdgeHash.Count() )
 	{
-		if( theList[i] > theList[i+1] )
+		g_EdgeHash.SetCount( g_EdgeHash.Count() * 2 );
+		memset( g_EdgeHash.Base(), 0, g_EdgeHash.Count() * sizeof(int) );
+
+		// relink oldest first so each chain stays newest to oldest
+		for( int i = g_nFirstHashedEdge; i < iEdge; i++ )
 		{
-			int temp = theList[i];
-			theList[i] = theList[i+1];
-			theList[i+1] = temp;
-			if( i > 0 )
-				i -= 2;
-			else
-				i = -1;
+			h = HashEdge( dedges[i].v[0], dedges[i].v[1] );
+			edgechain[i] = g_EdgeHash[h];
+			g_EdgeHash[h] = i;
 		}
 	}
+
+	h = HashEdge( dedges[iEdge].v[0], dedges[iEdge].v[1] );
+	edgechain[iEdge] = g_EdgeHash[h];
+	g_EdgeHash[h] = iEdge;
 }
 
 
@@ -869,21 +976,40 @@ int AddEdge( int v1, int v2, face_t *f )
 	if (numedges >= MAX_MAP_EDGES)
 		Error ("Too many edges in map, max == %d", MAX_MAP_EDGES);
 
-	g_VertEdgeList[v1].AddToTail( numedges );
-	g_VertEdgeList[v2].AddToTail( numedges );
-	IntSort( g_VertEdgeList[v1] );
-	IntSort( g_VertEdgeList[v2] );
-			  
 	dedge_t *edge = &dedges[numedges];
 	numedges++;
     
     edge->v[0] = v1;
     edge->v[1] = v2;
     edgefaces[numedges-1][0] = f;
+	HashEdgeNum( numedges - 1 );
 	return numedges - 1;
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Finds the oldest edge added since GetEdge2_InitOptimizedList() that
+//          runs from v2 to v1, has the same contents as f and isn't shared
+//          yet, and gives it to f as its back face.
+//  Output: the edge number, or 0 if there isn't one
+//-----------------------------------------------------------------------------
+int ShareBackEdge( int v1, int v2, face_t *f )
+{
+	// chains are newest to oldest, so the last match is the oldest
+	int iMatch = 0;
+	for( int iEdge = g_EdgeHash[HashEdge( v2, v1 )]; iEdge; iEdge = edgechain[iEdge] )
+	{
+		dedge_t *edge = &dedges[iEdge];
+		if ( v1 == edge->v[1] && v2 == edge->v[0] && !edgefaces[iEdge][1] && edgefaces[iEdge][0]->contents == f->contents )
+			iMatch = iEdge;
+	}
+
+	if ( iMatch )
+		edgefaces[iMatch][1] = f;
+	return iMatch;
+}
+
+
 /*
 ==================
 GetEdge
@@ -894,27 +1020,13 @@ Don't allow four way edges
 */
 int GetEdge2 (int v1, int v2,  face_t *f)
 {
-	dedge_t	*edge;
-
 	c_tryedges++;
 
 	if (!noshare)
 	{
-		// Check all edges connected to v1.
-		CUtlVector<int> &theList = g_VertEdgeList[v1];
-		for( int i=0; i < theList.Size(); i++ )
-		{
-			int iEdge = theList[i];
-			edge = &dedges[iEdge];
-			if (v1 == edge->v[1] && v2 == edge->v[0] && edgefaces[iEdge][0]->contents == f->contents)
-			{
-				if (edgefaces[iEdge][1])
-					continue;
-
-				edgefaces[iEdge][1] = f;
-				return -iEdge;
-			}
-		}
+		int iEdge = ShareBackEdge( v1, v2, f );
+		if ( iEdge )
+			return -iEdge;
 	}
 
 	return AddEdge( v1, v2, f );
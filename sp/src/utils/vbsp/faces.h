@@ -15,6 +15,7 @@
 void GetEdge2_InitOptimizedList();	// Call this before calling GetEdge2() on a bunch of edges.
 int AddEdge( int v1, int v2, face_t *f );
 int GetEdge2(int v1, int v2,  face_t *f);
+int ShareBackEdge( int v1, int v2, face_t *f );	// 0 if there's no unshared edge from v2 to v1
 
 
 #endif // FACES_H
@@ -588,9 +588,9 @@ void MakeTreePortals_r (node_t *node)
 		{
 			const char *pMatName = "<NO BRUSH>";
 			// split by brush side
-			if ( node->side )
+			if ( node->texinfo >= 0 )
 			{
-				texinfo_t *pTexInfo = &texinfo[node->side->texinfo];
+				texinfo_t *pTexInfo = &texinfo[node->texinfo];
 				dtexdata_t *pTexData = GetTexData( pTexInfo->texdata );
 				pMatName = TexDataStringTable_GetString( pTexData->nameStringTableID );
 			}
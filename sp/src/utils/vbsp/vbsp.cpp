@@ -19,6 +19,7 @@
 #include "loadcmdline.h"
 #include "byteswap.h"
 #include "worldvertextransitionfixup.h"
+#include "pacifier.h"
 
 #ifdef MAPBASE_VSCRIPT
 #include "vscript/ivscript.h"
@@ -275,8 +276,21 @@ void ProcessWorldModel (void)
 	{
 		qprintf ("--------------------------------------------\n");
 
-		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
-			!verbose, ProcessBlock_Thread);
+		// Blocks are built one at a time, so BrushBSP can use the threads for each block's tree
+		int nBlocks = (block_xh-block_xl+1)*(block_yh-block_yl+1);
+		if (!verbose)
+		{
+			printf ("%-20s ", "ProcessBlock_Thread:");
+			StartPacifier ("");
+		}
+		for (int iBlock = 0 ; iBlock < nBlocks ; iBlock++)
+		{
+			ProcessBlock_Thread (0, iBlock);
+			if (!verbose)
+				UpdatePacifier ((float)(iBlock+1) / nBlocks);
+		}
+		if (!verbose)
+			EndPacifier ();
 
 		//
 		// build the division tree
@@ -938,6 +952,10 @@ int RunVBSP( int argc, char **argv )
 			numthreads = atoi (argv[i+1]);
 			i++;
 		}
+		else if (!Q_stricmp(argv[i],"-threadstats"))
+		{
+			g_bThreadStats = true;
+		}
 		else if (!Q_stricmp(argv[i],"-glview"))
 		{
 			glview = true;
@@ -1315,6 +1333,7 @@ int RunVBSP( int argc, char **argv )
 				"  -novconfig   : Don't bring up graphical UI on vproject errors.\n"
 				"  -threads     : Control the number of threads vbsp uses (defaults to the # of\n"
 				"                 processors on your machine).\n"
+				"  -threadstats : Print how long each thread was busy and idle in each threaded stage.\n"
 				"  -verboseentities: If -v is on, this disables verbose output for submodels.\n"
 				"  -noweld      : Don't join face vertices together.\n"
 				"  -nocsg       : Don't chop out intersecting brush areas.\n"
@@ -1384,7 +1403,10 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
-	numthreads = 1;		// multiple threads aren't helping...
+
+	// The csg and plane lookups aren't thread safe, so only BrushBSP's tree build is threaded
+	g_nBrushBSPThreads = numthreads;
+	numthreads = 1;
 
 	// Setup the logfile.
 	char logFile[512];
@@ -191,6 +191,7 @@ struct bspbrush_t
 	int		            side, testside;		// side of node during construction
 	mapbrush_t	        *original;
 	int		            numsides;
+	int					maxsides;			// sides allocated, which numsides can be less than
 	side_t	            sides[6];			// variably sized
 };
 
@@ -214,7 +215,8 @@ struct node_t
 	bspbrush_t		*volume;	// one for each leaf/node
 
 	// nodes only
-	side_t			*side;		// the side that created the node
+	side_t			*side;		// the side that created the node, NULL once its brush is freed
+	int				texinfo;	// texinfo of side, kept after the brush is freed. -1 for leafs
 	node_t			*children[2];
 	face_t			*faces;		// these are the cutup ones that live in the plane of "side".
 
@@ -513,6 +515,7 @@ void SplitBrush (bspbrush_t *brush, int planenum,
 
 tree_t *AllocTree (void);
 node_t *AllocNode (void);
+void FreeNode (node_t *node);
 bspbrush_t *AllocBrush (int numsides);
 int	CountBrushList (bspbrush_t *brushes);
 void FreeBrush (bspbrush_t *brushes);
@@ -525,6 +528,9 @@ node_t	*PointInLeaf (node_t *node, Vector& point);
 
 tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs);
 
+// Threads the BrushBSP tree build gets; the rest of vbsp runs on one thread.
+extern int g_nBrushBSPThreads;
+
 #define	PSIDE_FRONT			1
 #define	PSIDE_BACK			2
 #define	PSIDE_BOTH			(PSIDE_FRONT|PSIDE_BACK)
@@ -294,31 +294,18 @@ int CreateOrigFace( face_t *f )
         eIndex[0] = vIndices[i];
         eIndex[1] = vIndices[(i+1)%pWinding->numpoints];
 
-        for( j = firstmodeledge; j < numedges; j++ )
+        j = ShareBackEdge( eIndex[0], eIndex[1], f );
+        if( j )
         {
-            if( ( eIndex[0] == dedges[j].v[1] ) &&
-                ( eIndex[1] == dedges[j].v[0] ) &&
-         	    ( edgefaces[j][0]->contents == f->contents ) )
-            {
-                // check for multiple backward edges!! -- shouldn't have
-				if( edgefaces[j][1] )
-					continue;
-
-                // set back edge
-				edgefaces[j][1] = f;
-
-                //
-                // get next surface edge
-                //
-                if( numsurfedges >= MAX_MAP_SURFEDGES )
-                    Error( "Too much brush geometry in bsp, numsurfedges == MAX_MAP_SURFEDGES" );                
-                dsurfedges[numsurfedges] = -j;
-                numsurfedges++;
-                break;
-            }
+            //
+            // get next surface edge
+            //
+            if( numsurfedges >= MAX_MAP_SURFEDGES )
+                Error( "Too much brush geometry in bsp, numsurfedges == MAX_MAP_SURFEDGES" );                
+            dsurfedges[numsurfedges] = -j;
+            numsurfedges++;
         }
-        
-        if( j == numedges )
+        else
         {
             //
             // get next edge
@@ -899,6 +886,8 @@ void WriteBSP (node_t *headnode, face_t *pLeafFaceList )
 	int		i;
 	int		oldfaces;
     int     oldorigfaces;
+	int		oldedges;
+	double	start;
 
 	c_nofaces = 0;
 	c_facenodes = 0;
@@ -907,6 +896,8 @@ void WriteBSP (node_t *headnode, face_t *pLeafFaceList )
 
 	oldfaces = numfaces;
     oldorigfaces = numorigfaces;
+	oldedges = numedges;
+	start = Plat_FloatTime();
 
 	GetEdge2_InitOptimizedList();
 	EmitLeafFaces( pLeafFaceList );
@@ -936,6 +927,8 @@ void WriteBSP (node_t *headnode, face_t *pLeafFaceList )
 	qprintf ("%5i nodes without faces\n", c_nofaces);
 	qprintf ("%5i faces\n", numfaces-oldfaces);
     qprintf( "%5i original faces\n", numorigfaces-oldorigfaces );
+	qprintf ("%5i edges\n", numedges-oldedges);
+	qprintf ("faces and edges emitted in %.2f seconds\n", Plat_FloatTime() - start);
 }
 
 
@@ -89,50 +89,71 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const Vector& d
 }
 
 
-void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
-{
-	fltx4 fractionVisible;
+// the emit_surface lights that go in the ambient cubes, in dworldlights order
+static CUtlVector<int> g_AmbientCubeLights;
 
-	FourVectors vStart4, wlOrigin4;
-	vStart4.DuplicateVector ( vStart );
+// Adds the direct light from the emit_surface lights in the ambient cubes to a batch of
+// samples. The shadow rays for every sample and light go through TestLineStream together.
+static void AddEmitSurfaceLights( const Vector *pPositions, int nSamples, Vector (*pLightBoxColors)[6] )
+{
+	int nLights = g_AmbientCubeLights.Count();
+	if ( !nLights )
+		return;
 
-	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
+	CUtlVector<ShadowRay_t> rays;
+	CUtlVector<float> fractionVisible;
+	rays.SetCount( nSamples * nLights );
+	fractionVisible.SetCount( nSamples * nLights );
+	for ( int iSample = 0; iSample < nSamples; iSample++ )
 	{
-		dworldlight_t *wl = &dworldlights[iLight];
+		for ( int i = 0; i < nLights; i++ )
+		{
+			ShadowRay_t &ray = rays[iSample * nLights + i];
+			ray.m_vecStart = pPositions[iSample];
+			ray.m_vecEnd = dworldlights[g_AmbientCubeLights[i]].origin;
+			ray.m_pFractionVisible = &fractionVisible[iSample * nLights + i];
+		}
+	}
 
-		// Should this light even go in the ambient cubes?
-		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
-			continue;
+	TestLineStream( rays.Base(), rays.Count() );
 
-		Assert( wl->type == emit_surface );
+	for ( int iSample = 0; iSample < nSamples; iSample++ )
+	{
+		const Vector &vStart = pPositions[iSample];
+		Vector *lightBoxColor = pLightBoxColors[iSample];
 
-		// Can this light see the point?
-		wlOrigin4.DuplicateVector ( wl->origin );
-		TestLine ( vStart4, wlOrigin4, &fractionVisible );
-		if ( !TestSignSIMD ( CmpGtSIMD ( fractionVisible, Four_Zeros ) ) )
-			continue;
+		for ( int i = 0; i < nLights; i++ )
+		{
+			dworldlight_t *wl = &dworldlights[g_AmbientCubeLights[i]];
+			Assert( wl->type == emit_surface );
 
-		// Add this light's contribution.
-		Vector vDelta = wl->origin - vStart;
-		float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
+			// Can this light see the point?
+			float flFractionVisible = fractionVisible[iSample * nLights + i];
+			if ( !( flFractionVisible > 0 ) )
+				continue;
 
-		Vector vDeltaNorm = vDelta;
-		VectorNormalize( vDeltaNorm );
-		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
+			// Add this light's contribution.
+			Vector vDelta = wl->origin - vStart;
+			float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
 
-		float ratio = flDistanceScale * flAngleScale * SubFloat ( fractionVisible, 0 );
-		if ( ratio == 0 )
-			continue;
+			Vector vDeltaNorm = vDelta;
+			VectorNormalize( vDeltaNorm );
+			float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
 
-		for ( int i=0; i < 6; i++ )
-		{
-			float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
-			if ( t > 0 )
+			float ratio = flDistanceScale * flAngleScale * flFractionVisible;
+			if ( ratio == 0 )
+				continue;
+
+			for ( int j=0; j < 6; j++ )
 			{
-				lightBoxColor[i] += wl->intensity * (t * ratio);
+				float t = DotProduct( g_BoxDirections[j], vDeltaNorm );
+				if ( t > 0 )
+				{
+					lightBoxColor[j] += wl->intensity * (t * ratio);
+				}
 			}
 		}
-	}	
+	}
 }
 
 
@@ -173,10 +194,20 @@ void ComputeAmbientFromSphericalSamples( int iThread, const Vector &vStart, Vect
 		
 		lightBoxColor[j] *= 1/t;
 	}
+}
+
+
+// lights a batch of ambient sample positions
+static void LightAmbientSamples( int iThread, const Vector *pPositions, int nSamples, Vector (*pLightBoxColors)[6] )
+{
+	for ( int i = 0; i < nSamples; i++ )
+	{
+		ComputeAmbientFromSphericalSamples( iThread, pPositions[i], pLightBoxColors[i] );
+	}
 
 	// Now add direct light from the emit_surface lights. These go in the ambient cube because
 	// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
-	AddEmitSurfaceLights( vStart, lightBoxColor );
+	AddEmitSurfaceLights( pPositions, nSamples, pLightBoxColors );
 }
 
 
@@ -522,13 +553,14 @@ static byte Fixed8Fraction( float t, float tMin, float tMax )
 
 CUtlVector< CUtlVector<ambientsample_t> > g_LeafAmbientSamples;
 
-void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t> &list )
+// picks the candidate sample positions for a leaf, there are none in solid leaves
+void GenerateLeafAmbientSamplePositions( int iThread, int leafID, CUtlVector<Vector> &positions )
 {
 	CUtlVector<dplane_t> leafPlanes;
 	CLeafSampler sampler( iThread );
 
 	GetLeafBoundaryPlanes( leafPlanes, leafID );
-	list.RemoveAll();
+	positions.RemoveAll();
 	// this heuristic tries to generate at least one sample per volume (chosen to be similar to the size of a player) in the space
 	int xSize = (dleafs[leafID].maxs[0] - dleafs[leafID].mins[0]) / 32;
 	int ySize = (dleafs[leafID].maxs[1] - dleafs[leafID].mins[1]) / 32;
@@ -550,22 +582,87 @@ void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t>
 		// NOTE: We copy the nearest non-solid leaf sample pointers into this leaf at the end
 		return;
 	}
-	Vector cube[6];
+	positions.SetCount( sampleCount );
 	for ( int i = 0; i < sampleCount; i++ )
 	{
-		// compute each candidate sample and add to the list
-		Vector samplePosition;
-		sampler.GenerateLeafSamplePosition( leafID, leafPlanes, samplePosition );
-		ComputeAmbientFromSphericalSamples( iThread, samplePosition, cube );
+		sampler.GenerateLeafSamplePosition( leafID, leafPlanes, positions[i] );
+	}
+}
+
+// adds the lit candidates to the leaf's list in order, then drops the ones the rest reconstruct
+void BuildLeafAmbientSampleList( CUtlVector<ambientsample_t> &list, const CUtlVector<Vector> &positions, const int *pCubeIndex, Vector (*pCubes)[6] )
+{
+	list.RemoveAll();
+	for ( int i = 0; i < positions.Count(); i++ )
+	{
 		// note this will remove the least valuable sample once the limit is reached
-		AddSampleToList( list, samplePosition, cube );
+		AddSampleToList( list, positions[i], pCubes[pCubeIndex[i]] );
 	}
 
 	// remove any samples that can be reconstructed with the remaining data
 	CompressAmbientSampleList( list );
 }
 
-static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
+void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t> &list )
+{
+	CUtlVector<Vector> positions;
+	GenerateLeafAmbientSamplePositions( iThread, leafID, positions );
+
+	// candidates that fell back to the leaf center are all the same point, only light it once
+	CUtlVector<Vector> unique;
+	CUtlVector<int> cubeIndex;
+	cubeIndex.SetCount( positions.Count() );
+	for ( int i = 0; i < positions.Count(); i++ )
+	{
+		int j = unique.Find( positions[i] );
+		cubeIndex[i] = ( j >= 0 ) ? j : unique.AddToTail( positions[i] );
+	}
+
+	CUtlVector<Vector> cubes;
+	cubes.SetCount( unique.Count() * 6 );
+	LightAmbientSamples( iThread, unique.Base(), unique.Count(), (Vector (*)[6])cubes.Base() );
+
+	BuildLeafAmbientSampleList( list, positions, cubeIndex.Base(), (Vector (*)[6])cubes.Base() );
+}
+
+//-----------------------------------------------------------------------------
+// The threaded path picks every leaf's candidate positions first, lights them
+// in batches and then builds the leaves' lists. Only candidates at exactly the
+// same point share a lighting result, nearby samples in adjacent leaves are
+// still lit separately.
+//-----------------------------------------------------------------------------
+#define AMBIENT_SAMPLE_BATCH	16
+
+static CUtlVector< CUtlVector<Vector> >	g_LeafAmbientCandidates;
+static CUtlVector< CUtlVector<int> >	g_LeafAmbientCandidateCube;	// index into g_AmbientSamplePositions
+static CUtlVector<Vector>				g_AmbientSamplePositions;
+static CUtlVector<Vector>				g_AmbientSampleCubes;			// 6 per position
+
+static void ThreadGenerateLeafAmbientSamples( int iThread, void *pUserData )
+{
+	while (1)
+	{
+		int leafID = GetThreadWork ();
+		if (leafID == -1)
+			break;
+		GenerateLeafAmbientSamplePositions( iThread, leafID, g_LeafAmbientCandidates[leafID] );
+	}
+}
+
+static void ThreadLightAmbientSamples( int iThread, void *pUserData )
+{
+	while (1)
+	{
+		int iBatch = GetThreadWork ();
+		if (iBatch == -1)
+			break;
+		int iFirst = iBatch * AMBIENT_SAMPLE_BATCH;
+		int nSamples = min( AMBIENT_SAMPLE_BATCH, g_AmbientSamplePositions.Count() - iFirst );
+		LightAmbientSamples( iThread, &g_AmbientSamplePositions[iFirst], nSamples, (Vector (*)[6])&g_AmbientSampleCubes[iFirst * 6] );
+	}
+}
+
+static void ThreadBuildLeafAmbientSampleLists( int iThread, void *pUserData )
 {
 	CUtlVector<ambientsample_t> list;
 	while (1)
@@ -573,8 +670,7 @@ static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 		int leafID = GetThreadWork ();
 		if (leafID == -1)
 			break;
-		list.RemoveAll();
-		ComputeAmbientForLeaf(iThread, leafID, list);
+		BuildLeafAmbientSampleList( list, g_LeafAmbientCandidates[leafID], g_LeafAmbientCandidateCube[leafID].Base(), (Vector (*)[6])g_AmbientSampleCubes.Base() );
 		// copy to the output array
 		g_LeafAmbientSamples[leafID].SetCount( list.Count() );
 		for ( int i = 0; i < list.Count(); i++ )
@@ -584,6 +680,91 @@ static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 	}
 }
 
+static inline unsigned int HashSamplePosition( const Vector &pos )
+{
+	const unsigned int *p = (const unsigned int *)pos.Base();
+	return ( p[0] * 73856093u ) ^ ( p[1] * 19349663u ) ^ ( p[2] * 83492791u );
+}
+
+// gives each candidate an index into g_AmbientSamplePositions, in leaf order. This only
+// merges bit-identical positions, which in practice are leaves falling back to their center
+static void MergeLeafAmbientCandidates()
+{
+	int nCandidates = 0;
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		nCandidates += g_LeafAmbientCandidates[leafID].Count();
+	}
+
+	int nHashSize = 1;
+	while ( nHashSize < nCandidates * 2 )
+	{
+		nHashSize <<= 1;
+	}
+
+	// open addressing, each slot is a position index + 1
+	CUtlVector<int> hash;
+	hash.SetCount( nHashSize );
+	memset( hash.Base(), 0, nHashSize * sizeof( int ) );
+
+	g_AmbientSamplePositions.RemoveAll();
+	g_AmbientSamplePositions.EnsureCapacity( nCandidates );
+	g_LeafAmbientCandidateCube.SetCount( numleafs );
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		const CUtlVector<Vector> &positions = g_LeafAmbientCandidates[leafID];
+		CUtlVector<int> &cubeIndex = g_LeafAmbientCandidateCube[leafID];
+		cubeIndex.SetCount( positions.Count() );
+		for ( int i = 0; i < positions.Count(); i++ )
+		{
+			unsigned int h = HashSamplePosition( positions[i] ) & ( nHashSize - 1 );
+			while ( hash[h] && g_AmbientSamplePositions[hash[h] - 1] != positions[i] )
+			{
+				h = ( h + 1 ) & ( nHashSize - 1 );
+			}
+			if ( !hash[h] )
+			{
+				hash[h] = g_AmbientSamplePositions.AddToTail( positions[i] ) + 1;
+			}
+			cubeIndex[i] = hash[h] - 1;
+		}
+	}
+}
+
+static void ComputeLeafAmbientSamplesThreaded()
+{
+	double start = Plat_FloatTime();
+
+	g_LeafAmbientCandidates.SetCount( numleafs );
+	RunThreadsOn( numleafs, true, ThreadGenerateLeafAmbientSamples );
+
+	MergeLeafAmbientCandidates();
+	int nCandidates = 0;
+	int nSampledLeafs = 0;
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		nCandidates += g_LeafAmbientCandidates[leafID].Count();
+		if ( g_LeafAmbientCandidates[leafID].Count() )
+			++nSampledLeafs;
+	}
+
+	g_AmbientSampleCubes.SetCount( g_AmbientSamplePositions.Count() * 6 );
+	int nBatches = ( g_AmbientSamplePositions.Count() + AMBIENT_SAMPLE_BATCH - 1 ) / AMBIENT_SAMPLE_BATCH;
+	RunThreadsOn( nBatches, true, ThreadLightAmbientSamples );
+
+	RunThreadsOn( numleafs, true, ThreadBuildLeafAmbientSampleLists );
+
+	Msg( "%d leaf ambient samples lit for %d candidates in %d leaves (%.1f per leaf) in %.1f seconds\n",
+		g_AmbientSamplePositions.Count(), nCandidates, nSampledLeafs,
+		nSampledLeafs ? (float)g_AmbientSamplePositions.Count() / nSampledLeafs : 0.0f,
+		Plat_FloatTime() - start );
+
+	g_LeafAmbientCandidates.Purge();
+	g_LeafAmbientCandidateCube.Purge();
+	g_AmbientSamplePositions.Purge();
+	g_AmbientSampleCubes.Purge();
+}
+
 void VMPI_ProcessLeafAmbient( int iThread, uint64 iLeaf, MessageBuffer *pBuf )
 {
 	CUtlVector<ambientsample_t> list;
@@ -622,6 +803,7 @@ void ComputePerLeafAmbientLighting()
 	// Figure out which lights should go in the per-leaf ambient cubes.
 	int nInAmbientCube = 0;
 	int nSurfaceLights = 0;
+	g_AmbientCubeLights.RemoveAll();
 	for ( int i=0; i < *pNumworldlights; i++ )
 	{
 		dworldlight_t *wl = &dworldlights[i];
@@ -635,7 +817,10 @@ void ComputePerLeafAmbientLighting()
 			++nSurfaceLights;
 
 		if ( wl->flags & DWL_FLAGS_INAMBIENTCUBE )
+		{
+			g_AmbientCubeLights.AddToTail( i );
 			++nInAmbientCube;
+		}
 	}
 
 	Msg( "%d of %d (%d%% of) surface lights went in leaf ambient cubes.\n", nInAmbientCube, nSurfaceLights, nSurfaceLights ? ((nInAmbientCube*100) / nSurfaceLights) : 0 );
@@ -650,7 +835,7 @@ void ComputePerLeafAmbientLighting()
 	}
 	else
 	{
-		RunThreadsOn(numleafs, true, ThreadComputeLeafAmbient);
+		ComputeLeafAmbientSamplesThreaded();
 	}
 
 	// now write out the data
@@ -1699,30 +1699,42 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 	}
 
 	fltx4 totalFractionVisible = Four_Zeros;
-	fltx4 fractionVisible = Four_Zeros;
 
 	DirectionalSampler_t sampler;
 
-	for ( int d = 0; d < nsamples; d++ )
+	// two samples at a time, so their rays can be traced together
+	for ( int d = 0; d < nsamples; d += 2 )
 	{
-		// determine visibility of skylight
-		// serach back to see if we can hit a sky brush
-		Vector delta;
-		VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
-		if ( d )
+		int nPackets = min( 2, nsamples - d );
+		FourVectors start4[2];
+		FourVectors delta4[2];
+		fltx4 fractionVisible[2];
+
+		for ( int p = 0; p < nPackets; p++ )
 		{
-			// jitter light source location
-			Vector ofs = sampler.NextValue();
-			ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
-			delta += ofs;
+			// determine visibility of skylight
+			// serach back to see if we can hit a sky brush
+			Vector delta;
+			VectorScale( dl->light.normal, -MAX_TRACE_LENGTH, delta );
+			if ( d + p )
+			{
+				// jitter light source location
+				Vector ofs = sampler.NextValue();
+				ofs *= MAX_TRACE_LENGTH * g_SunAngularExtent;
+				delta += ofs;
+			}
+			delta4[p].DuplicateVector ( delta );
+			delta4[p] += pos;
+			start4[p] = pos;
 		}
-		FourVectors delta4;
-		delta4.DuplicateVector ( delta );
-		delta4 += pos;
 
-		TestLine_DoesHitSky ( pos, delta4, &fractionVisible, true, static_prop_index_to_ignore );
+		if ( nPackets == 2 )
+			TestLine_DoesHitSky8 ( start4, delta4, fractionVisible, true, static_prop_index_to_ignore );
+		else
+			TestLine_DoesHitSky ( pos, delta4[0], &fractionVisible[0], true, static_prop_index_to_ignore );
 
-		totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible );
+		for ( int p = 0; p < nPackets; p++ )
+			totalFractionVisible = AddSIMD ( totalFractionVisible, fractionVisible[p] );
 	}
 
 	fltx4 seeAmount = MulSIMD ( totalFractionVisible, ReplicateX4 ( 1.0f / nsamples ) );
@@ -1741,6 +1753,23 @@ void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, i
 	}
 }
 
+// A direction GatherSampleAmbientSkySSE() is waiting to trace along with the next one
+struct AmbientSkyDirection_t
+{
+	FourVectors	m_SurfacePos;
+	FourVectors	m_Delta;
+	fltx4		m_Dots[NUM_BUMP_VECTS+1];
+};
+
+static inline void AddAmbientSkyDirection( fltx4 *ambient_intensity, AmbientSkyDirection_t const& dir, fltx4 fractionVisible, int normalCount )
+{
+	for ( int i = 0; i < normalCount; i++ )
+	{
+		fltx4 addedAmount = MulSIMD( fractionVisible, dir.m_Dots[i] );
+		ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+	}
+}
+
 // Helper function - gathers light from ambient sky light
 void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 							   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
@@ -1762,6 +1791,10 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 		possibleHitCount[i] = Four_Zeros;
 	}
 
+	// directions are traced in pairs, and added in the order they were sampled
+	AmbientSkyDirection_t pending[2];
+	int nPending = 0;
+
 	DirectionalSampler_t sampler;
 	int nsky_samples = NUMVERTEXNORMALS;
 	if (do_fast || force_fast )
@@ -1801,22 +1834,35 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 		}
 
 		// search back to see if we can hit a sky brush
-		FourVectors delta = anorm;
-		delta *= -MAX_TRACE_LENGTH;
-		delta += pos;
-		FourVectors surfacePos = pos;
+		AmbientSkyDirection_t &dir = pending[nPending++];
+		dir.m_Delta = anorm;
+		dir.m_Delta *= -MAX_TRACE_LENGTH;
+		dir.m_Delta += pos;
+		dir.m_SurfacePos = pos;
 		FourVectors offset = anorm;
 		offset *= -flEpsilon;
-		surfacePos -= offset;
-
-		fltx4 fractionVisible = Four_Ones;
-		TestLine_DoesHitSky( surfacePos, delta, &fractionVisible, true, static_prop_index_to_ignore );
+		dir.m_SurfacePos -= offset;
 		for ( int i = 0; i < normalCount; i++ )
+			dir.m_Dots[i] = dots[i];
+
+		if ( nPending == 2 )
 		{
-			fltx4 addedAmount = MulSIMD( fractionVisible, dots[i] );
-			ambient_intensity[i] = AddSIMD( ambient_intensity[i], addedAmount );
+			FourVectors surfacePos[2] = { pending[0].m_SurfacePos, pending[1].m_SurfacePos };
+			FourVectors delta[2] = { pending[0].m_Delta, pending[1].m_Delta };
+			fltx4 fractionVisible[2];
+			TestLine_DoesHitSky8( surfacePos, delta, fractionVisible, true, static_prop_index_to_ignore );
+
+			AddAmbientSkyDirection( ambient_intensity, pending[0], fractionVisible[0], normalCount );
+			AddAmbientSkyDirection( ambient_intensity, pending[1], fractionVisible[1], normalCount );
+			nPending = 0;
 		}
+	}
 
+	if ( nPending )
+	{
+		fltx4 fractionVisible = Four_Ones;
+		TestLine_DoesHitSky( pending[0].m_SurfacePos, pending[0].m_Delta, &fractionVisible, true, static_prop_index_to_ignore );
+		AddAmbientSkyDirection( ambient_intensity, pending[0], fractionVisible, normalCount );
 	}
 
 	out.m_flFalloff = Four_Ones;
@@ -1836,7 +1882,7 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 								  int nLFlags, int static_prop_index_to_ignore,
-								  float flEpsilon )
+								  float flEpsilon, FourVectors *pShadowRayEnd )
 {
 	bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
 
@@ -1978,7 +2024,10 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 
 	// Raytrace for visibility function
 	fltx4 fractionVisible = Four_Ones;
-	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+	if ( pShadowRayEnd )
+		*pShadowRayEnd = src;	// the caller traces it later and scales m_flDot[0] itself
+	else
+		TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
 	dot = MulSIMD( fractionVisible, dot );
 	out.m_flDot[0] = dot;
 
@@ -2000,11 +2049,12 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 // normal - surface normal of sample
 // out.m_flDot[] - returned dot products with light vector and each normal
 // out.m_flFalloff - amount of light falloff
-void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
+bool GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 					   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 					   int nLFlags,
 					   int static_prop_index_to_ignore,
-					   float flEpsilon )
+					   float flEpsilon,
+					   FourVectors *pShadowRayEnd )
 {
 	for ( int b = 0; b < normalCount; b++ )
 		out.m_flDot[b] = Four_Zeros;
@@ -2027,13 +2077,21 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 	case emit_surface:
 	case emit_spotlight:
 		GatherSampleStandardLightSSE( out, dl, facenum, pos, pNormals, normalCount,
-		                              iThread, nLFlags, static_prop_index_to_ignore, flEpsilon );
+		                              iThread, nLFlags, static_prop_index_to_ignore, flEpsilon, pShadowRayEnd );
+		if ( pShadowRayEnd )
+			return true;
 		break;
 	default:
 		Error ("Bad dl->light.type");
-		return;
+		return false;
 	}
 
+	ClampSampleLightDots( out, normalCount );
+	return false;
+}
+
+void ClampSampleLightDots( SSE_sampleLightOutput_t &out, int normalCount )
+{
 	// NOTE: Notice here that if the light is on the back side of the face
 	// (tested by checking the dot product of the face normal and the light position)
 	// we don't want it to contribute to *any* of the bumped lightmaps. It glows
@@ -2486,85 +2544,324 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 }
 
 //-----------------------------------------------------------------------------
-// Iterates over all lights and computes lighting at up to 4 sample points
+// Adds one light's contribution to up to 4 sample points
+//-----------------------------------------------------------------------------
+static void AddSampleLightAt4Points( SSE_SampleInfo_t& info, directlight_t *dl, SSE_sampleLightOutput_t const& out, 
+									 fltx4 dotMask, int sampleIdx, int numSamples, Vector const& vecWarnPoint )
+{
+	// Apply the PVS check filter and compute falloff x dot
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	bool skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
+		{
+			skipLight = false;
+		}
+	}
+	if ( skipLight )
+		return;
+
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
+		{
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				vecWarnPoint.x, vecWarnPoint.y, vecWarnPoint.z );
+			info.m_WarnFace = info.m_FaceNum;
+		}
+		return;
+	}
+
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+		}
+	}
+
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Returns a mask with 1.0 in each of the samples that can see the light's cluster
+//-----------------------------------------------------------------------------
+static bool GetLightPVSMask( SSE_SampleInfo_t const& info, directlight_t *dl, int numSamples, fltx4 *pDotMask )
+{
+	fltx4 dotMask = Four_Zeros;
+	bool skipLight = true;
+	for( int s = 0; s < numSamples; s++ )
+	{
+		if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
+		{
+			dotMask = SetComponentSIMD( dotMask, s, 1.0f );
+			skipLight = false;
+		}
+	}
+
+	*pDotMask = dotMask;
+	return !skipLight;
+}
+
+//-----------------------------------------------------------------------------
+// Iterates over all lights and computes lighting at up to 4 sample points.
+// Point, spot and surface lights' shadow rays are traced two lights at a time,
+// and every light is still added in order.
 //-----------------------------------------------------------------------------
 static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
 {
-	SSE_sampleLightOutput_t out;
+	SSE_sampleLightOutput_t out[2];
+	directlight_t *pLights[2];
+	fltx4 dotMasks[2];
+	FourVectors shadowRayStart[2] = { info.m_Points, info.m_Points };
+	FourVectors shadowRayEnd[2];
+	int nPending = 0;
 
 	// Iterate over all direct lights and add them to the particular sample
 	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
 	{	    
 		// is this lights cluster visible?
-		fltx4 dotMask = Four_Zeros;
-		bool skipLight = true;
-		for( int s = 0; s < numSamples; s++ )
+		fltx4 dotMask;
+		if ( !GetLightPVSMask( info, dl, numSamples, &dotMask ) )
+			continue;
+
+		SSE_sampleLightOutput_t &lightOut = out[nPending];
+		bool bShadowRayDeferred = GatherSampleLightSSE( lightOut, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, 
+			info.m_NormalCount, info.m_iThread, 0, -1, 0.0f, &shadowRayEnd[nPending] );
+
+		if ( !bShadowRayDeferred )
 		{
-			if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
+			// sky lights trace their own rays, so add the light waiting on a pair first
+			if ( nPending )
 			{
-				dotMask = SetComponentSIMD( dotMask, s, 1.0f );
-				skipLight = false;
+				fltx4 fractionVisible;
+				TestLine( shadowRayStart[0], shadowRayEnd[0], &fractionVisible );
+				out[0].m_flDot[0] = MulSIMD( fractionVisible, out[0].m_flDot[0] );
+				ClampSampleLightDots( out[0], info.m_NormalCount );
+				AddSampleLightAt4Points( info, pLights[0], out[0], dotMasks[0], sampleIdx, numSamples, info.m_Points.Vec( 0 ) );
+				nPending = 0;
 			}
+
+			AddSampleLightAt4Points( info, dl, lightOut, dotMask, sampleIdx, numSamples, info.m_Points.Vec( 0 ) );
+			continue;
 		}
-		if ( skipLight )
+
+		pLights[nPending] = dl;
+		dotMasks[nPending] = dotMask;
+		if ( ++nPending < 2 )
 			continue;
 
-		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-		
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+		fltx4 fractionVisible[2];
+		TestLine8( shadowRayStart, shadowRayEnd, fractionVisible );
+		for ( int p = 0; p < 2; p++ )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
+			out[p].m_flDot[0] = MulSIMD( fractionVisible[p], out[p].m_flDot[0] );
+			ClampSampleLightDots( out[p], info.m_NormalCount );
+			AddSampleLightAt4Points( info, pLights[p], out[p], dotMasks[p], sampleIdx, numSamples, info.m_Points.Vec( 0 ) );
 		}
-		if ( skipLight )
+		nPending = 0;
+	}
+
+	if ( nPending )
+	{
+		fltx4 fractionVisible;
+		TestLine( shadowRayStart[0], shadowRayEnd[0], &fractionVisible );
+		out[0].m_flDot[0] = MulSIMD( fractionVisible, out[0].m_flDot[0] );
+		ClampSampleLightDots( out[0], info.m_NormalCount );
+		AddSampleLightAt4Points( info, pLights[0], out[0], dotMasks[0], sampleIdx, numSamples, info.m_Points.Vec( 0 ) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// -raystream: instead of tracing each light's shadow rays for a group of samples
+// as soon as its falloff is known, BuildFacelights queues them up across all of a
+// face's sample groups and lights and traces them in large batches sorted by
+// direction. Each light's contribution is added once its rays are traced, in the
+// order it was queued, so the lightmaps come out the same as without -raystream.
+// The exception is -textureshadows: TestLineStream() traces each ray on its own
+// there, so alpha tested shadows can differ slightly from the immediate path,
+// where the coverage is added up over each group of four samples' rays.
+// Rays are only traced for samples the light would actually contribute to.
+//-----------------------------------------------------------------------------
+#define RAYSTREAM_FLUSH_RAYS	8192
+
+struct DeferredSampleLight_t
+{
+	SSE_sampleLightOutput_t	m_Out;
+	fltx4					m_FractionVisible;
+	fltx4					m_DotMask;
+	directlight_t			*m_pLight;
+	int						m_nSampleIdx;
+	int						m_nNumSamples;
+	bool					m_bShadowRayDeferred;	// Sky lights trace their own rays right away
+	Vector					m_vecWarnPoint;
+};
+
+struct DirectLightStreamStats_t
+{
+	DirectLightStreamStats_t()
+	{
+		m_nQueuedLights = m_nRays = m_nSkippedRays = m_nPackets = m_nFlushes = 0;
+	}
+
+	void Add( DirectLightStreamStats_t const& other )
+	{
+		m_nQueuedLights += other.m_nQueuedLights;
+		m_nRays += other.m_nRays;
+		m_nSkippedRays += other.m_nSkippedRays;
+		m_nPackets += other.m_nPackets;
+		m_nFlushes += other.m_nFlushes;
+		m_TraceTime += other.m_TraceTime;
+	}
+
+	int64		m_nQueuedLights;
+	int64		m_nRays;
+	int64		m_nSkippedRays;	// Samples that couldn't receive any light, so weren't traced
+	int64		m_nPackets;
+	int64		m_nFlushes;
+	CCycleCount	m_TraceTime;
+};
+
+class CDirectLightStream
+{
+public:
+	void	QueueSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples );
+	void	Flush( SSE_SampleInfo_t& info );
+
+	DirectLightStreamStats_t m_Stats;
+
+private:
+	CUtlVector< DeferredSampleLight_t, CUtlMemoryAligned< DeferredSampleLight_t, 16 > > m_Lights;
+	CUtlVector< ShadowRay_t > m_Rays;
+	CUtlVector< int > m_RayOwners;		// m_Lights index * 4 + sample
+};
+
+static CDirectLightStream g_DirectLightStreams[MAX_TOOL_THREADS+1];
+
+void CDirectLightStream::QueueSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, int numSamples )
+{
+	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
+	{
+		fltx4 dotMask;
+		if ( !GetLightPVSMask( info, dl, numSamples, &dotMask ) )
 			continue;
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+		int iLight = m_Lights.AddToTail();
+		DeferredSampleLight_t &light = m_Lights[iLight];
+
+		FourVectors shadowRayEnd;
+		light.m_bShadowRayDeferred = GatherSampleLightSSE( light.m_Out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, 
+			info.m_NormalCount, info.m_iThread, 0, -1, 0.0f, &shadowRayEnd );
+		light.m_FractionVisible = Four_Ones;
+		light.m_DotMask = dotMask;
+		light.m_pLight = dl;
+		light.m_nSampleIdx = sampleIdx;
+		light.m_nNumSamples = numSamples;
+		light.m_vecWarnPoint = info.m_Points.Vec( 0 );
+		m_Stats.m_nQueuedLights++;
+
+		if ( !light.m_bShadowRayDeferred )
+			continue;
+
+		// Samples the light can't reach don't care what's in the way
+		fltx4 reach = MulSIMD( MulSIMD( light.m_Out.m_flDot[0], dotMask ), light.m_Out.m_flFalloff );
+		int nRays = 0;
+		for ( int i = 0; i < 4; i++ )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
+			if ( SubFloat( reach, i ) == 0.0f )
 			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
+				m_Stats.m_nSkippedRays++;
+				continue;
 			}
-			continue;
+
+			ShadowRay_t &ray = m_Rays[m_Rays.AddToTail()];
+			ray.m_vecStart = info.m_Points.Vec( i );
+			ray.m_vecEnd = shadowRayEnd.Vec( i );
+			ray.m_pFractionVisible = NULL;
+			m_RayOwners.AddToTail( iLight * 4 + i );
+			nRays++;
 		}
 
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+		// Nothing to add, same as GatherSampleLightAt4Points would find
+		if ( nRays == 0 )
+		{
+			m_Lights.Remove( iLight );
+			m_Stats.m_nQueuedLights--;
+		}
+	}
+
+	if ( m_Rays.Count() >= RAYSTREAM_FLUSH_RAYS )
+		Flush( info );
+}
 
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
+void CDirectLightStream::Flush( SSE_SampleInfo_t& info )
+{
+	if ( m_Rays.Count() )
+	{
+		// m_Lights won't grow any more, so the results can point into it now
+		for ( int i = 0; i < m_Rays.Count(); i++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
-			}
+			DeferredSampleLight_t &light = m_Lights[m_RayOwners[i] / 4];
+			m_Rays[i].m_pFractionVisible = &SubFloat( light.m_FractionVisible, m_RayOwners[i] % 4 );
 		}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+		CTimeAdder timer( &m_Stats.m_TraceTime );
+		m_Stats.m_nPackets += TestLineStream( m_Rays.Base(), m_Rays.Count() );
+		m_Stats.m_nRays += m_Rays.Count();
+		m_Stats.m_nFlushes++;
+	}
+
+	for ( int i = 0; i < m_Lights.Count(); i++ )
+	{
+		DeferredSampleLight_t &light = m_Lights[i];
+		if ( light.m_bShadowRayDeferred )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
-			}
+			light.m_Out.m_flDot[0] = MulSIMD( light.m_FractionVisible, light.m_Out.m_flDot[0] );
+			ClampSampleLightDots( light.m_Out, info.m_NormalCount );
 		}
+
+		AddSampleLightAt4Points( info, light.m_pLight, light.m_Out, light.m_DotMask, light.m_nSampleIdx, light.m_nNumSamples, light.m_vecWarnPoint );
 	}
+
+	m_Lights.RemoveAll();
+	m_Rays.RemoveAll();
+	m_RayOwners.RemoveAll();
 }
 
+void ReportDirectLightStreamStats( double flElapsedTime )
+{
+	DirectLightStreamStats_t total;
+	for ( int i = 0; i < ARRAYSIZE( g_DirectLightStreams ); i++ )
+	{
+		total.Add( g_DirectLightStreams[i].m_Stats );
+		g_DirectLightStreams[i].m_Stats = DirectLightStreamStats_t();
+	}
 
+	double flTraceTime = total.m_TraceTime.GetSeconds();
+	Msg( "Ray stream: %lld light/sample groups, %lld rays in %lld packets over %lld batches, %lld rays skipped\n",
+		total.m_nQueuedLights, total.m_nRays, total.m_nPackets, total.m_nFlushes, total.m_nSkippedRays );
+	Msg( "Ray stream: %.2fs tracing (summed over threads), %.2f Mrays/s per thread, %.2f Mrays/s overall in %.2fs\n",
+		flTraceTime, ( flTraceTime > 0 ) ? total.m_nRays / flTraceTime * 1e-6 : 0.0,
+		( flElapsedTime > 0 ) ? total.m_nRays / flElapsedTime * 1e-6 : 0.0, flElapsedTime );
+}
 
 //-----------------------------------------------------------------------------
 // Iterates over all lights and computes lighting at a sample point
@@ -3142,8 +3439,14 @@ void BuildFacelights (int iThread, int facenum)
 		}
 
 		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		if ( g_bUseRayStream )
+			g_DirectLightStreams[iThread].QueueSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		else
+			GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
 	}
+
+	if ( g_bUseRayStream )
+		g_DirectLightStreams[iThread].Flush( sampleInfo );
 	
 	// Tell the incremental light manager that we're done with this face.
 	if( g_pIncremental )
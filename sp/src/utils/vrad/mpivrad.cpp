@@ -294,8 +294,14 @@ void MPI_ReceiveVisLeafsResults( uint64 iWorkUnit, MessageBuffer *pBuf, int iWor
 		patch->numtransfers = numtransfers;
 		if (numtransfers) 
 		{
-			patch->transfers = new transfer_t[numtransfers];
+			// allocated like MakeScales does, since BounceLight frees them
+			patch->transfers = ( transfer_t* )malloc( numtransfers * sizeof(transfer_t) );
+			if ( !patch->transfers )
+				Error( "Memory allocation failure" );
 			pBuf->read(patch->transfers, numtransfers * sizeof(transfer_t));
+
+			if ( g_bCompactTransfers )
+				CompactTransfers( patch );
 		}
 		
 		total_transfer += numtransfers;
@@ -148,21 +148,38 @@ public:
 	}
 };
 
-void TestLine( const FourVectors& start, const FourVectors& stop,
-               fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+//-----------------------------------------------------------------------------
+// Traces one or two packets of four lines. Two go through Trace8Rays, which
+// traces them together on CPUs with AVX and gives each packet the same result
+// Trace4Rays would, coverage callback included.
+//-----------------------------------------------------------------------------
+static void TraceLinePackets( const FourVectors *pStart, const FourVectors *pStop, int nPackets, int skip_id,
+							  fltx4 *pLen, RayTracingResult *pResults, CCoverageCountTexture *pCoverage )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
+	EightRays myrays;
+	for ( int p = 0; p < nPackets; p++ )
+	{
+		myrays.packets[p].origin = pStart[p];
+		myrays.packets[p].direction = pStop[p];
+		myrays.packets[p].direction -= myrays.packets[p].origin;
+		pLen[p] = myrays.packets[p].direction.length();
+		myrays.packets[p].direction *= ReciprocalSIMD( pLen[p] );
+	}
 
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? &coverageCallback : 0 );
+	if ( nPackets == 2 )
+	{
+		fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+		ITransparentTriangleCallback *pCallbacks[2] = { &pCoverage[0], &pCoverage[1] };
+		g_RtEnv.Trace8Rays( myrays, tmin, pLen, pResults, skip_id, g_bTextureShadows ? pCallbacks : NULL );
+	}
+	else
+	{
+		g_RtEnv.Trace4Rays( myrays.packets[0], Four_Zeros, pLen[0], &pResults[0], skip_id, g_bTextureShadows ? &pCoverage[0] : 0 );
+	}
+}
 
+static fltx4 LineFractionVisible( const RayTracingResult &rt_result, const fltx4 &len, CCoverageCountTexture &coverageCallback )
+{
 	// Assume we can see the targets unless we get hits
 	float visibility[4];
 	for ( int i = 0; i < 4; i++ )
@@ -174,9 +191,150 @@ void TestLine( const FourVectors& start, const FourVectors& stop,
 			visibility[i] = 0.0f;
 		}
 	}
-	*pFractionVisible = LoadUnalignedSIMD( visibility );
+	fltx4 fractionVisible = LoadUnalignedSIMD( visibility );
 	if ( g_bTextureShadows )
-		*pFractionVisible = MinSIMD( *pFractionVisible, coverageCallback.GetFractionVisible() );
+		fractionVisible = MinSIMD( fractionVisible, coverageCallback.GetFractionVisible() );
+	return fractionVisible;
+}
+
+void TestLine( const FourVectors& start, const FourVectors& stop,
+               fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+{
+	fltx4 len;
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	TraceLinePackets( &start, &stop, 1, TRACE_ID_STATICPROP | static_prop_index_to_ignore, &len, &rt_result, &coverageCallback );
+
+	*pFractionVisible = LineFractionVisible( rt_result, len, coverageCallback );
+}
+
+void TestLine8( const FourVectors *pStart, const FourVectors *pStop,
+                fltx4 *pFractionVisible, int static_prop_index_to_ignore )
+{
+	fltx4 len[2];
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+
+	TraceLinePackets( pStart, pStop, 2, TRACE_ID_STATICPROP | static_prop_index_to_ignore, len, rt_result, coverageCallback );
+
+	for ( int p = 0; p < 2; p++ )
+		pFractionVisible[p] = LineFractionVisible( rt_result[p], len[p], coverageCallback[p] );
+}
+
+//-----------------------------------------------------------------------------
+// Traces a batch of shadow rays collected from many samples and lights. Each
+// packet of four rays is built from rays whose directions have the same signs,
+// so Trace4Rays never has to split a packet up and the rays in a packet tend
+// to visit the same KD-tree nodes. Pairs of packets go through Trace8Rays,
+// which traces them together on CPUs with AVX.
+//
+// The texture shadow callback adds up coverage for a whole packet, so what a
+// ray picks up from alpha tested triangles depends on the rays it's packed
+// with. With -textureshadows each packet holds a single ray instead, so every
+// ray gets its own coverage no matter how the stream was sorted.
+//-----------------------------------------------------------------------------
+static inline int ShadowRaySignMask( const Vector &vecDelta )
+{
+	// Same bits FourRays::CalculateDirectionSignMask() looks at, so -0 counts as negative
+	return ( ( *(const uint32 *)&vecDelta.x ) >> 31 ) |
+		   ( ( ( *(const uint32 *)&vecDelta.y ) >> 31 ) << 1 ) |
+		   ( ( ( *(const uint32 *)&vecDelta.z ) >> 31 ) << 2 );
+}
+
+int TestLineStream( ShadowRay_t *pRays, int nRays, int static_prop_index_to_ignore )
+{
+	// Bucket the rays by direction sign, keeping them in order within each bucket
+	int nBucketStart[9];
+	memset( nBucketStart, 0, sizeof( nBucketStart ) );
+
+	CUtlVector<unsigned char> masks;
+	masks.SetCount( nRays );
+	for ( int i = 0; i < nRays; i++ )
+	{
+		masks[i] = ShadowRaySignMask( pRays[i].m_vecEnd - pRays[i].m_vecStart );
+		nBucketStart[masks[i] + 1]++;
+	}
+
+	for ( int i = 0; i < 8; i++ )
+		nBucketStart[i + 1] += nBucketStart[i];
+
+	CUtlVector<int> order;
+	order.SetCount( nRays );
+	int nBucketNext[8];
+	memcpy( nBucketNext, nBucketStart, sizeof( nBucketNext ) );
+	for ( int i = 0; i < nRays; i++ )
+		order[nBucketNext[masks[i]]++] = i;
+
+	int nRaysPerPacket = g_bTextureShadows ? 1 : 4;
+
+	int nPackets = 0;
+	for ( int msk = 0; msk < 8; msk++ )
+	{
+		for ( int i = nBucketStart[msk]; i < nBucketStart[msk + 1]; i += 2 * nRaysPerPacket )
+		{
+			// Two packets at a time. A partial packet, or a packet of one ray, is padded
+			// with copies of its first ray.
+			int nRaysLeft = min( 2 * nRaysPerPacket, nBucketStart[msk + 1] - i );
+			int nPacketsHere = ( nRaysLeft > nRaysPerPacket ) ? 2 : 1;
+
+			EightRays myrays;
+			fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+			fltx4 len[2];
+			int nLanes[2];
+			for ( int p = 0; p < nPacketsHere; p++ )
+			{
+				nLanes[p] = min( nRaysPerPacket, nRaysLeft - nRaysPerPacket * p );
+				for ( int r = 0; r < 4; r++ )
+				{
+					const ShadowRay_t &ray = pRays[order[i + nRaysPerPacket * p + ( ( r < nLanes[p] ) ? r : 0 )]];
+					myrays.packets[p].origin.X( r ) = ray.m_vecStart.x;
+					myrays.packets[p].origin.Y( r ) = ray.m_vecStart.y;
+					myrays.packets[p].origin.Z( r ) = ray.m_vecStart.z;
+					myrays.packets[p].direction.X( r ) = ray.m_vecEnd.x - ray.m_vecStart.x;
+					myrays.packets[p].direction.Y( r ) = ray.m_vecEnd.y - ray.m_vecStart.y;
+					myrays.packets[p].direction.Z( r ) = ray.m_vecEnd.z - ray.m_vecStart.z;
+				}
+
+				len[p] = myrays.packets[p].direction.length();
+				myrays.packets[p].direction *= ReciprocalSIMD( len[p] );
+			}
+
+			RayTracingResult rt_result[2];
+			CCoverageCountTexture coverageCallback[2];
+			ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallback[0], &coverageCallback[1] };
+
+			if ( nPacketsHere == 2 )
+				g_RtEnv.Trace8Rays( myrays, tmin, len, rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? pCallbacks : NULL );
+			else
+				g_RtEnv.Trace4Rays( myrays.packets[0], Four_Zeros, len[0], &rt_result[0], TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? &coverageCallback[0] : 0 );
+			nPackets += nPacketsHere;
+
+			for ( int p = 0; p < nPacketsHere; p++ )
+			{
+				fltx4 coverageVisible = Four_Ones;
+				if ( g_bTextureShadows )
+					coverageVisible = coverageCallback[p].GetFractionVisible();
+
+				for ( int r = 0; r < nLanes[p]; r++ )
+				{
+					float flVisibility = 1.0f;
+					if ( ( rt_result[p].HitIds[r] != -1 ) &&
+						 ( SubFloat( rt_result[p].HitDistance, r ) < SubFloat( len[p], r ) ) )
+					{
+						flVisibility = 0.0f;
+					}
+
+					if ( g_bTextureShadows )
+						flVisibility = min( flVisibility, SubFloat( coverageVisible, r ) );
+
+					*pRays[order[i + nRaysPerPacket * p + r]].m_pFractionVisible = flVisibility;
+				}
+			}
+		}
+	}
+
+	return nPackets;
 }
 
 
@@ -349,22 +507,20 @@ void DM_ClipBoxToBrush( CToolTrace *trace, const Vector& mins, const Vector& max
 	}
 }
 
-void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
-	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+//-----------------------------------------------------------------------------
+// The rest of TestLine_DoesHitSky once the lines have been traced: what they
+// hit, and the 3D skybox for the ones that got out to the sky.
+//-----------------------------------------------------------------------------
+static void FinishDoesHitSky( FourVectors const& start, FourVectors const& stop, const RayTracingResult &rt_result, const fltx4 &len,
+	CCoverageCountTexture &coverageCallback, fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
 {
-	FourRays myrays;
-	myrays.origin = start;
-	myrays.direction = stop;
-	myrays.direction -= myrays.origin;
-	fltx4 len = myrays.direction.length();
-	myrays.direction *= ReciprocalSIMD( len );
-	RayTracingResult rt_result;
-	CCoverageCountTexture coverageCallback;
-
-	g_RtEnv.Trace4Rays(myrays, Four_Zeros, len, &rt_result, TRACE_ID_STATICPROP | static_prop_to_skip, g_bTextureShadows? &coverageCallback : 0);
-
 	if ( bDoDebug )
 	{
+		FourRays myrays;
+		myrays.origin = start;
+		myrays.direction = stop;
+		myrays.direction -= myrays.origin;
+		myrays.direction *= ReciprocalSIMD( len );
 		WriteTrace( "trace.txt", myrays, rt_result );
 	}
 
@@ -428,6 +584,31 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 	*pFractionVisible = SubSIMD( Four_Ones, occlusion );
 }
 
+void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip, bool bDoDebug )
+{
+	fltx4 len;
+	RayTracingResult rt_result;
+	CCoverageCountTexture coverageCallback;
+
+	TraceLinePackets( &start, &stop, 1, TRACE_ID_STATICPROP | static_prop_to_skip, &len, &rt_result, &coverageCallback );
+
+	FinishDoesHitSky( start, stop, rt_result, len, coverageCallback, pFractionVisible, canRecurse, static_prop_to_skip, bDoDebug );
+}
+
+void TestLine_DoesHitSky8( FourVectors const *pStart, FourVectors const *pStop,
+	fltx4 *pFractionVisible, bool canRecurse, int static_prop_to_skip )
+{
+	fltx4 len[2];
+	RayTracingResult rt_result[2];
+	CCoverageCountTexture coverageCallback[2];
+
+	TraceLinePackets( pStart, pStop, 2, TRACE_ID_STATICPROP | static_prop_to_skip, len, rt_result, coverageCallback );
+
+	for ( int p = 0; p < 2; p++ )
+		FinishDoesHitSky( pStart[p], pStop[p], rt_result[p], len[p], coverageCallback[p], &pFractionVisible[p], canRecurse, static_prop_to_skip, false );
+}
+
 
 
 //-----------------------------------------------------------------------------
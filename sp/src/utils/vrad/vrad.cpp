@@ -57,6 +57,9 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bRayTraceBenchmark = false;
+uint32		g_nRtEnvBuildFlags = 0;
+bool		g_bRtCache = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
 bool        g_bNoSkyRecurse = false;
@@ -117,6 +120,8 @@ double		g_flStartTime;
 bool		g_bStaticPropLighting = false;
 bool        g_bStaticPropPolys = false;
 bool        g_bTextureShadows = false;
+bool		g_bUseRayStream = false;
+bool		g_bCompactTransfers = false;
 bool        g_bDisablePropSelfShadowing = false;
 
 
@@ -1258,6 +1263,105 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 	ThreadLock ();
 	total_transfer += patch->numtransfers;
 	ThreadUnlock ();
+
+	// VMPI workers send their transfers to the master as they are. it compacts them when they arrive
+	if ( g_bCompactTransfers && !g_bUseMPI )
+	{
+		CompactTransfers( patch );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// -compacttransfers statistics, for MakeAllScales' report. The error is how far
+// the light each patch receives in the first bounce is off from what the full
+// precision transfers give.
+//-----------------------------------------------------------------------------
+static int64	s_nFullTransferBytes = 0;
+static int64	s_nCompactTransferBytes = 0;
+static double	s_flFirstBounceLight = 0;
+static double	s_flFirstBounceError = 0;
+static float	s_flMaxFirstBounceError = 0;
+
+static int TransferPatchLess( const transfer_t *pLeft, const transfer_t *pRight )
+{
+	return pLeft->patch - pRight->patch;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces a patch's transfers with their compacttransfers_t form.
+//-----------------------------------------------------------------------------
+void CompactTransfers( CPatch *patch )
+{
+	if ( !patch->transfers )
+		return;
+
+	int num = patch->numtransfers;
+	transfer_t *trans = patch->transfers;
+
+	// sorted transfers have small gaps between patch indices, and use the cache better when gathering
+	qsort( trans, num, sizeof( transfer_t ), ( int (*)( const void *, const void * ) )TransferPatchLess );
+
+	float flMaxTransfer = 0;
+	for ( int k = 0; k < num; k++ )
+	{
+		flMaxTransfer = max( flMaxTransfer, trans[k].transfer );
+	}
+	float scale = ( flMaxTransfer > 0 ) ? flMaxTransfer / 65535.0f : 1.0f;
+
+	// at most 5 bytes for the gap and 2 for the transfer
+	compacttransfers_t *pCompact = ( compacttransfers_t * )malloc( sizeof( compacttransfers_t ) + num * 7 );
+	if ( !pCompact )
+		Error( "Memory allocation failure" );
+	pCompact->scale = scale;
+
+	Vector exact( 0, 0, 0 ), compact( 0, 0, 0 );
+	byte *pOut = pCompact->data;
+	int nPrevPatch = 0;
+	for ( int k = 0; k < num; k++ )
+	{
+		unsigned int nGap = trans[k].patch - nPrevPatch;
+		nPrevPatch = trans[k].patch;
+		while ( nGap >= 0x80 )
+		{
+			*pOut++ = ( nGap & 0x7f ) | 0x80;
+			nGap >>= 7;
+		}
+		*pOut++ = nGap;
+
+		unsigned short nTransfer = (unsigned short)( trans[k].transfer / scale + 0.5f );
+		*pOut++ = nTransfer & 0xff;
+		*pOut++ = nTransfer >> 8;
+
+		// the first bounce sends out the direct light
+		CPatch *patch2 = &g_Patches[trans[k].patch];
+		Vector v = patch2->totallight.light[0] * patch2->reflectivity;
+		VectorMA( exact, trans[k].transfer, v, exact );
+		VectorMA( compact, nTransfer * scale, v, compact );
+	}
+	int numbytes = pOut - pCompact->data;
+	pCompact->numbytes = numbytes;
+
+	// give back what the worst case estimate didn't use. pCompact may be gone after this
+	patch->compactTransfers = ( compacttransfers_t * )realloc( pCompact, sizeof( compacttransfers_t ) + numbytes );
+	if ( !patch->compactTransfers )
+		patch->compactTransfers = pCompact;
+
+	free( patch->transfers );
+	patch->transfers = NULL;
+
+	float flLight = exact.x + exact.y + exact.z;
+	float flError = fabs( compact.x - exact.x ) + fabs( compact.y - exact.y ) + fabs( compact.z - exact.z );
+
+	ThreadLock ();
+	s_nFullTransferBytes += num * sizeof( transfer_t );
+	s_nCompactTransferBytes += sizeof( compacttransfers_t ) + numbytes;
+	s_flFirstBounceLight += flLight;
+	s_flFirstBounceError += flError;
+	if ( flLight > 0 )
+	{
+		s_flMaxFirstBounceError = max( s_flMaxFirstBounceError, flError / flLight );
+	}
+	ThreadUnlock ();
 }
 
 /*
@@ -1531,114 +1635,344 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
-void GatherLight (int threadnum, void *pUserData)
+//-----------------------------------------------------------------------------
+// The transfers are copied into one sparse matrix before bouncing, with a row per
+// receiving patch. Each row is padded to a multiple of 4 transfers with zero weights so
+// GatherLight can walk it 4 at a time. Rows of bumpmapped patches hold a weight for the
+// flat normal and each bump normal, with the direction to the sending patch already
+// factored in, so they don't have to be worked out again every bounce.
+//
+// Each row is allocated when it's built, right before the patch's transfers are freed,
+// so the matrix never exists alongside all of the transfers. An unbumped row takes as
+// much memory as the transfers it replaces, a bumped one 2.5 times as much.
+//-----------------------------------------------------------------------------
+struct TransferRow_t
 {
-	int			i, j, k;
-	transfer_t	*trans;
-	int			num;
-	CPatch		*patch;
-	Vector		sum, v;
+	int		*m_pPatches;		// the sending patches, followed by the weights in the same allocation
+	float	*m_pWeights;		// normal n's weights start at m_pWeights + n * m_nCount
+	int		m_nCount;			// transfers in the row, including the padding
+	int		m_nWeights;			// m_nCount * the number of normals
+};
+
+static CUtlVector<TransferRow_t>	g_TransferRows;
+
+// emitlight * reflectivity for each patch, updated before each bounce. keeping it apart
+// from CPatch makes each transfer a single aligned load.
+static CUtlVector< fltx4, CUtlMemoryAligned< fltx4, 16 > >	g_PatchReflectivity;
+static CUtlVector< fltx4, CUtlMemoryAligned< fltx4, 16 > >	g_ReflectedLight;
+
+//-----------------------------------------------------------------------------
+// Purpose: The flat normal followed by the bump normals that a bumpmapped patch
+//			gathers light for.
+//-----------------------------------------------------------------------------
+static void GetPatchBumpNormals( CPatch *patch, Vector normals[NUM_BUMP_VECTS+1] )
+{
+	// Disps
+	bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
+	if ( bDisp )
+	{
+		normals[0] = patch->normal;
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		Vector vecTexU, vecTexV;
+		PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+	}
+	else
+	{
+		GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
+			pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
+			normals[0], &normals[1] );
+	}
 
+	// force the base lightmap to use the flat normal instead of the phong normal
+	// FIXME: why does the patch not use the phong normal?
+	normals[0] = patch->normal;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The weight of a transfer for each of a bumpmapped patch's normals.
+//-----------------------------------------------------------------------------
+static FORCEINLINE void GetBumpTransferWeights( CPatch *patch, const Vector normals[NUM_BUMP_VECTS+1], int nPatch2, float flTransfer, float weights[NUM_BUMP_VECTS+1] )
+{
+	// get vector to other patch
+	Vector delta;
+	VectorSubtract (g_Patches[nPatch2].origin, patch->origin, delta);
+	VectorNormalize (delta);
+
+	// remove normal already factored into transfer steradian
+	float scale = 1.0f / DotProduct (delta, patch->normal);
+
+	for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+	{
+		// transfers facing away from a normal don't light it
+		float dot = DotProduct( delta, normals[i] );
+		weights[i] = ( dot > 0 ) ? flTransfer * scale * dot : 0.0f;
+	}
+}
+
+static void BuildTransferRow( int threadnum, void *pUserData )
+{
 	while (1)
 	{
-		j = GetThreadWork ();
+		int j = GetThreadWork ();
 		if (j == -1)
 			break;
 
-		patch = &g_Patches[j];
+		CPatch *patch = &g_Patches[j];
+		TransferRow_t &row = g_TransferRows[j];
+		if ( row.m_nCount )
+		{
+			// m_nCount is a multiple of 4, so the weights stay 16 byte aligned
+			row.m_pPatches = (int *)MemAlloc_AllocAligned( row.m_nCount * sizeof( int ) + row.m_nWeights * sizeof( float ), 16 );
+			if ( !row.m_pPatches )
+				Error( "Memory allocation failure" );
+			row.m_pWeights = (float *)( row.m_pPatches + row.m_nCount );
+		}
+
+		int *pPatches = row.m_pPatches;
+		float *pWeights = row.m_pWeights;
+		transfer_t *trans = patch->transfers;
+		int num = patch->numtransfers;
+		int k;
 
-		trans = patch->transfers;
-		num = patch->numtransfers;
 		if ( patch->needsBumpmap )
 		{
-			Vector delta;
-			Vector bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
+			GetPatchBumpNormals( patch, normals );
 
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
-			if ( bDisp )
+			for (k=0 ; k<num ; k++, trans++)
 			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+				float weights[NUM_BUMP_VECTS+1];
+				GetBumpTransferWeights( patch, normals, trans->patch, trans->transfer, weights );
 
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+				pPatches[k] = trans->patch;
+				for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+				{
+					pWeights[i * row.m_nCount + k] = weights[i];
+				}
 			}
-			else
+			for ( ; k < row.m_nCount; k++ )
 			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
-
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
-					normals[0], &normals[1] );
+				pPatches[k] = j;
+				for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+				{
+					pWeights[i * row.m_nCount + k] = 0.0f;
+				}
+			}
+		}
+		else
+		{
+			for (k=0 ; k<num ; k++, trans++)
+			{
+				pPatches[k] = trans->patch;
+				pWeights[k] = trans->transfer;
 			}
+			for ( ; k < row.m_nCount; k++ )
+			{
+				pPatches[k] = j;
+				pWeights[k] = 0.0f;
+			}
+		}
+
+		// the matrix has everything bouncing needs
+		free( patch->transfers );
+		patch->transfers = NULL;
+	}
+}
+
+static void BuildTransferMatrix( void )
+{
+	int nPatches = g_Patches.Count();
+	g_TransferRows.SetCount( nPatches );
+	g_PatchReflectivity.SetCount( nPatches );
+	g_ReflectedLight.SetCount( nPatches );
+
+	int nTransfers = 0;
+	int nWeights = 0;
+	for ( int i = 0; i < nPatches; i++ )
+	{
+		CPatch *patch = &g_Patches[i];
+		TransferRow_t &row = g_TransferRows[i];
+		row.m_pPatches = NULL;
+		row.m_pWeights = NULL;
+		row.m_nCount = ( patch->numtransfers + 3 ) & ~3;
+		row.m_nWeights = row.m_nCount * ( patch->needsBumpmap ? NUM_BUMP_VECTS+1 : 1 );
+		nTransfers += row.m_nCount;
+		nWeights += row.m_nWeights;
+
+		g_PatchReflectivity[i] = LoadZeroSIMD();
+		for ( int c = 0; c < 3; c++ )
+		{
+			SubFloat( g_PatchReflectivity[i], c ) = patch->reflectivity[c];
+		}
+	}
+
+	// with -compacttransfers, GatherLight decodes each patch's transfers as it goes instead
+	if ( g_bCompactTransfers )
+		return;
 
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+	RunThreadsOn( nPatches, true, BuildTransferRow );
+
+	qprintf( "Transfer matrix: %d transfers, %d weights (%.1f MB)\n", nTransfers, nWeights,
+		( nTransfers * sizeof( int ) + nWeights * sizeof( float ) ) / ( 1024.0f * 1024.0f ) );
+}
+
+static void FreeTransferMatrix( void )
+{
+	for ( int i = 0; i < g_Patches.Count(); i++ )
+	{
+		free( g_Patches[i].compactTransfers );
+		g_Patches[i].compactTransfers = NULL;
+	}
+
+	for ( int i = 0; i < g_TransferRows.Count(); i++ )
+	{
+		if ( g_TransferRows[i].m_pPatches )
+			MemAlloc_FreeAligned( g_TransferRows[i].m_pPatches );
+	}
 
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+	g_TransferRows.Purge();
+	g_PatchReflectivity.Purge();
+	g_ReflectedLight.Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Sums a row's transfers for each of its normals. Each lane of the sums is one color
+// channel, and the transfers are added up in order, the same as a scalar loop would.
+//-----------------------------------------------------------------------------
+template< int NUM_NORMALS >
+static FORCEINLINE void GatherTransferRow( const int *pPatches, const float *pWeights, int nCount, Vector *pOut )
+{
+	const fltx4 *pLight = g_ReflectedLight.Base();
+
+	fltx4 sum[NUM_NORMALS];
+	for ( int n = 0; n < NUM_NORMALS; n++ )
+	{
+		sum[n] = LoadZeroSIMD();
+	}
+
+	for ( int k = 0; k < nCount; k += 4 )
+	{
+		fltx4 light0 = pLight[pPatches[k]];
+		fltx4 light1 = pLight[pPatches[k+1]];
+		fltx4 light2 = pLight[pPatches[k+2]];
+		fltx4 light3 = pLight[pPatches[k+3]];
+		for ( int n = 0; n < NUM_NORMALS; n++ )
+		{
+			fltx4 weights = LoadAlignedSIMD( pWeights + n * nCount + k );
+			sum[n] = AddSIMD( sum[n], MulSIMD( SplatXSIMD( weights ), light0 ) );
+			sum[n] = AddSIMD( sum[n], MulSIMD( SplatYSIMD( weights ), light1 ) );
+			sum[n] = AddSIMD( sum[n], MulSIMD( SplatZSIMD( weights ), light2 ) );
+			sum[n] = AddSIMD( sum[n], MulSIMD( SplatWSIMD( weights ), light3 ) );
+		}
+	}
+
+	for ( int n = 0; n < NUM_NORMALS; n++ )
+	{
+		pOut[n].Init( SubFloat( sum[n], 0 ), SubFloat( sum[n], 1 ), SubFloat( sum[n], 2 ) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: GatherLight for one patch, with -compacttransfers.
+//-----------------------------------------------------------------------------
+static void GatherCompactTransfers( int j )
+{
+	CPatch *patch = &g_Patches[j];
+	const fltx4 *pLight = g_ReflectedLight.Base();
+	int normalCount = patch->needsBumpmap ? NUM_BUMP_VECTS+1 : 1;
+
+	Vector normals[NUM_BUMP_VECTS+1];
+	if ( patch->needsBumpmap )
+	{
+		GetPatchBumpNormals( patch, normals );
+	}
+
+	fltx4 sum[NUM_BUMP_VECTS+1];
+	for ( int i = 0; i < normalCount; i++ )
+	{
+		sum[i] = LoadZeroSIMD();
+	}
+
+	const compacttransfers_t *pCompact = patch->compactTransfers;
+	if ( pCompact )
+	{
+		const byte *pIn = pCompact->data;
+		const byte *pEnd = pIn + pCompact->numbytes;
+		int nPatch2 = 0;
+		while ( pIn < pEnd )
+		{
+			unsigned int nGap = 0;
+			for ( int nShift = 0; ; nShift += 7 )
 			{
-				VectorFill( bumpSum[i], 0 );
+				byte b = *pIn++;
+				nGap |= ( b & 0x7f ) << nShift;
+				if ( !( b & 0x80 ) )
+					break;
 			}
+			nPatch2 += nGap;
 
-			float dot;
-			for (k=0 ; k<num ; k++, trans++)
-			{
-				CPatch *patch2 = &g_Patches[trans->patch];
+			float flTransfer = ( pIn[0] | ( pIn[1] << 8 ) ) * pCompact->scale;
+			pIn += 2;
 
-				// get vector to other patch
-				VectorSubtract (patch2->origin, patch->origin, delta);
-				VectorNormalize (delta);
-				// find light emitted from other patch
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * patch2->reflectivity[i];
-				}
-				// remove normal already factored into transfer steradian
-				float scale = 1.0f / DotProduct (delta, patch->normal);
-				VectorScale( v, trans->transfer * scale, v );
-				
-				Vector bumpTransfer;
-				for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+			if ( patch->needsBumpmap )
+			{
+				float weights[NUM_BUMP_VECTS+1];
+				GetBumpTransferWeights( patch, normals, nPatch2, flTransfer, weights );
+				for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
 				{
-					dot = DotProduct( delta, normals[i] );
-					if ( dot <= 0 )
-					{
-//						Assert( i > 0 ); // if this hits, then the transfer shouldn't be here.  It doesn't face the flat normal of this face!
-						continue;
-					}
-					bumpTransfer = v * dot;
-					VectorAdd( bumpSum[i], bumpTransfer, bumpSum[i] );
+					sum[i] = AddSIMD( sum[i], MulSIMD( ReplicateX4( weights[i] ), pLight[nPatch2] ) );
 				}
 			}
-			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
+			else
 			{
-				VectorCopy( bumpSum[i], addlight[j].light[i] );
+				sum[0] = AddSIMD( sum[0], MulSIMD( ReplicateX4( flTransfer ), pLight[nPatch2] ) );
 			}
 		}
+	}
+
+	for ( int i = 0; i < normalCount; i++ )
+	{
+		addlight[j].light[i].Init( SubFloat( sum[i], 0 ), SubFloat( sum[i], 1 ), SubFloat( sum[i], 2 ) );
+	}
+}
+
+void GatherLight (int threadnum, void *pUserData)
+{
+	while (1)
+	{
+		int j = GetThreadWork ();
+		if (j == -1)
+			break;
+
+		if ( g_bCompactTransfers )
+		{
+			GatherCompactTransfers( j );
+			continue;
+		}
+
+		const TransferRow_t &row = g_TransferRows[j];
+		const int *pPatches = row.m_pPatches;
+		const float *pWeights = row.m_pWeights;
+
+		if ( g_Patches[j].needsBumpmap )
+		{
+			GatherTransferRow<NUM_BUMP_VECTS+1>( pPatches, pWeights, row.m_nCount, addlight[j].light );
+		}
 		else
 		{
-			VectorFill( sum, 0 );
-			for (k=0 ; k<num ; k++, trans++)
-			{
-				for(i=0; i<3; i++)
-				{
-					v[i] = emitlight[trans->patch][i] * g_Patches[trans->patch].reflectivity[i];
-				}
-				VectorScale( v, trans->transfer, v );
-				VectorAdd( sum, v, sum );
-			}
-			VectorCopy( sum, addlight[j].light[0] );
+			GatherTransferRow<1>( pPatches, pWeights, row.m_nCount, addlight[j].light );
 		}
 	}
 }
 
+
 #ifdef _WIN32
 #pragma warning (default:4701)
 #endif
@@ -1699,9 +2033,29 @@ void BounceLight (void)
 	}
 #endif
 
+	if ( bouncing )
+	{
+		BuildTransferMatrix();
+	}
+
+	double flBounceStart = Plat_FloatTime();
+	float flPrevAdded = 0;
+
 	i = 0;
 	while ( bouncing )
 	{
+		double flStart = Plat_FloatTime();
+
+		// light leaving each patch, for GatherLight
+		for ( unsigned int j = 0; j < uiPatchCount; j++ )
+		{
+			fltx4 light = LoadZeroSIMD();
+			SubFloat( light, 0 ) = emitlight[j].x;
+			SubFloat( light, 1 ) = emitlight[j].y;
+			SubFloat( light, 2 ) = emitlight[j].z;
+			g_ReflectedLight[j] = MulSIMD( light, g_PatchReflectivity[j] );
+		}
+
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
@@ -1711,7 +2065,14 @@ void BounceLight (void)
 		// light is always received to leaf patches
 		CollectLight( added );
 
-		qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f)\n", i+1, added[0], added[1], added[2] );
+		// how much this bounce added compared to the last one, which is how fast the bounces are converging
+		float flAdded = max( added[0], max( added[1], added[2] ) );
+		if ( i == 0 )
+			qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f) (%.2f seconds)\n", i+1, added[0], added[1], added[2], Plat_FloatTime() - flStart );
+		else
+			qprintf ("\tBounce #%i added RGB(%.0f, %.0f, %.0f), %.1f%% of the last bounce (%.2f seconds)\n", i+1, added[0], added[1], added[2],
+				( flPrevAdded > 0 ) ? 100.0f * flAdded / flPrevAdded : 0.0f, Plat_FloatTime() - flStart );
+		flPrevAdded = flAdded;
 
 		if ( i+1 == numbounce || (added[0] < 1.0 && added[1] < 1.0 && added[2] < 1.0) )
 			bouncing = false;
@@ -1723,6 +2084,15 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	if ( i > 0 )
+	{
+		double flBounceTime = Plat_FloatTime() - flBounceStart;
+		Msg( "%d bounce%s in %.2f seconds (%.3f seconds per bounce), last one added RGB(%.0f, %.0f, %.0f)\n",
+			i, ( i == 1 ) ? "" : "s", flBounceTime, flBounceTime / i, added[0], added[1], added[2] );
+	}
+
+	FreeTransferMatrix();
 }
 
 
@@ -1931,8 +2301,25 @@ void MakeAllScales (void)
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	if ( g_bCompactTransfers )
+	{
+		// the VMPI master might have built some patches' transfers itself
+		for ( int i = 0; i < g_Patches.Count(); i++ )
+		{
+			CompactTransfers( &g_Patches[i] );
+		}
+
+		Msg( "compact transfer lists: %5.1f megs, down from %5.1f (%.1f%%)\n",
+			s_nCompactTransferBytes / ( 1024.0f * 1024.0f ), s_nFullTransferBytes / ( 1024.0f * 1024.0f ),
+			( s_nFullTransferBytes > 0 ) ? 100.0f * s_nCompactTransferBytes / s_nFullTransferBytes : 0.0f );
+		Msg( "compact transfer first bounce error: %.4f%% overall, %.4f%% on the worst patch\n",
+			( s_flFirstBounceLight > 0 ) ? 100.0 * s_flFirstBounceError / s_flFirstBounceLight : 0.0, 100.0f * s_flMaxFirstBounceError );
+	}
+	else
+	{
+		qprintf ("transfer lists: %5.1f megs\n"
+			, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	}
 }
 
 
@@ -1997,6 +2384,28 @@ void MakeAllScales (void)
 #endif
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Rough relative cost of lighting each face, from how many luxels and
+//			normals it has, so the threads start on the biggest faces first.
+//-----------------------------------------------------------------------------
+static void EstimateFaceLightingCosts( CUtlVector<float> &costs )
+{
+	costs.SetCount( numfaces );
+	for ( int i = 0; i < numfaces; i++ )
+	{
+		dface_t *f = &g_pFaces[i];
+		texinfo_t *tx = &texinfo[f->texinfo];
+		if ( tx->flags & TEX_SPECIAL )
+		{
+			costs[i] = 0;
+			continue;
+		}
+
+		int normalCount = ( tx->flags & SURF_BUMPLIGHT ) ? NUM_BUMP_VECTS + 1 : 1;
+		costs[i] = (float)( f->m_LightmapTextureSizeInLuxels[0] + 1 ) * ( f->m_LightmapTextureSizeInLuxels[1] + 1 ) * normalCount;
+	}
+}
+
 bool RadWorld_Go()
 {
 	g_iCurFace = 0;
@@ -2026,7 +2435,15 @@ bool RadWorld_Go()
 	}
 	else 
 	{
+		CUtlVector<float> faceCosts;
+		EstimateFaceLightingCosts( faceCosts );
+		SetThreadWorkCosts( faceCosts.Base() );
+
+		double flStart = Plat_FloatTime();
 		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
+
+		if ( g_bUseRayStream )
+			ReportDirectLightStreamStats( Plat_FloatTime() - flStart );
 	}
 
 	// Was the process interrupted?
@@ -2081,7 +2498,12 @@ bool RadWorld_Go()
 		// blend bounced light into direct light and save
 		VMPI_SetCurrentStage( "FinalLightFace" );
 		if ( !g_bUseMPI || g_bMPIMaster )
+		{
+			CUtlVector<float> faceCosts;
+			EstimateFaceLightingCosts( faceCosts );
+			SetThreadWorkCosts( faceCosts.Base() );
 			RunThreadsOnIndividual (numfaces, true, FinalLightFace);
+		}
 		
 		// Distribute the lighting data to workers.
 		VMPI_DistributeLightData();
@@ -2120,6 +2542,135 @@ void InitDumpPatchesFiles()
 }
 
 
+//-----------------------------------------------------------------------------
+// -rtbench: builds a kd-tree over the map's triangles with each builder and node
+// layout, traces the same rays through each one four and eight at a time and
+// reports how they compare.
+//-----------------------------------------------------------------------------
+static float RayTraceBenchmarkRandom( uint32 &nSeed )
+{
+	nSeed = nSeed * 1664525 + 1013904223;
+	return ( nSeed >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+static void RunRayTraceBenchmark()
+{
+	struct RayTraceBenchmarkConfig_t
+	{
+		const char *m_pName;
+		uint32 m_nFlags;
+	};
+	static const RayTraceBenchmarkConfig_t s_Configs[] =
+	{
+		{ "sampled SAH",			0 },
+		{ "binned SAH",				RTE_FLAGS_BINNED_SAH_BUILD },
+		{ "binned SAH, vEB layout",	RTE_FLAGS_BINNED_SAH_BUILD | RTE_FLAGS_VEB_LAYOUT },
+	};
+
+	const int nPackets = 250000;
+	int nTris = g_RtEnv.OptimizedTriangleList.Count();
+	Msg( "Ray-trace benchmark: %d triangles, %d threads, %d rays\n", nTris, numthreads, nPackets * 4 );
+
+	CUtlVector< EightRays, CUtlMemoryAligned< EightRays, 16 > > rays;
+	CUtlVector< RayTracingResult, CUtlMemoryAligned< RayTracingResult, 16 > > results4;
+
+	for ( int c = 0; c < ARRAYSIZE( s_Configs ); c++ )
+	{
+		RayTracingEnvironment *pEnv = new RayTracingEnvironment;
+		pEnv->Flags = s_Configs[c].m_nFlags | ( g_nRtEnvBuildFlags & RTE_FLAGS_DISABLE_AVX ) |
+			RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS | RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS;
+		pEnv->m_nBuildThreads = numthreads;
+		for ( int t = 0; t < nTris; t++ )
+			pEnv->OptimizedTriangleList.AddToTail( g_RtEnv.OptimizedTriangleList[t] );
+
+		double flStart = Plat_FloatTime();
+		pEnv->SetupAccelerationStructure();
+		double flBuildTime = Plat_FloatTime() - flStart;
+
+		int nNodes, nLeaves, nMaxDepth, nTriangleRefs;
+		pEnv->GetKDTreeStats( nNodes, nLeaves, nMaxDepth, nTriangleRefs );
+
+		// groups of eight nearly parallel rays from random points in the map, the same for every config
+		Vector vecExtent = pEnv->m_MaxBound - pEnv->m_MinBound;
+		fltx4 flLength[2] = { ReplicateX4( vecExtent.Length() ), ReplicateX4( vecExtent.Length() ) };
+		fltx4 flZero[2] = { Four_Zeros, Four_Zeros };
+		if ( !rays.Count() )
+		{
+			uint32 nSeed = 12345;
+			rays.SetCount( nPackets / 2 );
+			for ( int p = 0; p < rays.Count(); p++ )
+			{
+				Vector vecOrigin, vecDir;
+				for ( int i = 0; i < 3; i++ )
+				{
+					vecOrigin[i] = pEnv->m_MinBound[i] + vecExtent[i] * RayTraceBenchmarkRandom( nSeed );
+					vecDir[i] = RayTraceBenchmarkRandom( nSeed ) * 2.0f - 1.0f;
+				}
+
+				for ( int r = 0; r < 8; r++ )
+				{
+					Vector vecRayDir = vecDir;
+					for ( int i = 0; i < 3; i++ )
+						vecRayDir[i] += ( RayTraceBenchmarkRandom( nSeed ) - 0.5f ) * 0.02f;
+					VectorNormalize( vecRayDir );
+					FourRays &packet = rays[p].packets[r / 4];
+					packet.origin.X( r & 3 ) = vecOrigin.x;
+					packet.origin.Y( r & 3 ) = vecOrigin.y;
+					packet.origin.Z( r & 3 ) = vecOrigin.z;
+					packet.direction.X( r & 3 ) = vecRayDir.x;
+					packet.direction.Y( r & 3 ) = vecRayDir.y;
+					packet.direction.Z( r & 3 ) = vecRayDir.z;
+				}
+			}
+			results4.SetCount( nPackets );
+		}
+
+		// four at a time
+		int nHits = 0;
+		flStart = Plat_FloatTime();
+		for ( int p = 0; p < nPackets; p++ )
+			pEnv->Trace4Rays( rays[p / 2].packets[p & 1], Four_Zeros, flLength[0], &results4[p] );
+		double flTraceTime = Plat_FloatTime() - flStart;
+
+		// eight at a time, checking that the results match
+		RayTracingResult results8[2];
+		int nMismatches = 0;
+		flStart = Plat_FloatTime();
+		for ( int p = 0; p < rays.Count(); p++ )
+		{
+			pEnv->Trace8Rays( rays[p], flZero, flLength, results8 );
+			for ( int i = 0; i < 2; i++ )
+			{
+				if ( memcmp( results8[i].HitIds, results4[2 * p + i].HitIds, sizeof( results8[i].HitIds ) ) ||
+					 memcmp( &results8[i].HitDistance, &results4[2 * p + i].HitDistance, sizeof( fltx4 ) ) )
+				{
+					nMismatches++;
+				}
+			}
+		}
+		double flTrace8Time = Plat_FloatTime() - flStart;
+
+		for ( int p = 0; p < nPackets; p++ )
+		{
+			for ( int r = 0; r < 4; r++ )
+			{
+				if ( results4[p].HitIds[r] != -1 )
+					nHits++;
+			}
+		}
+
+		Msg( "  %-24s build %.2fs, %d nodes (%d leaves, max depth %d, %.2f tris/leaf), %d hits\n",
+			s_Configs[c].m_pName, flBuildTime, nNodes, nLeaves, nMaxDepth, nLeaves ? (float)nTriangleRefs / nLeaves : 0.0f, nHits );
+		Msg( "  %-24s %.2f Mrays/s 4-wide, %.2f Mrays/s 8-wide (%s), %d packets differ\n", "",
+			( flTraceTime > 0 ) ? nPackets * 4 / flTraceTime * 1e-6 : 0.0,
+			( flTrace8Time > 0 ) ? nPackets * 4 / flTrace8Time * 1e-6 : 0.0,
+			pEnv->m_bTraceAVX ? "AVX" : "no AVX", nMismatches );
+
+		delete pEnv;
+	}
+}
+
+
 void VRAD_LoadBSP( char const *pFilename )
 {
 	ThreadSetDefault ();
@@ -2182,6 +2733,10 @@ void VRAD_LoadBSP( char const *pFilename )
 
 	Msg( "Loading %s\n", platformPath );
 	VMPI_SetCurrentStage( "LoadBSPFile" );
+
+	// workers get the bsp through the VMPI filesystem, so there's nothing on disk to map
+	if ( g_bUseMPI && !g_bMPIMaster )
+		g_bMapBSPFile = false;
 	LoadBSPFile (platformPath);
 	
 	// now, set whether or not static prop lighting is present
@@ -2254,12 +2809,42 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
-	// Build acceleration structure
+	if ( g_bRayTraceBenchmark )
+	{
+		RunRayTraceBenchmark();
+		exit( 0 );
+	}
+
+	// Build acceleration structure, or load the one built by a previous run on the same geometry
+	g_RtEnv.Flags |= g_nRtEnvBuildFlags;
+	g_RtEnv.m_nBuildThreads = numthreads;
+
+	char rtCacheFile[MAX_PATH];
+	uint32 nGeometryCRC = 0;
+	if ( g_bRtCache )
+	{
+		Q_StripExtension( platformPath, rtCacheFile, sizeof( rtCacheFile ) );
+		Q_strncat( rtCacheFile, ".rtc", sizeof( rtCacheFile ), COPY_ALL_CHARACTERS );
+		nGeometryCRC = g_RtEnv.GetGeometryCRC();
+	}
+
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
-	g_RtEnv.SetupAccelerationStructure();
-	float end = Plat_FloatTime();
-	printf ( "Done (%.2f seconds)\n", end-start );
+	if ( g_bRtCache && g_RtEnv.LoadAccelerationStructure( rtCacheFile, nGeometryCRC ) )
+	{
+		float end = Plat_FloatTime();
+		printf ( "Loaded from %s (%.2f seconds)\n", rtCacheFile, end-start );
+	}
+	else
+	{
+		g_RtEnv.SetupAccelerationStructure();
+		float end = Plat_FloatTime();
+		printf ( "Done (%.2f seconds)\n", end-start );
+
+		// VMPI workers load the master's cache but leave writing it to the master
+		if ( g_bRtCache && ( !g_bUseMPI || g_bMPIMaster ) && !g_RtEnv.SaveAccelerationStructure( rtCacheFile, nGeometryCRC ) )
+			Warning( "Couldn't write ray-trace cache %s\n", rtCacheFile );
+	}
 
 #if 0  // To test only k-d build
 	exit(0);
@@ -2380,6 +2965,14 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bTextureShadows = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-raystream" ) )
+		{
+			g_bUseRayStream = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-compacttransfers" ) )
+		{
+			g_bCompactTransfers = true;
+		}
 		else if ( !strcmp(argv[i], "-dump") )
 		{
 			g_bDumpPatches = true;
@@ -2400,6 +2993,34 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bDumpRtEnv = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-rtbench" ) )
+		{
+			g_bRayTraceBenchmark = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-rtbinnedsah" ) )
+		{
+			g_nRtEnvBuildFlags |= RTE_FLAGS_BINNED_SAH_BUILD;
+		}
+		else if ( !Q_stricmp( argv[i], "-rtveb" ) )
+		{
+			g_nRtEnvBuildFlags |= RTE_FLAGS_VEB_LAYOUT;
+		}
+		else if ( !Q_stricmp( argv[i], "-rtnoavx" ) )
+		{
+			g_nRtEnvBuildFlags |= RTE_FLAGS_DISABLE_AVX;
+		}
+		else if ( !Q_stricmp( argv[i], "-rtcache" ) )
+		{
+			g_bRtCache = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-threadstats" ) )
+		{
+			g_bThreadStats = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-mmap" ) )
+		{
+			g_bMapBSPFile = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-LargeDispSampleRadius" ) )
 		{
 			g_bLargeDispSampleRadius = true;
@@ -2792,8 +3413,18 @@ void PrintUsage( int argc, char **argv )
 		"  -dump           : Write debugging .txt files.\n"
 		"  -dumpnormals    : Write normals to debug files.\n"
 		"  -dumptrace      : Write ray-tracing environment to debug files.\n"
+		"  -rtbench        : Compare the ray-tracing kd-tree builders and layouts on this map, then exit.\n"
+		"  -rtbinnedsah    : Build the ray-tracing kd-tree with the parallel binned SAH builder instead\n"
+		"                    of the single-threaded sampled SAH one.\n"
+		"  -rtveb          : Lay the ray-tracing kd-tree out in van Emde Boas order.\n"
+		"  -rtnoavx        : Don't trace rays eight at a time with AVX, even if the CPU has it.\n"
+		"  -rtcache        : Keep the ray-tracing kd-tree in <mapname>.rtc and reuse it on\n"
+		"                    later runs while the map's geometry and static props don't change.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
+		"  -threadstats    : Print how long each thread was busy and idle in each threaded stage.\n"
+		"  -mmap           : Map the bsp instead of reading it all into memory, and put off\n"
+		"                    parsing the pakfile until it's read or the bsp is written.\n"
 		"  -lights <file>  : Load a lights file in addition to lights.rad and the\n"
 		"                    level lights file.\n"
 		"  -noextra        : Disable supersampling.\n"
@@ -2828,6 +3459,11 @@ void PrintUsage( int argc, char **argv )
         "  -OnlyStaticProps   : Only perform direct static prop lighting (vrad debug option)\n"
 		"  -StaticPropNormals : when lighting static props, just show their normal vector\n"
 		"  -textureshadows : Allows texture alpha channels to block light - rays intersecting alpha surfaces will sample the texture\n"
+		"  -raystream      : Queue up direct lighting shadow rays across many samples and lights and trace\n"
+		"                    them in batches sorted by direction. With -textureshadows, alpha\n"
+		"                    tested shadows can differ slightly from the default path.\n"
+		"  -compacttransfers : Store the patch to patch light transfers in about half the memory,\n"
+		"                    at the cost of slightly less accurate and slower bounces.\n"
 		"  -noskyboxrecurse : Turn off recursion into 3d skybox (skybox shadows on world)\n"
 		"  -nossprops      : Globally disable self-shadowing on static props\n"
 		"\n"
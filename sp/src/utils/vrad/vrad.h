@@ -112,6 +112,16 @@ struct transfer_t
 	float	transfer;
 };
 
+// A patch's transfers as stored with -compacttransfers: sorted by patch, each one the
+// gap from the previous patch index as a 7 bits per byte varint, followed by a 16-bit
+// transfer in units of scale.
+struct compacttransfers_t
+{
+	int		numbytes;		// of data
+	float	scale;
+	byte	data[1];
+};
+
 
 struct LightingValue_t
 {
@@ -238,6 +248,7 @@ struct CPatch
 
 	int			numtransfers;
 	transfer_t	*transfers;
+	compacttransfers_t *compactTransfers;	// replaces transfers with -compacttransfers
 
 	short		indices[3];				// displacement use these for subdivision
 };
@@ -287,6 +298,8 @@ extern float g_flSkySampleScale;								// extra sampling factor for indirect li
 extern bool g_bLargeDispSampleRadius;
 extern bool g_bStaticPropPolys;
 extern bool g_bTextureShadows;
+extern bool g_bUseRayStream;
+extern bool g_bCompactTransfers;
 extern bool g_bShowStaticPropNormals;
 extern bool g_bDisablePropSelfShadowing;
 
@@ -360,6 +373,7 @@ qboolean IsIncremental(char *filename);
 int SaveIncremental(char *filename);
 int PartialHead (void);
 void BuildFacelights (int facenum, int threadnum);
+void ReportDirectLightStreamStats( double flElapsedTime );	// -raystream ray counts and rates for the last BuildFacelights pass
 void PrecompLightmapOffsets();
 void FinalLightFace (int threadnum, int facenum);
 void PvsForOrigin (Vector& org, byte *pvs);
@@ -382,10 +396,29 @@ inline byte PVSCheck( const byte *pvs, int iCluster )
 // outputs 1 in fractionVisible if no occlusion, 0 if full occlusion, and in-between values
 void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFractionVisible, int static_prop_index_to_ignore=-1);
 
+// same as two TestLine() calls, but traces both packets together with Trace8Rays
+void TestLine8( FourVectors const *pStart, FourVectors const *pStop, fltx4 *pFractionVisible, int static_prop_index_to_ignore=-1);
+
+// A shadow ray queued up to be traced along with many others by TestLineStream()
+struct ShadowRay_t
+{
+	Vector	m_vecStart;
+	Vector	m_vecEnd;
+	float	*m_pFractionVisible;	// Gets the same value TestLine() would have produced for this ray
+};
+
+// sorts the rays by the signs of their directions and traces them eight at a time.
+// returns the number of four ray packets traced.
+int TestLineStream( ShadowRay_t *pRays, int nRays, int static_prop_index_to_ignore=-1 );
+
 // returns 1 if the ray sees the sky, 0 if it doesn't, and in-between values for partial coverage
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
 
+// same as two TestLine_DoesHitSky() calls, but traces both packets together with Trace8Rays
+void TestLine_DoesHitSky8( FourVectors const *pStart, FourVectors const *pStop,
+                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1 );
+
 // converts any marked brush entities to triangles for shadow casting
 void ExtractBrushEntityShadowCasters ( void );
 void AddBrushesForRayTrace ( void );
@@ -396,6 +429,7 @@ void GetPhongNormal( int facenum, Vector const& spot, Vector& phongnormal );
 int LightForString( char *pLight, Vector& intensity );
 void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers );
 void MakeScales( int ndxPatch, transfer_t *all_transfers );
+void CompactTransfers( CPatch *patch );
 
 // Run startup code like initialize mathlib.
 void VRAD_Init();
@@ -450,11 +484,16 @@ struct SSE_sampleLightOutput_t
 #define GATHERLFLAGS_IGNORE_NORMALS 2
 
 // SSE Gather light stuff
-void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
+// If pShadowRayEnd is given and the light's shadow rays are simple lines to the light, they're
+// not traced. The end points are stored in pShadowRayEnd and true is returned; the caller has to
+// scale out.m_flDot[0] by the visibility of each line and then call ClampSampleLightDots().
+bool GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 					   FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 					   int nLFlags = 0,					// GATHERLFLAGS_xxx
 					   int static_prop_to_skip=-1,
-					   float flEpsilon = 0.0 );
+					   float flEpsilon = 0.0,
+					   FourVectors *pShadowRayEnd = NULL );
+void ClampSampleLightDots( SSE_sampleLightOutput_t &out, int normalCount );
 //void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 //							 FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 //							 int nLFlags = 0,
@@ -7,6 +7,8 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "threads.h"
+#include "mathlib/ssemath.h"
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -33,15 +35,24 @@ int CountBits (byte *bits, int numbits)
 {
 	int		i;
 	int		c;
+	int		b;
 
 	c = 0;
-	for (i=0 ; i<numbits ; i++)
+	for (i=0 ; i<numbits>>3 ; i++)
+	{
+		// clear the lowest set bit until there are none left
+		for (b = bits[i] ; b ; b &= b-1)
+			c++;
+	}
+	for (i<<=3 ; i<numbits ; i++)
 		if ( CheckBit( bits, i ) )
 			c++;
 
 	return c;
 }
 
+flowstats_t	g_FlowStats[MAX_TOOL_THREADS+1];
+
 int		c_fullskip;
 int		c_portalskip, c_leafskip;
 int		c_vistest, c_mighttest;
@@ -102,6 +113,47 @@ void FreeStackWinding (winding_t *w, pstack_t *stack)
 	stack->freewindings[i] = 1;
 }
 
+/*
+==============
+ClassifyWinding
+
+Finds the distance of each point of w from plane, four points at a time,
+and returns a bit per point for the ones in front of and behind it.
+dists needs room for numpoints rounded up to a multiple of four.
+
+The float compares against ON_VIS_EPSILON give the same answers as the
+double ones in the scalar tests, since no float lies between the two.
+==============
+*/
+static inline void ClassifyWinding (const winding_t *w, const plane_t *plane, vec_t *dists, uint64 *front, uint64 *back)
+{
+	fltx4	nx = ReplicateX4 (plane->normal.x);
+	fltx4	ny = ReplicateX4 (plane->normal.y);
+	fltx4	nz = ReplicateX4 (plane->normal.z);
+	fltx4	dist = ReplicateX4 (plane->dist);
+	fltx4	eps = ReplicateX4 ((float)ON_VIS_EPSILON);
+	fltx4	negeps = ReplicateX4 (-(float)ON_VIS_EPSILON);
+	const Vector	*p = w->points;
+	int		last = w->numpoints - 1;
+	int		i;
+
+	*front = *back = 0;
+	for (i=0 ; i<w->numpoints ; i+=4)
+	{
+		// past the end, repeat the last point and mask it off after
+		FourVectors	points;
+		points.LoadAndSwizzle (p[i], p[min(i+1, last)], p[min(i+2, last)], p[min(i+3, last)]);
+
+		fltx4 d = AddSIMD (AddSIMD (MulSIMD (points.x, nx), MulSIMD (points.y, ny)), MulSIMD (points.z, nz));
+		d = SubSIMD (d, dist);
+		StoreUnalignedSIMD (dists + i, d);
+
+		uint64 valid = (1 << min(4, w->numpoints - i)) - 1;
+		*front |= (uint64)(TestSignSIMD (CmpGtSIMD (d, eps)) & valid) << i;
+		*back |= (uint64)(TestSignSIMD (CmpLtSIMD (d, negeps)) & valid) << i;
+	}
+}
+
 /*
 ==============
 ChopWinding
@@ -117,40 +169,34 @@ winding_t	*ChopWinding (winding_t *in, pstack_t *stack, plane_t *split)
 {
 	vec_t	dists[128];
 	int		sides[128];
-	int		counts[3];
+	uint64	front, back;
 	vec_t	dot;
 	int		i, j;
 	Vector	mid;
 	winding_t	*neww;
 
-	counts[0] = counts[1] = counts[2] = 0;
-
 // determine sides for each point
-	for (i=0 ; i<in->numpoints ; i++)
-	{
-		dot = DotProduct (in->points[i], split->normal);
-		dot -= split->dist;
-		dists[i] = dot;
-		if (dot > ON_VIS_EPSILON)
-			sides[i] = SIDE_FRONT;
-		else if (dot < -ON_VIS_EPSILON)
-			sides[i] = SIDE_BACK;
-		else
-		{
-			sides[i] = SIDE_ON;
-		}
-		counts[sides[i]]++;
-	}
+	ClassifyWinding (in, split, dists, &front, &back);
 
-	if (!counts[1])
+	if (!back)
 		return in;		// completely on front side
 	
-	if (!counts[0])
+	if (!front)
 	{
 		FreeStackWinding (in, stack);
 		return NULL;
 	}
 
+	for (i=0 ; i<in->numpoints ; i++)
+	{
+		if (front & ((uint64)1 << i))
+			sides[i] = SIDE_FRONT;
+		else if (back & ((uint64)1 << i))
+			sides[i] = SIDE_BACK;
+		else
+			sides[i] = SIDE_ON;
+	}
+
 	sides[i] = sides[0];
 	dists[i] = dists[0];
 	
@@ -236,12 +282,12 @@ flipclip should be set.
 */
 winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
 {
-	int			i, j, k, l;
+	int			i, j, l;
 	plane_t		plane;
 	Vector		v1, v2;
-	float		d;
+	vec_t		dists[MAX_POINTS_ON_WINDING+4];
+	uint64		front, back, side;
 	vec_t		length;
-	int			counts[3];
 	bool		fliptest;
 
 // check all combinations	
@@ -280,74 +326,44 @@ winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *targ
 
 		//
 		// find out which side of the generated seperating plane has the
-		// source portal
+		// source portal. the first source point off the plane decides it
 		//
-#if 1
-			fliptest = false;
-			for (k=0 ; k<source->numpoints ; k++)
-			{
-				if (k == i || k == l)
-					continue;
-				d = DotProduct (source->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-				{	// source is on the negative side, so we want all
-					// pass and target on the positive side
-					fliptest = false;
-					break;
-				}
-				else if (d > ON_VIS_EPSILON)
-				{	// source is on the positive side, so we want all
-					// pass and target on the negative side
-					fliptest = true;
-					break;
-				}
-			}
-			if (k == source->numpoints)
+			ClassifyWinding (source, &plane, dists, &front, &back);
+			side = (front | back) & ~(((uint64)1 << i) | ((uint64)1 << l));
+			if (!side)
 				continue;		// planar with source portal
-#else
-			fliptest = flipclip;
-#endif
+
+			// if the source is on the negative side we want all pass and
+			// target on the positive side, and the other way around
+			fliptest = (front & side & (~side + 1)) != 0;
+
 		//
-		// flip the normal if the source portal is backwards
+		// flip the normal if the source portal is backwards. negating
+		// the plane negates every distance exactly, so the pass points
+		// just trade sides
 		//
+			ClassifyWinding (pass, &plane, dists, &front, &back);
 			if (fliptest)
 			{
 				VectorSubtract (vec3_origin, plane.normal, plane.normal);
 				plane.dist = -plane.dist;
+
+				side = front;
+				front = back;
+				back = side;
 			}
-#if 1
+
 		//
 		// if all of the pass portal points are now on the positive side,
 		// this is the seperating plane
 		//
-			counts[0] = counts[1] = counts[2] = 0;
-			for (k=0 ; k<pass->numpoints ; k++)
-			{
-				if (k==j)
-					continue;
-				d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-					break;
-				else if (d > ON_VIS_EPSILON)
-					counts[0]++;
-				else
-					counts[2]++;
-			}
-			if (k != pass->numpoints)
+			front &= ~((uint64)1 << j);
+			back &= ~((uint64)1 << j);
+			if (back)
 				continue;	// points on negative side, not a seperating plane
 				
-			if (!counts[0])
+			if (!front)
 				continue;	// planar with seperating plane
-#else
-			k = (j+1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
-				continue;
-			k = (j+pass->numpoints-1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
-				continue;			
-#endif
 		//
 		// flip the normal if we want the back side
 		//
@@ -467,6 +483,42 @@ void WritePortalTrace( const char *source )
 	Warning("Wrote %s!!!\n", filename);
 }
 
+/*
+==================
+AndMightSee
+
+Sets stack's mightsee to prevstack's ANDed with test, only walking the
+64 bit words prevstack can have bits in, and narrows stack's range of
+words to the ones left with bits. Returns true if any of them aren't
+in vis yet.
+==================
+*/
+static inline bool AndMightSee (pstack_t *stack, const pstack_t *prevstack, const uint64 *test, const uint64 *vis)
+{
+	uint64			*might = (uint64 *)stack->mightsee;
+	const uint64	*prevmight = (const uint64 *)prevstack->mightsee;
+	uint64			more = 0;
+	int				first = prevstack->mightlast;
+	int				last = 0;
+
+	for (int j=prevstack->mightfirst ; j<prevstack->mightlast ; j++)
+	{
+		uint64 m = prevmight[j] & test[j];
+		might[j] = m;
+		if (m)
+		{
+			if (j < first)
+				first = j;
+			last = j + 1;
+			more |= m & ~vis[j];
+		}
+	}
+
+	stack->mightfirst = (last) ? first : 0;
+	stack->mightlast = last;
+	return more != 0;
+}
+
 /*
 ==================
 RecursiveLeafFlow
@@ -481,8 +533,8 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		*test, *might, *vis, more;
+	int			i;
+	uint64		*test;
 	int			pnum;
 
 	// Early-out if we're a VMPI worker that's told to exit. If we don't do this here, then the
@@ -506,8 +558,6 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.leaf = leaf;
 	stack.portal = NULL;
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
 	
 	// check all portals for flowing into other leafs	
 	for (i=0 ; i<leaf->portals.Count() ; i++)
@@ -516,7 +566,8 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		p = leaf->portals[i];
 		pnum = p - portals;
 
-		if ( ! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
+		if ( (pnum >> 6) < prevstack->mightfirst || (pnum >> 6) >= prevstack->mightlast ||
+			! (prevstack->mightsee[pnum >> 3] & (1<<(pnum&7)) ) )
 		{
 			continue;	// can't possibly see it
 		}
@@ -524,19 +575,14 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 		// if the portal can't see anything we haven't allready seen, skip it
 		if (p->status == stat_done)
 		{
-			test = (long *)p->portalvis;
+			test = (uint64 *)p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = (uint64 *)p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		bool more = AndMightSee (&stack, prevstack, test, (uint64 *)thread->base->portalvis);
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
@@ -630,7 +676,9 @@ void PortalFlow (int iThread, int portalnum)
 	int				i;
 	portal_t		*p;
 	int				c_might, c_can;
+	double			start;
 
+	start = Plat_FloatTime();
 	p = sorted_portals[portalnum];
 	p->status = stat_working;
 				
@@ -642,8 +690,19 @@ void PortalFlow (int iThread, int portalnum)
 	data.pstack_head.portal = p;
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
-	for (i=0 ; i<portallongs ; i++)
-		((long *)data.pstack_head.mightsee)[i] = ((long *)p->portalflood)[i];
+	data.pstack_head.mightfirst = 0;
+	data.pstack_head.mightlast = 0;
+	for (i=0 ; i<portalbytes>>3 ; i++)
+	{
+		uint64 m = ((uint64 *)p->portalflood)[i];
+		((uint64 *)data.pstack_head.mightsee)[i] = m;
+		if (m)
+		{
+			if (!data.pstack_head.mightlast)
+				data.pstack_head.mightfirst = i;
+			data.pstack_head.mightlast = i + 1;
+		}
+	}
 
 	RecursiveLeafFlow (p->leaf, &data, &data.pstack_head);
 
@@ -654,6 +713,11 @@ void PortalFlow (int iThread, int portalnum)
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
 		(int)(p - portals),	c_might, c_can, data.c_chains);
+
+	flowstats_t &stats = g_FlowStats[iThread];
+	stats.portals++;
+	stats.chains += data.c_chains;
+	stats.time += Plat_FloatTime() - start;
 }
 
 
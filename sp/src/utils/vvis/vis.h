@@ -67,6 +67,7 @@ struct leaf_t
 struct pstack_t
 {
 	byte		mightsee[MAX_PORTALS/8];		// bit string
+	int			mightfirst, mightlast;			// 64 bit words of mightsee that can have bits set
 	pstack_t	*next;
 	leaf_t		*leaf;
 	portal_t	*portal;	// portal exiting
@@ -113,8 +114,24 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+
+// PortalFlow totals for each thread, reported by -bench
+struct flowstats_t
+{
+	int			portals;
+	int64		chains;
+	double		time;
+};
+
+extern bool			g_bBench;
+extern flowstats_t	g_FlowStats[];
 void WritePortalTrace( const char *source );
 
+// viscache.cpp
+extern bool g_bIncremental;
+int ReuseVisCache( const char *pFileName );
+void SaveVisCache( const char *pFileName );
+
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
 extern int g_TraceClusterStart, g_TraceClusterStop;
 
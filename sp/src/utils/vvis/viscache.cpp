@@ -0,0 +1,373 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Incremental vis. Saves each portal's final vis next to the map so the
+//			next run can reuse it for portals whose surroundings haven't changed.
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#include "vis.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlvector.h"
+
+bool		g_bIncremental = false;
+
+// if fewer than this fraction of the portals can reuse their vis, everything is flowed again
+#define VISCACHE_MIN_REUSED		0.5f
+
+// layout of the file written by SaveVisCache. the header is followed by the portal
+// hashes, the mightsee hashes, the cluster hashes, the offset of each portal's vis in
+// the vis data and then the vis data, which holds each portal's visible portals as
+// the varint coded gaps between their indices.
+#define VISCACHE_MAGIC		( ( 'V' << 0 ) | ( 'V' << 8 ) | ( 'C' << 16 ) | ( 'H' << 24 ) )
+#define VISCACHE_VERSION	1
+
+struct VisCacheHeader_t
+{
+	uint32	m_nMagic;
+	uint32	m_nVersion;
+	int32	m_bUseRadius;			// radius vis changes mightsee
+	float	m_flVisRadius;
+	int32	m_nPortals;				// both directions, like g_numportals*2
+	int32	m_nClusters;
+	int32	m_nVisBytes;
+};
+
+// Hashes of this run's portals, filled in by HashPortals
+static CUtlVector<uint32>	s_PortalHashes;		// each portal's winding
+static CUtlVector<uint64>	s_MightSeeHashes;	// the set of portals in each portal's portalflood
+static CUtlVector<uint64>	s_ClusterHashes;	// the set of portals leading out of each cluster
+
+//-----------------------------------------------------------------------------
+// Mixes a portal hash before it's summed into a set hash, so that the sum doesn't
+// depend on the order the set is walked in but still tells different sets apart.
+//-----------------------------------------------------------------------------
+static uint64 MixPortalHash( uint32 nHash )
+{
+	uint64 x = nHash + 0x9E3779B97F4A7C15ull;
+	x = ( x ^ ( x >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+	x = ( x ^ ( x >> 27 ) ) * 0x94D049BB133111EBull;
+	return x ^ ( x >> 31 );
+}
+
+//-----------------------------------------------------------------------------
+// Portal indices and cluster numbers change whenever vbsp runs, so portals are
+// matched between runs by their windings alone. The two directions of a portal
+// have their points in opposite orders, so they hash differently.
+//-----------------------------------------------------------------------------
+static void HashPortals( void )
+{
+	int nPortals = g_numportals * 2;
+
+	s_PortalHashes.SetCount( nPortals );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		winding_t *w = portals[i].winding;
+
+		CRC32_t crc;
+		CRC32_Init( &crc );
+		CRC32_ProcessBuffer( &crc, &w->numpoints, sizeof( w->numpoints ) );
+		CRC32_ProcessBuffer( &crc, w->points, w->numpoints * sizeof( Vector ) );
+		CRC32_Final( &crc );
+		s_PortalHashes[i] = crc;
+	}
+
+	s_MightSeeHashes.SetCount( nPortals );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		uint64 nHash = 0;
+		for ( int j = 0; j < nPortals; j++ )
+		{
+			if ( !portals[i].portalflood[j >> 3] )
+				j |= 7;
+			else if ( CheckBit( portals[i].portalflood, j ) )
+				nHash += MixPortalHash( s_PortalHashes[j] );
+		}
+		s_MightSeeHashes[i] = nHash;
+	}
+
+	s_ClusterHashes.SetCount( portalclusters );
+	for ( int i = 0; i < portalclusters; i++ )
+	{
+		uint64 nHash = 0;
+		for ( int j = 0; j < leafs[i].portals.Count(); j++ )
+			nHash += MixPortalHash( s_PortalHashes[leafs[i].portals[j] - portals] );
+		s_ClusterHashes[i] = nHash;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Maps each hash to its index, or to -1 if more than one thing has that hash
+//-----------------------------------------------------------------------------
+template< class T >
+static void BuildHashMap( const T *pHashes, int nCount, CUtlMap<T, int, int> &map )
+{
+	SetDefLessFunc( map );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		int iIndex = map.Find( pHashes[i] );
+		if ( map.IsValidIndex( iIndex ) )
+			map[iIndex] = -1;
+		else
+			map.Insert( pHashes[i], i );
+	}
+}
+
+template< class T >
+static int FindHash( const CUtlMap<T, int, int> &map, T nHash )
+{
+	int iIndex = map.Find( nHash );
+	return map.IsValidIndex( iIndex ) ? map[iIndex] : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Gives the portals whose vis can't have changed since the cache was
+//			written their old vis and marks them done. Must be called after
+//			BasePortalVis and SortPortals.
+// Output : The number of portals reused. They're moved to the end of
+//			sorted_portals, so only the ones before them need to be flowed.
+//-----------------------------------------------------------------------------
+int ReuseVisCache( const char *pFileName )
+{
+	int nPortals = g_numportals * 2;
+
+	HashPortals();
+
+	FILE *fp = fopen( pFileName, "rb" );
+	if ( !fp )
+	{
+		Msg( "No vis cache, flowing all portals\n" );
+		return 0;
+	}
+
+	VisCacheHeader_t header;
+	if ( fread( &header, sizeof( header ), 1, fp ) != 1 ||
+		 header.m_nMagic != VISCACHE_MAGIC || header.m_nVersion != VISCACHE_VERSION ||
+		 header.m_bUseRadius != (int32)g_bUseRadius || header.m_flVisRadius != (float)g_VisRadius ||
+		 header.m_nPortals <= 0 || header.m_nClusters <= 0 || header.m_nVisBytes < 0 )
+	{
+		fclose( fp );
+		Msg( "Vis cache %s is out of date, flowing all portals\n", pFileName );
+		return 0;
+	}
+
+	CUtlVector<uint32> oldPortalHashes;
+	CUtlVector<uint64> oldMightSeeHashes;
+	CUtlVector<uint64> oldClusterHashes;
+	CUtlVector<int> oldVisOffsets;
+	CUtlVector<byte> oldVisData;
+	oldPortalHashes.SetCount( header.m_nPortals );
+	oldMightSeeHashes.SetCount( header.m_nPortals );
+	oldClusterHashes.SetCount( header.m_nClusters );
+	oldVisOffsets.SetCount( header.m_nPortals + 1 );
+	oldVisData.SetCount( header.m_nVisBytes );
+
+	bool bOk = fread( oldPortalHashes.Base(), sizeof( uint32 ), header.m_nPortals, fp ) == (size_t)header.m_nPortals &&
+		fread( oldMightSeeHashes.Base(), sizeof( uint64 ), header.m_nPortals, fp ) == (size_t)header.m_nPortals &&
+		fread( oldClusterHashes.Base(), sizeof( uint64 ), header.m_nClusters, fp ) == (size_t)header.m_nClusters &&
+		fread( oldVisOffsets.Base(), sizeof( int ), header.m_nPortals + 1, fp ) == (size_t)( header.m_nPortals + 1 ) &&
+		( !header.m_nVisBytes || fread( oldVisData.Base(), 1, header.m_nVisBytes, fp ) == (size_t)header.m_nVisBytes );
+	fclose( fp );
+
+	for ( int i = 0; bOk && i < header.m_nPortals; i++ )
+	{
+		if ( oldVisOffsets[i] < 0 || oldVisOffsets[i] > oldVisOffsets[i+1] )
+			bOk = false;
+	}
+	if ( bOk && oldVisOffsets[header.m_nPortals] != header.m_nVisBytes )
+		bOk = false;
+
+	if ( !bOk )
+	{
+		Warning( "Couldn't read vis cache %s, flowing all portals\n", pFileName );
+		return 0;
+	}
+
+	CUtlMap<uint32, int, int> oldPortalMap, newPortalMap;
+	CUtlMap<uint64, int, int> oldClusterMap;
+	BuildHashMap( oldPortalHashes.Base(), oldPortalHashes.Count(), oldPortalMap );
+	BuildHashMap( s_PortalHashes.Base(), s_PortalHashes.Count(), newPortalMap );
+	BuildHashMap( oldClusterHashes.Base(), oldClusterHashes.Count(), oldClusterMap );
+
+	// old portal index -> this run's index, for the ones that are still here
+	CUtlVector<int> oldToNew;
+	oldToNew.SetCount( header.m_nPortals );
+	for ( int i = 0; i < header.m_nPortals; i++ )
+		oldToNew[i] = FindHash( newPortalMap, oldPortalHashes[i] );
+
+	// Flowing through a portal only depends on the windings of the portals in its
+	// mightsee and on which portals lead out of the clusters they lead into. So a
+	// portal whose mightsee is the same set of portals as last time, all leading
+	// into clusters whose portals are all the same as last time, sees what it did.
+	CUtlVector<int> reuseFrom;
+	CUtlVector<byte> changed;
+	reuseFrom.SetCount( nPortals );
+	changed.SetCount( portalbytes );
+	memset( changed.Base(), 0, portalbytes );
+	int nChangedPortals = 0;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		int iOld = FindHash( oldPortalMap, s_PortalHashes[i] );
+		if ( iOld >= 0 && oldToNew[iOld] == i &&
+			 FindHash( oldClusterMap, s_ClusterHashes[portals[i].leaf] ) >= 0 )
+		{
+			reuseFrom[i] = iOld;
+		}
+		else
+		{
+			reuseFrom[i] = -1;
+			SetBit( changed.Base(), i );
+			nChangedPortals++;
+		}
+	}
+
+	int nReused = 0;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		int iOld = reuseFrom[i];
+		if ( iOld < 0 )
+			continue;
+
+		bool bSame = ( oldMightSeeHashes[iOld] == s_MightSeeHashes[i] );
+		for ( int j = 0; bSame && j < portallongs; j++ )
+		{
+			if ( ((long *)portals[i].portalflood)[j] & ((long *)changed.Base())[j] )
+				bSame = false;
+		}
+
+		if ( bSame )
+			nReused++;
+		else
+			reuseFrom[i] = -1;
+	}
+
+	Msg( "Vis cache: %d of %d portals changed, %d portals can reuse their vis\n", nChangedPortals, nPortals, nReused );
+
+	if ( nReused < VISCACHE_MIN_REUSED * nPortals )
+	{
+		Msg( "Too much has changed since the vis cache was written, flowing all portals\n" );
+		return 0;
+	}
+
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		int iOld = reuseFrom[i];
+		if ( iOld < 0 )
+			continue;
+
+		portal_t *p = &portals[i];
+		memset( p->portalvis, 0, portalbytes );
+
+		const byte *pData = oldVisData.Base() + oldVisOffsets[iOld];
+		const byte *pEnd = oldVisData.Base() + oldVisOffsets[iOld+1];
+		int iVis = -1;
+		while ( pData < pEnd )
+		{
+			int nGap = 0;
+			for ( int nShift = 0; pData < pEnd; nShift += 7 )
+			{
+				byte b = *pData++;
+				nGap |= ( b & 0x7f ) << nShift;
+				if ( !( b & 0x80 ) )
+					break;
+			}
+			iVis += nGap + 1;
+
+			int iNew = ( iVis < header.m_nPortals ) ? oldToNew[iVis] : -1;
+			if ( iNew < 0 )
+				Error( "Vis cache %s is corrupt, delete it and run vvis again\n", pFileName );
+			SetBit( p->portalvis, iNew );
+		}
+
+		p->status = stat_done;
+	}
+
+	// keep the order SortPortals picked for the ones that still need flowing
+	int nFlow = 0;
+	CUtlVector<portal_t *> reused;
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		if ( sorted_portals[i]->status == stat_done )
+			reused.AddToTail( sorted_portals[i] );
+		else
+			sorted_portals[nFlow++] = sorted_portals[i];
+	}
+	for ( int i = 0; i < reused.Count(); i++ )
+		sorted_portals[nFlow + i] = reused[i];
+
+	return nReused;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes every portal's final vis for the next incremental run
+//-----------------------------------------------------------------------------
+void SaveVisCache( const char *pFileName )
+{
+	int nPortals = g_numportals * 2;
+
+	CUtlVector<int> visOffsets;
+	CUtlVector<byte> visData;
+	visOffsets.SetCount( nPortals + 1 );
+	for ( int i = 0; i < nPortals; i++ )
+	{
+		visOffsets[i] = visData.Count();
+
+		int iLast = -1;
+		for ( int j = 0; j < nPortals; j++ )
+		{
+			if ( !portals[i].portalvis[j >> 3] )
+			{
+				j |= 7;
+				continue;
+			}
+			if ( !CheckBit( portals[i].portalvis, j ) )
+				continue;
+
+			unsigned int nGap = j - iLast - 1;
+			while ( nGap >= 0x80 )
+			{
+				visData.AddToTail( (byte)( nGap | 0x80 ) );
+				nGap >>= 7;
+			}
+			visData.AddToTail( (byte)nGap );
+			iLast = j;
+		}
+	}
+	visOffsets[nPortals] = visData.Count();
+
+	VisCacheHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nMagic = VISCACHE_MAGIC;
+	header.m_nVersion = VISCACHE_VERSION;
+	header.m_bUseRadius = g_bUseRadius;
+	header.m_flVisRadius = (float)g_VisRadius;
+	header.m_nPortals = nPortals;
+	header.m_nClusters = portalclusters;
+	header.m_nVisBytes = visData.Count();
+
+	FILE *fp = fopen( pFileName, "wb" );
+	if ( !fp )
+	{
+		Warning( "Couldn't write vis cache %s\n", pFileName );
+		return;
+	}
+
+	bool bOk = fwrite( &header, sizeof( header ), 1, fp ) == 1 &&
+		fwrite( s_PortalHashes.Base(), sizeof( uint32 ), nPortals, fp ) == (size_t)nPortals &&
+		fwrite( s_MightSeeHashes.Base(), sizeof( uint64 ), nPortals, fp ) == (size_t)nPortals &&
+		fwrite( s_ClusterHashes.Base(), sizeof( uint64 ), portalclusters, fp ) == (size_t)portalclusters &&
+		fwrite( visOffsets.Base(), sizeof( int ), nPortals + 1, fp ) == (size_t)( nPortals + 1 ) &&
+		( !visData.Count() || fwrite( visData.Base(), 1, visData.Count(), fp ) == (size_t)visData.Count() );
+	fclose( fp );
+
+	if ( !bOk )
+	{
+		Warning( "Couldn't write vis cache %s\n", pFileName );
+		remove( pFileName );
+		return;
+	}
+
+	Msg( "Wrote vis cache %s (%d bytes of vis)\n", pFileName, visData.Count() );
+}
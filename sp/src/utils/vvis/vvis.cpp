@@ -46,6 +46,7 @@ int			portalbytes, portallongs;
 
 bool		fastvis;
 bool		nosort;
+bool		g_bBench = false;
 
 int			totalvis;
 
@@ -56,6 +57,8 @@ double		g_VisRadius = 4096.0f * 4096.0f;
 
 bool		g_bLowPriority = false;
 
+char		viscachefile[1024];
+
 //=============================================================================
 
 void PlaneFromWinding (winding_t *w, plane_t *plane)
@@ -281,12 +284,45 @@ static int CompressAndCrosscheckClusterVis( int clusternum )
 }
 
 
+/*
+==================
+ReportFlowBench
+
+Prints how many portals each thread flowed per second of its own time
+==================
+*/
+void ReportFlowBench (double elapsed)
+{
+	int		i;
+	int		totalportals = 0;
+	int64	totalchains = 0;
+
+	Msg ("\nPortalFlow benchmark:\n");
+	for (i=0 ; i<=MAX_TOOL_THREADS ; i++)
+	{
+		flowstats_t &stats = g_FlowStats[i];
+		if (!stats.portals)
+			continue;
+
+		Msg ("  thread %2i: %6i portals in %8.2fs, %10.1f portals/sec, %10.0f chains/sec\n",
+			i, stats.portals, stats.time,
+			stats.portals / max (stats.time, 0.001),
+			(double)stats.chains / max (stats.time, 0.001));
+		totalportals += stats.portals;
+		totalchains += stats.chains;
+	}
+	Msg ("  total    : %6i portals in %8.2fs, %10.1f portals/sec, %10.0f chains/sec\n\n",
+		totalportals, elapsed,
+		totalportals / max (elapsed, 0.001),
+		(double)totalchains / max (elapsed, 0.001));
+}
+
 /*
 ==================
 CalcPortalVis
 ==================
 */
-void CalcPortalVis (void)
+void CalcPortalVis (int numflow)
 {
 	int		i;
 
@@ -308,7 +344,11 @@ void CalcPortalVis (void)
 	}
 	else 
 	{
-		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+		double start = Plat_FloatTime();
+		memset (g_FlowStats, 0, sizeof(g_FlowStats[0]) * (MAX_TOOL_THREADS+1));
+		RunThreadsOnIndividual (numflow, true, PortalFlow);
+		if (g_bBench)
+			ReportFlowBench (Plat_FloatTime() - start);
 	}
 }
 
@@ -342,7 +382,15 @@ void CalcVis (void)
 
 	SortPortals ();
 
-	CalcPortalVis ();
+	// portals that can reuse their vis from the last run are sorted after the ones to flow
+	int numflow = g_numportals*2;
+	if (g_bIncremental)
+		numflow -= ReuseVisCache (viscachefile);
+
+	CalcPortalVis (numflow);
+
+	if (g_bIncremental)
+		SaveVisCache (viscachefile);
 
 	//
 	// assemble the leaf vis lists by oring the portal lists
@@ -916,6 +964,10 @@ int ParseCommandLine( int argc, char **argv )
 			numthreads = atoi (argv[i+1]);
 			i++;
 		}
+		else if (!Q_stricmp(argv[i],"-threadstats"))
+		{
+			g_bThreadStats = true;
+		}
 		else if (!Q_stricmp(argv[i], "-fast"))
 		{
 			Msg ("fastvis = true\n");
@@ -942,6 +994,20 @@ int ParseCommandLine( int argc, char **argv )
 			i++;
 			Msg( "Tracing vis from cluster %d to %d\n", g_TraceClusterStart, g_TraceClusterStop );
 		}
+		else if (!Q_stricmp (argv[i],"-incremental"))
+		{
+			Msg ("incremental = true\n");
+			g_bIncremental = true;
+		}
+		else if (!Q_stricmp (argv[i],"-bench"))
+		{
+			Msg ("bench = true\n");
+			g_bBench = true;
+		}
+		else if (!Q_stricmp (argv[i],"-mmap"))
+		{
+			g_bMapBSPFile = true;
+		}
 		else if (!Q_stricmp (argv[i],"-nosort"))
 		{
 			Msg ("nosort = true\n");
@@ -1029,6 +1095,13 @@ void PrintUsage( int argc, char **argv )
 		"  -mpi_pw <pw>    : Use a password to choose a specific set of VMPI workers.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
+		"  -threadstats    : Print how long each thread was busy and idle in each threaded stage.\n"
+		"  -incremental    : Reuse the vis of portals that haven't changed since the last\n"
+		"                    -incremental run, which is saved in <mapname>.vvc.\n"
+		"  -bench          : Report the portals/sec each thread flows and don't write\n"
+		"                    the bsp.\n"
+		"  -mmap           : Map the bsp instead of reading it all into memory, and put off\n"
+		"                    parsing the pakfile until it's read or the bsp is written.\n"
 		"  -nosort         : Don't sort portals (sorting is an optimization).\n"
 		"  -tmpin          : Make portals come from \\tmp\\<mapname>.\n"
 		"  -tmpout         : Make portals come from \\tmp\\<mapname>.\n"
@@ -1120,6 +1193,10 @@ int RunVVis( int argc, char **argv )
 	char	targetPath[1024];
 	GetPlatformMapPath( source, targetPath, 0, 1024 );
 	Msg ("reading %s\n", targetPath);
+
+	// workers get the bsp through the VMPI filesystem, so there's nothing on disk to map
+	if ( g_bUseMPI && !g_bMPIMaster )
+		g_bMapBSPFile = false;
 	LoadBSPFile (targetPath);
 	if (numnodes == 0 || numfaces == 0)
 		Error ("Empty map");
@@ -1151,6 +1228,14 @@ int RunVVis( int argc, char **argv )
 		Q_StripExtension( portalfile, portalfile, sizeof( portalfile ) );
 	}
 	strcat (portalfile, ".prt");
+
+	// the cache only covers a full local vis run
+	if ( g_bIncremental && ( fastvis || g_bUseMPI || g_bBench || g_TraceClusterStart >= 0 ) )
+	{
+		Warning( "-incremental can't be used with -fast, -mpi, -bench or -trace, ignoring it\n" );
+		g_bIncremental = false;
+	}
+	Q_snprintf( viscachefile, sizeof( viscachefile ), "%s.vvc", source );
 	
 	Msg ("reading %s\n", portalfile);
 	LoadPortals (portalfile);
@@ -1171,8 +1256,15 @@ int RunVVis( int argc, char **argv )
 		visdatasize = vismap_p - dvisdata;	
 		Msg ("visdatasize:%i  compressed from %i\n", visdatasize, originalvismapsize*2);
 
-		Msg ("writing %s\n", targetPath);
-		WriteBSPFile (targetPath);	
+		if ( g_bBench )
+		{
+			Msg ("-bench, not writing %s\n", targetPath);
+		}
+		else
+		{
+			Msg ("writing %s\n", targetPath);
+			WriteBSPFile (targetPath);	
+		}
 	}
 	else
 	{